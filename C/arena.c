@@ -0,0 +1,227 @@
+// Block payload arenas (see arena.h)
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		// MAP_ANONYMOUS, MAP_HUGETLB, MADV_HUGEPAGE
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "arena.h"
+
+#define HUGE_2M ((size_t) 2 << 20)
+#define HUGE_1G ((size_t) 1 << 30)
+
+// the page size flags aren't in older headers
+#ifdef MAP_HUGETLB
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+#endif
+
+// from numaif.h, which we don't want to depend on libnuma for
+#define OC_MPOL_PREFERRED 1
+
+static size_t page_size     = 0;
+static int    page_size_set = 0;	// 0 => look at environment first
+static int    numa_node     = -1;
+static int    numa_node_set = 0;
+
+void oc_arena_set_pages(size_t size) {
+
+  page_size     = ((HUGE_2M == size) || (HUGE_1G == size)) ? size : 0;
+  page_size_set = 1;
+}
+
+size_t oc_arena_pages(void) {
+
+  const char *env;
+  char       *end;
+  size_t      size = 0;
+
+  if (!page_size_set) {
+    env = getenv("OC_ARENA_PAGES");
+    if ((NULL != env) && *env) {
+      size = strtoul(env, &end, 10);
+      switch (*end) {
+      case 'G': case 'g': size <<= 30; break;
+      case 'M': case 'm': size <<= 20; break;
+      case 'K': case 'k': size <<= 10; break;
+      }
+    }
+    oc_arena_set_pages(size);
+  }
+  return page_size;
+}
+
+void oc_arena_set_node(int node) {
+
+  numa_node     = (node < 0) ? -1 : node;
+  numa_node_set = 1;
+}
+
+int oc_arena_node(void) {
+
+  const char *env;
+
+  if (!numa_node_set) {
+    env = getenv("OC_ARENA_NODE");
+    oc_arena_set_node(((NULL != env) && *env) ? atoi(env) : -1);
+  }
+  return numa_node;
+}
+
+// Prefer node for the pages of a fresh mapping. Failure doesn't
+// matter (no NUMA support, no such node): the pages just go wherever
+// they would have anyway.
+static void bind_node(void *addr, size_t bytes, int node) {
+
+#ifdef SYS_mbind
+  unsigned long mask[16];
+
+  if ((node < 0) || (node >= (int) (8 * sizeof(mask))))
+    return;
+
+  memset(mask, 0, sizeof(mask));
+  mask[node / (8 * sizeof(unsigned long))] |=
+    1ul << (node % (8 * sizeof(unsigned long)));
+
+  syscall(SYS_mbind, addr, bytes, OC_MPOL_PREFERRED, mask,
+	  8 * sizeof(mask) + 1, 0);
+#endif
+}
+
+// Get bytes of memory for a, setting a->base, a->bytes and a->kind.
+// Mapped memory comes zeroed, so it's only cleared here if it's from
+// the heap.
+static int allocate(oc_arena *a, size_t bytes) {
+
+  size_t huge = oc_arena_pages();
+  void  *p;
+  int    flags;
+
+  if (bytes < OC_ARENA_MMAP_MIN) {
+    if (posix_memalign(&p, OC_ARENA_ALIGN, bytes))
+      return -1;
+    if (a->flags & OC_ARENA_ZERO)
+      memset(p, 0, bytes);
+    a->base  = p;
+    a->bytes = bytes;
+    a->kind  = OC_ARENA_HEAP;
+    return 0;
+  }
+
+  p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  if (huge) {
+    flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+      ((HUGE_1G == huge) ? MAP_HUGE_1GB : MAP_HUGE_2MB);
+    a->bytes = (bytes + huge - 1) & ~(huge - 1);
+    p = mmap(NULL, a->bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+    a->kind = (HUGE_1G == huge) ? OC_ARENA_HUGE_1G : OC_ARENA_HUGE_2M;
+  }
+#endif
+
+  if (MAP_FAILED == p) {
+    flags    = MAP_PRIVATE | MAP_ANONYMOUS;
+    a->bytes = bytes;
+    p = mmap(NULL, a->bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (MAP_FAILED == p)
+      return -1;
+    a->kind = OC_ARENA_MAPPED;
+#ifdef MADV_HUGEPAGE
+    if (bytes >= HUGE_2M)
+      madvise(p, a->bytes, MADV_HUGEPAGE);
+#endif
+  }
+
+  bind_node(p, a->bytes, oc_arena_node());
+  a->base = p;
+  return 0;
+}
+
+static void release(oc_arena *a) {
+
+  if (NULL == a->base)
+    return;
+  if (OC_ARENA_HEAP == a->kind)
+    free(a->base);
+  else
+    munmap(a->base, a->bytes);
+}
+
+int oc_arena_init(oc_arena *a, int blocks, int block_size, int flags) {
+
+  assert(NULL != a);
+
+  memset(a, 0, sizeof(oc_arena));
+  if ((blocks < 0) || (block_size <= 0)) {
+    fprintf(stderr, "oc_arena_init: invalid arguments\n");
+    return -1;
+  }
+
+  a->block_size = block_size;
+  a->flags      = flags;
+  a->stride     = block_size;
+  if (flags & OC_ARENA_PACKED)
+    ;
+  else if (block_size < OC_ARENA_ALIGN)
+    for (a->stride = 1; a->stride < (size_t) block_size; a->stride <<= 1)
+      ;
+  else
+    a->stride = (a->stride + OC_ARENA_ALIGN - 1) &
+      ~((size_t) OC_ARENA_ALIGN - 1);
+
+  if (0 == blocks)
+    return 0;
+  if (-1 == allocate(a, (size_t) blocks * a->stride)) {
+    memset(a, 0, sizeof(oc_arena));
+    return -1;
+  }
+  a->blocks = blocks;
+
+  return 0;
+}
+
+int oc_arena_grow(oc_arena *a, int blocks) {
+
+  oc_arena bigger;
+
+  assert(NULL != a);
+
+  if (blocks <= a->blocks)
+    return 0;
+
+  bigger = *a;
+  if (-1 == allocate(&bigger, (size_t) blocks * a->stride))
+    return -1;
+  bigger.blocks = blocks;
+
+  if (NULL != a->base)
+    memcpy(bigger.base, a->base, (size_t) a->blocks * a->stride);
+  release(a);
+  *a = bigger;
+
+  return 0;
+}
+
+void oc_arena_free(oc_arena *a) {
+
+  assert(NULL != a);
+
+  release(a);
+  a->base   = NULL;
+  a->bytes  = 0;
+  a->blocks = 0;
+}
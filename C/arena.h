@@ -0,0 +1,96 @@
+// Block payload arenas (aligned, optionally huge-page, NUMA-placed)
+
+#ifndef OC_ARENA_H
+#define OC_ARENA_H
+
+#include <stddef.h>
+
+// The encoder and decoder keep their aux and check blocks in big
+// arrays that all the xor work goes through. Coming straight from
+// malloc, a block only starts on a 16-byte boundary, and with block
+// sizes that aren't a multiple of 64, most blocks straddle a cache
+// line at each end, which costs the vector kernels a split load or
+// store per line and makes two threads working on neighbouring blocks
+// share lines. With a few hundred MB of blocks, the TLB misses from
+// 4K pages start to show too.
+//
+// An arena is one allocation holding a fixed number of blocks, each
+// of which starts on a cache line: the base is aligned to
+// OC_ARENA_ALIGN (or to a page) and the stride between blocks is
+// block_size rounded up to a multiple of it. Blocks smaller than a
+// line are rounded up to a power of two instead, which is enough to
+// keep each of them inside one line without using up to 64 times the
+// memory. The padding after each block is never read or written.
+//
+// A packed arena (OC_ARENA_PACKED) has stride == block_size, so the
+// blocks are contiguous. That's for buffers like the decoder's message
+// that callers treat as one flat array. Only the base is aligned.
+//
+// Where the memory comes from:
+//
+// * small arenas (under OC_ARENA_MMAP_MIN) come from posix_memalign
+//
+// * bigger ones are anonymous mappings, with MADV_HUGEPAGE so that
+//   transparent huge pages can back them where the system allows it
+//
+// * if huge pages are asked for (see below), big arenas are mapped
+//   with MAP_HUGETLB from the 2MB or 1GB pool instead, and rounded up
+//   to a whole number of pages. If the pool is empty or the kernel
+//   doesn't have it, they fall back to an ordinary mapping.
+//
+// * if a NUMA node is set, mapped arenas are bound to it (preferred,
+//   not strict, so the kernel can still go elsewhere rather than fail)
+//   before anything touches them. That's worth doing if the threads
+//   that will use the blocks are pinned to the node too.
+//
+// The page size comes from the OC_ARENA_PAGES environment variable
+// ("2M" or "1G"; anything else or unset => normal pages) and the node
+// from OC_ARENA_NODE, unless the setters below have been called. Like
+// the map cache directory, set them before creating any codecs.
+
+#define OC_ARENA_ALIGN     64		// cache line
+#define OC_ARENA_MMAP_MIN  (256 << 10)	// smaller arenas come from the heap
+
+#define OC_ARENA_ZERO      1		// clear the blocks
+#define OC_ARENA_PACKED    2		// stride == block_size
+
+// how an arena's memory was allocated
+#define OC_ARENA_HEAP      0
+#define OC_ARENA_MAPPED    1
+#define OC_ARENA_HUGE_2M   2
+#define OC_ARENA_HUGE_1G   3
+
+typedef struct {
+
+  char   *base;		// block i is at base + i * stride
+  size_t  stride;
+  size_t  bytes;	// size of the allocation (for munmap)
+  int     blocks;
+  int     block_size;
+  int     flags;	// as passed to oc_arena_init
+  int     kind;		// OC_ARENA_HEAP, ...
+
+} oc_arena;
+
+void   oc_arena_set_pages(size_t page_size);	// 0, 2M or 1G
+size_t oc_arena_pages(void);
+void   oc_arena_set_node(int node);		// -1 => no binding
+int    oc_arena_node(void);
+
+// Returns 0 on success, -1 if out of memory. An arena with no blocks
+// has a NULL base. Setting up an arena that's still in use leaks it.
+int  oc_arena_init(oc_arena *a, int blocks, int block_size, int flags);
+
+// Make room for at least blocks blocks, keeping the contents of the
+// ones already there (but not their addresses). New blocks are only
+// cleared if the arena was made with OC_ARENA_ZERO. Returns 0 on
+// success, or -1 with the arena unchanged.
+int  oc_arena_grow(oc_arena *a, int blocks);
+
+void oc_arena_free(oc_arena *a);
+
+static inline char *oc_arena_block(const oc_arena *a, int i) {
+  return a->base + (size_t) i * a->stride;
+}
+
+#endif
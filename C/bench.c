@@ -0,0 +1,403 @@
+// Headless encode/decode benchmark
+//
+// Runs the encoder and decoder over every combination of the
+// parameters given (each option takes a comma-separated list) and
+// prints one tab-separated line per combination, after a header line
+// starting with '#'. Nothing else goes to stdout, so the output can be
+// kept and compared against later runs to catch regressions.
+//
+// For each combination, it decodes the same message with n different
+// seeds and reports:
+//
+// * enc_MB/s: check block bytes made per second of encoder time
+//   (including building the aux block cache)
+// * dec_MB/s: message bytes decoded per second of decoder time
+//   (graphing, resolving and filling in solved blocks)
+// * graph_ops/s: check blocks graphed and resolved per second, not
+//   counting XORs (from the graph's own statistics)
+// * rss_MB: peak resident set size
+// * overhead: check blocks needed over mblocks, as a percentage, as
+//   min/mean/median/90th/99th percentile/max over the seeds (the same
+//   numbers trunk/tests/stats.pl was after)
+// * fails: seeds that didn't decode, or decoded the wrong message
+//
+// Each combination runs in its own process so that the peak RSS is
+// its own and a crash or out-of-memory only loses that line. Big
+// messages (over -M bytes with their blocks) are run without a data
+// plane, so there are only graph and overhead figures for them; -g
+// does the same for every size.
+//
+// Build with "make bench", which leaves out the profiling flags.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "online-code.h"
+#include "encoder.h"
+#include "decoder.h"
+
+extern char *optarg;		// getopt-related
+extern int   optind;
+
+#define MAX_LIST 32
+
+// one option's list of values
+typedef struct {
+  int    count;
+  double value[MAX_LIST];
+} value_list;
+
+value_list mblocks_list, bs_list, q_list, e_list, fudge_list, floyd_list;
+
+int        seeds        = 10;
+int        graph_only   = 0;
+int        transparent  = 0;
+int        max_inactive = 0;
+double     max_bytes    = 1 << 30;
+char       base_seed[OC_RNG_BYTES + 1] = "bench-seed-00000000";
+
+const char *floyd_names[] = { "auto", "list", "bitmap", "hash", NULL };
+
+// results for one seed
+typedef struct {
+  int       checks;		// check blocks it took (0 => failed)
+  long long enc_ns, dec_ns, graph_ns;
+  double    enc_bytes, dec_bytes;
+} trial;
+
+static long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+static int parse_list(value_list *l, const char *arg, const char **names) {
+
+  char *copy = strdup(arg), *tok, *end, *save = NULL;
+  int   i;
+
+  l->count = 0;
+  for (tok = strtok_r(copy, ",", &save); tok != NULL;
+       tok = strtok_r(NULL, ",", &save)) {
+    if (l->count == MAX_LIST)
+      return free(copy), -1;
+    if (NULL != names) {
+      for (i = 0; (NULL != names[i]) && strcmp(tok, names[i]); ++i)
+	;
+      if (NULL == names[i])
+	return free(copy), -1;
+      l->value[l->count++] = i;
+    } else {
+      l->value[l->count++] = strtod(tok, &end); // so 1e6 works
+      if ((end == tok) || *end || (l->value[l->count - 1] <= 0))
+	return free(copy), -1;
+    }
+  }
+  free(copy);
+  return l->count ? 0 : -1;
+}
+
+static void trial_seed(char *seed, int i) {
+  char tail[9];
+  memcpy(seed, base_seed, OC_RNG_BYTES);
+  snprintf(tail, sizeof(tail), "%08x", i);
+  memcpy(seed + OC_RNG_BYTES - 8, tail, 8);
+}
+
+static long long graph_ns(oc_decoder *d) {
+  oc_graph_stats s;
+  oc_decoder_get_stats(d, &s);
+  return s.ns_map + s.ns_graph + s.ns_resolve;
+}
+
+static void free_list(oc_uni_block *l) {
+  oc_uni_block *p;
+  for (; l != NULL; l = p) {
+    p = l->a.next;
+    free(l);
+  }
+}
+
+// Decode one message. Returns 0 if it went to plan (t->checks says
+// whether it decoded), -1 if something couldn't be set up.
+static int run_trial(trial *t, int i, int mblocks, int bs, int q, double e,
+		     double fudge, int floyd, int data) {
+
+  oc_encoder    enc;
+  oc_decoder    dec;
+  oc_rng_sha1   erng, drng, crng;
+  oc_uni_block *solved;
+  char          seed[OC_RNG_BYTES], cseed[OC_RNG_BYTES];
+  char         *message = NULL, *block = NULL;
+  unsigned long long x;
+  long long     start, limit;
+  size_t        j, bytes = (size_t) mblocks * bs;
+  int           n = 0, done = 0, flags = transparent;
+
+  memset(t, 0, sizeof(trial));
+  trial_seed(seed, i);
+  oc_rng_init_seed(&erng, seed);
+  oc_rng_init_seed(&drng, seed);
+
+  if (oc_decoder_init(&dec, mblocks, &drng, flags, fudge, q, e, 0)
+      & OC_FATAL_ERROR)
+    return fprintf(stderr, "bench: failed to init decoder\n"), -1;
+  oc_floyd_set_method(&(dec.base.floyd), floyd);
+  oc_decoder_set_resolve_mode(&dec, OC_RESOLVE_FIXPOINT);
+  if (max_inactive)
+    oc_decoder_set_inactivation(&dec, max_inactive);
+
+  // give up if something's badly wrong rather than run forever
+  limit = 4ll * mblocks + 1000;
+
+  if (!data) {
+    start = now_ns();
+    while (!done && (n < limit)) {
+      if (-1 == oc_accept_check_block(&dec, &drng))
+	break;
+      ++n;
+      if (-1 == (done = oc_resolve(&dec, &solved)))
+	break;
+      free_list(solved);
+    }
+    t->dec_ns   = now_ns() - start;
+    t->graph_ns = graph_ns(&dec);
+    t->checks   = (1 == done) ? n : 0;
+    oc_decoder_free(&dec);
+    return 0;
+  }
+
+  if ((oc_encoder_init(&enc, mblocks, &erng, 0, q, e, 0) & OC_FATAL_ERROR) ||
+      (NULL == (message = malloc(bytes))) || (NULL == (block = malloc(bs)))) {
+    oc_decoder_free(&dec);
+    return fprintf(stderr, "bench: failed to init encoder\n"), -1;
+  }
+  oc_floyd_set_method(&(enc.base.floyd), floyd);
+
+  // any old junk will do for the message
+  x = 0x9e3779b97f4a7c15ull + i;
+  for (j = 0; j < bytes; ++j) {
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+    message[j] = x >> 32;
+  }
+
+  start = now_ns();
+  if (oc_encoder_init_data(&enc, message, bs))
+    goto fail;
+  t->enc_ns += now_ns() - start;
+
+  start = now_ns();
+  if (oc_decoder_init_data(&dec, NULL, bs))
+    goto fail;
+  t->dec_ns += now_ns() - start;
+
+  while (!done && (n < limit)) {
+    start = now_ns();
+    if (-1 == oc_encoder_emit_block(&enc, cseed, block))
+      break;
+    t->enc_ns += now_ns() - start;
+    ++n;
+
+    start = now_ns();
+    oc_rng_init_seed(&crng, cseed);
+    if (-1 == oc_accept_check_block_data(&dec, &crng, block))
+      break;
+    if (-1 == (done = oc_resolve(&dec, &solved)))
+      break;
+    free_list(solved);
+    t->dec_ns += now_ns() - start;
+  }
+
+  t->graph_ns  = graph_ns(&dec);
+  t->enc_bytes = (double) n * bs;
+  t->dec_bytes = bytes;
+  if ((1 == done) && (0 == memcmp(message, dec.message, bytes)))
+    t->checks = n;
+
+ fail:
+  oc_encoder_free(&enc);
+  oc_decoder_free(&dec);
+  free(message);
+  free(block);
+  return 0;
+}
+
+static int compare_ints(const void *a, const void *b) {
+  return *(const int *) a - *(const int *) b;
+}
+
+// nearest-rank percentile of a sorted list
+static double percentile(const int *v, int n, double p) {
+  int k = ceil(p * n);
+  return v[(k < 1) ? 0 : k - 1];
+}
+
+static void print_header(void) {
+  printf("# mblocks\tbs\tq\te\tfudge\tfloyd\tmode\tinact\tseeds"
+	 "\tenc_MB/s\tdec_MB/s\tgraph_ops/s\trss_MB"
+	 "\tovh_min\tovh_mean\tovh_p50\tovh_p90\tovh_p99\tovh_max"
+	 "\tfails\n");
+}
+
+static void print_rate(double amount, long long ns) {
+  if (ns > 0)
+    printf("\t%.1f", amount * 1e9 / ns);
+  else
+    printf("\t-");
+}
+
+// Run all the seeds for one combination (in a child process) and
+// print its line
+static int run_combination(int mblocks, int bs, int q, double e,
+			   double fudge, int floyd) {
+
+  trial         t;
+  int          *checks, good = 0, fails = 0, i;
+  int           data = !graph_only && ((double) mblocks * bs <= max_bytes);
+  long long     enc_ns = 0, dec_ns = 0, g_ns = 0, graphed = 0;
+  double        enc_bytes = 0, dec_bytes = 0, sum = 0, m = mblocks;
+  double        actual_e = e;
+  struct rusage ru;
+  oc_codec      codec;
+
+  // report the e that the codec actually uses
+  if (0 == (oc_codec_init(&codec, mblocks, q, e, 0) & OC_FATAL_ERROR))
+    actual_e = codec.e;
+  oc_codec_free(&codec);
+
+  if (NULL == (checks = calloc(seeds, sizeof(int))))
+    return -1;
+
+  for (i = 0; i < seeds; ++i) {
+    if (-1 == run_trial(&t, i, mblocks, bs, q, e, fudge, floyd, data))
+      return free(checks), -1;
+    if (0 == t.checks) {
+      ++fails;
+      continue;
+    }
+    checks[good++] = t.checks;
+    sum       += t.checks;
+    enc_ns    += t.enc_ns;
+    dec_ns    += t.dec_ns;
+    g_ns      += t.graph_ns;
+    graphed   += t.checks;
+    enc_bytes += t.enc_bytes;
+    dec_bytes += t.dec_bytes;
+  }
+  qsort(checks, good, sizeof(int), compare_ints);
+  getrusage(RUSAGE_SELF, &ru);
+
+  printf("%d\t%d\t%d\t%g\t%g\t%s\t%s\t%d\t%d", mblocks, bs, q, actual_e,
+	 fudge, floyd_names[floyd], transparent ? "transparent" : "opaque",
+	 max_inactive, seeds);
+  print_rate(data ? enc_bytes / 1e6 : 0, data ? enc_ns : 0);
+  print_rate(data ? dec_bytes / 1e6 : 0, data ? dec_ns : 0);
+  print_rate(graphed, g_ns);
+  printf("\t%.1f", ru.ru_maxrss / 1024.0);	// Linux gives KiB
+
+#define OVH(V) (100.0 * ((V) - m) / m)
+  if (good)
+    printf("\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f",
+	   OVH(checks[0]), OVH(sum / good),
+	   OVH(percentile(checks, good, 0.5)),
+	   OVH(percentile(checks, good, 0.9)),
+	   OVH(percentile(checks, good, 0.99)), OVH(checks[good - 1]));
+  else
+    printf("\t-\t-\t-\t-\t-\t-");
+#undef OVH
+
+  printf("\t%d\n", fails);
+  free(checks);
+  return 0;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+	  "bench [-m mblocks,...] [-b block_size,...] [-q q,...] [-e e,...]\n"
+	  "      [-f fudge,...] [-F auto|list|bitmap|hash,...] [-n seeds]\n"
+	  "      [-s seed] [-M max_bytes] [-g] [-T] [-I max_inactive]\n");
+  exit(1);
+}
+
+int main(int argc, char * const argv[]) {
+
+  int    opt, a, b, c, d, f, g, status;
+  pid_t  pid;
+
+  parse_list(&mblocks_list, "1000,10000,100000", NULL);
+  parse_list(&bs_list,      "1024", NULL);
+  parse_list(&q_list,       "3", NULL);
+  parse_list(&e_list,       "0.01", NULL);
+  parse_list(&fudge_list,   "1.2", NULL);
+  parse_list(&floyd_list,   "auto", floyd_names);
+
+  while ((opt = getopt(argc, argv, "m:b:q:e:f:F:n:s:M:gTI:")) != -1) {
+    switch(opt) {
+    case 'm': if (parse_list(&mblocks_list, optarg, NULL)) usage(); break;
+    case 'b': if (parse_list(&bs_list,      optarg, NULL)) usage(); break;
+    case 'q': if (parse_list(&q_list,       optarg, NULL)) usage(); break;
+    case 'e': if (parse_list(&e_list,       optarg, NULL)) usage(); break;
+    case 'f': if (parse_list(&fudge_list,   optarg, NULL)) usage(); break;
+    case 'F':
+      if (parse_list(&floyd_list, optarg, floyd_names)) usage();
+      break;
+    case 'n':
+      if ((seeds = atoi(optarg)) < 1) usage();
+      break;
+    case 's':
+      if (strlen(optarg) != OC_RNG_BYTES - 8) {
+	fprintf(stderr, "bench: -s seed must be %d chars\n", OC_RNG_BYTES - 8);
+	exit(1);
+      }
+      memcpy(base_seed, optarg, OC_RNG_BYTES - 8);
+      break;
+    case 'M': max_bytes    = strtod(optarg, NULL); break;
+    case 'g': graph_only   = 1; break;
+    case 'T': transparent  = OC_TRANSPARENT_AUX; break;
+    case 'I': max_inactive = atoi(optarg); break;
+    default:
+      usage();
+    }
+  }
+  if (optind < argc)
+    usage();
+
+  print_header();
+  fflush(stdout);
+
+  for (a = 0; a < mblocks_list.count; ++a)
+    for (b = 0; b < bs_list.count; ++b)
+      for (c = 0; c < q_list.count; ++c)
+	for (d = 0; d < e_list.count; ++d)
+	  for (f = 0; f < fudge_list.count; ++f)
+	    for (g = 0; g < floyd_list.count; ++g) {
+	      if (-1 == (pid = fork())) {
+		perror("bench: fork");
+		return 1;
+	      }
+	      if (0 == pid) {
+		status = run_combination(mblocks_list.value[a], bs_list.value[b],
+					 q_list.value[c], e_list.value[d],
+					 fudge_list.value[f], floyd_list.value[g]);
+		fflush(stdout);
+		_exit(status ? 1 : 0);
+	      }
+	      if ((-1 == waitpid(pid, &status, 0)) ||
+		  !WIFEXITED(status) || WEXITSTATUS(status))
+		// keep going; the line says which one it was
+		printf("# failed: mblocks %g, bs %g, q %g, e %g, fudge %g, "
+		       "floyd %s\n", mblocks_list.value[a], bs_list.value[b],
+		       q_list.value[c], e_list.value[d], fudge_list.value[f],
+		       floyd_names[(int) floyd_list.value[g]]);
+	      fflush(stdout);
+	    }
+
+  return 0;
+}
@@ -6,29 +6,69 @@
 
 #include "bones.h"
 
-oc_bone *oc_new_bone(oc_graph *g, int size) {
+int oc_new_bone(oc_graph *g, int size) {
+
+  int required   = size + 1;
+  int chunk_size = 1 << g->bone_bits;
+  int index      = g->boneyard_next;
+  int chunk;
+  oc_bone **table;
+
+  // printf("Requested new bone of size %d at %d\n",
+  //   required, g->boneyard_next);
+
+  if (required > chunk_size)
+    return 0;
+
+  // Bones can't straddle chunks, so if this one doesn't fit in what's
+  // left of the current chunk, skip to the start of a new one
+  chunk = index >> g->bone_bits;
+  if ((chunk == g->bone_chunks_used) ||
+      ((index & (chunk_size - 1)) + required > chunk_size)) {
+
+    chunk = g->bone_chunks_used;
+    if (chunk >= (1 << (31 - g->bone_bits)) - 1)
+      return 0;			// out of indices
+
+    if (chunk == g->bone_chunks_space) {
+      table = realloc(g->bone_chunks, 2 * chunk * sizeof(oc_bone *));
+      if (NULL == table)
+	return 0;
+      g->bone_chunks       = table;
+      g->bone_chunks_space = 2 * chunk;
+    }
+    // no need to clear this memory
+    g->bone_chunks[chunk] = malloc(chunk_size * sizeof(oc_bone));
+    if (NULL == g->bone_chunks[chunk])
+      return 0;
+    ++(g->bone_chunks_used);
+    index = chunk << g->bone_bits;
+  }
 
-  int required = size + 1;
-  oc_bone *p;
+  g->boneyard_next = index + required;
 
-  // printf("Requested new bone of size %d from pool of [%d,%d]\n",
-  //   required, g->boneyard_next, g->boneyard_size);
+  return index;
+}
 
-  if (required + g->boneyard_next >= g->boneyard_size)
-    return NULL;
+// Give back every bone made since g->boneyard_next was mark, along
+// with any chunks that were allocated for them
+void oc_release_bones(oc_graph *g, int mark) {
 
-  p = g->boneyard + g->boneyard_next;
-  g->boneyard_next += required;
+  int chunk_size = 1 << g->bone_bits;
+  int keep       = (mark + chunk_size - 1) >> g->bone_bits;
 
-  return p;
+  assert(mark <= g->boneyard_next);
+
+  while (g->bone_chunks_used > keep)
+    free(g->bone_chunks[--(g->bone_chunks_used)]);
+  g->boneyard_next = mark;
 }
 
 // Create a bone that will attach to a check node
-oc_bone *oc_check_bone(oc_graph *g, int cnode, int *list) {
+int oc_check_bone(oc_graph *g, int cnode, int *list) {
 
   oc_bone        *bone, *bp;
-  oc_n_edge_ring *ring;
-  int             count, last_index;
+  int             index, edge, count, last_index;
   int             size, unknowns, lower;
 
   // size of list is stored in the first element
@@ -37,8 +77,9 @@ oc_bone *oc_check_bone(oc_graph *g, int cnode, int *list) {
   // reserve one extra space for known check node
   last_index = size + 1;
 
-  if (NULL == (bone = oc_new_bone(g, last_index)))
-    return NULL;
+  if (0 == (index = oc_new_bone(g, last_index)))
+    return 0;
+  bone = oc_graph_bone(g, index);
 
   // save total size of array
   bone->b.size = last_index;
@@ -46,59 +87,78 @@ oc_bone *oc_check_bone(oc_graph *g, int cnode, int *list) {
   // all the known elements go at the end of the list. Initially, only
   // the check node is known and  the rest go below it.
   bone[last_index]  .a.node = cnode; 
-  bone[last_index--].b.link = NULL; // known => no edge
+  bone[last_index--].b.link = OC_NO_EDGE; // known => no edge
 
   count = size; bp = bone + 1;
   while (count--) {
     lower = *(list++);
     if (g->solution[lower]) {
       bone[last_index].a.node = lower; 
-      bone[last_index].b.link = NULL; // known => no edge
+      bone[last_index].b.link = OC_NO_EDGE; // known => no edge
       --last_index;
       --unknowns;
     } else {
-      if (NULL == (ring = oc_create_n_edge(g, cnode, lower))) {
+      if (OC_NO_EDGE == (edge = oc_create_n_edge(g, cnode, lower))) {
 	fprintf(stderr, "oc_check_bone: failed to malloc up edge\n");
-	return NULL;
+	oc_unlink_check_bone(g, index, cnode, bp - (bone + 1));
+	return 0;
       }
       bp->a.node = lower;
-      bp->b.link = ring;
+      bp->b.link = edge;
       ++bp;
     }
   }
 
   // save count of unknowns and return
   bone->a.unknowns = unknowns;
-  return bone;
+  return index;
+
+}
+
+// Take back a check node's bone if the node can't be added to the
+// graph after all: delete the up edges made for the first 'linked'
+// unknowns and return the bone's space to the boneyard if nothing has
+// been allocated after it.
+void oc_unlink_check_bone(oc_graph *g, int index, int cnode, int linked) {
+
+  oc_bone *bone = oc_graph_bone(g, index);
+  int      i;
 
+  for (i = 1; i <= linked; ++i)
+    oc_delete_lower_end(g, bone[i].b.link, cnode, bone[i].a.node, 0);
+
+  if (g->boneyard_next == index + bone->b.size + 1)
+    g->boneyard_next = index;
 }
 
 // We also use bones for aux nodes but I'm creating them directly
 // during graph initialisation. This routine does some checks on the
 // bone to make sure that it's correctly constructed.
 
-void oc_validate_bone(oc_bone *bone, int anode) {
+void oc_validate_bone(oc_graph *g, oc_bone *bone, int anode) {
 
-  int count, lower;
-  oc_n_edge_ring *ring;
+  int count, lower, edge;
 
   // aux blocks are created before everything else, so these should
   // match:
   assert(bone->a.unknowns == bone->b.size);
 
-  // iterate over the elements and maybe segfault if links weren't set
-  // up correctly
+  // iterate over the elements and check that links were set up
+  // correctly (aux nodes only have edges from the aux map)
   count = bone->b.size;
   ++bone;
   while (count--) {
     lower = bone->a.node;
-    ring  = bone->b.link;
+    edge  = bone->b.link;
     ++bone;
     assert (lower <= anode);
     if (lower == anode)
-      assert (ring == NULL);
-    else 
-      assert (ring->upper == anode);
+      assert (edge == OC_NO_EDGE);
+    else {
+      assert (edge >= 0 && edge < g->static_edges);
+      assert (edge / g->q == lower);
+      assert (g->aux_map[edge] == anode);
+    }
   }
 }
 
@@ -152,17 +212,16 @@ int oc_known_unsolved(oc_bone *bone, int anode) {
 
 void oc_bubble_unsolved(oc_bone *bone, oc_graph *g, int index) {
 
-  int count, node;
-  oc_n_edge_ring *ring;
+  int count, node, edge;
 
-  // swap node, ring elements to front
+  // swap node, edge elements to front
   node = bone[index].a.node;
   if (index != 1) {
     bone[index].a.node = bone[1]    .a.node;
     bone[1]    .a.node = node;
-    ring               = bone[index].b.link;
+    edge               = bone[index].b.link;
     bone[index].b.link = bone[1]    .b.link;
-    bone[1]    .b.link = ring;
+    bone[1]    .b.link = edge;
   }
 
   // set unknown count
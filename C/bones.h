@@ -7,8 +7,6 @@
 #include "graph.h"
 #include "structs.h"
 
-struct oc_n_edge_ring_node;
-
 
 // Functions to give a range of indices for known/unknown elements or
 // count knowns/unknowns
@@ -36,9 +34,12 @@ static inline int oc_count_knowns(oc_bone *b) {
   return b->b.size - b->a.unknowns;
 }
 
-oc_bone *oc_new_bone(oc_graph *g, int size);
-oc_bone *oc_check_bone(oc_graph *g, int cnode, int *list);
-void oc_validate_bone(oc_bone *bone, int anode);
+// These return the new bone's index (see oc_graph_bone) or 0 on error
+int oc_new_bone(oc_graph *g, int size);
+void oc_release_bones(oc_graph *g, int mark);
+int oc_check_bone(oc_graph *g, int cnode, int *list);
+void oc_unlink_check_bone(oc_graph *g, int index, int cnode, int linked);
+void oc_validate_bone(oc_graph *g, oc_bone *bone, int anode);
 int oc_unknown_unsolved(oc_bone *bone, oc_graph *g);
 int oc_known_unsolved(oc_bone *bone, int anode);
 void oc_bubble_unsolved(oc_bone *bone, oc_graph *g, int index);
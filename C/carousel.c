@@ -0,0 +1,324 @@
+// Carousel encoder (see carousel.h)
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "online-code.h"
+#include "encoder.h"
+#include "carousel.h"
+#include "xor.h"
+
+static int compare_nodes(const void *a, const void *b) {
+  return *(const int *) a - *(const int *) b;
+}
+
+// Blocks in schedule n (only the last one of a period can be short)
+static int schedule_count(oc_carousel *c, long long n) {
+
+  long long left;
+
+  if (0 == c->period)
+    return c->batch;
+  left = c->period - n * c->batch;
+  return (left < c->batch) ? left : c->batch;
+}
+
+// Work out the next count blocks of the seed chain into s. Only the
+// schedule thread calls this, and only on schedules the sender isn't
+// using.
+static int fill_schedule(oc_carousel *c, oc_carousel_schedule *s,
+			 int count) {
+
+  oc_encoder *enc = c->enc;
+  uint32_t *nodes;
+  size_t    used = 0, space;
+  char     *seed;
+  int      *list, i, j, k, degree, node;
+
+  for (i = 0; i < count; ++i) {
+    seed = s->seeds + (size_t) i * OC_RNG_BYTES;
+    oc_encoder_next_seed(enc, seed);
+    if (NULL == (list = oc_encoder_check_block_r(enc, &(c->t), seed)))
+      return -1;
+    degree = *(list++);
+
+    if (used + degree > s->nodes_space) {
+      for (space = s->nodes_space; used + degree > space; space *= 2)
+	;
+      if (NULL == (nodes = realloc(s->nodes, space * sizeof(uint32_t)))) {
+	fprintf(stderr, "oc_carousel: failed to allocate memory\n");
+	return -1;
+      }
+      s->nodes       = nodes;
+      s->nodes_space = space;
+    }
+
+    // most blocks have only a few sources, so insertion sort does
+    if (degree > 32) {
+      qsort(list, degree, sizeof(int), compare_nodes);
+    } else {
+      for (j = 1; j < degree; ++j) {
+	node = list[j];
+	for (k = j; (k > 0) && (list[k - 1] > node); --k)
+	  list[k] = list[k - 1];
+	list[k] = node;
+      }
+    }
+
+    s->start[i] = used;
+    for (j = 0; j < degree; ++j)
+      s->nodes[used++] = list[j];
+  }
+  s->start[count] = used;
+  s->count        = count;
+
+  return 0;
+}
+
+static void *schedule_main(void *arg) {
+
+  oc_carousel          *c = arg;
+  oc_carousel_schedule *s;
+  long long             n;
+  int                   rc;
+
+  pthread_mutex_lock(&c->lock);
+  while (1) {
+    n = c->made;		// we're the only one that changes it
+    if (c->period && (n == c->schedules))
+      break;			// made the whole period
+    while (!c->period && (n - c->sent >= c->schedules) && !c->shutdown)
+      pthread_cond_wait(&c->sent_one, &c->lock);
+    if (c->shutdown)
+      break;
+    pthread_mutex_unlock(&c->lock);
+
+    s  = c->ring + (n % c->schedules);
+    rc = fill_schedule(c, s, schedule_count(c, n));
+
+    pthread_mutex_lock(&c->lock);
+    if (-1 == rc) {
+      c->error = 1;
+      pthread_cond_broadcast(&c->made_one);
+      break;
+    }
+    __atomic_store_n(&c->made, n + 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&c->made_one);
+  }
+  pthread_mutex_unlock(&c->lock);
+
+  return NULL;
+}
+
+int oc_carousel_init(oc_carousel *c, oc_encoder *enc, int batch,
+		     long long period, int cache_degree, int cache_blocks) {
+
+  oc_carousel_schedule *s;
+  long long schedules;
+  int i;
+
+  assert(NULL != c);
+  assert(NULL != enc);
+
+  memset(c, 0, sizeof(oc_carousel));
+  c->enc = enc;
+
+  if (NULL == enc->message) {
+    fprintf(stderr, "oc_carousel_init: encoder has no data plane\n");
+    return -1;
+  }
+  if ((batch < 0) || (period < 0) || (cache_blocks < 0)) {
+    fprintf(stderr, "oc_carousel_init: invalid arguments\n");
+    return -1;
+  }
+
+  if (0 == batch)
+    batch = OC_CAROUSEL_BATCH;
+  if (period && (batch > period))
+    batch = period;
+  schedules = period ? (period + batch - 1) / batch : OC_CAROUSEL_SCHEDULES;
+  if (schedules > INT_MAX) {
+    fprintf(stderr, "oc_carousel_init: period too long\n");
+    return -1;
+  }
+
+  c->block_size = enc->block_size;
+  c->batch      = batch;
+  c->period     = period;
+  c->schedules  = schedules;
+
+  pthread_mutex_init(&c->lock,     NULL);
+  pthread_cond_init (&c->made_one, NULL);
+  pthread_cond_init (&c->sent_one, NULL);
+
+  c->ring = calloc(c->schedules, sizeof(oc_carousel_schedule));
+  c->srcs = malloc(enc->base.F * sizeof(void *));
+  if ((NULL == c->ring) || (NULL == c->srcs) ||
+      (-1 == oc_encoder_thread_init(enc, &(c->t))))
+    goto fail;
+
+  // start off with room for an average of 8 sources a block
+  for (i = 0; i < c->schedules; ++i) {
+    s = c->ring + i;
+    s->nodes_space = 8 * (size_t) schedule_count(c, i);
+    s->seeds = malloc((size_t) schedule_count(c, i) * OC_RNG_BYTES);
+    s->start = malloc((schedule_count(c, i) + 1) * sizeof(uint32_t));
+    s->nodes = malloc(s->nodes_space * sizeof(uint32_t));
+    if ((NULL == s->seeds) || (NULL == s->start) || (NULL == s->nodes))
+      goto fail;
+  }
+
+  if (period && (cache_degree >= 2) && cache_blocks) {
+    c->cache_degree = cache_degree;
+    c->cache_slot   = malloc(period * sizeof(int));
+    if ((NULL == c->cache_slot) ||
+	(-1 == oc_arena_init(&(c->cache), cache_blocks, c->block_size, 0)))
+      goto fail;
+    memset(c->cache_slot, -1, period * sizeof(int));
+  }
+
+  if (pthread_create(&c->tid, NULL, &schedule_main, c)) {
+    fprintf(stderr, "oc_carousel_init: failed to start thread\n");
+    oc_carousel_free(c);
+    return -1;
+  }
+  c->running = 1;
+
+  return 0;
+
+ fail:
+  fprintf(stderr, "oc_carousel_init: failed to allocate memory\n");
+  oc_carousel_free(c);
+  return -1;
+}
+
+// Wait for the sender's current schedule to be made
+static int wait_schedule(oc_carousel *c) {
+
+  int error = 0;
+
+  if (__atomic_load_n(&c->made, __ATOMIC_ACQUIRE) > c->current)
+    return 0;
+
+  ++(c->waits);
+  pthread_mutex_lock(&c->lock);
+  while ((c->made <= c->current) && !c->error)
+    pthread_cond_wait(&c->made_one, &c->lock);
+  if (c->made <= c->current)
+    error = 1;
+  pthread_mutex_unlock(&c->lock);
+
+  if (error)
+    fprintf(stderr, "oc_carousel_emit: schedule thread failed\n");
+  return error ? -1 : 0;
+}
+
+// Done with the current schedule: hand it back to the schedule thread
+// (or, with a period, go on to the next one, wrapping round)
+static void next_schedule(oc_carousel *c) {
+
+  c->pos = 0;
+  if (c->period) {
+    if (++(c->current) == c->schedules)
+      c->current = 0;
+    return;
+  }
+
+  pthread_mutex_lock(&c->lock);
+  c->sent = ++(c->current);
+  pthread_cond_signal(&c->sent_one);
+  pthread_mutex_unlock(&c->lock);
+}
+
+int oc_carousel_emit(oc_carousel *c, char *seed, char *dest) {
+
+  oc_carousel_schedule *s;
+  oc_encoder *enc;
+  const uint32_t *np;
+  int mblocks, block_size, degree, i, *slot = NULL;
+
+  assert(NULL != c);
+
+  if (-1 == wait_schedule(c))
+    return -1;
+
+  enc        = c->enc;
+  mblocks    = enc->base.mblocks;
+  block_size = c->block_size;
+
+  s      = c->ring + (c->current % c->schedules);
+  np     = s->nodes + s->start[c->pos];
+  degree = s->start[c->pos + 1] - s->start[c->pos];
+  memcpy(seed, s->seeds + (size_t) c->pos * OC_RNG_BYTES, OC_RNG_BYTES);
+
+  if (c->cache_degree)
+    slot = c->cache_slot + (c->current * c->batch + c->pos);
+
+  if ((NULL != slot) && (*slot >= 0)) {
+    memcpy(dest, oc_arena_block(&(c->cache), *slot), block_size);
+    ++(c->cache_hits);
+  } else {
+    for (i = 0; i < degree; ++i)
+      c->srcs[i] = (np[i] < (uint32_t) mblocks) ?
+	enc->message + (size_t) np[i] * block_size :
+	oc_arena_block(&(enc->aux_cache), np[i] - mblocks);
+
+    // copy the first block rather than clearing dest and xoring it in
+    memcpy(dest, c->srcs[0], block_size);
+    oc_xor_many(dest, c->srcs + 1, degree - 1, block_size);
+
+    // first time round: keep it if it's one of the ones we cache
+    if ((NULL != slot) && (degree >= 2) && (degree <= c->cache_degree) &&
+	(c->cache_used < c->cache.blocks)) {
+      *slot = c->cache_used++;
+      memcpy(oc_arena_block(&(c->cache), *slot), dest, block_size);
+    }
+  }
+
+  if (++(c->pos) == s->count)
+    next_schedule(c);
+  ++(c->emitted);
+
+  return degree;
+}
+
+void oc_carousel_free(oc_carousel *c) {
+
+  int i;
+
+  assert(NULL != c);
+
+  if (c->running) {
+    pthread_mutex_lock(&c->lock);
+    c->shutdown = 1;
+    pthread_cond_broadcast(&c->sent_one);
+    pthread_mutex_unlock(&c->lock);
+    pthread_join(c->tid, NULL);
+    c->running = 0;
+  }
+
+  if (NULL != c->ring) {
+    for (i = 0; i < c->schedules; ++i) {
+      if (NULL != c->ring[i].seeds) free(c->ring[i].seeds);
+      if (NULL != c->ring[i].start) free(c->ring[i].start);
+      if (NULL != c->ring[i].nodes) free(c->ring[i].nodes);
+    }
+    free(c->ring);
+  }
+  if (NULL != c->srcs)       free(c->srcs);
+  if (NULL != c->cache_slot) free(c->cache_slot);
+  oc_arena_free(&(c->cache));
+  oc_encoder_thread_free(&(c->t));
+
+  pthread_mutex_destroy(&c->lock);
+  pthread_cond_destroy (&c->made_one);
+  pthread_cond_destroy (&c->sent_one);
+
+  c->ring       = NULL;
+  c->srcs       = NULL;
+  c->cache_slot = NULL;
+}
@@ -0,0 +1,119 @@
+// Carousel encoder (check blocks from precomputed schedules)
+
+#ifndef OC_CAROUSEL_H
+#define OC_CAROUSEL_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "online-code.h"
+#include "encoder.h"
+#include "arena.h"
+
+// A broadcast sender goes round and round the same message for hours,
+// and for every packet oc_encoder_emit_block hashes the next seed,
+// picks a degree and runs Floyd's algorithm (more hashes) before it
+// can start xoring. A carousel moves all of that onto a thread of its
+// own: the thread works ahead through the encoder's seed chain,
+// writing each check block's seed and sorted list of source blocks
+// into a schedule, and the sending thread only has to look blocks up
+// in the schedule and xor them.
+//
+// Schedules hold OC_CAROUSEL_BATCH blocks (or as many as asked for),
+// and there's a ring of OC_CAROUSEL_SCHEDULES of them, so the thread
+// stays up to that many schedules ahead and then waits for the sender
+// to finish one. A schedule is three flat arrays: seeds, a start
+// index for each block and the block numbers themselves (32 bits
+// each). The degree is the difference between two start indices, so
+// it doesn't need storing. Block numbers are sorted so that a block's
+// sources are read in address order.
+//
+// With a period, the carousel really goes round: after period blocks
+// it starts again from the first, sending the same check blocks (and
+// seeds) again. That's for when the set of receivers changes slowly
+// and there's no point making new blocks forever. The schedules for
+// the whole period are kept (and the thread stops once it's made
+// them), and so the contents of some blocks can be kept too: with
+// cache_degree >= 2, the first cache_blocks blocks of degree 2 up to
+// cache_degree are saved the first time round and copied out on later
+// laps rather than made again. Low degree blocks are most of them, and
+// each is still a handful of scattered reads and a call per source to
+// make, against one copy from the cache. Without a period no block is
+// ever sent twice, so there's nothing to cache.
+//
+// Output is the same as calling oc_encoder_emit_block over and over
+// (for the first period blocks, with a period), since the seeds come
+// from the same chain. The carousel takes the encoder's seed chain
+// over, though, so don't make blocks with the encoder's own
+// non-reentrant routines while it's running.
+
+#define OC_CAROUSEL_BATCH     4096	// default blocks per schedule
+#define OC_CAROUSEL_SCHEDULES 4		// ring size (no period)
+
+typedef struct {
+
+  int        count;		// blocks in this schedule
+  char      *seeds;		// count * OC_RNG_BYTES
+  uint32_t  *start;		// count + 1: block i's sources are
+  uint32_t  *nodes;		// nodes[start[i]] .. nodes[start[i + 1] - 1]
+  size_t     nodes_space;
+
+} oc_carousel_schedule;
+
+typedef struct {
+
+  oc_encoder           *enc;
+  int                   block_size;
+  int                   batch;
+  long long             period;		// 0 => no repeats
+
+  oc_carousel_schedule *ring;
+  int                   schedules;	// size of ring
+
+  // schedule thread: made counts schedules finished (atomic),
+  // sent the ones the sender is done with (never, with a period)
+  oc_encoder_thread     t;
+  pthread_t             tid;
+  int                   running;
+  pthread_mutex_t       lock;
+  pthread_cond_t        made_one;
+  pthread_cond_t        sent_one;
+  long long             made;
+  long long             sent;
+  int                   shutdown;
+  int                   error;
+
+  // sender
+  long long             current;	// schedule (counting from 0)
+  int                   pos;		// next block in it
+  const void          **srcs;		// F pointers
+
+  // payload cache (period only)
+  int                   cache_degree;
+  oc_arena              cache;
+  int                  *cache_slot;	// per block of the period, or -1
+  int                   cache_used;
+
+  long long             emitted;
+  long long             cache_hits;
+  long long             waits;		// times the sender caught up
+
+} oc_carousel;
+
+// Set up a carousel for an encoder whose data plane is set up. batch
+// is the number of blocks per schedule (0 => OC_CAROUSEL_BATCH) and
+// period the number of check blocks before it goes round again (0 =>
+// never). The cache arguments only count with a period (see above).
+// Starts the schedule thread. Returns 0 on success.
+int  oc_carousel_init(oc_carousel *c, oc_encoder *enc, int batch,
+		      long long period, int cache_degree, int cache_blocks);
+
+// Make the next check block: its seed (OC_RNG_BYTES) is written to
+// seed and its contents to dest. Waits for the schedule thread if it's
+// fallen behind. Returns the degree of the block or -1 on error.
+int  oc_carousel_emit(oc_carousel *c, char *seed, char *dest);
+
+// Stops the thread and frees the carousel (not the encoder)
+void oc_carousel_free(oc_carousel *c);
+
+#endif
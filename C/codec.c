@@ -11,7 +11,8 @@
 #include "online-code.h"
 #include "encoder.h"
 #include "decoder.h"
-// #include "xor.h"
+#include "diskio.h"
+#include "xor.h"
 
 #define OC_DEBUG 0
 
@@ -33,29 +34,15 @@ char e_message[PADLEN] = "The quick brown fox jumps over a lazy dog"
 char d_message[PADLEN];		// decoder message buffer
 char xmit[PADLEN];		// "transmitted" block
 
-// Auxiliary caches used by encoder and decoder, respectively
-char *e_aux_cache;
-char *d_aux_cache;
-
-// Cache for received check blocks (with a huge fudge factor)
-#define CHK_CACHE_BYTES (PADLEN * 10)
-char chk_cache[CHK_CACHE_BYTES];
-
 // encoder/decoder flags
 int eargs = 0;
 int dargs = 0; //OC_EXPAND_MSG;
 
 
-// simple XOR routine (for now)
-void xor(unsigned char *dst, unsigned char *src, int count) {
-  while (count--)
-    *(dst++) ^= *(src++);
-}
-
 void test_xor(void) {
   // basic test; should print cAMELcASE
   memcpy(xmit, "CamelCase", 9);
-  xor (xmit, "         ", 9);
+  oc_xor(xmit, "         ", 9);
   printf("%.9s\n", xmit);
 }
 
@@ -87,12 +74,15 @@ int main(int argc, char * const argv[]) {
   double e;
   int    block_size = 4;
   int    q, f, ablocks, coblocks;
-  int    done, i, j, check_count;
-  int    msg, aux, aux_block, *mp;
+  int    done, i, j, k, check_count;
+  int    aux, *mp;
+  char   block_seed[OC_RNG_BYTES];
   int    remainder, padding;
-  int   *exor_list, *dxor_list, count;
+  int   *exor_list, *dxor_list;
 
   oc_uni_block *solved, *sp;
+  oc_delivery   delivery;
+  int           delivered;
 
   // parse opts
   while ((opt = getopt(argc, argv, "ds:")) != -1) {
@@ -171,10 +161,9 @@ int main(int argc, char * const argv[]) {
 
   printf("Setting up decoder with default parameters\n");
 
-  // Set up Decoder, also with default args (except fudge, which is
-  // specific to the decoder and must be relatively large for small
-  // values of mblocks)
-  flags = oc_decoder_init(&dec, mblocks, &drng, dargs, 4.0, 0);
+  // Set up Decoder, also with default args (the graph grows if we
+  // need more check blocks than the default fudge factor allows for)
+  flags = oc_decoder_init(&dec, mblocks, &drng, dargs, 0.0);
   if (flags & OC_FATAL_ERROR)
     return fprintf(stderr, "Fatal error setting up decoder\n");
 
@@ -185,100 +174,68 @@ int main(int argc, char * const argv[]) {
   assert(e        == dec.base.e);
   assert(f        == dec.base.F);
 
-  // The Perl version uses OC_EXPAND_AUX to avoid creating an aux
-  // cache. I'm not implementing that functionality yet so I have to
-  // calculate the aux block contents here.
-  e_aux_cache = malloc(ablocks * block_size);
-  if (NULL == e_aux_cache)
-    return fprintf(stderr, "Failed to allocate encoder auxiliary cache\n");
-
-  memset(e_aux_cache, 0, ablocks * block_size);
-  mp = enc.base.auxiliary;
-  for (msg = 0; msg < mblocks; ++msg) {
-    for (aux = 0; aux < q; ++aux) {
-      aux_block = *(mp++) - mblocks;
-      assert(aux_block >= 0);
-      assert(aux_block < ablocks);
-      xor(e_aux_cache + block_size * aux_block,
-      	  e_message   + block_size * msg,
-      	  block_size);
-    }
-  }
+  // The encoder keeps its own aux cache once it's given the message
+  if (-1 == oc_encoder_init_data(&enc, e_message, block_size))
+    return fprintf(stderr, "Failed to set up encoder data\n");
 
   // print out encoder's aux cache
   printf ("ENCODER: Auxiliary block signatures:\n");
   for (aux = 0; aux < ablocks; ++aux) {
     printf("  signature %d :", aux + mblocks);
-    print_sum(e_aux_cache + block_size * aux, block_size," ", "\n");
+    print_sum(oc_arena_block(&enc.aux_cache, aux), block_size," ", "\n");
   }
 
-  // Set up decoder arrays (received check and solved msg/aux blocks)
-  d_aux_cache = malloc(ablocks * block_size);
-  if (NULL == d_aux_cache)
-    return fprintf(stderr, "Failed to allocate decoder auxiliary cache\n");
+  // Set up decoder data plane (received check and solved msg/aux
+  // blocks). Solved message blocks are written straight to d_message.
   memset(d_message, 0, LENGTH + padding + 1);
-  memset(chk_cache, 0, CHK_CACHE_BYTES);
-  memset(d_aux_cache, 0, ablocks * block_size);
+  if (-1 == oc_decoder_init_data(&dec, d_message, block_size))
+    return fprintf(stderr, "Failed to set up decoder data\n");
+
+  // Follow the decoded prefix of the message as it grows (without
+  // writing it anywhere)
+  if (-1 == oc_delivery_init(&delivery, &dec, -1, LENGTH, block_size, 0))
+    return fprintf(stderr, "Failed to set up delivery cursor\n");
 
   // main loop
   done = check_count = 0;
   while (!done) {
 
 
-    // Encoder side: create a check block. The erng's current value is
-    // taken to be the "uuid/seed" for this checkblock. In practice,
-    // we'd create a random uuid/seed (or at least advance the rng)
-    // and save it for sending to the decoder along with the xored
-    // contents of the check block.
-
-    printf("\nENCODE Block #%d %s\n", check_count, oc_rng_as_hex(&erng));
+    // Encoder side: create a check block. The encoder picks a new
+    // seed for each check block and hands it back to us along with
+    // the xored contents. Both would be sent to the decoder.
 
-    if (NULL == (exor_list = oc_encoder_check_block(&enc)))
+    if (-1 == oc_encoder_emit_block(&enc, block_seed, xmit))
       return fprintf(stderr, "codec failed to create encoder check block\n");
 
-    //    printf("Encoder check block (degree %d): ",exor_list[0]);
+    // the emitted block's xor list is left in the codec's scratch area
+    exor_list = enc.base.xor_scratch;
+
+    printf("\nENCODE Block #%d ", check_count);
+    for (k = 0; k < OC_RNG_BYTES; ++k)
+      printf("%02x", (unsigned char) block_seed[k]);
+    printf("\n");
+
     printf("Encoder check block: ");
     oc_print_xor_list(exor_list, "\n");
 
-    // XOR the contained message/auxiliary blocks
-    memset(xmit, 0, block_size);
-    mp    = exor_list;
-    count = *(mp++);
-    while (count--) {
-      i = *(mp++);
-      printf("Encoder XORing block %d into check block %d\n", i, check_count);
-      assert (i < coblocks);
-      if (i < mblocks)
-       	xor(xmit, e_message   + i             * block_size, block_size);
-      else
-	xor(xmit, e_aux_cache + (i - mblocks) * block_size, block_size);
-    }
-
     // Check that xmit buffer is right (rint plain text/signature)
-    if ((1 == exor_list[0]) && (i < mblocks))
+    if ((1 == exor_list[0]) && (exor_list[1] < mblocks))
       printf("SOLITARY ENCODED: %.*s\n", block_size, xmit);
     else
       print_sum(xmit, block_size, "Encoder check block signature: ", "\n");
 
-    //    free(exor_list);
-
-    // At this point the encoder would send the saved seed plus the
-    // contents of the xmit buffer
-
-    // Decoder side: Normally the first thing we'd do now is to seed
-    // our rng with the value given by the encoder, but we don't need
-    // to do that here because both rngs are synchronised right from
-    // the start.
+    // Decoder side: seed our rng with the value sent by the encoder
+    // so that it regenerates the same list of blocks
 
+    oc_rng_init_seed(&drng, block_seed);
     printf("\nDECODE Block #%d %s\n", check_count, oc_rng_as_hex(&drng));
 
     // Save contents of checkblock and add it to the graph
-    memcpy(chk_cache + check_count * block_size,
-	   xmit, block_size);
-    if (-1 == oc_accept_check_block(&dec, &drng))
+    if (-1 == oc_accept_check_block_data(&dec, &drng, xmit))
       return fprintf(stderr, "Failed to accept check block\n");
-    print_sum(chk_cache + check_count * block_size, block_size,
-	      "Decoder check block signature: ", "\n");
+    print_sum((char *) oc_decoder_block(&dec, coblocks + check_count),
+	      block_size, "Decoder check block signature: ", "\n");
 
     ++check_count;
 
@@ -313,71 +270,41 @@ int main(int argc, char * const argv[]) {
 
 	// print the cache contents (only plain text)
 	if ((1 == dxor_list[0]) && (i < mblocks)) {
-	  j = dxor_list[1] - coblocks;
+	  j = dxor_list[1];
 	  printf("SOLITARY DECODED: '%.*s' (check #%d)\n", block_size, 
-		 chk_cache + j * block_size, j);
-	}
-
-	// re-use xmit buffer and mp to XOR all the blocks
-	memset(xmit, 0, block_size);
-	mp    = dxor_list;
-	count = *(mp++);
-
-	while (count--) {
-	  j = *(mp++);		// component node
-	  if (j < mblocks) {
-	    if (dargs & OC_EXPAND_MSG)
-	      return fprintf(stderr,
-                "got msg block %d with OC_EXPAND_MSG set\n", j);
-
-	    printf("DECODER: XORing block %d (message) into %d\n",
-		   j, i);
-
-	    xor(xmit, d_message + j * block_size, block_size);
-
-	  } else if (j >= coblocks) {
-	    printf("DECODER: XORing block %d (check #%d) into %d\n",
-		   j, j - coblocks, i);
-	    j -= coblocks;
-	    xor(xmit, chk_cache + j * block_size, block_size);
-
-	  } else {
-	    if (dargs & OC_EXPAND_AUX)
-	      return fprintf(stderr,
-                "got aux block %d with OC_EXPAND_AUX set\n", j);
-	    printf("DECODER: XORing block %d (auxiliary) into %d\n",
-		   j, i);
-	    j -= mblocks;
-	    xor(xmit, d_aux_cache + j * block_size, block_size);
-	  }
+		 oc_decoder_block(&dec, j), j - coblocks);
 	}
 
+	// oc_resolve() has already xored the blocks in the list above
+	// (taking solved ones from the decoder's cache)
 	assert (i < coblocks);
 
-	// save newly-decoded message/aux block
 	if (i < mblocks) {
-
-	  memcpy(d_message + i * block_size, xmit, block_size);
 	  printf("Decoded block %d (message): '%.*s'\n",
 		 i, block_size, d_message + i * block_size);
-
 	} else {
-
 	  printf("Decoded block %d (auxiliary): ", i);
-	  i -= mblocks;
-	  assert(i >= 0);
-	  assert(i < ablocks);
-	  memcpy(d_aux_cache + i * block_size, xmit, block_size);
-	  print_sum(d_aux_cache + i * block_size, block_size,
+	  print_sum((char *) oc_decoder_block(&dec, i), block_size,
 		    "(signature ", ")\n");
 	}
 
-	//free(dxor_list);
+	free(dxor_list);
 
 	solved = solved->a.next;
 	//free(sp);
       }
 
+      delivered = delivery.next;
+      if (-1 == oc_delivery_advance(&delivery))
+	return fprintf(stderr, "Delivery cursor failed\n");
+      if (delivery.next > delivered) {
+	j = delivery.next * block_size;
+	if (j > LENGTH) j = LENGTH;
+	printf("Delivered message blocks %d-%d: '%.*s'\n",
+	       delivered, delivery.next - 1, j - delivered * block_size,
+	       d_message + delivered * block_size);
+      }
+
       if (done)
 	break;			// escape inner loop
     } // end while(1)
@@ -386,4 +313,8 @@ int main(int argc, char * const argv[]) {
 
   printf("Decoded text: '%.*s'\n", LENGTH + padding, d_message);
 
+  oc_encoder_free(&enc);
+  oc_decoder_free(&dec);
+  oc_delivery_free(&delivery);
+  return 0;
 }
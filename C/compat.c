@@ -3,10 +3,12 @@
 // Primarily based on checking RNG implementations
 
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <assert.h>
 
 #include "rng_sha1.h"
+#include "sha1.h"
 #include "online-code.h"
 
 const char *null_seed = "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0";
@@ -16,6 +18,45 @@ oc_rng_sha1 rng;
 int fisher_src[25];
 int fisher_dst[25];
 
+#define BATCH_SEEDS 13	// not a multiple of OC_RNG_BATCH
+#define BATCH_DRAWS 100	// enough to go past the lookahead
+
+int check_batches(void) {
+
+  const oc_sha1_kernel *k;
+  oc_rng_sha1 serial, chain, batch[BATCH_SEEDS];
+  char seeds[BATCH_SEEDS][OC_RNG_BYTES];
+  const char *seed_ptrs[BATCH_SEEDS];
+  char ahead[OC_RNG_AHEAD_BYTES(BATCH_SEEDS, OC_RNG_LOOKAHEAD)];
+  int i, j, errors = 0;
+
+  oc_rng_init_seed(&chain, null_seed);
+  for (i = 0; i < BATCH_SEEDS; ++i) {
+    oc_rng_reseed(&chain);
+    memcpy(seeds[i], chain.seed, OC_RNG_BYTES);
+    seed_ptrs[i] = seeds[i];
+  }
+
+  for (k = oc_sha1_kernels; k->name != NULL; ++k) {
+    if (-1 == oc_sha1_select(k->name))
+      continue;			// not supported on this CPU
+    oc_rng_init_seeds(batch, seed_ptrs, BATCH_SEEDS, ahead, OC_RNG_LOOKAHEAD);
+    for (i = 0; i < BATCH_SEEDS; ++i) {
+      oc_rng_init_seed(&serial, seeds[i]);
+      for (j = 0; j < BATCH_DRAWS; ++j)
+	if (oc_rng_rand(&serial, 1000000) != oc_rng_rand(batch + i, 1000000)) {
+	  fprintf(stderr, "%s: batch rng %d differs at draw %d\n",
+		  k->name, i, j);
+	  ++errors;
+	  break;
+	}
+    }
+  }
+  oc_sha1_init();
+
+  return errors ? 1 : 0;
+}
+
 int main (int ac, char *av[]) {
 
   unsigned int i, j;
@@ -34,4 +75,8 @@ int main (int ac, char *av[]) {
 
   // maybe add check for oc_floyd() too
 
+  // The batched rngs have to give exactly the same numbers as the one
+  // above, whichever SHA1 kernel is used. Report any problems on
+  // stderr so that stdout can still be compared with the Perl version.
+  return check_batches();
 }
@@ -9,18 +9,55 @@
 
 #include "structs.h"
 #include "decoder.h"
+#include "xor.h"
+
+// per-session fields that both init routines start off empty
+static void clear_session(oc_decoder *dec) {
+
+  dec->block_size  = 0;
+  dec->message     = NULL;
+  dec->cached      = NULL;
+  dec->srcs        = NULL;
+  dec->srcs_space  = 0;
+  memset(&(dec->aux_cache),   0, sizeof(oc_arena));
+  memset(&(dec->chk_cache),   0, sizeof(oc_arena));
+  memset(&(dec->own_message), 0, sizeof(oc_arena));
+
+  dec->stamps      = NULL;
+  dec->stamps_space = 0;
+  dec->xlist       = NULL;
+  dec->epoch       = 0;
+
+  dec->solved_fn    = NULL;
+  dec->solved_arg   = NULL;
+  dec->solved_error = 0;
+
+  dec->seeds        = NULL;
+  dec->seeds_space  = 0;
+}
+
+// OC_TRANSPARENT_AUX: the graph links check blocks through aux blocks
+// using the (possibly shared) reverse aux map
+static int transparent_aux(oc_decoder *dec) {
+
+  const int *rev = oc_aux_reverse_map(&(dec->base));
+
+  if (NULL == rev) return -1;
+  return oc_graph_set_transparent_aux(&(dec->graph), rev);
+}
 
 int oc_decoder_init(oc_decoder *dec, int mblocks, oc_rng_sha1 *rng,
-		    int flags, ...) { // ... fudge, q, e, f
+		    int flags, ...) { // ... fudge, q, e, f, ablocks
 
   // Besides required parameters, we also have optional ones that are
   // the same ones that oc_codec_init takes. The end of the optional
   // list of args must be terminated with 0ll.
   //
   // The flags parameter here is composed of OC_EXPAND_MSG,
-  // OC_EXPAND_AUX or a combination (logical or) of the two. I'm
-  // making it a required parameter to make sure a null value isn't
-  // confused with the end of the optional parameter list.
+  // OC_EXPAND_AUX or a combination (logical or) of the two, plus
+  // OC_TRANSPARENT_AUX if wanted. I'm making it a required parameter
+  // to make sure a null value isn't confused with the end of the
+  // optional parameter list.
 
   // C doesn't let you pass va_args from here into the oc_codec_init
   // function so I'm stuck with various inelegant solutions. The least
@@ -32,6 +69,7 @@ int oc_decoder_init(oc_decoder *dec, int mblocks, oc_rng_sha1 *rng,
   int    q=OC_DEFAULT_Q, new_q;
   double e=OC_DEFAULT_E, new_e;
   int    f=OC_DEFAULT_F, new_f;	// f=0 => not supplied (calculated)
+  int    ablocks=0, new_a;	// ablocks=0 => calculated
   int    i, *p, coblocks;
 
   int    super_flag;
@@ -54,6 +92,9 @@ int oc_decoder_init(oc_decoder *dec, int mblocks, oc_rng_sha1 *rng,
     new_f = va_arg(ap, int);
     if (new_f == 0) break; else f=new_f;
 
+    new_a = va_arg(ap, int);
+    if (new_a == 0) break; else ablocks=new_a;
+
   } while(0);
   va_end(ap);
 
@@ -67,9 +108,11 @@ int oc_decoder_init(oc_decoder *dec, int mblocks, oc_rng_sha1 *rng,
     return OC_FATAL_ERROR;
   }
   dec->rng = rng;
+  clear_session(dec);
 
   // call "super" with extracted args
-  super_flag = oc_codec_init(&(dec->base), mblocks, q, e, f, 0ll);
+  super_flag = oc_codec_init_lazy(&(dec->base), mblocks, q, e, f,
+				    ablocks);
 
   if (super_flag & OC_FATAL_ERROR) {
     fprintf(stderr, "oc_decoder_init: parent class returned fatal error\n");
@@ -94,24 +137,139 @@ int oc_decoder_init(oc_decoder *dec, int mblocks, oc_rng_sha1 *rng,
     return super_flag & OC_FATAL_ERROR;
   }
 
+  if ((flags & OC_TRANSPARENT_AUX) && (-1 == transparent_aux(dec))) {
+    fprintf(stderr, "oc_decoder_init: failed to set up transparent aux\n");
+    return super_flag & OC_FATAL_ERROR;
+  }
+
   return super_flag;
 
 }
 
 
-// Accept a check block (from a sender) and return zero on success
-int oc_accept_check_block(oc_decoder *decoder, oc_rng_sha1 *rng) {
+int oc_decoder_init_shared(oc_decoder *dec, oc_codec_template *t,
+			   oc_rng_sha1 *rng, int flags, float fudge) {
+
+  int super_flag;
+
+  if (NULL == dec) {
+    fprintf(stderr, "oc_decoder_init_shared: passed NULL decoder pointer\n");
+    return OC_FATAL_ERROR;
+  }
+
+  if ((NULL == rng) || (NULL == t)) {
+    fprintf(stderr, "oc_decoder_init_shared: passed NULL rng/template\n");
+    return OC_FATAL_ERROR;
+  }
+
+  if (flags & OC_EXPAND_CHK) {
+    fprintf(stderr, "oc_decoder_init_shared: OC_EXPAND_CHK not valid here\n");
+    return OC_FATAL_ERROR;
+  }
+
+  if (fudge == 0.0) fudge = 1.2;
+
+  // leave rng where making the map would have left it
+  *rng     = t->rng;
+  dec->rng = rng;
+  clear_session(dec);
+
+  super_flag = oc_codec_init_shared(&(dec->base), t);
+  if (super_flag & OC_FATAL_ERROR) {
+    fprintf(stderr, "oc_decoder_init_shared: parent class returned fatal error\n");
+    return super_flag;
+  }
+  dec->flags = flags;
+
+  // the graph is the only big per-session structure
+  if (oc_graph_init(&(dec->graph), &(dec->base), fudge)) {
+    fprintf(stderr, "oc_decoder_init_shared: failed to initialise graph\n");
+    oc_codec_free(&(dec->base));
+    return OC_FATAL_ERROR;
+  }
+
+  if ((flags & OC_TRANSPARENT_AUX) && (-1 == transparent_aux(dec))) {
+    fprintf(stderr, "oc_decoder_init_shared: failed to set up transparent aux\n");
+    oc_graph_free(&(dec->graph));
+    oc_codec_free(&(dec->base));
+    return OC_FATAL_ERROR;
+  }
+
+  return super_flag;
+}
+
+// Double the room for seeds (there's always some after keep_seeds,
+// but don't count on it)
+static int grow_seeds(oc_decoder *dec) {
+
+  char *seeds;
+  int   space = dec->seeds_space ? 2 * dec->seeds_space : 64;
+
+  if (space <= dec->seeds_space)	// overflow
+    return -1;
+  if (NULL == (seeds = realloc(dec->seeds, (size_t) space * OC_RNG_BYTES)))
+    return -1;
+  dec->seeds       = seeds;
+  dec->seeds_space = space;
+  return 0;
+}
+
+int oc_decoder_keep_seeds(oc_decoder *dec) {
+
+  int space;
+
+  assert(dec != NULL);
+
+  if (NULL != dec->seeds)
+    return 0;
+
+  // seeds for blocks graphed before now are unknown (all zeroes)
+  space = dec->graph.node_space - dec->base.coblocks;
+  if (NULL == (dec->seeds = calloc(space, OC_RNG_BYTES))) {
+    fprintf(stderr, "oc_decoder_keep_seeds: failed to allocate memory\n");
+    return -1;
+  }
+  dec->seeds_space = space;
+  return 0;
+}
+
+const char *oc_decoder_check_seed(oc_decoder *dec, int node) {
+
+  assert(dec != NULL);
+
+  if ((NULL == dec->seeds) || (node < dec->base.coblocks) ||
+      (node >= dec->graph.nodes))
+    return NULL;
+  return dec->seeds + (size_t) (node - dec->base.coblocks) * OC_RNG_BYTES;
+}
 
-  int *p, f;
+// Work out which blocks make up a check block and add it to the
+// graph. Returns the new node number or -1 on error.
+static int graph_check_block(oc_decoder *decoder, oc_rng_sha1 *rng) {
+
+  int *p, f, node;
   oc_codec *codec;
   oc_graph *graph;
 
+#if OC_GRAPH_STATS
+  long long start = oc_stat_ns();
+#endif
+
   assert(decoder != NULL);
   assert(rng != NULL);
 
   codec = &(decoder->base);	// could just cast decoder
   graph = &(decoder->graph);
 
+  // make room for the seed first so that failing doesn't leave a
+  // check node without one
+  if ((NULL != decoder->seeds) &&
+      (graph->nodes - codec->coblocks >= decoder->seeds_space) &&
+      (-1 == grow_seeds(decoder))) {
+    fprintf(stderr, "oc_accept_check_block: failed to grow seed list\n");
+    return -1;
+  }
+
   // call parent class methods to figure out mapping based on RNG
   f = oc_random_degree(codec, rng);
   p = oc_checkblock_map(codec, f, rng);
@@ -119,24 +277,205 @@ int oc_accept_check_block(oc_decoder *decoder, oc_rng_sha1 *rng) {
     fprintf(stderr, "oc_accept_check_block: failed to allocate check block\n");
     return -1;
   }
+  OC_STAT(graph->stats.ns_map += oc_stat_ns() - start);
 
   // register the new check block in the graph
-  if (-1 == oc_graph_check_block(graph, p)) {
+  if (-1 == (node = oc_graph_check_block(graph, p))) {
     fprintf(stderr, "oc_accept_check_block: failed to graph check block\n");
     return -1;
   }
 
-  return 0;
+  if (NULL != decoder->seeds)
+    memcpy(decoder->seeds + (size_t) (node - codec->coblocks) * OC_RNG_BYTES,
+	   rng->seed, OC_RNG_BYTES);
+
+  return node;
+}
+
+// Accept a check block (from a sender) and return zero on success
+int oc_accept_check_block(oc_decoder *decoder, oc_rng_sha1 *rng) {
+
+  assert(decoder != NULL);
+
+  // we'd have nothing to store for this check block
+  if (NULL != decoder->cached) {
+    fprintf(stderr, "oc_accept_check_block: decoder has data plane; "
+	    "use oc_accept_check_block_data\n");
+    return -1;
+  }
 
+  return (-1 == graph_check_block(decoder, rng)) ? -1 : 0;
+}
+
+int oc_decoder_graph_check_block(oc_decoder *decoder, oc_rng_sha1 *rng) {
+  assert(decoder != NULL);
+  return graph_check_block(decoder, rng);
+}
+
+// As above, but also save the check block's contents
+int oc_accept_check_block_data(oc_decoder *decoder, oc_rng_sha1 *rng,
+			       const char *data) {
+
+  int node, block_size, check, space;
+
+  assert(decoder != NULL);
+  assert(data    != NULL);
+
+  if (NULL == decoder->cached) {
+    fprintf(stderr, "oc_accept_check_block_data: no data plane\n");
+    return -1;
+  }
+
+  // make room for the contents before the node goes into the graph,
+  // growing the same way the graph does when it runs out of nodes
+  check = decoder->graph.nodes - decoder->base.coblocks;
+  if (check >= decoder->chk_cache.blocks) {
+    space = decoder->chk_cache.blocks;
+    space += (space < 64) ? 64 : space / 2;
+    if (-1 == oc_arena_grow(&(decoder->chk_cache), space)) {
+      fprintf(stderr, "oc_accept_check_block_data: failed to grow cache\n");
+      return -1;
+    }
+  }
+
+  if (-1 == (node = graph_check_block(decoder, rng)))
+    return -1;
+
+  block_size = decoder->block_size;
+  assert(node - decoder->base.coblocks == check);
+
+  memcpy(oc_arena_block(&(decoder->chk_cache), check), data, block_size);
+
+  return 0;
 }
 
 // pass resolve calls onto graph decoder resolve method
 int oc_resolve(oc_decoder *decoder, oc_uni_block **solved) {
 
+  oc_uni_block *p;
+  int done;
+
   assert(decoder != NULL);
   assert(solved  != NULL);
 
-  return oc_graph_resolve(&(decoder->graph), solved);
+  done = oc_graph_resolve(&(decoder->graph), solved);
+
+  if (decoder->solved_error) {
+    decoder->solved_error = 0;
+    return -1;
+  }
+
+  // Fill in the contents of newly-solved blocks. The solved list is
+  // in the order that nodes were solved in, so everything in a
+  // node's solution will already be in the cache.
+  if ((-1 != done) && (NULL != decoder->cached))
+    for (p = *solved; p != NULL; p = p->a.next)
+      if (-1 == oc_decoder_solve_block(decoder, p->b.value))
+	return -1;
+
+  return done;
+}
+
+void oc_decoder_set_resolve_mode(oc_decoder *decoder, int mode) {
+  assert(decoder != NULL);
+  oc_graph_set_mode(&(decoder->graph), mode);
+}
+
+void oc_decoder_set_inactivation(oc_decoder *decoder, int max_inactive) {
+  assert(decoder != NULL);
+  oc_graph_set_inactivation(&(decoder->graph), max_inactive);
+}
+
+// graph calls this; we fill in the block then pass it on
+static void solved_trampoline(void *arg, int node) {
+
+  oc_decoder *decoder = arg;
+
+  if ((NULL != decoder->cached) &&
+      (-1 == oc_decoder_solve_block(decoder, node)))
+    decoder->solved_error = 1;
+
+  (*(decoder->solved_fn))(decoder->solved_arg, node);
+}
+
+void oc_decoder_set_solved_callback(oc_decoder *decoder,
+				    void (*fn)(void *arg, int node),
+				    void *arg) {
+  assert(decoder != NULL);
+
+  decoder->solved_fn  = fn;
+  decoder->solved_arg = arg;
+  if (NULL == fn)
+    oc_graph_set_solved_callback(&(decoder->graph), NULL, NULL);
+  else
+    oc_graph_set_solved_callback(&(decoder->graph),
+				 &solved_trampoline, decoder);
+}
+
+// Batched check block handling
+//
+// Graphing a whole batch before resolving means that we only call
+// the resolver once per batch rather than once per check block.
+// Check blocks that arrive after the message is decoded are still
+// graphed (they're harmless) but won't solve anything.
+
+// resolve as far as we can in one go
+static int resolve_batch(oc_decoder *decoder, oc_uni_block **solved) {
+
+  oc_graph *graph = &(decoder->graph);
+  int mode = graph->resolve_mode;
+  int done;
+
+  oc_graph_set_mode(graph, OC_RESOLVE_FIXPOINT);
+  done = oc_resolve(decoder, solved);
+  oc_graph_set_mode(graph, mode);
+
+  return done;
+}
+
+int oc_accept_check_blocks(oc_decoder *decoder, const char *seeds[], int n,
+			   oc_uni_block **solved) {
+
+  oc_rng_sha1 rngs[OC_RNG_BATCH];
+  char ahead[OC_RNG_AHEAD_BYTES(OC_RNG_BATCH, OC_RNG_LOOKAHEAD)];
+  int i, j, count;
+
+  assert(decoder != NULL);
+  assert(solved  != NULL);
+
+  *solved = NULL;
+  for (i = 0; i < n; i += OC_RNG_BATCH) {
+    count = (n - i < OC_RNG_BATCH) ? n - i : OC_RNG_BATCH;
+    oc_rng_init_seeds(rngs, seeds + i, count, ahead, OC_RNG_LOOKAHEAD);
+    for (j = 0; j < count; ++j)
+      if (-1 == oc_accept_check_block(decoder, rngs + j))
+	return -1;
+  }
+
+  return resolve_batch(decoder, solved);
+}
+
+int oc_accept_check_blocks_data(oc_decoder *decoder, const char *seeds[],
+				const char *data[], int n,
+				oc_uni_block **solved) {
+
+  oc_rng_sha1 rngs[OC_RNG_BATCH];
+  char ahead[OC_RNG_AHEAD_BYTES(OC_RNG_BATCH, OC_RNG_LOOKAHEAD)];
+  int i, j, count;
+
+  assert(decoder != NULL);
+  assert(solved  != NULL);
+
+  *solved = NULL;
+  for (i = 0; i < n; i += OC_RNG_BATCH) {
+    count = (n - i < OC_RNG_BATCH) ? n - i : OC_RNG_BATCH;
+    oc_rng_init_seeds(rngs, seeds + i, count, ahead, OC_RNG_LOOKAHEAD);
+    for (j = 0; j < count; ++j)
+      if (-1 == oc_accept_check_block_data(decoder, rngs + j, data[i + j]))
+	return -1;
+  }
+
+  return resolve_batch(decoder, solved);
 }
 
 // "Lazy" expansion routines
@@ -156,11 +495,18 @@ int oc_resolve(oc_decoder *decoder, oc_uni_block **solved) {
 //
 // * a recursive part that iterates over the list and takes a callback
 //   (function pointer) argument
-// * one callback that scans the expansion to find its length
-// * one callback that copies the expanded list
-// * a high-level function that calls the recursive part twice (once
-//   for each callback) to create the expanded array and then does the
-//   sorting/de-duplication stages to create the final array
+// * callbacks that track the parity of each node seen (a node that
+//   appears an even number of times cancels itself out)
+// * high-level functions that call the recursive part and give back
+//   the nodes with odd parity
+//
+// My first version counted the expansion, calloc'd an array, copied
+// the expansion into it, sorted it and then scanned for odd-length
+// runs. That was far too slow to do once per solved node, so now
+// each decoder keeps an array with one stamp per node. The top bits
+// of a stamp hold the "epoch" (incremented for every expansion) and
+// the low bit holds the node's parity for that epoch. That way the
+// array never needs clearing between expansions.
 // 
 // To cut down on the size of the stack frames I'm going to use a set
 // of decoder-local variables that the callbacks will access (instead
@@ -169,9 +515,34 @@ int oc_resolve(oc_decoder *decoder, oc_uni_block **solved) {
 
 typedef void (*callback_t)(oc_decoder *d, int node);
 
-// callbacks
-static void count(oc_decoder *d, int node) { ++(d->count); };
-static void copy(oc_decoder *d, int node)  { *((d->dest)++) = node; };
+#define STAMP(d)     ((d)->epoch << 1)
+
+// callbacks: toggle parity (and note new nodes), or emit odd nodes
+static void toggle_and_note(oc_decoder *d, int node) {
+  unsigned int *s = d->stamps + node;
+  if ((*s & ~1u) != STAMP(d)) {
+    *s = STAMP(d) | 1;
+    d->dest[++(d->count)] = node;
+  } else
+    *s ^= 1;
+}
+static void toggle(oc_decoder *d, int node) {
+  unsigned int *s = d->stamps + node;
+  if ((*s & ~1u) != STAMP(d))
+    *s = STAMP(d) | 1;
+  else
+    *s ^= 1;
+}
+static void emit_odd(oc_decoder *d, int node) {
+  unsigned int *s = d->stamps + node;
+  if (*s == (STAMP(d) | 1)) {
+    *s ^= 1;			// so later duplicates aren't emitted
+    ++(d->count);
+    (*(d->user_fn))(d->user_arg, node);
+  }
+}
+
+#define IS_CACHED(d,node) ((d)->cached && (d)->cached[node])
 
 // recursive part
 static void expandr(oc_decoder *d, int flags, oc_bone *b) {
@@ -188,17 +559,112 @@ static void expandr(oc_decoder *d, int flags, oc_bone *b) {
 
   for (i=0; i < size; ++i, ++b) {
     node = b->a.node;
-    // TODO: implement cache-related stuff
+    // don't descend into solved blocks whose contents we already have
     if (
-	((flags & OC_EXPAND_MSG) && (node <  mblocks)) ||
-	((flags & OC_EXPAND_AUX) && (node >= mblocks) && (node < coblocks))
+	((flags & OC_EXPAND_MSG) && (node <  mblocks) &&
+	 !((flags & OC_XOR_CACHED_MSG) && IS_CACHED(d,node))) ||
+	((flags & OC_EXPAND_AUX) && (node >= mblocks) && (node < coblocks) &&
+	 !((flags & OC_XOR_CACHED_AUX) && IS_CACHED(d,node)))
        )
-      expandr(d, flags, d->graph.solution[node]);
+      expandr(d, flags, oc_graph_solution(&d->graph, node));
     else 
       (*(d->callback))(d, node);	// call callback on unexpanded block
   }
 }
 
+// Allocate the stamps and list on first use (or grow them if the
+// graph has grown since) and start a new epoch
+static int expansion_setup(oc_decoder *d) {
+
+  int space = d->graph.node_space;
+  unsigned int *stamps;
+  int *xlist;
+
+  if (d->stamps_space < space) {
+    stamps = realloc(d->stamps, space * sizeof(unsigned int));
+    if (NULL != stamps) d->stamps = stamps;
+    xlist  = realloc(d->xlist, (space + 1) * sizeof(int));
+    if (NULL != xlist)  d->xlist  = xlist;
+    if ((NULL == stamps) || (NULL == xlist)) {
+      fprintf(stderr, "oc_expansion: failed to allocate memory\n");
+      return -1;
+    }
+    // new stamps are zero, so they look old whatever the epoch is
+    memset(d->stamps + d->stamps_space, 0,
+	   (space - d->stamps_space) * sizeof(unsigned int));
+    if (0 == d->stamps_space)
+      d->epoch = 0;
+    d->stamps_space = space;
+  }
+
+  // on wrap-around, clear all stamps so that none look current
+  if (++(d->epoch) > (~0u >> 1)) {
+    memset(d->stamps, 0, space * sizeof(unsigned int));
+    d->epoch = 1;
+  }
+  return 0;
+}
+
+int *oc_expansion_list(oc_decoder *decoder, int node) {
+
+  int i, in, out, *p;
+
+  assert(decoder != NULL);
+
+  if (-1 == expansion_setup(decoder))
+    return NULL;
+
+  // single pass notes each new node and toggles its parity
+  decoder->callback = &toggle_and_note;
+  decoder->dest     = p = decoder->xlist;
+  decoder->count    = 0;
+  expandr(decoder, decoder->flags, oc_graph_solution(&decoder->graph, node));
+
+  // keep only nodes that appeared an odd number of times
+  in = decoder->count;
+  for (i = out = 1; i <= in; ++i)
+    if (decoder->stamps[p[i]] & 1)
+      p[out++] = p[i];
+  p[0] = out - 1;
+
+  return p;
+}
+
+int oc_expansion_into(oc_decoder *decoder, int node, int *dest, int space) {
+
+  int *p;
+
+  if (NULL == (p = oc_expansion_list(decoder, node)))
+    return -1;
+
+  if (p[0] <= space)
+    memcpy(dest, p + 1, p[0] * sizeof(int));
+
+  return p[0];
+}
+
+int oc_expansion_foreach(oc_decoder *decoder, int node,
+			 void (*fn)(void *arg, int node), void *arg) {
+
+  assert(decoder != NULL);
+  assert(fn      != NULL);
+
+  if (-1 == expansion_setup(decoder))
+    return -1;
+
+  // first pass works out parity, second calls fn on odd nodes
+  decoder->callback = &toggle;
+  expandr(decoder, decoder->flags, oc_graph_solution(&decoder->graph, node));
+
+  decoder->callback = &emit_odd;
+  decoder->user_fn  = fn;
+  decoder->user_arg = arg;
+  decoder->count    = 0;
+  expandr(decoder, decoder->flags, oc_graph_solution(&decoder->graph, node));
+
+  return decoder->count;
+}
+
 // callback for qsort
 static int compare_ascending(const void *a, const void *b) {
        if ( *((int *)a) == *((int *)b))    return 0;
@@ -206,72 +672,206 @@ static int compare_ascending(const void *a, const void *b) {
                        else                return +1;
 }
 
+// Original interface: returns a sorted list that the caller must free
 int *oc_expansion(oc_decoder *decoder, int node) {
 
-  int ic, *p, oc, *op, pass, i, previous, runlength;
+  int *p, *op;
 
-  // 1st Stage: expand into a list with duplicates
-  decoder->callback = &count;
-  decoder->count    = 0;
-  expandr(decoder, decoder->flags, decoder->graph.solution[node]);
+  if (NULL == (p = oc_expansion_list(decoder, node)))
+    return NULL;
 
-  // Allocate memory, including space for a sentinel at the end.
-  if (NULL == (p = calloc(decoder->count + 2, sizeof(int))))
+  if (NULL == (op = malloc((p[0] + 1) * sizeof(int))))
     return NULL;
 
-  p[0]      = ic = decoder->count;
-  p[ic + 1] = -1;		// sentinel (not a valid block number)
-
-  decoder->callback = &copy;
-  decoder->dest     = p + 1;
-  expandr(decoder, decoder->flags, decoder->graph.solution[node]);
-
-  assert(-1 == p[ic + 1]);	// make sure sentinel wasn't clobbered
-
-  decoder->dest     = p;	// stash p for later reuse/free
-
-  // 2nd Stage: sort the list. I will probably use heap sort later,
-  // but I can use glibc's qsort for now (don't sort sentinel value)
-  qsort(++p, ic, sizeof(int), &compare_ascending);
-
-  // 3rd Stage: remove elements that appear an even number of times
-
-  // I'll do this in two passes so that we can return a fixed-size
-  // array to the caller. Using a sentinel at the end of the list
-  // avoids duplicating a bunch of code outside the loop to deal with
-  // the last run in the input.
-
-  for (pass = oc = 0; pass < 2; ++pass ) {
-
-    p = decoder->dest;		// restore stashed input pointer
-    previous  = *(++p);		// start from p[1] (skip p[0] = length)
-    runlength = 0;		// even run lengths cancel each other out
-    for (i = 0; i <= ic; ++i, ++p) { // scan up to and including sentinel
-      if (*p == previous) {
-	++runlength;
-      } else {
-	if (runlength &1) {
-	  // TODO: implement cache-related stuff
-	  if (pass == 0)	// count up non-cancelling blocks first 
-	    ++oc;
-	  else			// copy block ID or XOR from cache later
-	    *(++op) = previous;
-	}
-	previous  = *p;
-	runlength = 1;
-      }
-    }
+  memcpy(op, p, (p[0] + 1) * sizeof(int));
+  qsort(op + 1, op[0], sizeof(int), &compare_ascending);
+
+  return op;
+}
+
+// Decoder data plane
+//
+// Solved block contents are built by running expandr() over the
+// block's solution with a callback that collects pointers to the
+// blocks to be xored. We allow expandr() to go all the way down to
+// check blocks, but it stops as soon as it hits a block that's
+// already cached. Since oc_resolve() fills in blocks in the order
+// they're solved, it normally never has to descend at all and we
+// just xor the solution's components straight from the cache.
+
+static const char *block_data(oc_decoder *d, int node) {
+
+  int mblocks  = d->base.mblocks;
+  int coblocks = d->base.coblocks;
+
+  if (node < mblocks)
+    return d->message   + (size_t) node              * d->block_size;
+  else if (node < coblocks)
+    return oc_arena_block(&(d->aux_cache), node - mblocks);
+  else
+    return oc_arena_block(&(d->chk_cache), node - coblocks);
+}
+
+// callback: count everything but only save pointers if they'll fit.
+// The caller can grow srcs and try again if count comes back bigger
+// than srcs_space.
+static void gather(oc_decoder *d, int node) {
+  if (d->count < d->srcs_space)
+    d->srcs[d->count] = block_data(d, node);
+  ++(d->count);
+}
+
+int oc_decoder_init_data(oc_decoder *dec, char *message, int block_size) {
+
+  int mblocks, ablocks, check_space;
+
+  if ((NULL == dec) || (block_size <= 0)) {
+    fprintf(stderr, "oc_decoder_init_data: invalid arguments\n");
+    return -1;
+  }
+
+  if (NULL != dec->cached)
+    oc_decoder_free_data(dec);	// in case we're called twice
+
+  mblocks     = dec->base.mblocks;
+  ablocks     = dec->base.ablocks;
+  check_space = dec->graph.node_space - dec->base.coblocks;
+
+  dec->block_size  = block_size;
+  dec->srcs_space  = dec->base.F + 1; // enough for any check block
+
+  // our own message buffer is packed, since callers read it as one
+  // array, but the aux and check blocks are padded out to cache lines
+  if ((NULL == message) &&
+      (0 == oc_arena_init(&(dec->own_message), mblocks, block_size,
+			  OC_ARENA_ZERO | OC_ARENA_PACKED)))
+    message = dec->own_message.base;
+  dec->message = message;
+  dec->cached  = calloc(dec->base.coblocks, sizeof(unsigned char));
+  dec->srcs    = malloc(dec->srcs_space * sizeof(void *));
+
+  if ((NULL == dec->message) || (NULL == dec->cached) ||
+      (NULL == dec->srcs) ||
+      (-1 == oc_arena_init(&(dec->aux_cache), ablocks, block_size,
+			   OC_ARENA_ZERO)) ||
+      (-1 == oc_arena_init(&(dec->chk_cache), check_space, block_size, 0))) {
+    fprintf(stderr, "oc_decoder_init_data: failed to allocate memory\n");
+    oc_decoder_free_data(dec);
+    return -1;
+  }
+
+  return 0;
+}
+
+int oc_decoder_solve_block(oc_decoder *decoder, int node) {
+
+  int   flags = OC_EXPAND_MSG | OC_EXPAND_AUX |
+                OC_XOR_CACHED_MSG | OC_XOR_CACHED_AUX;
+  char *dest;
+  const void **new_srcs;
+
+#if OC_GRAPH_STATS
+  long long start = oc_stat_ns();
+#endif
+
+  assert(decoder != NULL);
+  assert(node    <  decoder->base.coblocks);
+
+  if (NULL == decoder->cached) {
+    fprintf(stderr, "oc_decoder_solve_block: no data plane\n");
+    return -1;
+  }
+  if (decoder->cached[node])
+    return 0;
+  if (NULL == decoder->chk_cache.base) {
+    fprintf(stderr, "oc_decoder_solve_block: check blocks aren't in memory\n");
+    return -1;
+  }
+  if (0 == decoder->graph.solution[node]) {
+    fprintf(stderr, "oc_decoder_solve_block: node %d not solved\n", node);
+    return -1;
+  }
 
-    // create output array at end of first pass
-    if (pass == 0) {
-      if (NULL == (op = calloc(oc + 1, sizeof(int))))
-	return NULL;
-      *op = oc;
+  decoder->callback = &gather;
+  while (1) {
+    decoder->count = 0;
+    expandr(decoder, flags, oc_graph_solution(&decoder->graph, node));
+    if (decoder->count <= decoder->srcs_space)
+      break;
+
+    new_srcs = realloc(decoder->srcs, decoder->count * sizeof(void *));
+    if (NULL == new_srcs) {
+      fprintf(stderr, "oc_decoder_solve_block: failed to grow xor list\n");
+      return -1;
     }
+    decoder->srcs       = new_srcs;
+    decoder->srcs_space = decoder->count;
   }
 
-  free(decoder->dest);
-  return op - oc;
+  dest = (char *) block_data(decoder, node);
+  memset(dest, 0, decoder->block_size);
+  oc_xor_many(dest, decoder->srcs, decoder->count, decoder->block_size);
+
+  decoder->cached[node] = 1;
+  OC_STAT(decoder->graph.stats.ns_xor += oc_stat_ns() - start);
+  return 0;
+}
+
+const char *oc_decoder_block(oc_decoder *decoder, int node) {
+
+  assert(decoder != NULL);
+
+  if ((NULL == decoder->cached) || (node < 0) ||
+      (node >= decoder->graph.nodes))
+    return NULL;
+
+  if ((node < decoder->base.coblocks) && !decoder->cached[node])
+    return NULL;
+
+  // check blocks may be kept elsewhere (see oc_disk_decoder)
+  if ((node >= decoder->base.coblocks) && (NULL == decoder->chk_cache.base))
+    return NULL;
+
+  return block_data(decoder, node);
+}
+
+void oc_decoder_free_data(oc_decoder *dec) {
+
+  assert(NULL != dec);
 
+  if (NULL != dec->cached) free(dec->cached);
+  if (NULL != dec->srcs)   free(dec->srcs);
+  oc_arena_free(&(dec->own_message));
+  oc_arena_free(&(dec->aux_cache));
+  oc_arena_free(&(dec->chk_cache));
+
+  dec->message     = NULL;
+  dec->cached      = NULL;
+  dec->srcs        = NULL;
+  dec->srcs_space  = 0;
+  dec->block_size  = 0;
 }
 
+void oc_decoder_get_stats(oc_decoder *decoder, oc_graph_stats *stats) {
+  assert(decoder != NULL);
+  oc_graph_get_stats(&(decoder->graph), stats);
+}
+
+void oc_decoder_free(oc_decoder *dec) {
+
+  assert(NULL != dec);
+
+  oc_decoder_free_data(dec);
+
+  if (NULL != dec->stamps) free(dec->stamps);
+  if (NULL != dec->xlist)  free(dec->xlist);
+  if (NULL != dec->seeds)  free(dec->seeds);
+  dec->stamps = NULL;
+  dec->xlist  = NULL;
+  dec->seeds  = NULL;
+  dec->stamps_space = 0;
+  dec->seeds_space  = 0;
+
+  oc_graph_free(&(dec->graph));
+  oc_codec_free(&(dec->base));
+}
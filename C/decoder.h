@@ -5,6 +5,7 @@
 
 #include "online-code.h"
 #include "graph.h"
+#include "arena.h"
 
 // need to give the struct a name to allow declaration of callback
 // function prototype
@@ -22,6 +23,34 @@ typedef struct oc_decoder_struct {
   int  count;			// use when counting
   int *dest;			// use when copying
 
+  // reusable expansion state (see oc_expansion_list)
+  unsigned int *stamps;		// per-node epoch << 1 | parity
+  int           stamps_space;	// graph's node_space when last grown
+  unsigned int  epoch;
+  int          *xlist;		// decoder-owned expansion list
+  void        (*user_fn)(void *arg, int node);
+  void         *user_arg;
+
+  // caller's solved-node callback (see oc_decoder_set_solved_callback)
+  void        (*solved_fn)(void *arg, int node);
+  void         *solved_arg;
+  int           solved_error;	// data plane failed inside callback
+
+  // check block seeds, if kept (see oc_decoder_keep_seeds)
+  char         *seeds;		// OC_RNG_BYTES per check node
+  int           seeds_space;	// in seeds
+
+  // Data plane (only valid after oc_decoder_init_data)
+  int            block_size;
+  char          *message;	// mblocks * block_size, contiguous
+  oc_arena       aux_cache;	// ablocks blocks (see arena.h)
+  oc_arena       chk_cache;	// one block per check node slot
+				// (grows with the graph's node space)
+  unsigned char *cached;	// per msg/aux node: contents valid?
+  const void   **srcs;		// blocks to xor (filled by expandr)
+  int            srcs_space;
+  oc_arena       own_message;	// message, if we allocated it (packed)
+
 } oc_decoder;
 
 
@@ -31,14 +60,115 @@ typedef struct oc_decoder_struct {
 // flags= oc_..._init(..., flags, fudge, 0)          // q     = int
 // flags= oc_..._init(..., flags, fudge, q, 0.0)     // e     = float/double
 // flags= oc_..._init(..., flags, fudge, q, e, 0)    // f     = int
+// flags= oc_..._init(..., flags, fudge, q, e, f, 0) // ablocks = int
+//
+// (see oc_codec_init for ablocks)
 
 int oc_decoder_init(oc_decoder *dec, int mblocks, oc_rng_sha1 *rng,
-		    int flags, ...); // ... fudge, q, e, f
+		    int flags, ...); // ... fudge, q, e, f, ablocks
+
+// Set up a decoder that uses a shared codec template's tables (see
+// online-code.h) instead of making its own. Only the graph (and
+// scratch space) is made for each decoder. rng is set to the
+// template's rng, ie, where it would be if this decoder had made the
+// map. fudge = 0 means the default.
+int oc_decoder_init_shared(oc_decoder *dec, oc_codec_template *t,
+			   oc_rng_sha1 *rng, int flags, float fudge);
 
 int oc_accept_check_block(oc_decoder *decoder, oc_rng_sha1 *rng);
 
+// Graph a check block (whatever the data plane) and return its node
+// number or -1 on error. This is for data planes that keep check
+// block contents themselves (see oc_disk_decoder in diskio.h); check
+// nodes are numbered in the order they're graphed.
+int oc_decoder_graph_check_block(oc_decoder *decoder, oc_rng_sha1 *rng);
+
+// Keep the seed of every check block graphed from now on (the seed
+// the rng that was passed in started from). It's OC_RNG_BYTES per
+// check block, so it's off unless something needs it (snapshots do;
+// see snapshot.h). Returns 0 on success.
+int oc_decoder_keep_seeds(oc_decoder *decoder);
+
+// Seed of check node node, or NULL if it isn't known
+const char *oc_decoder_check_seed(oc_decoder *decoder, int node);
+
 int oc_resolve(oc_decoder *decoder, oc_uni_block **solved_list);
+
+// Resolver mode (OC_RESOLVE_STEP or OC_RESOLVE_FIXPOINT; see graph.h)
+void oc_decoder_set_resolve_mode(oc_decoder *decoder, int mode);
+
+// Inactivation decoding (see oc_graph_set_inactivation in graph.h)
+void oc_decoder_set_inactivation(oc_decoder *decoder, int max_inactive);
+
+// Have oc_resolve pass solved nodes to fn instead of returning them in
+// a list (pass NULL to turn this off). If the data plane is set up,
+// the node's contents are available by the time fn is called.
+void oc_decoder_set_solved_callback(oc_decoder *decoder,
+				    void (*fn)(void *arg, int node),
+				    void *arg);
+
+// Batched versions of the above: graph n check blocks (given by their
+// seeds, each OC_RNG_BYTES long) and then resolve until nothing more
+// can be solved. The solved list has everything solved by the batch,
+// in the order it was solved. Returns 1 if the message is fully
+// decoded, 0 if not, or -1 on error.
+int oc_accept_check_blocks(oc_decoder *decoder, const char *seeds[], int n,
+			   oc_uni_block **solved_list);
 int *oc_expansion(oc_decoder *decoder, int node);
 
+// Faster expansion routines. These don't allocate anything per call
+// and the nodes are given in no particular order.
+//
+// oc_expansion_list returns a list in the same format as
+// oc_expansion (count first), but the list belongs to the decoder
+// and is only valid until the next expansion call.
+// 
+// oc_expansion_into copies the nodes (without the count) to dest if
+// there are no more than space of them, and returns the count in
+// either case (or -1 on error).
+//
+// oc_expansion_foreach calls fn once for each node in the expansion
+// and returns the number of calls made (or -1 on error).
+int *oc_expansion_list(oc_decoder *decoder, int node);
+int  oc_expansion_into(oc_decoder *decoder, int node, int *dest, int space);
+int  oc_expansion_foreach(oc_decoder *decoder, int node,
+			  void (*fn)(void *arg, int node), void *arg);
+
+// Decoder data plane
+//
+// Once oc_decoder_init_data() has been called, the decoder keeps the
+// contents of all received check blocks along with every message and
+// aux block that it solves. Check blocks must then be added with
+// oc_accept_check_block_data() and oc_resolve() will fill in the
+// contents of newly-solved blocks before returning them. If message
+// is NULL, a buffer of mblocks * block_size bytes is allocated. The
+// check block cache grows along with the graph, so pointers into it
+// (from oc_decoder_block) are only good until the next check block.
+int oc_decoder_init_data(oc_decoder *dec, char *message, int block_size);
+
+int oc_accept_check_block_data(oc_decoder *decoder, oc_rng_sha1 *rng,
+			       const char *data);
+
+// batched version (see oc_accept_check_blocks); data[i] holds the
+// contents of the check block with seed seeds[i]
+int oc_accept_check_blocks_data(oc_decoder *decoder, const char *seeds[],
+				const char *data[], int n,
+				oc_uni_block **solved_list);
+
+// Fill in the contents of a solved message or aux block (oc_resolve
+// does this for you). Returns 0 on success, -1 on error.
+int oc_decoder_solve_block(oc_decoder *decoder, int node);
+
+// Pointer to the contents of any block, or NULL if not (yet) known
+const char *oc_decoder_block(oc_decoder *decoder, int node);
+
+void oc_decoder_free_data(oc_decoder *dec);
+
+// Decoder statistics (see oc_graph_stats in structs.h)
+void oc_decoder_get_stats(oc_decoder *decoder, oc_graph_stats *stats);
+
+// Free everything the decoder allocated (including the data plane)
+void oc_decoder_free(oc_decoder *dec);
+
 
 #endif
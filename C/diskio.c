@@ -0,0 +1,997 @@
+// Disk-backed block storage and the out-of-core encoder (see diskio.h)
+
+#define _XOPEN_SOURCE 600	// pread/pwrite, posix_fadvise
+#define _DEFAULT_SOURCE		// MAP_ANONYMOUS, MAP_POPULATE, madvise
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		// sync_file_range
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "online-code.h"
+#include "encoder.h"
+#include "decoder.h"
+#include "graph.h"
+#include "heap.h"
+#include "parallel.h"
+#include "diskio.h"
+#include "xor.h"
+
+// Block files
+
+int oc_block_file_init(oc_block_file *bf, int fd, off_t offset,
+		       off_t length, int block_size) {
+
+  struct stat st;
+  off_t blocks;
+
+  assert(bf != NULL);
+
+  memset(bf, 0, sizeof(oc_block_file));
+  bf->fd = -1;
+
+  if ((fd < 0) || (offset < 0) || (block_size <= 0)) {
+    fprintf(stderr, "oc_block_file_init: invalid arguments\n");
+    return -1;
+  }
+
+  if (length < 0) {
+    if (fstat(fd, &st) < 0) {
+      fprintf(stderr, "oc_block_file_init: fstat: %s\n", strerror(errno));
+      return -1;
+    }
+    length = st.st_size - offset;
+  }
+
+  blocks = (length + block_size - 1) / block_size;
+  if ((length < 0) || (blocks > 0x7fffffff)) {
+    fprintf(stderr, "oc_block_file_init: bad length %lld\n",
+	    (long long) length);
+    return -1;
+  }
+
+  bf->fd         = fd;
+  bf->offset     = offset;
+  bf->length     = length;
+  bf->block_size = block_size;
+  bf->blocks     = blocks;
+
+  // we mostly read in order, so ask for aggressive readahead
+  posix_fadvise(fd, offset, length, POSIX_FADV_SEQUENTIAL);
+
+  return 0;
+}
+
+int oc_block_file_open(oc_block_file *bf, const char *path, int block_size) {
+
+  int fd;
+
+  assert(bf   != NULL);
+  assert(path != NULL);
+
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    fprintf(stderr, "oc_block_file_open: %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  if (-1 == oc_block_file_init(bf, fd, 0, -1, block_size)) {
+    close(fd);
+    return -1;
+  }
+  bf->own_fd = 1;
+
+  return 0;
+}
+
+void oc_block_file_close(oc_block_file *bf) {
+
+  assert(bf != NULL);
+
+  if (bf->own_fd && (bf->fd >= 0))
+    close(bf->fd);
+  bf->fd     = -1;
+  bf->own_fd = 0;
+}
+
+int oc_block_file_read(oc_block_file *bf, int first, int count, char *buf) {
+
+  off_t   start, avail;
+  size_t  bytes = (size_t) count * bf->block_size, want, done = 0;
+  ssize_t rc;
+
+  assert(bf != NULL);
+  assert((first >= 0) && (count > 0) && (first + count <= bf->blocks));
+
+  // the last block may be short (but never empty)
+  start = (off_t) first * bf->block_size;
+  avail = bf->length - start;
+  assert(avail > 0);
+  want  = (avail < (off_t) bytes) ? (size_t) avail : bytes;
+
+  while (done < want) {
+    rc = pread(bf->fd, buf + done, want - done, bf->offset + start + done);
+    if (rc < 0) {
+      if (EINTR == errno)
+	continue;
+      fprintf(stderr, "oc_block_file_read: %s\n", strerror(errno));
+      return -1;
+    }
+    if (0 == rc) {
+      fprintf(stderr, "oc_block_file_read: unexpected end of file\n");
+      return -1;
+    }
+    ++(bf->reads);
+    done += (size_t) rc;
+  }
+  bf->bytes_read += done;
+
+  // virtual padding after the end of the data
+  if (done < bytes)
+    memset(buf + done, 0, bytes - done);
+
+  return 0;
+}
+
+int oc_block_file_write(oc_block_file *bf, int first, int count,
+			const char *buf) {
+
+  off_t   start, end;
+  size_t  bytes = (size_t) count * bf->block_size, done = 0;
+  ssize_t rc;
+
+  assert(bf != NULL);
+  assert((first >= 0) && (count > 0) &&
+	 ((long long) first + count <= 0x7fffffff));
+
+  start = (off_t) first * bf->block_size;
+
+  while (done < bytes) {
+    rc = pwrite(bf->fd, buf + done, bytes - done, bf->offset + start + done);
+    if (rc < 0) {
+      if (EINTR == errno)
+	continue;
+      fprintf(stderr, "oc_block_file_write: %s\n", strerror(errno));
+      return -1;
+    }
+    ++(bf->writes);
+    done += rc;
+  }
+  bf->bytes_written += done;
+
+  end = start + bytes;
+  if (end > bf->length) {
+    bf->length = end;
+    bf->blocks = first + count;
+  }
+
+  return 0;
+}
+
+void oc_block_file_willneed(oc_block_file *bf, int first, int count) {
+
+  assert(bf != NULL);
+
+  if (first + count > bf->blocks)
+    count = bf->blocks - first;
+  if (count > 0)
+    posix_fadvise(bf->fd, bf->offset + (off_t) first * bf->block_size,
+		  (off_t) count * bf->block_size, POSIX_FADV_WILLNEED);
+}
+
+
+// Mapped messages
+
+int oc_message_map(oc_mapped_message *mm, const char *path, int block_size,
+		   int populate) {
+
+  oc_block_file bf;
+  struct stat   st;
+  size_t        page = sysconf(_SC_PAGESIZE), padded;
+  void         *base;
+  int           fd;
+
+  assert(mm   != NULL);
+  assert(path != NULL);
+
+  memset(mm, 0, sizeof(oc_mapped_message));
+
+  if (block_size <= 0) {
+    fprintf(stderr, "oc_message_map: invalid block size %d\n", block_size);
+    return -1;
+  }
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    fprintf(stderr, "oc_message_map: %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  if (fstat(fd, &st) < 0) {
+    fprintf(stderr, "oc_message_map: fstat: %s\n", strerror(errno));
+    close(fd);
+    return -1;
+  }
+  if ((st.st_size <= 0) ||
+      ((st.st_size + block_size - 1) / block_size > 0x7fffffff)) {
+    fprintf(stderr, "oc_message_map: bad file size %lld\n",
+	    (long long) st.st_size);
+    close(fd);
+    return -1;
+  }
+
+  mm->length     = st.st_size;
+  mm->block_size = block_size;
+  mm->blocks     = (st.st_size + block_size - 1) / block_size;
+  padded         = (size_t) mm->blocks * block_size;
+  mm->size       = (padded + page - 1) & ~(page - 1);
+
+  // zero pages for the padding, then the file over the top of them
+  base = mmap(NULL, mm->size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if ((MAP_FAILED != base) &&
+      (MAP_FAILED != mmap(base, st.st_size, PROT_READ,
+			  MAP_PRIVATE | MAP_FIXED |
+			  (populate ? MAP_POPULATE : 0), fd, 0))) {
+    if (!populate)
+      madvise(base, st.st_size, MADV_SEQUENTIAL);
+    close(fd);
+    mm->data   = base;
+    mm->mapped = 1;
+    return 0;
+  }
+  if (MAP_FAILED != base)
+    munmap(base, mm->size);
+
+  // fall back on reading it in
+  mm->size = padded;
+  if (NULL == (mm->data = malloc(padded))) {
+    fprintf(stderr, "oc_message_map: failed to allocate memory\n");
+    close(fd);
+    return -1;
+  }
+  if ((-1 == oc_block_file_init(&bf, fd, 0, st.st_size, block_size)) ||
+      (-1 == oc_block_file_read(&bf, 0, mm->blocks, mm->data))) {
+    free(mm->data);
+    mm->data = NULL;
+    close(fd);
+    return -1;
+  }
+  close(fd);
+
+  return 0;
+}
+
+void oc_message_unmap(oc_mapped_message *mm) {
+
+  assert(mm != NULL);
+
+  if (NULL == mm->data)
+    return;
+  if (mm->mapped)
+    munmap(mm->data, mm->size);
+  else
+    free(mm->data);
+
+  mm->data   = NULL;
+  mm->size   = 0;
+  mm->mapped = 0;
+}
+
+
+// Out-of-core encoder
+
+int oc_disk_encoder_init_fd(oc_disk_encoder *de, oc_encoder *enc, int fd,
+			    off_t offset, off_t length, int block_size,
+			    size_t buffer_bytes, int threads) {
+
+  oc_codec       *codec;
+  oc_aux_builder  builder;
+  int mblocks, first, count;
+
+  assert(de  != NULL);
+  assert(enc != NULL);
+
+  memset(de, 0, sizeof(oc_disk_encoder));
+  de->file.fd = -1;
+  de->enc     = enc;
+
+  codec   = &(enc->base);
+  mblocks = codec->mblocks;
+
+  if (NULL != enc->aux_cache.base) {
+    fprintf(stderr, "oc_disk_encoder_init: encoder already has data\n");
+    return -1;
+  }
+  if (NULL == codec->auxiliary) {
+    fprintf(stderr, "oc_disk_encoder_init: no auxiliary mapping\n");
+    return -1;
+  }
+
+  if (-1 == oc_block_file_init(&(de->file), fd, offset, length, block_size))
+    return -1;
+  if (de->file.blocks != mblocks) {
+    fprintf(stderr, "oc_disk_encoder_init: file has %d blocks, not %d\n",
+	    de->file.blocks, mblocks);
+    return -1;
+  }
+
+  if (0 == buffer_bytes)
+    buffer_bytes = OC_DISK_BUFFER_BYTES;
+  de->buf_blocks = buffer_bytes / block_size;
+  if (de->buf_blocks < 1)         de->buf_blocks = 1;
+  if (de->buf_blocks > mblocks)   de->buf_blocks = mblocks;
+
+  de->span_space = 1024;
+
+  de->buf       = malloc((size_t) de->buf_blocks * block_size);
+  de->span      = malloc(de->span_space * sizeof(oc_heap_entry));
+  if ((NULL == de->buf) || (NULL == de->span) ||
+      (-1 == oc_arena_init(&(enc->aux_cache), codec->ablocks, block_size,
+			   OC_ARENA_ZERO)) ||
+      (-1 == oc_heap_init(&(de->heap), mblocks, 16 * de->buf_blocks)) ||
+      (-1 == oc_encoder_thread_init(enc, &(de->t)))) {
+    fprintf(stderr, "oc_disk_encoder_init: failed to allocate memory\n");
+    oc_disk_encoder_free(de);
+    return -1;
+  }
+
+  // Build the aux cache in one pass, a buffer at a time. The aux
+  // builder's gather lists are in message order, so each buffer only
+  // has to be gone over once, by all the threads together.
+  if (-1 == oc_aux_builder_init(&builder, codec, &(enc->aux_cache),
+				block_size, threads)) {
+    oc_disk_encoder_free(de);
+    return -1;
+  }
+  for (first = 0; first < mblocks; first += count) {
+    count = mblocks - first;
+    if (count > de->buf_blocks) count = de->buf_blocks;
+
+    if (-1 == oc_block_file_read(&(de->file), first, count, de->buf)) {
+      oc_aux_builder_free(&builder);
+      oc_disk_encoder_free(de);
+      return -1;
+    }
+    if (first + count < mblocks)
+      oc_block_file_willneed(&(de->file), first + count, de->buf_blocks);
+
+    if (-1 == oc_aux_builder_add(&builder, de->buf, first, count)) {
+      oc_aux_builder_free(&builder);
+      oc_disk_encoder_free(de);
+      return -1;
+    }
+  }
+  oc_aux_builder_free(&builder);
+
+  // no message in memory, so the encoder's own emit routines won't
+  // work until the data plane is set up again
+  enc->message    = NULL;
+  enc->block_size = block_size;
+
+  return 0;
+}
+
+int oc_disk_encoder_init(oc_disk_encoder *de, oc_encoder *enc,
+			 const char *path, int block_size,
+			 size_t buffer_bytes, int threads) {
+
+  int fd;
+
+  assert(path != NULL);
+
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    fprintf(stderr, "oc_disk_encoder_init: %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  if (-1 == oc_disk_encoder_init_fd(de, enc, fd, 0, -1, block_size,
+				    buffer_bytes, threads)) {
+    close(fd);
+    return -1;
+  }
+  de->file.own_fd = 1;
+
+  return 0;
+}
+
+// Take entries off the heap for the next span: all the wanted blocks
+// from the first one on that fit in the buffer, without wrapping
+// around. Returns the number of entries (or -1 on error). Shared by
+// the disk encoder and decoder.
+static int gather_span(oc_heap *heap, oc_heap_entry **span, int *space,
+		       int buf_blocks) {
+
+  oc_heap_entry *e, *p;
+  int count = 0, first = -1, limit = 0;
+
+  while ((NULL != (e = oc_heap_peek(heap))) &&
+	 ((0 == count) || ((e->block >= first) && (e->block < limit) &&
+			   (e->key - (*span)[0].key == e->block - first)))) {
+    if (count == *space) {
+      p = realloc(*span, 2 * (size_t) count * sizeof(oc_heap_entry));
+      if (NULL == p)
+	return -1;
+      *span  = p;
+      *space = 2 * count;
+    }
+    oc_heap_pop(heap, *span + count);
+    if (0 == count++) {
+      first = (*span)[0].block;
+      limit = first + buf_blocks;
+    }
+  }
+
+  return count;
+}
+
+int oc_disk_encoder_emit_seeded(oc_disk_encoder *de, int n,
+				const char *seeds, char *blocks) {
+
+  oc_rng_sha1 rngs[OC_RNG_BATCH];
+  char ahead[OC_RNG_AHEAD_BYTES(OC_RNG_BATCH, OC_RNG_LOOKAHEAD)];
+  const char *batch[OC_RNG_BATCH];
+  oc_encoder *enc;
+  oc_heap_entry *e, *next;
+  int mblocks, block_size, i, j, k, count, first, *list;
+  char *dest;
+
+  assert(de != NULL);
+
+  enc        = de->enc;
+  mblocks    = enc->base.mblocks;
+  block_size = enc->block_size;
+
+  // Work out every block's sources. Aux blocks come from the cache;
+  // message blocks are queued for the sweep.
+  for (i = 0; i < n; i += OC_RNG_BATCH) {
+    count = (n - i < OC_RNG_BATCH) ? n - i : OC_RNG_BATCH;
+    for (j = 0; j < count; ++j)
+      batch[j] = seeds + (size_t) (i + j) * OC_RNG_BYTES;
+    oc_rng_init_seeds(rngs, batch, count, ahead, OC_RNG_LOOKAHEAD);
+
+    for (j = 0; j < count; ++j) {
+      list = oc_encoder_check_block_rng(enc, &(de->t), rngs + j);
+      if (NULL == list)
+	goto fail;
+
+      dest = blocks + (size_t) (i + j) * block_size;
+      memset(dest, 0, block_size);
+      for (k = 1; k <= list[0]; ++k)
+	if (list[k] >= mblocks)
+	  oc_xor(dest, oc_arena_block(&(enc->aux_cache), list[k] - mblocks),
+		 block_size);
+	else if (-1 == oc_heap_push(&(de->heap), list[k], i + j))
+	  goto fail;
+    }
+  }
+
+  // The sweep. Start the kernel reading the next span before xoring
+  // in the current one.
+  while (oc_heap_size(&(de->heap))) {
+    if ((count = gather_span(&(de->heap), &(de->span), &(de->span_space),
+			     de->buf_blocks)) <= 0)
+      goto fail;
+    first = de->span[0].block;
+    if (-1 == oc_block_file_read(&(de->file), first,
+				 de->span[count - 1].block - first + 1,
+				 de->buf))
+      goto fail;
+
+    if (NULL != (next = oc_heap_peek(&(de->heap))))
+      oc_block_file_willneed(&(de->file), next->block, de->buf_blocks);
+
+    for (e = de->span; e < de->span + count; ++e)
+      oc_xor(blocks + (size_t) e->target * block_size,
+	     de->buf + (size_t) (e->block - first) * block_size, block_size);
+  }
+
+  ++(de->sweeps);
+  return 0;
+
+ fail:
+  fprintf(stderr, "oc_disk_encoder_emit: failed to create check blocks\n");
+  de->heap.size = 0;		// next batch starts afresh
+  return -1;
+}
+
+int oc_disk_encoder_emit(oc_disk_encoder *de, int n,
+			 char *seeds, char *blocks) {
+
+  int i;
+
+  assert(de != NULL);
+
+  for (i = 0; i < n; ++i)
+    oc_encoder_next_seed(de->enc, seeds + (size_t) i * OC_RNG_BYTES);
+
+  return oc_disk_encoder_emit_seeded(de, n, seeds, blocks);
+}
+
+void oc_disk_encoder_free(oc_disk_encoder *de) {
+
+  assert(de != NULL);
+
+  if (NULL != de->buf)  free(de->buf);
+  if (NULL != de->span) free(de->span);
+  if (NULL != de->t.list)
+    oc_encoder_thread_free(&(de->t));
+  oc_heap_free(&(de->heap));
+  oc_block_file_close(&(de->file));
+
+  if (NULL != de->enc)
+    oc_encoder_free_data(de->enc);
+
+  de->buf  = NULL;
+  de->span = NULL;
+  de->enc  = NULL;
+}
+
+
+// Out-of-core decoder
+
+// the heap needs a bound on block numbers, but the log keeps growing
+#define OC_LOG_MAX_BLOCKS 0x7fffffff
+
+int oc_disk_decoder_init_fd(oc_disk_decoder *dd, oc_decoder *dec, int fd,
+			    off_t offset, char *message, int block_size,
+			    size_t buffer_bytes) {
+
+  int mblocks, ablocks;
+
+  assert(dd  != NULL);
+  assert(dec != NULL);
+
+  memset(dd, 0, sizeof(oc_disk_decoder));
+  dd->log.fd = -1;
+  dd->dec    = dec;
+
+  mblocks = dec->base.mblocks;
+  ablocks = dec->base.ablocks;
+
+  if (NULL != dec->cached) {
+    fprintf(stderr, "oc_disk_decoder_init: decoder already has data\n");
+    return -1;
+  }
+  if (-1 == oc_block_file_init(&(dd->log), fd, offset, 0, block_size))
+    return -1;
+
+  if (0 == buffer_bytes)
+    buffer_bytes = OC_DISK_BUFFER_BYTES;
+  dd->buf_blocks = buffer_bytes / block_size;
+  if (dd->buf_blocks < 1)
+    dd->buf_blocks = 1;
+
+  dd->span_space = 1024;
+
+  // same data plane as oc_decoder_init_data, minus the check cache
+  dec->block_size  = block_size;
+  if ((NULL == message) &&
+      (0 == oc_arena_init(&(dec->own_message), mblocks, block_size,
+			  OC_ARENA_ZERO | OC_ARENA_PACKED)))
+    message = dec->own_message.base;
+  dec->message = message;
+  dec->cached  = calloc(dec->base.coblocks, sizeof(unsigned char));
+
+  dd->buf  = malloc((size_t) dd->buf_blocks * block_size);
+  dd->wbuf = malloc((size_t) dd->buf_blocks * block_size);
+  dd->span = malloc(dd->span_space * sizeof(oc_heap_entry));
+  if ((NULL == dec->message) || (NULL == dec->cached) ||
+      (-1 == oc_arena_init(&(dec->aux_cache), ablocks, block_size,
+			   OC_ARENA_ZERO)) || (NULL == dd->buf) ||
+      (NULL == dd->wbuf)     || (NULL == dd->span) ||
+      (-1 == oc_heap_init(&(dd->heap), OC_LOG_MAX_BLOCKS,
+			  16 * dd->buf_blocks))) {
+    fprintf(stderr, "oc_disk_decoder_init: failed to allocate memory\n");
+    oc_disk_decoder_free(dd);
+    return -1;
+  }
+
+  return 0;
+}
+
+int oc_disk_decoder_init(oc_disk_decoder *dd, oc_decoder *dec,
+			 const char *path, char *message, int block_size,
+			 size_t buffer_bytes) {
+
+  int fd;
+
+  assert(path != NULL);
+
+  if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0) {
+    fprintf(stderr, "oc_disk_decoder_init: %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  if (-1 == oc_disk_decoder_init_fd(dd, dec, fd, 0, message, block_size,
+				    buffer_bytes)) {
+    close(fd);
+    return -1;
+  }
+  dd->log.own_fd = 1;
+
+  return 0;
+}
+
+int oc_disk_decoder_flush(oc_disk_decoder *dd) {
+
+  assert(dd != NULL);
+
+  if (0 == dd->wbuf_count)
+    return 0;
+  if (-1 == oc_block_file_write(&(dd->log), dd->wbuf_first, dd->wbuf_count,
+				dd->wbuf))
+    return -1;
+  dd->wbuf_count = 0;
+
+  return 0;
+}
+
+int oc_disk_decoder_accept(oc_disk_decoder *dd, oc_rng_sha1 *rng,
+			   const char *data) {
+
+  int check;
+
+  assert(dd   != NULL);
+  assert(data != NULL);
+
+  // make room before graphing the block: nothing after that can fail
+  if ((dd->wbuf_count == dd->buf_blocks) && (-1 == oc_disk_decoder_flush(dd)))
+    return -1;
+
+  if (-1 == (check = oc_decoder_graph_check_block(dd->dec, rng)))
+    return -1;
+  check -= dd->dec->base.coblocks;
+
+  if (0 == dd->wbuf_count)
+    dd->wbuf_first = check;
+  assert(check == dd->wbuf_first + dd->wbuf_count);
+
+  memcpy(dd->wbuf + (size_t) (dd->wbuf_count++) * dd->dec->block_size,
+	 data, dd->dec->block_size);
+
+  return 0;
+}
+
+// message or aux block contents
+static char *node_data(oc_decoder *dec, int node) {
+  if (node < dec->base.mblocks)
+    return dec->message + (size_t) node * dec->block_size;
+  return oc_arena_block(&(dec->aux_cache), node - dec->base.mblocks);
+}
+
+// Fill in the contents of everything on the solved list (see diskio.h)
+static int fill_solved(oc_disk_decoder *dd, oc_uni_block *list) {
+
+  oc_decoder    *dec = dd->dec;
+  oc_uni_block  *p;
+  oc_bone       *b;
+  oc_heap_entry *e, *next;
+  int coblocks = dec->base.coblocks, block_size = dec->block_size;
+  int i, node, count, first;
+  char *dest;
+
+#if OC_GRAPH_STATS
+  long long start = oc_stat_ns();
+#endif
+
+  if (-1 == oc_disk_decoder_flush(dd))
+    return -1;
+
+  // queue the check block parts of each solution
+  for (p = list; p != NULL; p = p->a.next) {
+    node = p->b.value;
+    if (dec->cached[node])
+      continue;
+    if (NULL == (b = oc_graph_solution(&(dec->graph), node)))
+      goto fail;
+
+    memset(node_data(dec, node), 0, block_size);
+    for (i = 2; i <= b->b.size; ++i)
+      if ((b[i].a.node >= coblocks) &&
+	  (-1 == oc_heap_push(&(dd->heap), b[i].a.node - coblocks, node)))
+	goto fail;
+  }
+
+  // one sweep over the log
+  if (oc_heap_size(&(dd->heap)))
+    ++(dd->sweeps);
+  while (oc_heap_size(&(dd->heap))) {
+    if ((count = gather_span(&(dd->heap), &(dd->span), &(dd->span_space),
+			     dd->buf_blocks)) <= 0)
+      goto fail;
+    first = dd->span[0].block;
+    if (-1 == oc_block_file_read(&(dd->log), first,
+				 dd->span[count - 1].block - first + 1,
+				 dd->buf))
+      goto fail;
+
+    if (NULL != (next = oc_heap_peek(&(dd->heap))))
+      oc_block_file_willneed(&(dd->log), next->block, dd->buf_blocks);
+
+    for (e = dd->span; e < dd->span + count; ++e)
+      oc_xor(node_data(dec, e->target),
+	     dd->buf + (size_t) (e->block - first) * block_size, block_size);
+  }
+
+  // Now the message/aux parts. Each of them was solved before the
+  // block that needs it, so going in solved order means they're all
+  // complete by the time they're used.
+  for (p = list; p != NULL; p = p->a.next) {
+    node = p->b.value;
+    if (dec->cached[node])
+      continue;
+    b    = oc_graph_solution(&(dec->graph), node);
+    dest = node_data(dec, node);
+    for (i = 2; i <= b->b.size; ++i)
+      if (b[i].a.node < coblocks) {
+	if (!dec->cached[b[i].a.node])
+	  goto fail;
+	oc_xor(dest, node_data(dec, b[i].a.node), block_size);
+      }
+    dec->cached[node] = 1;
+  }
+
+  OC_STAT(dec->graph.stats.ns_xor += oc_stat_ns() - start);
+  return 0;
+
+ fail:
+  fprintf(stderr, "oc_disk_decoder_resolve: failed to fill in solved blocks\n");
+  dd->heap.size = 0;
+  return -1;
+}
+
+int oc_disk_decoder_resolve(oc_disk_decoder *dd, oc_uni_block **solved) {
+
+  int done;
+
+  assert(dd     != NULL);
+  assert(solved != NULL);
+
+  if (NULL != dd->dec->solved_fn) {
+    fprintf(stderr, "oc_disk_decoder_resolve: solved callbacks not supported\n");
+    return -1;
+  }
+
+  done = oc_graph_resolve(&(dd->dec->graph), solved);
+  if ((-1 != done) && (-1 == fill_solved(dd, *solved)))
+    return -1;
+
+  return done;
+}
+
+int oc_disk_decoder_accept_blocks(oc_disk_decoder *dd, const char *seeds[],
+				  const char *data[], int n,
+				  oc_uni_block **solved) {
+
+  oc_rng_sha1 rngs[OC_RNG_BATCH];
+  char ahead[OC_RNG_AHEAD_BYTES(OC_RNG_BATCH, OC_RNG_LOOKAHEAD)];
+  oc_graph *graph;
+  int i, j, count, mode, done;
+
+  assert(dd     != NULL);
+  assert(solved != NULL);
+
+  *solved = NULL;
+  for (i = 0; i < n; i += OC_RNG_BATCH) {
+    count = (n - i < OC_RNG_BATCH) ? n - i : OC_RNG_BATCH;
+    oc_rng_init_seeds(rngs, seeds + i, count, ahead, OC_RNG_LOOKAHEAD);
+    for (j = 0; j < count; ++j)
+      if (-1 == oc_disk_decoder_accept(dd, rngs + j, data[i + j]))
+	return -1;
+  }
+
+  // resolve as far as we can so that everything shares one sweep
+  graph = &(dd->dec->graph);
+  mode  = graph->resolve_mode;
+  oc_graph_set_mode(graph, OC_RESOLVE_FIXPOINT);
+  done = oc_disk_decoder_resolve(dd, solved);
+  oc_graph_set_mode(graph, mode);
+
+  return done;
+}
+
+void oc_disk_decoder_free(oc_disk_decoder *dd) {
+
+  assert(dd != NULL);
+
+  if (NULL != dd->buf)  free(dd->buf);
+  if (NULL != dd->wbuf) free(dd->wbuf);
+  if (NULL != dd->span) free(dd->span);
+  oc_heap_free(&(dd->heap));
+  oc_block_file_close(&(dd->log));
+
+  if (NULL != dd->dec)
+    oc_decoder_free_data(dd->dec);
+
+  dd->buf  = NULL;
+  dd->wbuf = NULL;
+  dd->span = NULL;
+  dd->dec  = NULL;
+  dd->wbuf_count = 0;
+}
+
+
+// Streaming delivery
+
+int oc_delivery_init(oc_delivery *d, oc_decoder *dec, int fd, off_t length,
+		     int block_size, int flags) {
+
+  off_t padded;
+  void *map;
+
+  assert(d   != NULL);
+  assert(dec != NULL);
+
+  memset(d, 0, sizeof(oc_delivery));
+  d->fd = -1;
+
+  padded = (off_t) dec->base.mblocks * block_size;
+  if (length < 0)
+    length = padded;
+  if ((block_size <= 0) || (length > padded) || (length <= padded - block_size)
+      || ((flags & OC_DELIVERY_MAPPED) && (fd < 0))
+      || ((flags & OC_DELIVERY_RELEASE) && !(flags & OC_DELIVERY_MAPPED))) {
+    fprintf(stderr, "oc_delivery_init: invalid arguments\n");
+    return -1;
+  }
+
+  d->dec        = dec;
+  d->fd         = fd;
+  d->flags      = flags;
+  d->length     = length;
+  d->block_size = block_size;
+
+  if (!(flags & OC_DELIVERY_MAPPED))
+    return 0;
+
+  // start from an empty (sparse) file so that nothing stale is read in
+  // when the decoder first touches each page
+  if ((ftruncate(fd, 0) < 0) || (ftruncate(fd, padded) < 0)) {
+    fprintf(stderr, "oc_delivery_init: ftruncate: %s\n", strerror(errno));
+    return -1;
+  }
+  map = mmap(NULL, padded, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (MAP_FAILED == map) {
+    fprintf(stderr, "oc_delivery_init: mmap: %s\n", strerror(errno));
+    return -1;
+  }
+  d->message  = map;
+  d->map_size = padded;
+
+  return 0;
+}
+
+// plain output: write [written, upto) of the message to fd
+static int write_out(oc_delivery *d, const char *message, off_t upto) {
+
+  ssize_t rc;
+
+  while (d->written < upto) {
+    rc = write(d->fd, message + d->written, upto - d->written);
+    if (rc < 0) {
+      if (EINTR == errno)
+	continue;
+      fprintf(stderr, "oc_delivery: write: %s\n", strerror(errno));
+      return -1;
+    }
+    ++(d->writes);
+    d->written       += rc;
+    d->bytes_written += rc;
+  }
+  return 0;
+}
+
+// mapped output: start writeback on [written, upto), then wait for
+// the ranges started earlier and, if we're releasing, drop them. This
+// keeps one range in flight while the decoder carries on.
+static int write_behind(oc_delivery *d, off_t upto) {
+
+  long  page = sysconf(_SC_PAGESIZE);
+  off_t end;
+
+  if (sync_file_range(d->fd, d->written, upto - d->written,
+		      SYNC_FILE_RANGE_WRITE) < 0) {
+    fprintf(stderr, "oc_delivery: sync_file_range: %s\n", strerror(errno));
+    return -1;
+  }
+  ++(d->writes);
+  d->bytes_written += upto - d->written;
+
+  end = d->written - d->written % page;
+  if ((d->flags & OC_DELIVERY_RELEASE) && (end > d->released)) {
+    if (sync_file_range(d->fd, d->released, end - d->released,
+			SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+			SYNC_FILE_RANGE_WAIT_AFTER) < 0) {
+      fprintf(stderr, "oc_delivery: sync_file_range: %s\n", strerror(errno));
+      return -1;
+    }
+    madvise(d->message + d->released, end - d->released, MADV_DONTNEED);
+    posix_fadvise(d->fd, d->released, end - d->released, POSIX_FADV_DONTNEED);
+    d->released = end;
+  }
+
+  d->written = upto;
+  return 0;
+}
+
+static int deliver(oc_delivery *d, off_t upto) {
+
+  if (upto <= d->written)
+    return 0;
+  if (d->fd < 0) {
+    d->written = upto;
+    return 0;
+  }
+  if (d->flags & OC_DELIVERY_MAPPED)
+    return write_behind(d, upto);
+  return write_out(d, d->dec->message, upto);
+}
+
+int oc_delivery_advance(oc_delivery *d) {
+
+  oc_decoder *dec;
+  int   start, mblocks;
+  off_t upto;
+
+  assert(d      != NULL);
+  assert(d->dec != NULL);
+
+  dec     = d->dec;
+  mblocks = dec->base.mblocks;
+  if (NULL == dec->cached) {
+    fprintf(stderr, "oc_delivery_advance: decoder has no data plane\n");
+    return -1;
+  }
+  if ((d->flags & OC_DELIVERY_MAPPED) && (dec->message != d->message)) {
+    fprintf(stderr, "oc_delivery_advance: data plane isn't using the map\n");
+    return -1;
+  }
+
+  // pipeline workers mark blocks done with a release store once the
+  // contents are in place
+  start = d->next;
+  while ((d->next < mblocks) &&
+	 __atomic_load_n(&(dec->cached[d->next]), __ATOMIC_ACQUIRE))
+    ++(d->next);
+
+  upto = (off_t) d->next * d->block_size;
+  if (upto > d->length)
+    upto = d->length;
+
+  if (((d->next == mblocks) || (upto - d->written >= OC_DELIVERY_CHUNK)) &&
+      (-1 == deliver(d, upto)))
+    return -1;
+
+  return d->next - start;
+}
+
+int oc_delivery_flush(oc_delivery *d) {
+
+  off_t upto;
+
+  assert(d != NULL);
+
+  upto = (off_t) d->next * d->block_size;
+  if (upto > d->length)
+    upto = d->length;
+
+  return deliver(d, upto);
+}
+
+void oc_delivery_free(oc_delivery *d) {
+
+  assert(d != NULL);
+
+  if (NULL != d->message) {
+    oc_delivery_flush(d);
+    munmap(d->message, d->map_size);
+    if (ftruncate(d->fd, d->length) < 0)
+      fprintf(stderr, "oc_delivery_free: ftruncate: %s\n", strerror(errno));
+  }
+
+  d->message  = NULL;
+  d->map_size = 0;
+  d->dec      = NULL;
+}
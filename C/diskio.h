@@ -1,2 +1,333 @@
 // Manage access to disk-backed storage of message/check block data
 
+#ifndef OC_DISKIO_H
+#define OC_DISKIO_H
+
+#include <sys/types.h>
+
+#include "online-code.h"
+#include "encoder.h"
+#include "decoder.h"
+#include "heap.h"
+
+// Block files
+//
+// A block file is just a region of an ordinary file (or block device)
+// treated as an array of fixed-size blocks. If the region isn't a
+// whole number of blocks long, the last block is padded out with
+// zeros when it's read (the file itself isn't touched), so it works
+// the same way as padding the message in memory would. Writing past
+// the end makes the file longer, so a block file can also be used as
+// an append-only log.
+
+typedef struct {
+
+  int    fd;
+  int    own_fd;		// did we open it (and so close it)?
+  off_t  offset;		// where block 0 starts
+  off_t  length;		// bytes of real data
+  int    block_size;
+  int    blocks;		// ceil(length / block_size)
+
+  // counters (for tuning buffer sizes)
+  long long reads;		// read calls
+  long long bytes_read;
+  long long writes;		// write calls
+  long long bytes_written;
+
+} oc_block_file;
+
+// Use an already-open file. length < 0 means "to the end of the file"
+int  oc_block_file_init(oc_block_file *bf, int fd, off_t offset,
+			off_t length, int block_size);
+int  oc_block_file_open(oc_block_file *bf, const char *path, int block_size);
+void oc_block_file_close(oc_block_file *bf);
+
+// Read count blocks starting at first into buf (count * block_size
+// bytes). Returns 0 on success.
+int  oc_block_file_read(oc_block_file *bf, int first, int count, char *buf);
+
+// Write count blocks starting at first from buf. Returns 0 on success.
+int  oc_block_file_write(oc_block_file *bf, int first, int count,
+			 const char *buf);
+
+// Tell the kernel we're going to read these blocks soon
+void oc_block_file_willneed(oc_block_file *bf, int first, int count);
+
+
+// Mapped messages
+//
+// The usual way to encode a file is to read it all into a buffer
+// that's padded out to a whole number of blocks. oc_message_map maps
+// the file instead, so nothing is read until the encoder touches it
+// and memory can be given back under pressure. The padding is done
+// virtually: the mapping is made over an anonymous one of the padded
+// size, so whatever lies past the end of the file reads as zeros
+// without the file being copied. If the file can't be mapped (eg,
+// on some special filesystems) it's read into an ordinary padded
+// buffer instead.
+//
+// With populate set the whole file is faulted in up front
+// (MAP_POPULATE), which is quickest overall when it's going to be
+// read anyway. Otherwise, the kernel is told to expect a sequential
+// pass (the encoder's aux block build) and pages are read as needed.
+
+typedef struct {
+
+  char   *data;			// blocks * block_size bytes
+  size_t  size;			// of the mapping (or buffer)
+  off_t   length;		// of the file
+  int     block_size;
+  int     blocks;
+  int     mapped;		// 0 => data is a malloc'd copy
+
+} oc_mapped_message;
+
+int  oc_message_map(oc_mapped_message *mm, const char *path, int block_size,
+		    int populate);
+void oc_message_unmap(oc_mapped_message *mm);
+
+
+// Out-of-core encoder
+//
+// For messages that are too big to keep in memory. Only the aux block
+// cache is kept in RAM; it's built with a single sequential pass over
+// the file when the disk encoder is set up (in place of
+// oc_encoder_init_data). After that, check blocks are made in
+// batches. For each batch, the sources of every check block are
+// worked out first and aux blocks are xored in from the cache, while
+// message block reads are queued on a heap (see heap.h). The reads
+// are then done as one sweep over the file in the order the blocks
+// are stored, carrying on from wherever the last batch's sweep ended
+// (so the disk head never has to seek back to the start). Each
+// message block that's read is xored into every check block in the
+// batch that wants it.
+//
+// Reads are grouped into spans of up to buffer_bytes, and the span
+// after the current one is passed to the kernel as a readahead hint
+// before the current one is xored in, so I/O and xoring overlap.
+// Bigger batches mean more check blocks share each sweep; as a rule
+// of thumb, a batch that's big enough for every message block to be
+// wanted by at least one check block makes a sweep purely sequential.
+//
+// Output is the same as calling oc_encoder_emit_block n times on an
+// encoder with the whole message in memory.
+
+typedef struct {
+
+  oc_encoder       *enc;
+  oc_encoder_thread t;		// lists and scratch space
+  oc_block_file     file;
+  oc_heap           heap;
+
+  char             *buf;	// read buffer
+  int               buf_blocks;
+
+  // entries taken off the heap for the span being read
+  oc_heap_entry    *span;
+  int               span_space;
+
+  long long         sweeps;	// batches served
+
+} oc_disk_encoder;
+
+#define OC_DISK_BUFFER_BYTES (4 << 20)	// default read buffer size
+
+// Set up a disk encoder for an encoder made with oc_encoder_init (or
+// _init_shared) whose data plane hasn't been set up. The message is in
+// path (the file is padded out to a whole number of blocks). The
+// encoder's aux cache is built from it, so afterwards the encoder
+// can't be used with a message in memory until oc_encoder_free_data
+// is called. buffer_bytes = 0 means OC_DISK_BUFFER_BYTES. threads is
+// the number of extra threads that build the aux cache as the file is
+// read (see oc_aux_builder_init in parallel.h). Returns 0 on success.
+int  oc_disk_encoder_init(oc_disk_encoder *de, oc_encoder *enc,
+			  const char *path, int block_size,
+			  size_t buffer_bytes, int threads);
+
+// As above, but for a region of an open file (see oc_block_file_init)
+int  oc_disk_encoder_init_fd(oc_disk_encoder *de, oc_encoder *enc, int fd,
+			     off_t offset, off_t length, int block_size,
+			     size_t buffer_bytes, int threads);
+
+// Create n check blocks, writing their seeds (n * OC_RNG_BYTES) and
+// contents (n * block_size) from the encoder's seed chain
+int  oc_disk_encoder_emit(oc_disk_encoder *de, int n,
+			  char *seeds, char *blocks);
+
+// As above, but with seeds supplied by the caller
+int  oc_disk_encoder_emit_seeded(oc_disk_encoder *de, int n,
+				 const char *seeds, char *blocks);
+
+// Frees the disk encoder and the encoder's data plane (but not the
+// encoder itself)
+void oc_disk_encoder_free(oc_disk_encoder *de);
+
+
+// Out-of-core decoder
+//
+// The decoder's side of the problem is the check blocks: we have to
+// keep every one we receive until the message is decoded, and we
+// usually receive a few percent more than mblocks of them. The disk
+// decoder keeps the message and aux blocks in memory as usual but
+// appends check block contents to a log file (check node n - coblocks
+// is block n - coblocks of the log), buffering the writes.
+//
+// Solved blocks are filled in by oc_disk_decoder_resolve. Each solved
+// block is the xor of one or more check blocks and some message/aux
+// blocks that were solved before it. All the check block reads for
+// the newly-solved blocks are queued on a heap and done as one sweep
+// over the log, so a check block that's part of several solutions is
+// read once, and the message/aux parts are then xored in in the
+// order the blocks were solved. As with the encoder, the more work
+// there is per sweep the better, so it's best to accept check blocks
+// in batches (oc_disk_decoder_accept_blocks) rather than resolving
+// after every one.
+//
+// Solved callbacks (oc_decoder_set_solved_callback) aren't supported,
+// and oc_decoder_block returns NULL for check blocks.
+
+typedef struct {
+
+  oc_decoder       *dec;
+  oc_block_file     log;
+  oc_heap           heap;
+
+  char             *buf;	// read buffer
+  int               buf_blocks;
+
+  // entries taken off the heap for the span being read
+  oc_heap_entry    *span;
+  int               span_space;
+
+  // check blocks not yet written to the log (wbuf_count of them,
+  // starting with log block wbuf_first)
+  char             *wbuf;
+  int               wbuf_first, wbuf_count;
+
+  long long         sweeps;	// resolves that read the log
+
+} oc_disk_decoder;
+
+// Set up a disk decoder (and the data plane) for a decoder made with
+// oc_decoder_init (or _init_shared) whose data plane hasn't been set
+// up. The log file at path is created or truncated. message is as for
+// oc_decoder_init_data. buffer_bytes = 0 means OC_DISK_BUFFER_BYTES
+// (used for each of the read and write buffers). Returns 0 on success.
+int  oc_disk_decoder_init(oc_disk_decoder *dd, oc_decoder *dec,
+			  const char *path, char *message, int block_size,
+			  size_t buffer_bytes);
+
+// As above, but the log goes in an open file from offset on (anything
+// already there is overwritten)
+int  oc_disk_decoder_init_fd(oc_disk_decoder *dd, oc_decoder *dec, int fd,
+			     off_t offset, char *message, int block_size,
+			     size_t buffer_bytes);
+
+// Equivalents of oc_accept_check_block_data and oc_resolve
+int  oc_disk_decoder_accept(oc_disk_decoder *dd, oc_rng_sha1 *rng,
+			    const char *data);
+int  oc_disk_decoder_resolve(oc_disk_decoder *dd, oc_uni_block **solved_list);
+
+// Equivalent of oc_accept_check_blocks_data
+int  oc_disk_decoder_accept_blocks(oc_disk_decoder *dd, const char *seeds[],
+				   const char *data[], int n,
+				   oc_uni_block **solved_list);
+
+// Write out any buffered check blocks. Returns 0 on success.
+int  oc_disk_decoder_flush(oc_disk_decoder *dd);
+
+// Frees the disk decoder and the decoder's data plane (but not the
+// decoder itself). The log file is left in place.
+void oc_disk_decoder_free(oc_disk_decoder *dd);
+
+
+// Streaming delivery
+//
+// The decoder solves message blocks in no particular order, so the
+// usual thing is to wait until it's done before using the message.
+// Something that consumes the message as a stream can start sooner:
+// a delivery cursor follows the longest run of solved message blocks
+// from block 0. Call oc_delivery_advance after each resolve to move it
+// past any blocks at the front that have been solved since; blocks
+// below d->next can then be read from the decoder's message buffer
+// and won't change. It only looks at the data plane's per-block
+// cached flags, so it works with the in-memory, disk and parallel
+// decoders alike.
+//
+// Don't expect it to cut the time to the first byte by much, though.
+// Peeling solves message blocks at random, and the contiguous prefix
+// can't move until every block in it is solved, so in practice the
+// cursor only starts moving in the final rush before done. What
+// streaming does give is that output overlaps with the last part of
+// decoding, and that mapped output (below) keeps the message out of
+// anonymous memory.
+//
+// Write-behind. If fd isn't -1, delivered data is written to it (only
+// the first length bytes of the message, so the padding never
+// appears). Writes are gathered into chunks of OC_DELIVERY_CHUNK
+// bytes, except for the last one, which goes as soon as the whole
+// message has been delivered, and oc_delivery_flush sends whatever's
+// waiting straight away. Plain output is written at the fd's current
+// position with write(), so pipes and sockets are fine.
+//
+// Mapped output (OC_DELIVERY_MAPPED). fd must be a regular file,
+// opened for reading and writing. It's truncated, sized to a whole
+// number of blocks and mapped shared, and d->message is the mapping:
+// pass it as the message buffer when setting up the data plane (eg,
+// oc_decoder_init_data or oc_disk_decoder_init). Solved blocks then
+// go straight into the page cache, and delivery just starts writeback
+// on the new part of the prefix (with sync_file_range). With
+// OC_DELIVERY_RELEASE as well, once a delivered range has been
+// written back, its pages are dropped from the mapping and from the
+// page cache, so a big message doesn't have to fit in memory all at
+// once. The decoder can still read delivered blocks (a message block
+// may be part of the solution of some block solved after it); the
+// kernel reads them back from the file if so. oc_delivery_free
+// unmaps the file and truncates it to length.
+
+#define OC_DELIVERY_CHUNK   (1 << 20)
+
+#define OC_DELIVERY_MAPPED  1
+#define OC_DELIVERY_RELEASE 2
+
+typedef struct {
+
+  oc_decoder *dec;
+  int         fd;		// -1 => no write-behind
+  int         flags;
+  off_t       length;		// of the message (the rest is padding)
+  int         block_size;
+  int         next;		// first message block not yet delivered
+
+  char       *message;		// mapped output, if OC_DELIVERY_MAPPED
+  size_t      map_size;
+
+  off_t       written;		// bytes written (or queued for writeback)
+  off_t       released;		// bytes given back (page aligned)
+
+  long long   writes;		// write/sync_file_range calls
+  long long   bytes_written;
+
+} oc_delivery;
+
+// Set up a cursor for a decoder made with oc_decoder_init (or
+// _init_shared). Without OC_DELIVERY_MAPPED, the decoder's data plane
+// can be set up before or after this. length is the message size in
+// bytes (< 0 means mblocks * block_size). Returns 0 on success.
+int  oc_delivery_init(oc_delivery *d, oc_decoder *dec, int fd, off_t length,
+		      int block_size, int flags);
+
+// Move the cursor past newly-solved blocks at the front of the
+// message and write out what's due. Returns the number of blocks the
+// cursor moved (0 if none) or -1 on error.
+int  oc_delivery_advance(oc_delivery *d);
+
+// Write out everything delivered so far. Returns 0 on success.
+int  oc_delivery_flush(oc_delivery *d);
+
+// Unmap mapped output (after flushing it). The fd isn't closed. Call
+// after the decoder's data plane is freed, or at least no longer used.
+void oc_delivery_free(oc_delivery *d);
+
+#endif
@@ -10,15 +10,17 @@
 #include "structs.h"
 #include "online-code.h"
 #include "encoder.h"
+#include "xor.h"
 
 // Encoder is somewhat simpler than the Decoder, but the constructor
 // is almost the same.
 int oc_encoder_init(oc_encoder *enc, int mblocks, oc_rng_sha1 *rng,
-		    int flags, ...) { // ... q, e, f
+		    int flags, ...) { // ... q, e, f, ablocks
 
   int    q=OC_DEFAULT_Q, new_q;
   double e=OC_DEFAULT_E, new_e;
   int    f=OC_DEFAULT_F, new_f;	// f=0 => not supplied (calculated)
+  int    ablocks=0, new_a;	// ablocks=0 => calculated
   int    i, *p, coblocks;
 
   int    super_flag = 0;
@@ -37,6 +39,9 @@ int oc_encoder_init(oc_encoder *enc, int mblocks, oc_rng_sha1 *rng,
     new_f = va_arg(ap, int);
     if (new_f == 0) break; else f=new_f;
 
+    new_a = va_arg(ap, int);
+    if (new_a == 0) break; else ablocks=new_a;
+
   } while(0);
   va_end(ap);
 
@@ -51,8 +56,14 @@ int oc_encoder_init(oc_encoder *enc, int mblocks, oc_rng_sha1 *rng,
   }
   enc->rng = rng;
 
+  enc->block_size = 0;
+  enc->message    = NULL;
+  enc->srcs       = NULL;
+  memset(&(enc->aux_cache), 0, sizeof(oc_arena));
+
   // call "super" with extracted args
-  super_flag = oc_codec_init(&(enc->base), mblocks, q, e, f, 0ll);
+  super_flag = oc_codec_init_lazy(&(enc->base), mblocks, q, e, f,
+				    ablocks);
 
   if (super_flag & OC_FATAL_ERROR) {
     fprintf(stderr, "oc_encoder_init: parent class returned fatal error\n");
@@ -91,6 +102,45 @@ int oc_encoder_init(oc_encoder *enc, int mblocks, oc_rng_sha1 *rng,
 
 }
 
+int oc_encoder_init_shared(oc_encoder *enc, oc_codec_template *t,
+			   oc_rng_sha1 *rng, int flags) {
+
+  int super_flag;
+
+  if (NULL == enc) {
+    fprintf(stderr, "oc_encoder_init_shared: passed NULL encoder pointer\n");
+    return OC_FATAL_ERROR;
+  }
+
+  if ((NULL == rng) || (NULL == t)) {
+    fprintf(stderr, "oc_encoder_init_shared: passed NULL rng/template\n");
+    return OC_FATAL_ERROR;
+  }
+
+  if (flags & (OC_EXPAND_AUX | OC_EXPAND_CHK | OC_EXPAND_MSG)) {
+    fprintf(stderr, "oc_encoder_init_shared: expansion flags not valid here\n");
+    return OC_FATAL_ERROR;
+  }
+
+  // carry on the seed chain from where making the map left it
+  *rng     = t->rng;
+  enc->rng = rng;
+
+  enc->block_size = 0;
+  enc->message    = NULL;
+  enc->srcs       = NULL;
+  memset(&(enc->aux_cache), 0, sizeof(oc_arena));
+
+  super_flag = oc_codec_init_shared(&(enc->base), t);
+  if (super_flag & OC_FATAL_ERROR) {
+    fprintf(stderr, "oc_encoder_init_shared: parent class returned fatal error\n");
+    return super_flag;
+  }
+  enc->flags = flags;
+
+  return super_flag;
+}
+
 // I'm not implementing OC_EXPAND_AUX right now, so check block
 // creation is simply a matter of returning whatever the parent
 // class's oc_checkblock_map() routine returns. I'll just create a
@@ -109,3 +159,229 @@ int *oc_encoder_check_block(oc_encoder *enc) {
   return   oc_checkblock_map(codec, degree, enc->rng);
 }
 
+
+// Data plane
+//
+// Everything above only deals with block numbers. The routines below
+// do the actual xoring so that applications don't all have to keep
+// their own aux block cache and xor loops.
+
+int oc_encoder_init_data(oc_encoder *enc, const char *message,
+			 int block_size) {
+
+  oc_codec *codec;
+  int   mblocks, ablocks, q, msg, aux;
+  int  *mp;
+
+  if ((NULL == enc) || (NULL == message) || (block_size <= 0)) {
+    fprintf(stderr, "oc_encoder_init_data: invalid arguments\n");
+    return -1;
+  }
+
+  codec   = &(enc->base);
+  mblocks = codec->mblocks;
+  ablocks = codec->ablocks;
+  q       = codec->q;
+
+  if (NULL == (mp = codec->auxiliary)) {
+    fprintf(stderr, "oc_encoder_init_data: no auxiliary mapping\n");
+    return -1;
+  }
+
+  oc_encoder_free_data(enc);	// in case we're called twice
+
+  enc->srcs = malloc((codec->F + 1) * sizeof(void *));
+  if ((-1 == oc_arena_init(&(enc->aux_cache), ablocks, block_size,
+			   OC_ARENA_ZERO)) || (NULL == enc->srcs)) {
+    fprintf(stderr, "oc_encoder_init_data: failed to allocate memory\n");
+    oc_encoder_free_data(enc);
+    return -1;
+  }
+
+  // Each message block is xored into q aux blocks. The auxiliary map
+  // is laid out the same way (q entries per message block), so we
+  // can just walk along it.
+  for (msg = 0; msg < mblocks; ++msg) {
+    for (aux = 0; aux < q; ++aux) {
+      oc_xor(oc_arena_block(&(enc->aux_cache), *(mp++) - mblocks),
+	     message + (size_t) msg * block_size, block_size);
+    }
+  }
+
+  enc->message    = message;
+  enc->block_size = block_size;
+
+  return 0;
+}
+
+// Each check block gets its own seed so that the receiver can
+// regenerate the block's composition from the seed alone, no matter
+// which blocks were lost along the way. The encoder's rng only holds
+// the seed chain (each seed is the hash of the one before it) while
+// a separate rng generates each block. That means the chain doesn't
+// depend on what happens while the blocks are being made, so seeds
+// can be handed out first and the blocks made in any order.
+void oc_encoder_next_seed(oc_encoder *enc, char *seed) {
+
+  assert(NULL != enc);
+
+  oc_rng_reseed(enc->rng);
+  memcpy(seed, enc->rng->seed, OC_RNG_BYTES);
+}
+
+// xor the blocks in list into dest, using srcs as scratch space
+static void xor_check_block(oc_encoder *enc, int *list,
+			    const void **srcs, char *dest) {
+
+  int mblocks    = enc->base.mblocks;
+  int block_size = enc->block_size;
+  int count, i, j;
+
+  count = *(list++);
+  for (j = 0; j < count; ++j) {
+    i = *(list++);
+    if (i < mblocks)
+      srcs[j] = enc->message + (size_t) i * block_size;
+    else
+      srcs[j] = oc_arena_block(&(enc->aux_cache), i - mblocks);
+  }
+
+  // copy the first block rather than clearing dest and xoring it in
+  memcpy(dest, srcs[0], block_size);
+  oc_xor_many(dest, srcs + 1, count - 1, block_size);
+}
+
+int oc_encoder_emit_block(oc_encoder *enc, char *seed, char *dest) {
+
+  oc_rng_sha1 rng;
+  oc_codec   *codec;
+  int        *list;
+
+  if ((NULL == enc) || (NULL == enc->message)) {
+    fprintf(stderr, "oc_encoder_emit_block: no data (call init_data)\n");
+    return -1;
+  }
+
+  codec = &(enc->base);
+
+  oc_encoder_next_seed(enc, seed);
+  oc_rng_init_seed(&rng, seed);
+
+  list = oc_checkblock_map(codec, oc_random_degree(codec, &rng), &rng);
+  if (NULL == list)
+    return -1;
+
+  xor_check_block(enc, list, enc->srcs, dest);
+
+  return list[0];
+}
+
+int oc_encoder_thread_init(oc_encoder *enc, oc_encoder_thread *t) {
+
+  int f;
+
+  assert(NULL != enc);
+  assert(NULL != t);
+
+  f = enc->base.F;
+
+  t->floyd_buf = malloc(f * sizeof(int));
+  t->list      = malloc((f + 1) * sizeof(int));
+  t->srcs      = malloc(f * sizeof(void *));
+  oc_floyd_init_ctx(&(t->floyd), t->floyd_buf);
+
+  if ((NULL == t->floyd_buf) || (NULL == t->list) || (NULL == t->srcs)) {
+    fprintf(stderr, "oc_encoder_thread_init: failed to allocate memory\n");
+    oc_encoder_thread_free(t);
+    return -1;
+  }
+
+  oc_rng_init(&(t->rng));
+
+  return 0;
+}
+
+void oc_encoder_thread_free(oc_encoder_thread *t) {
+
+  assert(NULL != t);
+
+  if (NULL != t->floyd_buf) free(t->floyd_buf);
+  if (NULL != t->list)      free(t->list);
+  if (NULL != t->srcs)      free(t->srcs);
+  oc_floyd_free_ctx(&(t->floyd));
+
+  t->floyd_buf = NULL;
+  t->list      = NULL;
+  t->srcs      = NULL;
+}
+
+int *oc_encoder_check_block_rng(oc_encoder *enc, oc_encoder_thread *t,
+				oc_rng_sha1 *rng) {
+
+  oc_codec *codec;
+  int degree;
+
+  assert(NULL != enc);
+  assert(NULL != t);
+  assert(NULL != rng);
+
+  codec  = &(enc->base);
+  degree = oc_random_degree(codec, rng);
+  return   oc_checkblock_map_r(codec, degree, rng, &(t->floyd), t->list);
+}
+
+int *oc_encoder_check_block_r(oc_encoder *enc, oc_encoder_thread *t,
+			      const char *seed) {
+
+  assert(NULL != t);
+
+  oc_rng_init_seed(&(t->rng), seed);
+  return oc_encoder_check_block_rng(enc, t, &(t->rng));
+}
+
+int oc_encoder_emit_block_rng(oc_encoder *enc, oc_encoder_thread *t,
+			      oc_rng_sha1 *rng, char *dest) {
+
+  int *list;
+
+  if ((NULL == enc) || (NULL == enc->message)) {
+    fprintf(stderr, "oc_encoder_emit_block_rng: no data (call init_data)\n");
+    return -1;
+  }
+
+  if (NULL == (list = oc_encoder_check_block_rng(enc, t, rng)))
+    return -1;
+
+  xor_check_block(enc, list, t->srcs, dest);
+
+  return list[0];
+}
+
+int oc_encoder_emit_block_r(oc_encoder *enc, oc_encoder_thread *t,
+			    const char *seed, char *dest) {
+
+  assert(NULL != t);
+
+  oc_rng_init_seed(&(t->rng), seed);
+  return oc_encoder_emit_block_rng(enc, t, &(t->rng), dest);
+}
+
+void oc_encoder_free_data(oc_encoder *enc) {
+
+  assert(NULL != enc);
+
+  if (NULL != enc->srcs) free(enc->srcs);
+  oc_arena_free(&(enc->aux_cache));
+
+  enc->srcs       = NULL;
+  enc->message    = NULL;
+  enc->block_size = 0;
+}
+
+void oc_encoder_free(oc_encoder *enc) {
+
+  assert(NULL != enc);
+
+  oc_encoder_free_data(enc);
+  oc_codec_free(&(enc->base));
+}
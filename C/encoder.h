@@ -3,17 +3,89 @@
 #ifndef OC_ENCODER_H
 #define OC_ENCODER_H
 
+#include "arena.h"
+
 typedef struct {
 
   oc_codec     base;
   oc_rng_sha1 *rng;
   int          flags;
+
+  // Data plane (only valid after oc_encoder_init_data, except that an
+  // out-of-core encoder (see diskio.h) has an aux cache but no message)
+  int          block_size;
+  const char  *message;		// caller's buffer, mblocks * block_size
+  oc_arena     aux_cache;	// ablocks blocks (see arena.h)
+  const void **srcs;		// scratch list of blocks to xor
 } oc_encoder;
 
 
 int oc_encoder_init(oc_encoder *enc, int mblocks, oc_rng_sha1 *rng,
-		    int flags, ...); // ... q, e, f
+		    int flags, ...); // ... q, e, f, ablocks
+
+// Set up an encoder that uses a shared codec template's tables (see
+// online-code.h). rng is set to the template's rng, so the encoder's
+// seed chain is the same as one made by oc_encoder_init with the rng
+// that the template was made from.
+int oc_encoder_init_shared(oc_encoder *enc, oc_codec_template *t,
+			   oc_rng_sha1 *rng, int flags);
   
 int *oc_encoder_check_block(oc_encoder *enc);
 
+// Attach message data to the encoder and build the aux block cache.
+// The message isn't copied, so it must stay around (and unchanged)
+// until oc_encoder_free_data() is called. Returns 0 on success.
+int oc_encoder_init_data(oc_encoder *enc, const char *message,
+			 int block_size);
+
+// Create a complete check block: its seed (OC_RNG_BYTES) is written
+// to seed and its contents (block_size bytes) to dest. Returns the
+// degree of the block or -1 on error.
+int oc_encoder_emit_block(oc_encoder *enc, char *seed, char *dest);
+
+void oc_encoder_free_data(oc_encoder *enc);
+
+// Free everything the encoder allocated (including the data plane)
+void oc_encoder_free(oc_encoder *enc);
+
+// Reentrant check block creation
+//
+// The routines above all use scratch space in the encoder (and its
+// rng) so only one thread can use them at a time. The ones below take
+// a per-thread state structure instead and only read from the
+// encoder, so any number of threads can create check blocks from the
+// same encoder at once. The caller hands out the seeds (normally from
+// oc_encoder_next_seed, which is what oc_encoder_emit_block uses).
+
+typedef struct {
+  oc_rng_sha1   rng;
+  oc_floyd_ctx  floyd;
+  int          *floyd_buf;	// F ints
+  int          *list;		// degree followed by F block numbers
+  const void  **srcs;		// F source pointers
+} oc_encoder_thread;
+
+int  oc_encoder_thread_init(oc_encoder *enc, oc_encoder_thread *t);
+void oc_encoder_thread_free(oc_encoder_thread *t);
+
+// Get the next seed in the encoder's seed chain. Not reentrant.
+void oc_encoder_next_seed(oc_encoder *enc, char *seed);
+
+// Block list for the check block with the given seed (in t->list)
+int *oc_encoder_check_block_r(oc_encoder *enc, oc_encoder_thread *t,
+			      const char *seed);
+
+// Contents of the check block with the given seed (data plane must be
+// set up). Returns the degree of the block or -1 on error
+int oc_encoder_emit_block_r(oc_encoder *enc, oc_encoder_thread *t,
+			    const char *seed, char *dest);
+
+// As above, but taking an rng that's already been started from the
+// block's seed (eg, one of a batch set up by oc_rng_init_seeds)
+// instead of the seed itself
+int *oc_encoder_check_block_rng(oc_encoder *enc, oc_encoder_thread *t,
+				oc_rng_sha1 *rng);
+int  oc_encoder_emit_block_rng(oc_encoder *enc, oc_encoder_thread *t,
+			       oc_rng_sha1 *rng, char *dest);
+
 #endif
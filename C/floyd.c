@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "floyd.h"
 
@@ -103,50 +104,179 @@
 // (unordered list and bit array) and leave refining them or
 // implementing some other option until later.
 
-// declare some static globals so that macros and functions don't have
-// to include them in local data structures or pass them as arguments.
+// All three implementations below keep the picks in ctx->list in the
+// order they were made. The bitmap and hash table are just indexes
+// that make the "is T in S" test cheaper:
+//
+// * SET_UNORDERED_LIST scans the list: O(k) per test, O(k^2) in all,
+//   but nothing to set up, so it's quickest when k is small
+//
+// * SET_BITMAP has a bit for each of the n values: O(1) per test.
+//   Rather than scanning the bitmap at the end, the bits that were set
+//   are cleared again by going through the list, so the cost per call
+//   is O(k) rather than O(n)
+//
+// * SET_HASH is an open-addressing table (linear probing) with at
+//   least twice as many slots as picks: O(1) expected per test and
+//   O(k) space, so it's the one to use when n is much bigger than k
 
-static int global_start;
-static int global_n, global_k;
+#ifndef SET_METHOD
+#define SET_METHOD SET_AUTO
+#endif
 
-#define STASH_GLOBALS(START, N, K) (\
-   global_start = START, global_n = N, global_k = K )
+#if (SET_METHOD < SET_AUTO) || (SET_METHOD > SET_HASH)
+#error Unknown SET_METHOD. See floyd.h for valid options
+#endif
 
-// Set implementation for SET_UNORDERED_LIST
+#define BITMAP_WORD_BITS (8 * sizeof(unsigned long))
 
- // The structures below are also used by SET_ORDERED_LIST
-static int *int_list = 0;
-static int items;
+// Fibonacci hashing; the top bits of the product are the best mixed
+#define HASH_SLOT(c,x) \
+  ((int) (((unsigned int) (x) * 2654435769u) >> (32 - (c)->hash_bits)))
 
-void oc_alloc_int_list(int *buf, int start, int n, int k) {
-  STASH_GLOBALS(start, n, k);
-  int_list = buf;
-}
+// Make sure the index for method is big enough for this call and
+// empty. Returns the method to use, which is the unordered list if
+// memory for the other two can't be had (it always works).
+static int set_prepare(oc_floyd_ctx *c, int method, int n, int k) {
+
+  unsigned long *bitmap;
+  int *hash, bits, words;
 
-static void clear_int_list(void) {
-  items = 0;
+  c->items = 0;
+
+  switch (method) {
+  case SET_BITMAP:
+    if (n > c->bitmap_bits) {
+      words  = (n + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
+      bitmap = calloc(words, sizeof(unsigned long));
+      if (NULL == bitmap)
+	return SET_UNORDERED_LIST;
+      if (NULL != c->bitmap) free(c->bitmap);
+      c->bitmap      = bitmap;
+      c->bitmap_bits = words * BITMAP_WORD_BITS;
+    }
+    return SET_BITMAP;		// bitmap is left clear after each call
+
+  case SET_HASH:
+    for (bits = 1; (1 << bits) < 2 * k; ++bits)
+      ;
+    if ((1 << bits) > c->hash_space) {
+      hash = malloc((1 << bits) * sizeof(int));
+      if (NULL == hash)
+	return SET_UNORDERED_LIST;
+      if (NULL != c->hash) free(c->hash);
+      c->hash       = hash;
+      c->hash_space = 1 << bits;
+    }
+    c->hash_bits = bits;
+    memset(c->hash, 0, (1 << bits) * sizeof(int));
+    return SET_HASH;
+  }
+
+  return SET_UNORDERED_LIST;
 }
 
-inline int scan_unordered_list(int x) {
-  int    *p = int_list;
-  int count = items;
+static inline int set_get(oc_floyd_ctx *c, int method, int x) {
+
+  int *p, count, i, mask;
+
+  switch (method) {
+  case SET_BITMAP:
+    x -= c->start;
+    return (c->bitmap[x / BITMAP_WORD_BITS] >> (x % BITMAP_WORD_BITS)) & 1;
+
+  case SET_HASH:
+    mask = (1 << c->hash_bits) - 1;
+    for (i = HASH_SLOT(c, x); c->hash[i]; i = (i + 1) & mask)
+      if (c->hash[i] == x + 1)
+	return 1;
+    return 0;
+  }
+
+  p     = c->list;
+  count = c->items;
   while (count--)
     if (*(p++) == x) return 1;
   return 0;
 }
 
-inline static void append_int_list(int x) {
-  //printf("Adding %d (item %d/%d)\n", x, items+1, global_k);
-  //  if (items == global_k) {
-  //    fprintf(stderr, "append_int_list: list is already full\n");
-  //    exit (1);
-  //  }
-  int_list[items++] = x;
+static inline void set_put(oc_floyd_ctx *c, int method, int x) {
+
+  int i, mask, b;
+
+  c->list[c->items++] = x;
+
+  switch (method) {
+  case SET_BITMAP:
+    b = x - c->start;
+    c->bitmap[b / BITMAP_WORD_BITS] |= 1ul << (b % BITMAP_WORD_BITS);
+    break;
+
+  case SET_HASH:
+    mask = (1 << c->hash_bits) - 1;
+    for (i = HASH_SLOT(c, x); c->hash[i]; i = (i + 1) & mask)
+      ;
+    c->hash[i] = x + 1;
+    break;
+  }
 }
 
-static int *return_int_list(void) {
-  return int_list;
+static inline int *set_out(oc_floyd_ctx *c, int method) {
+
+  int i, b;
+
+  if (method == SET_BITMAP)
+    for (i = 0; i < c->items; ++i) {
+      b = c->list[i] - c->start;
+      c->bitmap[b / BITMAP_WORD_BITS] &= ~(1ul << (b % BITMAP_WORD_BITS));
+    }
+
+  return c->list;
 }
+
+static int choose_method(oc_floyd_ctx *c, int n, int k) {
+
+  if (c->method != SET_AUTO)
+    return c->method;
+  if (k <= OC_FLOYD_LIST_MAX)
+    return SET_UNORDERED_LIST;
+  if (n <= OC_FLOYD_BITMAP_MAX * k)
+    return SET_BITMAP;
+  return SET_HASH;
+}
+
+void oc_floyd_init_ctx(oc_floyd_ctx *ctx, int *buf) {
+  memset(ctx, 0, sizeof(oc_floyd_ctx));
+  ctx->list   = buf;
+  ctx->method = SET_METHOD;
+}
+
+void oc_floyd_free_ctx(oc_floyd_ctx *ctx) {
+
+  if (NULL != ctx->bitmap) free(ctx->bitmap);
+  if (NULL != ctx->hash)   free(ctx->hash);
+
+  ctx->bitmap      = NULL;
+  ctx->bitmap_bits = 0;
+  ctx->hash        = NULL;
+  ctx->hash_space  = 0;
+}
+
+int oc_floyd_set_method(oc_floyd_ctx *ctx, int method) {
+  if ((method < SET_AUTO) || (method > SET_HASH))
+    return -1;
+  ctx->method = method;
+  return 0;
+}
+
+// context used by the old oc_floyd() interface
+static oc_floyd_ctx global_ctx;
+
+void oc_alloc_int_list(int *buf, int start, int n, int k) {
+  oc_floyd_free_ctx(&global_ctx);
+  oc_floyd_init_ctx(&global_ctx, buf);
+}
+
 // oc_rng_rand(rng, x) returns floats in the range [0,x). This macro
 // makes it work like the RandInt in the pseudocode returning ints in
 // the range [LOW,HIGH].
@@ -155,58 +285,63 @@ static int *return_int_list(void) {
   (LOW + floor(oc_rng_rand(rng, HIGH - LOW + 1)))
 
 // The high-level algorithm, modified to use zero-based arrays
-int *oc_floyd(oc_rng_sha1 *rng, int start, int n, int k) {
-  int j, t, t0, t1, t2;
-  SET_CLR();			// initialize set S to empty
+int *oc_floyd_r(oc_floyd_ctx *ctx, oc_rng_sha1 *rng,
+		int start, int n, int k) {
+  int j, t, t0, t1, t2, m;
+
+  m = choose_method(ctx, n, k);
+  m = set_prepare(ctx, m, n, k);	// initialize set S to empty
+  ctx->start = start;
   j =  n-k;
 
-  // Unroll first few iterations
+  // Unroll first few iterations. t0..t2 hold what was actually
+  // inserted (T or J), since that's what later steps must test
+  // against.
   if (1) {
     t0 = RandInt(0,j);		//   T := RandInt(1, J)
-    SET_PUT(t0 + start);	//     insert T in s
+    set_put(ctx, m, t0 + start);	//     insert T in s
 
     if (++j >= n)
-      return SET_OUT();
+      return set_out(ctx, m);
 
     t1 = RandInt(0,j);		//   T := RandInt(1, J)
-    if (t1 != t0)		//   if T is not in S then
-      SET_PUT(t1 + start);	//     insert T in s
-    else			//   else
-      SET_PUT(j + start);	//     insert J in S
+    if (t1 == t0)		//   if T is in S then
+      t1 = j;			//     insert J instead
+    set_put(ctx, m, t1 + start);
 
     if (++j >= n)
-      return SET_OUT();
+      return set_out(ctx, m);
 
     t2 = RandInt(0,j);		//   T := RandInt(1, J)
-    if ((t2 != t0) && (t2 != t1)) // if T is not in S then
-      SET_PUT(t2 + start);      //     insert T in s
-    else			//   else
-      SET_PUT(j + start);	//     insert J in S
+    if ((t2 == t0) || (t2 == t1))
+      t2 = j;
+    set_put(ctx, m, t2 + start);
 
     if (++j >= n)
-      return SET_OUT();
+      return set_out(ctx, m);
 
     t = RandInt(0,j);		//   T := RandInt(1, J)
-    if ((t!=t0)&&(t!=t1)&&(t!=t2)) //if T is not in S then
-      SET_PUT(t + start);       //     insert T in s
-    else			//   else
-      SET_PUT(j + start);	//     insert J in S
+    if ((t == t0) || (t == t1) || (t == t2))
+      t = j;
+    set_put(ctx, m, t + start);
 
     if (++j >= n)
-      return SET_OUT();
+      return set_out(ctx, m);
   }
 
   //  printf("oc_floyd: going to choose %d elements\n", k);
   while (j < n) {		// for J := N-K + 1 to N do
     t = RandInt(0,j);		//   T := RandInt(1, J)
-    if (!SET_GET(t+start))	//   if T is not in S then
-      SET_PUT(t+start);		//     insert T in s
+    if (!set_get(ctx, m, t+start))	//   if T is not in S then
+      set_put(ctx, m, t+start);	//     insert T in s
     else			//   else
-      SET_PUT(j+start);		//     insert J in S
+      set_put(ctx, m, j+start);	//     insert J in S
     ++j;
   }
 
-  return SET_OUT();
+  return set_out(ctx, m);
 }
 
-// Use a hash table (Bloom Filters(?)) for set inclusion?
+int *oc_floyd(oc_rng_sha1 *rng, int start, int n, int k) {
+  return oc_floyd_r(&global_ctx, rng, start, n, k);
+}
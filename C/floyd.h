@@ -6,60 +6,65 @@
 
 #include "rng_sha1.h"
 
-#ifndef SET_METHOD
-#error Must set SET_METHOD macro
-#endif
-
-// C's preprocessor doesn't let you compare strings so the best we can
-// do is to use #defines to enumerate the options
+// The set used by Floyd's algorithm can be implemented in several
+// ways. By default the best one is picked at runtime for each call
+// depending on k and n (SET_AUTO), but a particular one can be forced
+// for all contexts by setting SET_METHOD at compile time, or for one
+// context with oc_floyd_set_method(). C's preprocessor doesn't let
+// you compare strings so the best we can do is to use #defines to
+// enumerate the options
+#define SET_AUTO            0
 #define SET_UNORDERED_LIST  1
 #define SET_BITMAP          2
-
-// The set implementation has to define four macros:
-//
-// SET_INIT(buf,start,n,k) :  Initialise the set (allocate struct)
-// SET_CLR()           :  Empty the set
-// SET_GET(x)          :  Test whether element x is in set
-// SET_PUT(x)          :  Put element x into the set
-// SET_OUT()           :  Write set elements to output int array
-//
-// For the first implementation I'm going to use (implied) static data
-// structures. Later on I might define typedefs and add structure
-// pointers to the argument lists above.
-
-// Most the functions listed below are declared as static in floyd.c
-// so they shouldn't cause namespace pollution (apart from the SET_*
-// macro names themselves). The exception is SET_INIT since that needs
-// to be called during program initialisation.
-
-#if   SET_METHOD == SET_UNORDERED_LIST
-#warning Using unordered list
-
-#define SET_INIT oc_alloc_int_list
-#define SET_CLR  clear_int_list
-#define SET_GET  scan_unordered_list
-#define SET_PUT  append_int_list
-#define SET_OUT  return_int_list
-
-
-#elif SET_METHOD == SET_BITMAP
-#warning Using bitmap
-
-
-#else 
-#error Unknown SET_METHOD. See this file for valid options
-#endif
-
-// The prototype for calling oc_floyd is the same regardless of which
-// set implementation is used, though the program does need to call
-// the SET_INIT macro before using it.
+#define SET_HASH            3
+
+// All of the set's state lives in a context structure so that several
+// threads can run the algorithm at the same time as long as each has
+// its own context. The output list is always written in the order the
+// picks are made, so all the methods give exactly the same result. It
+// doubles as the set storage for the unordered list implementation;
+// the others keep a separate index (allocated the first time they're
+// used) for lookups.
+typedef struct {
+  int *list;			// where the k picks are written
+  int  items;			// number of picks so far
+  int  method;			// SET_* (SET_AUTO to choose per call)
+  int  start;			// start of range for current call
+
+  unsigned long *bitmap;	// SET_BITMAP: one bit per value in range
+  int            bitmap_bits;	// capacity
+
+  int           *hash;		// SET_HASH: open addressing, value + 1
+  int            hash_bits;	// table has 1 << hash_bits slots
+  int            hash_space;	// capacity (slots)
+} oc_floyd_ctx;
+
+// Limits for SET_AUTO. Scanning the list is fastest for small k. Past
+// that, a bitmap is used as long as it wouldn't be bigger than the
+// hash table (which has 2-4 slots per pick), otherwise a hash table.
+#define OC_FLOYD_LIST_MAX   16
+#define OC_FLOYD_BITMAP_MAX 64	// bits per pick
+
+// Set up a context that writes to buf (which must have room for k
+// ints on each call)
+void oc_floyd_init_ctx(oc_floyd_ctx *ctx, int *buf);
+
+// Free the bitmap/hash index (but not buf)
+void oc_floyd_free_ctx(oc_floyd_ctx *ctx);
+
+// Force a particular set method (or SET_AUTO). Returns 0 on success or
+// -1 if the method is unknown.
+int  oc_floyd_set_method(oc_floyd_ctx *ctx, int method);
+
+// Pick k distinct values from [start, start + n). Returns ctx->list.
+int *oc_floyd_r(oc_floyd_ctx *ctx, oc_rng_sha1 *rng, int start, int n, int k);
+
+// Older, non-reentrant interface (uses a single internal context that
+// must be set up with oc_alloc_int_list first)
 //
 // The return value is an array of k ints.
 int *oc_floyd(oc_rng_sha1 *rng, int start, int n, int k);
 
 void oc_alloc_int_list(int *buf, int start, int n, int k);
-static void clear_int_list(void);
-
-
 
 #endif
@@ -10,115 +10,82 @@
 #include "graph.h"
 
 #define OC_DEBUG 0
-#define STEPPING 1
-#define INSTRUMENT 1
 
-#ifdef INSTRUMENT
-
-// Static structure to hold measurements relating to key bottlenecks
-
-static struct {
-
-  int delete_n_calls;
-  int delete_n_seek_length;
-  int delete_n_max_seek;
-
-  int push_pending_calls;
-  int pending_fill_level;
-  int pending_max_full;
-
-} m;
-
-#endif
-
-// Static structure to hold and return a list of freed oc_uni_block
-// nodes (actually a circular list since it avoids some comparisons)
-static oc_uni_block *free_head = NULL;
-static oc_uni_block *free_tail = NULL;
-
-static int ouser = 0;		// share among all graph instances
-
-// uses pointer in universal block's a union to represent "next"
-
-static oc_uni_block *hold_blocks(void) {
-  if (NULL == (free_tail = malloc(sizeof(oc_uni_block))))
-    return NULL;
-  return free_head = free_tail->a.next = free_tail;
-}
-
-static oc_uni_block *alloc_block(void) {
-  oc_uni_block *p;
-  if (free_head == free_tail)
-    return malloc(sizeof(oc_uni_block));
-  
-  // shift (read) head element
-  p = free_head;
-  free_tail->a.next = free_head = free_head->a.next;
-  return p;
-}
+// Allocate a new (all tombstones) slab in the slab arena. Returns its
+// slot number or 0 if we've run out of memory or handles.
+static int new_slab(oc_graph *g) {
+
+  int slab = g->slab_next, chunk, *s;
+  int **table;
+
+  // slab_next is at the end of the last chunk
+  if (0 == (slab & (OC_SLAB_CHUNK_INTS - 1))) {
+    chunk = slab >> OC_SLAB_CHUNK_BITS;
+    if ((long long) (chunk + 1) * OC_SLAB_CHUNK_INTS >
+	0x7fffffff - (long long) g->static_edges)
+      return 0;
+
+    if (chunk == g->slab_chunks_space) {
+      if (NULL == (table = realloc(g->slab_chunks,
+				   2 * chunk * sizeof(int *))))
+	return 0;
+      g->slab_chunks       = table;
+      g->slab_chunks_space = 2 * chunk;
+    }
+    if (posix_memalign((void **) (g->slab_chunks + chunk), 64,
+		       OC_SLAB_CHUNK_INTS * sizeof(int)))
+      return 0;
+    ++(g->slab_chunks_used);
+  }
+  g->slab_next += OC_SLAB_INTS;
 
-static void free_block(oc_uni_block *p) {
-  // push (write) after tail
-  p->a.next = free_head;
-  free_tail = free_tail->a.next = p;
-}
+  s = &OC_SLOT(g, slab);
+  s[0] = 0;
+  memset(s + 1, 0xff, OC_SLAB_EDGES * sizeof(int));
 
-// clean up circular list completely
-static void release_blocks(void) {
-  oc_uni_block *p;
-  free_tail->a.next = NULL;
-  do {
-    free_head = (p=free_head)->a.next;
-    free(p);
-  } while (free_head != NULL);
-  free_tail = free_head;
+  return slab;
 }
 
-// Create an up edge
-oc_n_edge_ring *oc_create_n_edge(oc_graph *g, int upper, int lower) {
+// Create an up edge (to a check node; message -> aux edges come from
+// the aux map)
+int oc_create_n_edge(oc_graph *g, int upper, int lower) {
 
-  oc_n_edge_ring *p, *ring;
+  int slot, slab;
 
   //  OC_DEBUG && fprintf(stdout, "Adding n edge %d -> %d\n", lower, upper);
 
   assert(upper > lower);
 
-  // We shouldn't need to test for overflowing so long as we have
-  // similar checks when creating bones and we always create bones
-  // before the bottom links.
-  //  if (g->ringfence_next + 1 >= g->ringfence_size)
-  //  return NULL;
-
-  p = g->ringfence + g->ringfence_next++;
-
-  ring = g->bottom + lower;
-
-  // update the count of n edges in this ring
-  ring->upper = 0;
-
-  // we could push to the left (as here) or right; it doesn't matter
-  p->upper          = upper;
-  p->left           = ring->left;
-  p->right          = ring;
-  ring->left->right = p;
-  ring->left        = p;
+  // slot is 0 if the node has no slabs yet, or a multiple of the slab
+  // size if its last slab is full. Either way, add a new slab to the
+  // end of the chain.
+  slot = g->up_tail[lower];
+  if (0 == slot % OC_SLAB_INTS) {
+    if (0 == (slab = new_slab(g)))
+      return OC_NO_EDGE;
+
+    if (0 == slot)
+      g->up_head[lower] = slab;
+    else
+      OC_SLOT(g, slot - OC_SLAB_INTS) = slab;
+    slot = slab + 1;
+  }
 
-  return p;
+  OC_SLOT(g, slot)  = upper;
+  g->up_tail[lower] = slot + 1;
 
+  return g->static_edges + slot;
 }
 
-// complementary function to oc_create_n_edge
-void oc_delete_lower_end(oc_graph *g, oc_n_edge_ring *node, 
+// complementary function to oc_create_n_edge (but works for any edge)
+void oc_delete_lower_end(oc_graph *g, int edge, 
 			 int upper, int lower, int decrement) {
 
-  oc_n_edge_ring *ring;
-
-  assert(node != NULL);
+  assert(edge != OC_NO_EDGE);
 
   OC_DEBUG && printf("Deleting lower half from %d up to %d\n", lower, upper);
-  OC_DEBUG && printf("ring_node->upper is %d\n", node->upper);
 
-  assert(upper == node->upper);	// reciprocity
+  OC_STAT(++(g->stats.delete_n_calls));
 
   // Update the unsolved count first
   if (decrement) {
@@ -127,15 +94,67 @@ void oc_delete_lower_end(oc_graph *g, oc_n_edge_ring *node,
     --(g->v_count[upper - g->mblocks]);
   }
 
-  // update node count in this ring
-  ring = g->bottom + lower;
-  ring->upper = 0; 
+  // leave a tombstone
+  if (edge < g->static_edges) {
+    assert(upper == g->aux_map[edge]);	// reciprocity
+    assert(lower == edge / g->q);
+    g->aux_dead[edge >> 3] |= 1 << (edge & 7);
+  } else {
+    assert(upper == OC_SLOT(g, edge - g->static_edges));
+    OC_SLOT(g, edge - g->static_edges) = -1;
+  }
+}
+
+// Make room for more check nodes. All the arrays here are indexed by
+// node number and nothing keeps pointers into them, so they can just
+// be realloc'd. The pending queue is a ring buffer, though, so if it
+// wraps around, the part at the start has to be moved to the end.
+static int grow_nodes(oc_graph *g) {
 
-  // remove node from the ring
-  node->left->right = node->right;
-  node->right->left = node->left;
+  int old_space = g->node_space - g->mblocks;	// indexed by node - mblocks
+  int old_check = g->node_space - g->coblocks;
+  int new_space, wrapped;
+  void *p;
 
-  //  free(node);
+  new_space = old_space + ((old_check < 64) ? 64 : old_check / 2);
+  if (new_space <= old_space)	// overflow
+    return -1;
+
+  OC_DEBUG && fprintf(stdout, "Growing node space to %d\n",
+		      new_space + g->mblocks);
+
+#define OC_GROW(MEMBER, TYPE) \
+  if (NULL == (p = realloc(g->MEMBER, new_space * sizeof(TYPE)))) \
+    return -1; \
+  g->MEMBER = p; \
+  memset(g->MEMBER + old_space, 0, (new_space - old_space) * sizeof(TYPE));
+
+  OC_GROW(v_count, int);
+  OC_GROW(top,     int);
+  OC_GROW(queued,  unsigned char);
+  OC_GROW(pending, int);
+
+#undef OC_GROW
+
+  // old_space == pending_size here
+  wrapped = g->pending_head + g->pending_count - old_space;
+  if (wrapped > 0) {
+    if (wrapped <= new_space - old_space) {
+      memcpy(g->pending + old_space, g->pending, wrapped * sizeof(int));
+    } else {
+      // only happens if we've grown by less than the wrapped part;
+      // move the head part up to the end instead
+      memmove(g->pending + new_space - (old_space - g->pending_head),
+	      g->pending + g->pending_head,
+	      (old_space - g->pending_head) * sizeof(int));
+      g->pending_head = new_space - (old_space - g->pending_head);
+    }
+  }
+
+  g->pending_size = new_space;
+  g->node_space   = new_space + g->mblocks;
+
+  return 0;
 }
 
 int oc_graph_init(oc_graph *graph, oc_codec *codec, float fudge) {
@@ -144,6 +163,7 @@ int oc_graph_init(oc_graph *graph, oc_codec *codec, float fudge) {
   int  mblocks = codec->mblocks;
   int  ablocks = codec->ablocks;
   int coblocks = codec->coblocks;
+  int max_bone;
 
   // we need e and q to calculate the expected number of check blocks
   double e = codec->e;
@@ -158,7 +178,6 @@ int oc_graph_init(oc_graph *graph, oc_codec *codec, float fudge) {
   // iterators and temporary variables
   int msg, aux, *mp, *p, aux_temp, temp;
   oc_bone *bone;
-  oc_n_edge_ring *ring;
 
   // Check parameters and return non-zero value on failures
   if (mblocks < 1)
@@ -170,12 +189,14 @@ int oc_graph_init(oc_graph *graph, oc_codec *codec, float fudge) {
   if (NULL == aux_map)
     return fprintf(stdout, "graph init: codec has null auxiliary map\n");
 
-  if (fudge <= 1.0)
-    return fprintf(stdout, "graph init: Fudge factor (%f) <= 1.0\n", fudge);
+  if (fudge <= 0.0)
+    return fprintf(stdout, "graph init: Fudge factor (%f) <= 0.0\n", fudge);
 
   // calculate space to allocate for check blocks (only)
   expected = (1 + q * e) * mblocks;
   check_space = fudge * expected;
+  if (check_space < 1)
+    check_space = 1;
 
   // prepare structure
   memset(graph, 0, sizeof(oc_graph));
@@ -188,6 +209,8 @@ int oc_graph_init(oc_graph *graph, oc_codec *codec, float fudge) {
   graph->node_space = coblocks + check_space;
   graph->unsolved_count = mblocks;
 
+  graph->stats.check_blocks_expected = expected + 0.5;
+
   OC_DEBUG && fprintf(stdout, "check space is %d\n", check_space);
 
   // use a macro to make the following code clearer/less error-prone
@@ -200,58 +223,45 @@ int oc_graph_init(oc_graph *graph, oc_codec *codec, float fudge) {
   // unsolved (downward) edge counts: omit message blocks
   OC_ALLOC(v_count, ablocks + check_space, int,    "unsolved v_edge counts");
 
+  // pending queue: aux and check nodes only
+  OC_ALLOC(pending, ablocks + check_space, int,    "pending queue");
+  OC_ALLOC(queued,  ablocks + check_space, unsigned char, "queued flags");
+  graph->pending_size = ablocks + check_space;
+
   //
   // New bones-related arrays
   //
 
   // solutions: omit check blocks; they are their own solutions
-  OC_ALLOC(solution, coblocks, oc_bone *,          "solutions");
+  OC_ALLOC(solution, coblocks, int,           "solutions");
 
   // top end of edges: omit message blocks
-  OC_ALLOC(top, ablocks + check_space, oc_bone *,  "top");
+  OC_ALLOC(top, ablocks + check_space, int,   "top");
 
   // bottom end of edges: omit check blocks
-  OC_ALLOC(bottom, coblocks, oc_n_edge_ring,       "bottom");
-
-  // Space for bones will be carved out of a single chunk of
-  // memory. Since the average number of edges per node will be
-  // log(F), I'll use a rough value of fudge * fudge * expected number
-  // of check blocks times that to decide on the size of the
-  // allocation.
-
-  check_space = check_space + check_space * log(f) * fudge;
-
-  OC_DEBUG && printf("Allocating %d bones\n", (int) check_space);
-  //  OC_ALLOC(boneyard, check_space, oc_bone,         "boneyard");
-  if (NULL == (graph->boneyard = malloc(check_space * sizeof(oc_bone))))
-    return fprintf(stdout, "graph init: Failed to allocate boneyard \n");
-  // no need to clear this memory
-  graph->boneyard_size = check_space;
-  graph->boneyard_next = 0;
-
-  // Also ring-fence an area of memory for reciprocal links
-  if (NULL == (graph->ringfence = malloc(check_space * 
-					 sizeof(oc_n_edge_ring))))
-    return fprintf(stdout, "graph init: Failed to allocate ringfence \n");
-  // no need to clear this memory
-  graph->ringfence_size = check_space;
-  graph->ringfence_next = 0;
-  
-
-  // Hold onto freed blocks
-  if ( (NULL == free_head) && (NULL == hold_blocks()) )
-    return fprintf(stderr, "Curiouser and curiouser!\n");
-  else
-    ++ouser;
-
-  // initialise the rings that will store bottom ends of edges
-  for (msg = 0; msg < coblocks; ++msg) {
-    graph->bottom[msg].left = graph->bottom[msg].right
-      = graph->bottom + msg;
-  }
+  OC_ALLOC(up_head, coblocks, int,            "up edge slab heads");
+  OC_ALLOC(up_tail, coblocks, int,            "up edge slab tails");
+  OC_ALLOC(aux_dead, (mblocks * q + 7) / 8, unsigned char,
+	   "deleted aux edge bitmap");
+
+  graph->aux_map      = aux_map;
+  graph->q            = q;
+  graph->static_edges = mblocks * q;
+
+  // Bones and slabs are allocated in chunks as needed. Start off with
+  // one chunk of each so that index 0 can be kept back.
+  OC_ALLOC(bone_chunks, 16, oc_bone *,        "bone chunk table");
+  OC_ALLOC(slab_chunks, 16, int *,            "slab chunk table");
+  graph->bone_chunks_space = 16;
+  graph->slab_chunks_space = 16;
+
+  // slab 0 is never used so that 0 can stand for "none"
+  new_slab(graph);
+  if (0 == graph->slab_chunks_used)
+    return fprintf(stdout, "graph init: Failed to allocate edge slabs\n");
 
   // Register the auxiliary mapping
-  // 1st stage: allocate/store message up edges, count aux down edges
+  // 1st stage: count aux down edges (the up edges are the map itself)
 
   mp = codec->auxiliary;	// start of 2d message -> aux* map
   for (msg = 0; msg < mblocks; ++msg) {
@@ -264,6 +274,22 @@ int oc_graph_init(oc_graph *graph, oc_codec *codec, float fudge) {
     }
   }
 
+  // Chunks have to be big enough for the biggest bone (at least
+  // twice over so that we don't waste too much at the ends of chunks)
+  max_bone = f;
+  for (aux = 0; aux < ablocks; ++aux)
+    if (graph->v_count[aux] / 2 > max_bone)
+      max_bone = graph->v_count[aux] / 2;
+  max_bone += 3;
+  for (graph->bone_bits = 16; (1 << graph->bone_bits) < 2 * max_bone; )
+    ++(graph->bone_bits);
+
+  OC_DEBUG && printf("Bone chunks hold %d bones\n", 1 << graph->bone_bits);
+  // first chunk; bone 0 is a dummy since index 0 means "no bone"
+  oc_new_bone(graph, 0);
+  if (0 == graph->bone_chunks_used)
+    return fprintf(stdout, "graph init: Failed to allocate boneyard \n");
+
   // 2nd stage: allocate bones for auxiliary nodes
 
   for (aux = 0; aux < ablocks; ++aux) {
@@ -272,14 +298,16 @@ int oc_graph_init(oc_graph *graph, oc_codec *codec, float fudge) {
 
     //    if (NULL == (bone = calloc(2 + aux_temp, sizeof(oc_bone))))
     //      return fprintf(stdout, "graph init: failed to malloc aux bones\n");
-    if (NULL == (bone = oc_new_bone(graph, 2 + aux_temp)))
+    if (0 == (temp = oc_new_bone(graph, 2 + aux_temp)))
       return  fprintf(stdout, "graph init: failed to malloc aux bones\n");
+    bone = oc_graph_bone(graph, temp);
 
     // save bone size, aux node; edges stored in next pass
     bone->a.unknowns = aux_temp + 1;
     bone->b.size     = aux_temp + 1;
     bone[aux_temp + 1].a.node = aux + mblocks;
-    graph->top[aux]  = bone;
+    bone[aux_temp + 1].b.link = OC_NO_EDGE; // boneyard isn't cleared
+    graph->top[aux]  = temp;
   }
 
   // 3rd stage: store down edges
@@ -289,7 +317,7 @@ int oc_graph_init(oc_graph *graph, oc_codec *codec, float fudge) {
     for (aux = 0; aux < q; ++aux) {
       aux_temp    = *(mp++) - mblocks;
 
-      bone = graph->top[aux_temp];
+      bone = oc_graph_bone(graph, graph->top[aux_temp]);
 
 #if 0
       OC_DEBUG && fprintf(stdout,
@@ -311,12 +339,8 @@ int oc_graph_init(oc_graph *graph, oc_codec *codec, float fudge) {
 
       bone->a.node = msg;
 
-      // deferred creation of up edge until now so that we can stash
-      // the returned pointer in the array allocated in 2nd stage
-      if (NULL == (ring = oc_create_n_edge(graph, aux_temp + mblocks, msg)))
-	return fprintf(stdout, "graph init: failed to malloc aux up edge\n");
-
-      bone->b.link = ring;
+      // the up edge's handle is just its position in the aux map
+      bone->b.link = mp - 1 - aux_map;
     }
   }
 
@@ -324,37 +348,109 @@ int oc_graph_init(oc_graph *graph, oc_codec *codec, float fudge) {
   if (OC_DEBUG) {
     printf ("Auxiliary mapping expressed as bones:\n");
     for (aux = 0; aux < ablocks; ++aux) {
-      bone = graph->top[aux];
+      bone = oc_graph_top(graph, aux + mblocks);
 #ifndef NDEBUG
-      oc_validate_bone(bone, aux + mblocks);
+      oc_validate_bone(graph, bone, aux + mblocks);
 #endif
       printf ("  ");
       oc_print_bone(bone, "\n");
     }
   }
 
+  return 0;
+}
 
-#ifdef INSTRUMENT
-  memset(&m, 0, sizeof(m));
-#endif
+// Transparent aux blocks (see graph.h): make a copy of a check
+// block's list with every unsolved aux node replaced by its message
+// blocks, dropping any node that comes up an even number of times.
+// Returns the new list (in g->t_list), the original list if there's
+// nothing to expand or the result wouldn't fit in a bone, or NULL if
+// malloc fails.
+static int *transparent_list(oc_graph *g, int *list) {
+
+  const int     *rev     = g->aux_rev;
+  unsigned char *parity  = g->t_parity;
+  int            mblocks = g->mblocks;
+  int            count   = list[0];
+  int            need = 0, expanded = 0;
+  int            i, j, a, node, n, kept, *out;
+  void          *p;
+
+  // how big could it get?
+  for (i = 1; i <= count; ++i) {
+    node = list[i];
+    if ((node >= mblocks) && !g->solution[node]) {
+      a     = node - mblocks;
+      need += rev[a + 1] - rev[a];
+      ++expanded;
+    } else
+      ++need;
+  }
+  if (0 == expanded)
+    return list;
+
+  if (need + 1 > g->t_space) {
+    if (NULL == (p = realloc(g->t_list, (need + 1) * sizeof(int))))
+      return NULL;
+    g->t_list  = p;
+    g->t_space = need + 1;
+  }
+  out = g->t_list;
+
+  // toggle each node's parity (bit 0), listing it the first time it's
+  // seen (bit 1)
+#define OC_TOGGLE(NODE) \
+  do { if (0 == parity[NODE]) out[++n] = NODE; \
+       parity[NODE] = (parity[NODE] ^ 1) | 2; } while (0)
+
+  n = 0;
+  for (i = 1; i <= count; ++i) {
+    node = list[i];
+    if ((node >= mblocks) && !g->solution[node]) {
+      a = node - mblocks;
+      for (j = rev[a]; j < rev[a + 1]; ++j)
+	OC_TOGGLE(rev[j]);
+    } else
+      OC_TOGGLE(node);
+  }
+#undef OC_TOGGLE
+
+  // keep the odd ones and clear the parity flags behind us
+  kept = 0;
+  for (i = 1; i <= n; ++i) {
+    node = out[i];
+    if (parity[node] & 1)
+      out[++kept] = node;
+    parity[node] = 0;
+  }
+  out[0] = kept;
 
-  return 0;
+  // the bone also needs room for the check node and its header
+  if (kept + 2 > (1 << g->bone_bits))
+    return list;
+
+  OC_STAT(g->stats.aux_expanded  += expanded;
+	  g->stats.aux_cancelled += need - kept);
+
+  return out;
 }
 
 // Install a new check block into the graph. Called from decoder.
 // Returns node number on success, -1 otherwise
 int oc_graph_check_block(oc_graph *g, int *v_edges) {
 
-  int node;
+  int node, b;
   int count, solved_count, end, i, tmp;
   int mblocks;
 
   int xor_length = 1, *ep, *xp;
 
-  oc_n_edge_ring **pipes;
-
   oc_bone *bone;
 
+#if OC_GRAPH_STATS
+  long long start = oc_stat_ns();
+#endif
+
   assert(g != NULL);
   assert(v_edges != NULL);
 
@@ -364,18 +460,31 @@ int oc_graph_check_block(oc_graph *g, int *v_edges) {
   OC_DEBUG && fprintf(stdout, "Graphing check node %d/%d:\n", node, g->node_space);
 
   // have we run out of space for new nodes?
-  if (node >= g->node_space)
-    return fprintf(stdout, "oc_graph_check_block: node >= node_space\n"), -1;
+  if ((node >= g->node_space) && (-1 == grow_nodes(g))) {
+    --(g->nodes);
+    return fprintf(stdout, "oc_graph_check_block: can't grow node space\n"),
+      -1;
+  }
+
+  if ((NULL != g->aux_rev) &&
+      (NULL == (v_edges = transparent_list(g, v_edges)))) {
+    --(g->nodes);
+    return fprintf(stderr, "oc_graph_check_block: failed to expand aux\n"),
+      -1;
+  }
 
   // When using bones, most of the work is now done in oc_check_bone
 
-  if (NULL == (bone=oc_check_bone(g, node, v_edges))) {
+  // (it doesn't leave any edges or bone behind if it fails)
+  if (0 == (b = oc_check_bone(g, node, v_edges))) {
+    --(g->nodes);
     fprintf(stderr, "Failed to allocate bone for check block\n");
     return -1;
   }
+  bone = oc_graph_bone(g, b);
 
-  // we only have to stash the pointer and unsolved v edge count
-  g->top    [node - mblocks] = bone;
+  // we only have to stash the index and unsolved v edge count
+  g->top    [node - mblocks] = b;
   g->v_count[node - mblocks] = bone->a.unknowns;
 
   if (OC_DEBUG) {
@@ -387,9 +496,17 @@ int oc_graph_check_block(oc_graph *g, int *v_edges) {
   }
 
   // mark node as pending resolution
-  if (NULL == oc_push_pending(g, node))
+  if (-1 == oc_push_pending(g, node)) {
+    oc_unlink_check_bone(g, b, node, bone->a.unknowns);
+    g->top    [node - mblocks] = 0;
+    g->v_count[node - mblocks] = 0;
+    --(g->nodes);
     return fprintf(stdout, "oc_graph_check_block: failed to push pending\n"),
       -1;
+  }
+
+  OC_STAT(++(g->stats.check_blocks);
+	  g->stats.ns_graph += oc_stat_ns() - start);
 
   // success: return index of newly created node
   return node;
@@ -408,8 +525,8 @@ void oc_aux_rule(oc_graph *g, int anode) {
   assert(g->v_count[anode - mblocks] == 0);
 
   // bone becomes a solution
-  bone = g->top[anode - mblocks];
-  g->solution[anode] = bone;
+  bone = oc_graph_top(g, anode);
+  g->solution[anode] = g->top[anode - mblocks];
 
   // count all nodes except aux node itself:
   count = oc_count_unknowns(bone) - 1;
@@ -424,126 +541,195 @@ void oc_aux_rule(oc_graph *g, int anode) {
 
   // check that aux details in first element are OK
   assert(bone[1].a.node == anode);
-  assert(bone[1].b.link == NULL);
+  assert(bone[1].b.link == OC_NO_EDGE);
 
   // clean up 
-  g->top[anode - mblocks] = NULL; 
+  g->top[anode - mblocks] = 0; 
 }
 
 
+// Decrement an upper node's unsolved count during the cascade
+static inline int cascade_to(oc_graph *g, int node, int to) {
+
+  int mblocks = g->mblocks;
+
+  assert(to != node);
+
+  if (OC_DEBUG) {
+    fprintf(stdout, "  pending link %d\n", to);
+    printf("Decrementing v_count for block %d\n", to);
+  }
+
+  assert(g->v_count[to - mblocks]);
+  if (--(g->v_count[to - mblocks]) < 2)
+    return oc_push_pending(g, to);
+  return 0;
+}
+
 // Cascade works up from a newly-solved message or auxiliary block
 int oc_cascade(oc_graph *g, int node) {
 
   int mblocks  = g->mblocks;
   int coblocks = g->coblocks;
-  oc_n_edge_ring *ring, *p;
-  int to;
+  int q = g->q, i, h, slab, *sp;
+#if OC_GRAPH_STATS
+  int edges = 0;
+#endif
 
   assert(node < coblocks);
 
   OC_DEBUG && fprintf(stdout, "Cascading from node %d:\n", node);
 
-  assert ((g->bottom + node) != NULL);
-
-  p = (ring = g->bottom + node)->right;
+  // update unsolved edge count and push target to pending. Aux edges
+  // were created first, so they come first.
+  if (node < mblocks) {
+    for (i = 0, h = node * q; i < q; ++i, ++h)
+      if (!(g->aux_dead[h >> 3] & (1 << (h & 7)))) {
+	OC_STAT(++edges);
+	if (-1 == cascade_to(g, node, g->aux_map[h]))
+	  return -1;
+      }
+  }
 
-  // update unsolved edge count and push target to pending
-  while (p != ring) {
-    to = p->upper;
-    assert(to != node);
+  // The upper nodes' counts are scattered all over v_count, so fetch
+  // a whole slab's worth (and the next slab) before using any of them
+  for (slab = g->up_head[node]; slab; slab = *sp) {
+    sp = &OC_SLOT(g, slab);
+    if (*sp)
+      __builtin_prefetch(&OC_SLOT(g, *sp));
+    for (i = 1; i <= OC_SLAB_EDGES; ++i)
+      if (sp[i] >= 0)
+	__builtin_prefetch(g->v_count + sp[i] - mblocks, 1);
+    for (i = 1; i <= OC_SLAB_EDGES; ++i)
+      if (sp[i] >= 0) {
+	OC_STAT(++edges);
+	if (-1 == cascade_to(g, node, sp[i]))
+	  return -1;
+      }
+  }
 
-    if (OC_DEBUG) {
-      fprintf(stdout, "  pending link %d\n", to);
-      printf("Decrementing v_count for block %d\n", to);
-    }
+  OC_STAT(++(g->stats.cascade_calls);
+	  g->stats.cascade_edges += edges;
+	  if (edges > g->stats.cascade_max) g->stats.cascade_max = edges);
 
-    assert(g->v_count[to - mblocks]);
-    if (--(g->v_count[to - mblocks]) < 2)
-      if (NULL == oc_push_pending(g, to))
-	return -1;
-    p = p->right;
-  }
   return 0;
 }
 
-// Add a new node to the end of the pending list
-oc_uni_block *oc_push_pending(oc_graph *g, int value) {
+// Add a node to the end of the pending queue, unless it's already
+// queued. The resolver reads a node's unsolved edge count when it
+// takes it off the queue rather than when it's put on, so a second
+// copy of the node wouldn't add anything.
+int oc_push_pending(oc_graph *g, int node) {
 
-  oc_uni_block *p;
+  int slot = node - g->mblocks;
 
-#ifdef INSTRUMENT
+  assert(slot >= 0);
 
-  m.push_pending_calls++;
-  if (++m.pending_fill_level > m.pending_max_full)
-    ++m.pending_max_full;
+  if (g->queued[slot])
+    return 0;
 
-#endif
+  if (g->pending_count >= g->pending_size)
+    return fprintf(stderr, "oc_push_pending: queue full\n"), -1;
 
-  if (NULL == (p = alloc_block()))
-    return NULL;
+  OC_STAT(g->stats.push_pending_calls++;
+	  if (++g->stats.pending_fill_level > g->stats.pending_max_full)
+	    ++g->stats.pending_max_full);
 
-  p->a.next = NULL;
-  p->b.value = value;
+  g->queued[slot] = 1;
+  g->pending[(g->pending_head + g->pending_count++) % g->pending_size]
+    = node;
 
-  if (g->ptail != NULL)
-    g->ptail->a.next = p;
-  else
-    g->phead = p;
-  g->ptail = p;
-
-  return p;
+  return 0;
 }
 
-// Remove a node from the start of the pending list (returns a pointer
-// to the node so that it can be re-used or freed later)
-oc_uni_block *oc_shift_pending(oc_graph *g) {
+// Remove a node from the start of the pending queue
+int oc_shift_pending(oc_graph *g) {
 
-  oc_uni_block *node;
+  int node;
 
-#ifdef INSTRUMENT
+  assert(g->pending_count > 0);
 
-  --m.pending_fill_level;
+  OC_STAT(--g->stats.pending_fill_level);
 
-#endif
+  node = g->pending[g->pending_head];
+  if (++(g->pending_head) == g->pending_size)
+    g->pending_head = 0;
+  --(g->pending_count);
 
-  node = g->phead;
-  assert(node != NULL);
-
-  if (NULL == (g->phead = node->a.next))
-    g->ptail = NULL;
+  g->queued[node - g->mblocks] = 0;
 
   return node;
-
 }
 
 void oc_flush_pending(oc_graph *graph) {
 
-  oc_uni_block *tmp;
-
   assert(graph != NULL);
 
-  while ((tmp = graph->phead) != NULL) {
-    OC_DEBUG && fprintf(stdout, "Flushing pending node %d\n", tmp->b.value);
-    graph->phead = tmp->a.next;
-    free(tmp);
+  while (graph->pending_count) {
+    OC_DEBUG && fprintf(stdout, "Flushing pending node %d\n",
+			graph->pending[graph->pending_head]);
+    oc_shift_pending(graph);
   }
-  graph->ptail = NULL;
+  graph->pending_head = 0;
+}
 
+void oc_graph_set_mode(oc_graph *g, int mode) {
+  assert(g != NULL);
+  g->resolve_mode = mode;
 }
 
-// Pushing to solved is similar to pushing to pending, but we don't
-// need to allocate the new node
-void oc_push_solved(oc_uni_block *pnode, 
-		    oc_uni_block **phead,   // update caller's head
-		    oc_uni_block **ptail) { // and tail pointers
+void oc_graph_set_inactivation(oc_graph *g, int max_inactive) {
+  assert(g != NULL);
+  g->max_inactive = (max_inactive > 0) ? max_inactive : 0;
+  g->inact_retry  = 0;
+}
 
-  pnode->a.next  = NULL;
+int oc_graph_set_transparent_aux(oc_graph *g, const int *aux_reverse) {
+
+  assert(g != NULL);
+
+  if ((NULL != aux_reverse) && (NULL == g->t_parity) &&
+      (NULL == (g->t_parity = calloc(g->coblocks, sizeof(unsigned char)))))
+    return -1;
+
+  g->aux_rev = aux_reverse;
+  return 0;
+}
+
+void oc_graph_set_solved_callback(oc_graph *g,
+				  void (*fn)(void *arg, int node), void *arg) {
+  assert(g != NULL);
+  g->solved_cb  = fn;
+  g->solved_arg = arg;
+}
+
+// Pass a solved node to the callback or add it to the solved list.
+// List nodes are individually malloc'd and belong to the caller, who
+// can free() them. Returns -1 if we failed to allocate a list node.
+int oc_push_solved(oc_graph *g, int node,
+		   oc_uni_block **phead,   // update caller's head
+		   oc_uni_block **ptail) { // and tail pointers
+
+  oc_uni_block *p;
+
+  if (NULL != g->solved_cb) {
+    (*(g->solved_cb))(g->solved_arg, node);
+    return 0;
+  }
+
+  if (NULL == (p = malloc(sizeof(oc_uni_block))))
+    return -1;
+
+  p->a.next  = NULL;
+  p->b.value = node;
 
   if (*ptail != NULL)
-    (*ptail)->a.next = pnode;
+    (*ptail)->a.next = p;
   else
-    *phead = pnode;
-  *ptail = pnode;
+    *phead = p;
+  *ptail = p;
+
+  return 0;
 }
 
 
@@ -558,22 +744,24 @@ int oc_graph_resolve(oc_graph *graph, oc_uni_block **solved_list) {
   int ablocks  = graph->ablocks;
   int coblocks = graph->coblocks;
 
-  oc_uni_block *pnode;		// pending node
-
   // linked list for storing solved nodes (we return solved_head)
   oc_uni_block *solved_head = NULL;
   oc_uni_block *solved_tail = NULL;
 
-  int from, to, count_unsolved, xor_count, i, *p, *xp, *ep;
+  int from, to, count_unsolved, xor_count, i, *p, *xp, *ep, b;
 
   oc_bone *bone = NULL;
 
+#if OC_GRAPH_STATS
+  long long start = oc_stat_ns();
+#endif
+
   // mark solved list (passed by reference) as empty
   *solved_list = (oc_uni_block *) NULL;
 
   // Check whether our queue is empty. If it is, the caller needs to
   // add another check block
-  if (NULL == graph->phead) {
+  if (0 == graph->pending_count) {
     goto finish;
     //    return graph->done;
   }
@@ -584,14 +772,14 @@ int oc_graph_resolve(oc_graph *graph, oc_uni_block **solved_list) {
     goto finish;
   }
 
-  while (NULL != graph->phead) { // while items in pending queue
+  while (graph->pending_count) { // while items in pending queue
 
-    pnode = oc_shift_pending(graph);
-    from  = pnode->b.value;
+    from = oc_shift_pending(graph);
 
     assert(from >= mblocks);
 
-    bone           = graph->top    [from - mblocks];
+    b              = graph->top    [from - mblocks];
+    bone           = b ? oc_graph_bone(graph, b) : NULL;
     count_unsolved = graph->v_count[from - mblocks];
 
     if (OC_DEBUG) {
@@ -623,7 +811,8 @@ int oc_graph_resolve(oc_graph *graph, oc_uni_block **solved_list) {
       // This is an unsolved aux block. Solve it with aux rule
       oc_aux_rule(graph,from);
 
-      oc_push_solved(pnode, &solved_head, &solved_tail);
+      if (-1 == oc_push_solved(graph, from, &solved_head, &solved_tail))
+	return -1;
       if (-1 == oc_cascade(graph,from))
 	return -1;
 
@@ -652,9 +841,9 @@ int oc_graph_resolve(oc_graph *graph, oc_uni_block **solved_list) {
 
       // Set 'to' as solved
       assert (!graph->solution[to]);
-      pnode->b.value      = to;	// update value (was 'from')
-      graph->solution[to] = bone;
-      oc_push_solved(pnode, &solved_head, &solved_tail);
+      graph->solution[to] = b;
+      if (-1 == oc_push_solved(graph, to, &solved_head, &solved_tail))
+	return -1;
 
 
       // Update global structure and decide if we're done
@@ -667,7 +856,7 @@ int oc_graph_resolve(oc_graph *graph, oc_uni_block **solved_list) {
 	}
       } else {
 	// Solved auxiliary block, so queue it for resolving again
-	if (NULL == oc_push_pending(graph, to))
+	if (-1 == oc_push_pending(graph, to))
 	  return -1;
       }
 
@@ -677,35 +866,27 @@ int oc_graph_resolve(oc_graph *graph, oc_uni_block **solved_list) {
 
     } // end if(count_unsolved is 0 or 1)
 
-    // If we reach this point, then pnode has been added to the
-    // solved list. We continue to avoid the following free()
-    if (STEPPING) goto finish;
+    // If we reach this point, then a node has been solved. In step
+    // mode we return it to the caller straight away.
+    if (OC_RESOLVE_STEP == graph->resolve_mode) goto finish;
     continue;
 
   discard:
     OC_DEBUG && fprintf(stdout, "Skipping node %d\n\n", from);
-    free_block(pnode);
 
   } // end while(items in pending queue)
 
- finish:
+  // Peeling is stuck. If inactivation is on, it may be able to solve
+  // everything that's left in one go.
+  if (graph->max_inactive &&
+      (-1 == oc_graph_inactivate(graph, &solved_head, &solved_tail)))
+    return -1;
 
-  if (graph->done && !--ouser) release_blocks();
+ finish:
 
-#ifdef INSTRUMENT
-  if (graph -> done) {
-    fprintf(stderr, "Information on oc_delete_n_edge:\n");
-    fprintf(stderr, "  Total Calls = %d\n", m.delete_n_calls);
-    fprintf(stderr, "  Total Seeks = %d\n", m.delete_n_seek_length);
-    fprintf(stderr, "  Avg.  Seeks = %g\n", ((double) m.delete_n_seek_length
-					     / m.delete_n_calls));
-    fprintf(stderr, "  Max.  Seek  = %d\n", m.delete_n_max_seek);
-
-    fprintf(stderr, "\nInformation on pending queue:\n");
-    fprintf(stderr, "  Total push calls = %d\n", m.push_pending_calls);
-    fprintf(stderr, "  Max. Fill Level  = %d\n", m.pending_max_full);
-  }
-#endif
+  OC_STAT(if (graph->done && !graph->stats.check_blocks_to_decode)
+	    graph->stats.check_blocks_to_decode = graph->nodes - coblocks;
+	  graph->stats.ns_resolve += oc_stat_ns() - start);
 
   // Return done status and solved list (passed by reference)
   *solved_list = solved_head;
@@ -713,3 +894,56 @@ int oc_graph_resolve(oc_graph *graph, oc_uni_block **solved_list) {
 
 
 }
+
+void oc_graph_get_stats(oc_graph *g, oc_graph_stats *stats) {
+
+  assert(g     != NULL);
+  assert(stats != NULL);
+
+  *stats = g->stats;
+
+  stats->nodes       = g->nodes;
+  stats->node_space  = g->node_space;
+  stats->bones_used  = g->boneyard_next;
+  stats->bones_space = (long long) g->bone_chunks_used << g->bone_bits;
+  stats->slabs_used  = g->slab_next / OC_SLAB_INTS;
+  stats->slabs_space = (long long) g->slab_chunks_used *
+    (OC_SLAB_CHUNK_INTS / OC_SLAB_INTS);
+}
+
+// Free everything allocated by oc_graph_init (and since). Nodes that
+// were returned in solved lists belong to the caller and aren't
+// touched.
+void oc_graph_free(oc_graph *graph) {
+
+  int i;
+
+  assert(graph != NULL);
+
+  oc_flush_pending(graph);
+
+#define OC_FREE(MEMBER) \
+  if (NULL != graph->MEMBER) { free(graph->MEMBER); graph->MEMBER = NULL; }
+
+  OC_FREE(v_count);
+  OC_FREE(pending);
+  OC_FREE(queued);
+  OC_FREE(solution);
+  OC_FREE(top);
+  OC_FREE(up_head);
+  OC_FREE(up_tail);
+  OC_FREE(aux_dead);
+  OC_FREE(t_parity);
+  OC_FREE(t_list);
+  if (NULL != graph->bone_chunks)
+    for (i = 0; i < graph->bone_chunks_used; ++i)
+      free(graph->bone_chunks[i]);
+  if (NULL != graph->slab_chunks)
+    for (i = 0; i < graph->slab_chunks_used; ++i)
+      free(graph->slab_chunks[i]);
+  OC_FREE(bone_chunks);
+  OC_FREE(slab_chunks);
+  graph->bone_chunks_used = graph->slab_chunks_used = 0;
+
+#undef OC_FREE
+}
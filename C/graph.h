@@ -6,24 +6,160 @@
 #include "online-code.h"
 #include "bones.h"
 
+// Statistics (see oc_graph_stats in structs.h). Build with
+// -DOC_GRAPH_STATS=0 to compile out all the counting and timing.
+#ifndef OC_GRAPH_STATS
+#define OC_GRAPH_STATS 1
+#endif
+
+#if OC_GRAPH_STATS
+#include <time.h>
+#define OC_STAT(x) do { x; } while (0)
+static inline long long oc_stat_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+#else
+#define OC_STAT(x) do { } while (0)
+#endif
+
+// Copy the graph's statistics into *stats (it's safe to call this at
+// any time, but not while another thread is using the graph)
+void oc_graph_get_stats(oc_graph *g, oc_graph_stats *stats);
+
 // Allocate spaces within graph structure and initialise them.  
 //
-// The fudge factor parameter is a multiplier (>1.0) telling how much
-// extra space to allocate beyond the expected number of check blocks. 
+// The fudge factor parameter is a multiplier telling how much space to
+// allocate up front relative to the expected number of check blocks.
+// Everything grows if more check blocks than that arrive, so it's only
+// a hint (values around 1.0 to 1.2 are fine). 
 //
 // Returns 0 on success
 //
 int oc_graph_init(oc_graph *graph, oc_codec *codec, float fudge);
 
+// Free all memory allocated by the graph (but not the structure
+// itself or any solved lists returned by oc_graph_resolve)
+void oc_graph_free(oc_graph *graph);
+
 
 void oc_decommission_node (oc_graph *g, int node);
-void oc_push_solved (oc_uni_block *pnode, 
-		     oc_uni_block **phead,  // update caller's head
-		     oc_uni_block **ptail); // and tail pointers
-oc_n_edge_ring *oc_create_n_edge(oc_graph *g, int upper, int lower);
 void oc_delete_n_edge (oc_graph *g, int upper, int lower, int decrement);
-oc_uni_block *oc_push_pending(oc_graph *g, int value);
 
+// Up edges. Create returns an edge handle (see structs.h) or
+// OC_NO_EDGE if there's no room left for it.
+int  oc_create_n_edge(oc_graph *g, int upper, int lower);
+void oc_delete_lower_end(oc_graph *g, int edge, int upper, int lower,
+			 int decrement);
+
+// Bones are stored as boneyard indices; these turn them into pointers
+// (NULL if the node has no bone). Pointers stay valid for the life of
+// the graph.
+static inline oc_bone *oc_graph_bone(oc_graph *g, int b) {
+  return g->bone_chunks[b >> g->bone_bits] + (b & ((1 << g->bone_bits) - 1));
+}
+
+static inline oc_bone *oc_graph_solution(oc_graph *g, int node) {
+  return g->solution[node] ? oc_graph_bone(g, g->solution[node]) : NULL;
+}
+
+static inline oc_bone *oc_graph_top(oc_graph *g, int node) {
+  int b = g->top[node - g->mblocks];
+  return b ? oc_graph_bone(g, b) : NULL;
+}
+
+// slab slot i (see structs.h)
+#define OC_SLOT(g, i) \
+  ((g)->slab_chunks[(i) >> OC_SLAB_CHUNK_BITS][(i) & (OC_SLAB_CHUNK_INTS - 1)])
+
+// pending queue (returns 0 on success)
+int  oc_push_pending(oc_graph *g, int node);
+int  oc_shift_pending(oc_graph *g);
+void oc_flush_pending(oc_graph *g);
+
+// Resolver modes
+//
+// In OC_RESOLVE_STEP mode (the default) oc_graph_resolve returns as
+// soon as it solves a node, so the caller has to keep calling it until
+// it returns an empty solved list. In OC_RESOLVE_FIXPOINT mode it
+// keeps going until the pending queue is empty (or the message is
+// decoded) and returns all newly-solved nodes at once.
+#define OC_RESOLVE_STEP     0
+#define OC_RESOLVE_FIXPOINT 1
+
+void oc_graph_set_mode(oc_graph *g, int mode);
+
+// If a solved callback is set, solved nodes are passed to it (as they
+// are solved) instead of being returned in the solved list. Pass NULL
+// to go back to using the list.
+void oc_graph_set_solved_callback(oc_graph *g,
+				  void (*fn)(void *arg, int node), void *arg);
+
+// Inactivation decoding
+//
+// Peeling alone needs noticeably more than (1 + qe) * mblocks check
+// blocks for small and medium messages, because it gets stuck while
+// there are still enough equations to solve what's left. With
+// inactivation on, when the pending queue runs dry with message
+// blocks still unsolved, oc_graph_resolve treats the rest as a linear
+// system: peeling carries on inside it, "inactivating" a node
+// whenever it gets stuck, and the inactivated nodes are then solved
+// together by Gaussian elimination on a dense bit matrix (see
+// inactivate.c). If it works, everything is solved at once (even in
+// step mode); if not, the graph is left as it was.
+//
+// max_inactive limits how many nodes can be inactivated at once (0
+// turns inactivation off, which is the default). It's a trade-off:
+// each inactive node's solution is a sum of about as many blocks as
+// there were unsolved nodes left, so the decoder's data plane does
+// more xoring in return for needing fewer check blocks. The dense
+// matrix takes about max_inactive^2 / 4 bytes (plus max_inactive / 8
+// bytes per unsolved node). A few hundred is a reasonable limit; the
+// gain is biggest for small and medium messages, where peeling needs
+// the most extra check blocks anyway.
+void oc_graph_set_inactivation(oc_graph *g, int max_inactive);
+
+// Returns 1 if the message is now decoded, 0 if not and -1 on error.
+// oc_graph_resolve calls this; the solved list pointers are its own.
+int  oc_graph_inactivate(oc_graph *g,
+			 oc_uni_block **phead, oc_uni_block **ptail);
+
+// used by the above and oc_graph_resolve
+int  oc_push_solved(oc_graph *g, int node,
+		    oc_uni_block **phead, oc_uni_block **ptail);
+void oc_aux_rule(oc_graph *g, int anode);
+int  oc_cascade(oc_graph *g, int node);
+
+// Transparent auxiliary blocks
+//
+// Normally an aux block in a check block is "opaque": it's an
+// ordinary lower node of the check node, and its message blocks are
+// only reached through the aux node's own bone. With transparent aux
+// blocks on, oc_graph_check_block replaces each unsolved aux node in
+// a check block with that aux block's message blocks before making
+// the bone, so the check node links straight through to them. A
+// message block that turns up an even number of times (in two of the
+// aux blocks, or in an aux block and the check block itself) cancels
+// out, which is where the extra solving power comes from. Solved aux
+// nodes are left alone since they're already known.
+//
+// The catch is that a check node no longer solves the aux node for
+// the other check blocks that share it, and peeling through an opaque
+// aux node already reaches its message blocks by way of the aux rule.
+// So decoding usually needs more check blocks this way, not fewer, and
+// the expanded check blocks cost more XORs in the data plane. It's a
+// mode to measure against the usual one (mindecoder -T, bench -T)
+// rather than something that's always better.
+//
+// aux_reverse is the codec's reverse aux map (oc_aux_reverse_map);
+// pass NULL to turn the mode off. It only affects check blocks graphed
+// after the call. Returns 0 on success, -1 if out of memory.
+int  oc_graph_set_transparent_aux(oc_graph *g, const int *aux_reverse);
+
+
+// Returns new node number or -1 on error
+int oc_graph_check_block(oc_graph *g, int *v_edges);
 
 int oc_graph_resolve(oc_graph *graph, oc_uni_block **solved_list);
 
@@ -0,0 +1,108 @@
+// Priority queue (see heap.h)
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "heap.h"
+
+int oc_heap_init(oc_heap *h, int blocks, int size) {
+
+  assert(h != NULL);
+
+  if (blocks < 1)
+    return fprintf(stderr, "oc_heap_init: blocks (%d) invalid\n", blocks), -1;
+  if (size < 16)
+    size = 16;
+
+  if (NULL == (h->heap = malloc(size * sizeof(oc_heap_entry))))
+    return fprintf(stderr, "oc_heap_init: failed to allocate heap\n"), -1;
+
+  h->max_size      = size;
+  h->size          = 0;
+  h->blocks        = blocks;
+  h->read_position = 0;
+  h->sweep         = 0;
+
+  return 0;
+}
+
+void oc_heap_free(oc_heap *h) {
+
+  assert(h != NULL);
+
+  if (NULL != h->heap) free(h->heap);
+
+  h->heap     = NULL;
+  h->max_size = h->size = 0;
+}
+
+// Standard binary heap (smallest key at the root, children of i at
+// 2i + 1 and 2i + 2)
+int oc_heap_push(oc_heap *h, int block, int target) {
+
+  oc_heap_entry *p, e;
+  int i, parent;
+
+  assert(h != NULL);
+  assert((block >= 0) && (block < h->blocks));
+
+  if (h->size == h->max_size) {
+    p = realloc(h->heap, 2 * (size_t) h->max_size * sizeof(oc_heap_entry));
+    if (NULL == p)
+      return fprintf(stderr, "oc_heap_push: failed to grow heap\n"), -1;
+    h->heap      = p;
+    h->max_size *= 2;
+  }
+
+  // blocks behind the read head wait for the next sweep
+  e.key    = (h->sweep + (block < h->read_position)) * h->blocks + block;
+  e.block  = block;
+  e.target = target;
+
+  // sift up
+  i = h->size++;
+  while (i) {
+    parent = (i - 1) >> 1;
+    if (h->heap[parent].key <= e.key)
+      break;
+    h->heap[i] = h->heap[parent];
+    i = parent;
+  }
+  h->heap[i] = e;
+
+  return 0;
+}
+
+int oc_heap_pop(oc_heap *h, oc_heap_entry *e) {
+
+  oc_heap_entry last;
+  int i, child, size;
+
+  assert(h != NULL);
+  assert(e != NULL);
+
+  if (0 == h->size)
+    return -1;
+
+  *e = h->heap[0];
+  h->read_position = e->block;
+  h->sweep         = e->key / h->blocks;
+
+  // sift the last entry down from the root
+  size = --(h->size);
+  last = h->heap[size];
+  i    = 0;
+  while ((child = 2 * i + 1) < size) {
+    if ((child + 1 < size) && (h->heap[child + 1].key < h->heap[child].key))
+      ++child;
+    if (last.key <= h->heap[child].key)
+      break;
+    h->heap[i] = h->heap[child];
+    i = child;
+  }
+  if (size)
+    h->heap[i] = last;
+
+  return 0;
+}
@@ -1,5 +1,8 @@
 // Priority queue implementation (heap-based)
 
+#ifndef OC_HEAP_H
+#define OC_HEAP_H
+
 // The structures and routines here are intended to support more
 // efficient reads from an external message file or check block file.
 // The naive approach would be:
@@ -44,10 +47,18 @@
 // See "diskio.h" for more details of using the priority queue as part
 // of a caching/command queueing strategy.
 
+// The heap holds (block, target) pairs: block is the block to be read
+// and target is whatever the caller wants to do with it (eg, the
+// index of a check block in a batch that it's to be XORed into). A
+// block that's wanted by several targets just has several entries,
+// and since they all have the same key they come off the heap one
+// after the other, so the block only needs to be read once.
+
 typedef struct {
 
-  int            block;		// ID of block to be read from file
-  oc_block_list *xor_list;	// will be XORed into these blocks
+  long long key;		// sweep * blocks + block (see below)
+  int       block;		// ID of block to be read from file
+  int       target;		// will be XORed into this
 
 } oc_heap_entry;
 
@@ -62,8 +73,37 @@ typedef struct {
   // manner. That means that the heap will have to sort block IDs
   // relative to the current read position (seek pointer) rather than
   // relative to the start of the file.
+  //
+  // It works like an elevator: blocks at or after the read position
+  // are read on the current sweep and blocks before it wait until the
+  // next one (after we wrap around at eof). Keys are sweep number *
+  // blocks + block, so entries can be pushed while the heap is being
+  // drained and still come out in the right order.
 
-  int read_position;
+  int       read_position;	// last block popped
+  long long sweep;
+  int       blocks;		// number of blocks in the file
 
 } oc_heap;
 
+// Returns 0 on success. size is just a hint; the heap grows as needed
+int  oc_heap_init(oc_heap *h, int blocks, int size);
+void oc_heap_free(oc_heap *h);
+
+// Queue a read of block for target. Returns 0 on success.
+int  oc_heap_push(oc_heap *h, int block, int target);
+
+// Take the next entry in (circular) file order. Returns 0 on success
+// or -1 if the heap is empty.
+int  oc_heap_pop(oc_heap *h, oc_heap_entry *e);
+
+// Look at the next entry without removing it (NULL if empty)
+static inline oc_heap_entry *oc_heap_peek(oc_heap *h) {
+  return h->size ? h->heap : NULL;
+}
+
+static inline int oc_heap_size(oc_heap *h) {
+  return h->size;
+}
+
+#endif
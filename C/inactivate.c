@@ -0,0 +1,723 @@
+// Inactivation decoding (see oc_graph_set_inactivation in graph.h)
+//
+// Peeling gets stuck as soon as every unused aux/check node has two
+// or more unsolved lowers, even if there are already more than enough
+// equations to pin down the rest of the message. When that happens,
+// this routine takes what's left (the unsolved message/aux nodes and
+// the equations that still mention them) and solves it as a linear
+// system over GF(2), in the same way that Raptor decoders do:
+//
+// 1. Carry on peeling the leftover system, but whenever that gets
+//    stuck, "inactivate" one of the unknowns (the one that's in the
+//    most equations) and treat it as if it were known. Each equation
+//    used up this way solves one "pivot" node in terms of earlier
+//    pivots and inactive nodes.
+//
+// 2. Substituting for the pivots in the equations that are left over
+//    gives a small, dense system in just the inactive nodes. That's
+//    put into triangular form with bit-matrix Gaussian elimination.
+//
+// 3. The inactive nodes are then solved one at a time, each from some
+//    set of the original equations added together. Apart from the
+//    node being solved, everything that doesn't cancel out is already
+//    known by then, so the sum becomes a new bone. The equation that
+//    each pivot was found from is already a bone that solves it once
+//    the other nodes in it are known, just like with the propagation
+//    rule, so pivots are solved as soon as that happens.
+//
+// The graph is only changed if the whole system can be solved: new
+// bones are only made once every inactive node's sum has been worked
+// out and known to fit, and are given back if the boneyard can't hold
+// them all. So a failed attempt costs time but nothing else (unless
+// memory runs out part way through installing the solutions). Nodes
+// are solved in an order where everything in a node's solution comes
+// before it, so the decoder's data plane doesn't need to know about
+// any of this.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "online-code.h"
+#include "graph.h"
+#include "bones.h"
+
+#define OC_DEBUG 0
+
+// Column states: pivots hold the order in which they were found, and
+// inactive columns hold -2 - their index in the dense system
+#define COL_ACTIVE       -1
+#define IS_PIVOT(st)     ((st) >= 0)
+#define INACTIVE_COL(st) (-2 - (st))
+
+#define SIG(s, i) ((s)->sig + (size_t) (i) * (s)->words)
+
+typedef struct {
+
+  oc_graph *g;
+
+  // The leftover system. Rows are equations (aux or check nodes) and
+  // columns are unsolved message/aux nodes. Both sides are kept as
+  // packed lists, so row r's columns are row_cols[row_start[r]] up to
+  // (but not including) row_cols[row_start[r + 1]].
+  int  rows, cols, nnz;
+  int *row_node, *row_start, *row_cols;
+  int *col_node, *col_start, *col_rows;
+  int *col_of;			// per msg/aux node: column + 1 (0 => none)
+
+  // peeling with inactivation
+  int           *active;	// per row: active columns left in it
+  int           *deg;		// per column: unused rows it's in
+  int           *state;		// per column (see above)
+  unsigned char *used;		// per row: has it solved a pivot?
+  int           *ripple;	// rows down to one active column
+  int            ripple_count;
+  int            pivots;
+  int           *pivot_row;	// in the order they were found
+  int           *pivot_col;
+  int            k;
+  int           *inactive;	// columns, in the order inactivated
+
+  // per pivot: its signature, and later which sums it's part of (see
+  // eliminate and inactive_sums)
+  uint64_t      *sig;
+
+  // Dense system: one k-bit row per inactive column (the basis row
+  // whose lowest bit is that column) plus, for each one, which of the
+  // accepted leftover rows were added together to make it
+  int            words;		// 64-bit words per bit row
+  uint64_t      *basis, *track, *x, *t;
+  uint64_t      *tacc;		// tracking bits, transposed
+  int           *level;		// per pivot (see inactive_sums)
+  unsigned char *have;		// per column: is there a basis row?
+  int           *acc_row;	// leftover rows that made it into the basis
+  int            accepted;
+
+  // parity of each node when adding equations together
+  unsigned char *parity;	// per node: bit 0 parity, bit 1 listed
+  int           *list;
+  int            listed;
+
+  // per inactive column: the nodes in its sum (packed, from
+  // vnodes[vstart[j]]) and then the new bone made from them
+  int           *vnodes, *vstart;
+  int            vspace;
+  int           *vbone;
+
+  // pivots sorted by level (see commit)
+  int           *start, *order;
+
+} oc_inact;
+
+static void free_inact(oc_inact *s) {
+
+  free(s->row_node);  free(s->row_start); free(s->row_cols);
+  free(s->col_node);  free(s->col_start); free(s->col_rows);
+  free(s->col_of);    free(s->active);    free(s->deg);
+  free(s->state);     free(s->used);      free(s->ripple);
+  free(s->pivot_row); free(s->pivot_col); free(s->inactive);
+  free(s->sig);       free(s->tacc);      free(s->basis);
+  free(s->track);     free(s->x);         free(s->t);
+  free(s->have);      free(s->acc_row);   free(s->parity);
+  free(s->list);      free(s->vbone);     free(s->level);
+  free(s->vnodes);    free(s->vstart);    free(s->start);
+  free(s->order);
+}
+
+// Collect the equations that still have unsolved nodes in them. An
+// aux node's bone is an equation whether or not the aux node is
+// solved (it's an unknown in it if it isn't), and a check node's bone
+// is one until all its lowers are solved. Returns 0, or the number of
+// equations we're short of (there have to be at least as many as
+// there are unknowns), or -1 if we ran out of memory.
+static int build_rows(oc_inact *s) {
+
+  oc_graph *g = s->g;
+  int mblocks  = g->mblocks;
+  int coblocks = g->coblocks;
+  int node, lower, n, i, r, c, e;
+  oc_bone *bone;
+
+  // first pass: count rows and entries
+  for (node = mblocks; node < g->nodes; ++node) {
+    if (!g->top[node - mblocks])
+      continue;
+    n = g->v_count[node - mblocks];
+    if ((node < coblocks) && !g->solution[node])
+      ++n;			// unsolved aux node itself
+    if (n) {
+      ++(s->rows);
+      s->nnz += n;
+    }
+  }
+
+  // every unsolved node is in a row, and each row solves one node at
+  // most, so this is a quick way out when too few have arrived
+  n = g->unsolved_count;
+  for (node = mblocks; node < coblocks; ++node)
+    if (!g->solution[node])
+      ++n;
+  if (s->rows < n)
+    return n - s->rows;
+
+  if ((NULL == (s->row_node  = malloc(s->rows * sizeof(int))))       ||
+      (NULL == (s->row_start = malloc((s->rows + 1) * sizeof(int)))) ||
+      (NULL == (s->row_cols  = malloc(s->nnz * sizeof(int))))        ||
+      (NULL == (s->col_node  = malloc(n * sizeof(int))))             ||
+      (NULL == (s->col_start = calloc(n + 1, sizeof(int))))          ||
+      (NULL == (s->col_rows  = malloc(s->nnz * sizeof(int))))        ||
+      (NULL == (s->col_of    = calloc(coblocks, sizeof(int)))))
+    return -1;
+
+  // second pass: fill in the rows, numbering columns as we go
+  r = e = 0;
+  for (node = mblocks; node < g->nodes; ++node) {
+    if (NULL == (bone = oc_graph_top(g, node)))
+      continue;
+    s->row_start[r] = e;
+    for (i = 1; i <= bone->a.unknowns; ++i) {
+      lower = bone[i].a.node;
+      if (g->solution[lower])
+	continue;
+      assert(e < s->nnz);
+      if (0 == (c = s->col_of[lower])) {
+	assert(s->cols < n);
+	s->col_node[s->cols] = lower;
+	c = s->col_of[lower] = ++(s->cols);
+      }
+      s->row_cols[e++] = --c;
+      ++(s->col_start[c + 1]);
+    }
+    if (e > s->row_start[r])
+      s->row_node[r++] = node;
+  }
+  assert(r == s->rows);
+  assert(e == s->nnz);
+  assert(s->cols == n);
+  s->row_start[r] = e;
+
+  // and the transpose
+  for (c = 0; c < s->cols; ++c)
+    s->col_start[c + 1] += s->col_start[c];
+  for (r = 0; r < s->rows; ++r)
+    for (e = s->row_start[r]; e < s->row_start[r + 1]; ++e)
+      s->col_rows[s->col_start[s->row_cols[e]]++] = r;
+  for (c = s->cols; c > 0; --c)
+    s->col_start[c] = s->col_start[c - 1];
+  s->col_start[0] = 0;
+
+  return 0;
+}
+
+// A column has been pivoted or inactivated, so it's no longer active
+// in any of the rows it's in
+static void retire(oc_inact *s, int c) {
+
+  int e, r;
+
+  for (e = s->col_start[c]; e < s->col_start[c + 1]; ++e) {
+    r = s->col_rows[e];
+    if (!s->used[r] && (1 == --(s->active[r])))
+      s->ripple[s->ripple_count++] = r;
+  }
+}
+
+// Step 1: every column becomes either a pivot or inactive. Returns 0,
+// a guess at how many more check blocks we need, or -1.
+static int peel(oc_inact *s) {
+
+  oc_graph *g = s->g;
+  int left = s->cols, r, c, e, best;
+
+  if ((NULL == (s->active    = malloc(s->rows * sizeof(int))))     ||
+      (NULL == (s->deg       = malloc(s->cols * sizeof(int))))     ||
+      (NULL == (s->state     = malloc(s->cols * sizeof(int))))     ||
+      (NULL == (s->used      = calloc(s->rows, 1)))                ||
+      (NULL == (s->ripple    = malloc(s->rows * sizeof(int))))     ||
+      (NULL == (s->pivot_row = malloc(s->cols * sizeof(int))))     ||
+      (NULL == (s->pivot_col = malloc(s->cols * sizeof(int))))     ||
+      (NULL == (s->inactive  = malloc(g->max_inactive * sizeof(int)))))
+    return -1;
+
+  for (r = 0; r < s->rows; ++r)
+    if (1 == (s->active[r] = s->row_start[r + 1] - s->row_start[r]))
+      s->ripple[s->ripple_count++] = r;
+  for (c = 0; c < s->cols; ++c) {
+    s->state[c] = COL_ACTIVE;
+    s->deg[c]   = s->col_start[c + 1] - s->col_start[c];
+  }
+
+  while (left) {
+
+    if (s->ripple_count) {
+
+      // A row with one active column left solves that column. Rows can
+      // lose their last active column while they're waiting.
+      r = s->ripple[--(s->ripple_count)];
+      if (s->used[r] || (1 != s->active[r]))
+	continue;
+      for (e = s->row_start[r]; COL_ACTIVE != s->state[s->row_cols[e]]; ++e)
+	;
+      c = s->row_cols[e];
+
+      s->used[r] = 1;
+      for (e = s->row_start[r]; e < s->row_start[r + 1]; ++e)
+	--(s->deg[s->row_cols[e]]);
+
+      s->state[c] = s->pivots;
+      s->pivot_row[s->pivots]   = r;
+      s->pivot_col[s->pivots++] = c;
+
+    } else {
+
+      // Stuck, so inactivate the column that's in the most unused rows.
+      // If that's none, the column can't be solved yet.
+      best = -1;
+      for (c = 0; c < s->cols; ++c)
+	if ((COL_ACTIVE == s->state[c]) &&
+	    ((best < 0) || (s->deg[c] > s->deg[best])))
+	  best = c;
+      if (0 == s->deg[best])
+	return 1;
+      if (s->k == g->max_inactive)
+	return 1 + s->cols / 64;
+
+      c = best;
+      s->state[c] = -2 - s->k;
+      s->inactive[(s->k)++] = c;
+    }
+
+    retire(s, c);
+    --left;
+  }
+
+  OC_DEBUG && fprintf(stdout, "Inactivation: %d unknowns, %d rows, "
+		      "%d pivots, %d inactive\n",
+		      s->cols, s->rows, s->pivots, s->k);
+  return 0;
+}
+
+// Flip the parity of every node in row r's equation, remembering each
+// node the first time we see it
+static void flip_row(oc_inact *s, int r) {
+
+  oc_bone *bone = oc_graph_top(s->g, s->row_node[r]);
+  int i, node;
+
+  for (i = 1; i <= bone->b.size; ++i) {
+    node = bone[i].a.node;
+    if (!(s->parity[node] & 2)) {
+      s->list[(s->listed)++] = node;
+      s->parity[node] |= 2;
+    }
+    s->parity[node] ^= 1;
+  }
+}
+
+static inline void xor_words(uint64_t *to, const uint64_t *from, int words) {
+  while (words--)
+    *(to++) ^= *(from++);
+}
+
+// Add row r's substitutions into x: the bits of its inactive columns
+// and the signatures of its pivot columns (other than the one it
+// solves, if it's a pivot row)
+static void reduce_row(oc_inact *s, int r, int pivot, uint64_t *x) {
+
+  int e, st, j;
+
+  for (e = s->row_start[r]; e < s->row_start[r + 1]; ++e) {
+    st = s->state[s->row_cols[e]];
+    if (IS_PIVOT(st)) {
+      if (st != pivot)
+	xor_words(x, SIG(s, st), s->words);
+    } else {
+      j = INACTIVE_COL(st);
+      x[j >> 6] ^= 1ull << (j & 63);
+    }
+  }
+}
+
+// Step 2: reduce the leftover rows down to their inactive columns and
+// add them to the basis until it's full. Returns 0, the number of rows
+// we're short of, or -1.
+//
+// Each pivot is equal to some known nodes plus some inactive ones (its
+// "signature"). Pivot rows only have earlier pivots in them, so one
+// pass in pivot order works out all the signatures, and then reducing
+// a leftover row is just a matter of adding up its pivots' signatures.
+static int eliminate(oc_inact *s) {
+
+  int k = s->k, words, r, w, c, i;
+  uint64_t *x, *t;
+
+  s->words = words = (k + 63) / 64;
+
+  if ((NULL == (s->sig     = calloc((size_t) s->pivots * words + 1, 8))) ||
+      (NULL == (s->basis   = malloc((k + 1) * (words + 1) * 8)))       ||
+      (NULL == (s->track   = malloc((k + 1) * (words + 1) * 8)))       ||
+      (NULL == (s->x       = malloc((words + 1) * 8)))                 ||
+      (NULL == (s->t       = malloc((words + 1) * 8)))                 ||
+      (NULL == (s->have    = calloc(k + 1, 1)))                        ||
+      (NULL == (s->acc_row = malloc((k + 1) * sizeof(int)))))
+    return -1;
+  x = s->x;
+  t = s->t;
+
+  for (i = 0; i < s->pivots; ++i)
+    reduce_row(s, s->pivot_row[i], i, SIG(s, i));
+
+  for (r = 0; (r < s->rows) && (s->accepted < k); ++r) {
+
+    if (s->used[r])
+      continue;
+
+    memset(x, 0, words * 8);
+    reduce_row(s, r, -1, x);
+
+    memset(t, 0, words * 8);
+    t[s->accepted >> 6] = 1ull << (s->accepted & 63);
+
+    // Knock out bits that already have a basis row. Basis row c's
+    // highest bit is c, so this only ever clears bits from the top.
+    for (w = words - 1; w >= 0; --w)
+      while (x[w]) {
+	c = 64 * w + 63 - __builtin_clzll(x[w]);
+	if (!s->have[c]) {
+	  memcpy(s->basis + c * words, x, words * 8);
+	  memcpy(s->track + c * words, t, words * 8);
+	  s->have[c] = 1;
+	  s->acc_row[(s->accepted)++] = r;
+	  goto next_row;
+	}
+	xor_words(x, s->basis + c * words, w + 1);
+	xor_words(t, s->track + c * words, words);
+      }
+    // otherwise it was redundant
+  next_row:
+    ;
+  }
+
+  return (s->accepted < k) ? k - s->accepted : 0;
+}
+
+// The basis is triangular: row c has bit c and maybe some lower ones.
+// So we solve the inactive nodes from the bottom up (j = 0 first),
+// each one from the accepted rows that made its basis row (which
+// brings in inactive nodes that are already solved). If the pivots in
+// those rows were all cancelled out with their own rows, whose pivots
+// would in turn need cancelling, and so on, every sum would end up
+// including most of the equations. Instead, each pivot is solved as
+// soon as everything in its row is, and after that it can just be
+// used as it is. A pivot's level is the last inactive node it depends
+// on (-1 if none). Pivots found early in step 1 only depend on nodes
+// inactivated early, so they're solved early.
+
+// Step 3a: work out pivot levels, then which equations go into each
+// inactive node's sum. The accepted rows are given by the tracking
+// bits, but any of their pivots that aren't solved yet by then have
+// to be cancelled out with pivot rows, which can bring in other
+// pivots, and so on. Going back through the pivots in reverse order
+// handles that for every sum at once: afterwards, bit j of pivot i's
+// vector (which reuses its signature's space) says whether its row is
+// part of inactive node j's sum.
+static int inactive_sums(oc_inact *s) {
+
+  int k = s->k, words = s->words, i, j, a, w, e, st, level, hi;
+  uint64_t *y, bits;
+  int any;
+
+  if ((NULL == (s->tacc  = calloc((size_t) (k + 1) * words + 1, 8))) ||
+      (NULL == (s->level = malloc((s->pivots + 1) * sizeof(int)))))
+    return -1;
+
+  for (i = 0; i < s->pivots; ++i) {
+    level = -1;
+    for (e = s->row_start[s->pivot_row[i]];
+	 e < s->row_start[s->pivot_row[i] + 1]; ++e) {
+      st = s->state[s->row_cols[e]];
+      if (IS_PIVOT(st)) {
+	if ((st != i) && (s->level[st] > level))
+	  level = s->level[st];
+      } else if (INACTIVE_COL(st) > level) {
+	level = INACTIVE_COL(st);
+      }
+    }
+    s->level[i] = level;
+  }
+
+  // transpose the tracking bits: which inactive nodes' sums is each
+  // accepted row part of?
+  for (j = 0; j < k; ++j)
+    for (w = 0; w < words; ++w)
+      for (bits = s->track[j * words + w]; bits; bits &= bits - 1) {
+	a = 64 * w + __builtin_ctzll(bits);
+	s->tacc[a * words + (j >> 6)] |= 1ull << (j & 63);
+      }
+
+  memset(s->sig, 0, (size_t) s->pivots * words * 8);
+  for (a = 0; a < s->accepted; ++a)
+    for (e = s->row_start[s->acc_row[a]];
+	 e < s->row_start[s->acc_row[a] + 1]; ++e)
+      if (IS_PIVOT(st = s->state[s->row_cols[e]]))
+	xor_words(SIG(s, st), s->tacc + a * words, words);
+
+  for (i = s->pivots - 1; i >= 0; --i) {
+
+    // pivot i is already solved for sums j > its level
+    y  = SIG(s, i);
+    hi = s->level[i] + 1;
+    for (w = words - 1; (w >= 0) && (64 * w >= hi); --w)
+      y[w] = 0;
+    if ((w >= 0) && (hi & 63))
+      y[w] &= ~(~0ull << (hi & 63));
+
+    for (any = 0; w >= 0; --w)
+      any |= (0 != y[w]);
+    if (!any)
+      continue;
+
+    for (e = s->row_start[s->pivot_row[i]];
+	 e < s->row_start[s->pivot_row[i] + 1]; ++e)
+      if (IS_PIVOT(st = s->state[s->row_cols[e]]) && (st != i))
+	xor_words(SIG(s, st), y, words);
+  }
+
+  return 0;
+}
+
+// Step 3b: add up the equations for inactive node j and list
+// whatever doesn't cancel (apart from the node itself). Returns 0, 1
+// if the bone for it won't fit in a boneyard chunk, or -1.
+static int inactive_sum(oc_inact *s, int j) {
+
+  oc_graph *g = s->g;
+  int target = s->col_node[s->inactive[j]];
+  int words = s->words, w, a, i, n, node, st, *p;
+  uint64_t bits, *t = s->track + j * words, mask = 1ull << (j & 63);
+
+  s->listed = 0;
+  for (w = 0; w < words; ++w)
+    for (bits = t[w]; bits; bits &= bits - 1) {
+      a = 64 * w + __builtin_ctzll(bits);
+      flip_row(s, s->acc_row[a]);
+    }
+  for (i = 0; i < s->pivots; ++i)
+    if (SIG(s, i)[j >> 6] & mask)
+      flip_row(s, s->pivot_row[i]);
+
+  // make room for all of them
+  n = s->vstart[j];
+  if (n + s->listed > s->vspace) {
+    s->vspace = 2 * (n + s->listed);
+    if (NULL == (p = realloc(s->vnodes, s->vspace * sizeof(int))))
+      return -1;
+    s->vnodes = p;
+  }
+
+  for (i = 0; i < s->listed; ++i) {
+    node = s->list[i];
+    if ((s->parity[node] & 1) && (node != target)) {
+
+      // anything unsolved has to be solved before this step
+      if ((node < g->coblocks) && !g->solution[node]) {
+	st = s->state[s->col_of[node] - 1];
+	if (IS_PIVOT(st) ? (s->level[st] >= j) : (INACTIVE_COL(st) >= j)) {
+	  fprintf(stderr, "oc_graph_inactivate: node %d didn't cancel\n",
+		  node);
+	  return -1;
+	}
+      }
+      s->vnodes[n++] = node;
+    }
+    s->parity[node] = 0;
+  }
+  s->vstart[j + 1] = n;
+
+  // the bone holds the target and its header too (see oc_new_bone)
+  return (n - s->vstart[j] + 2 > (1 << g->bone_bits)) ? 1 : 0;
+}
+
+// Step 3c: make a bone for each inactive node from its sum. If they
+// don't all fit, the ones made so far are given back. Returns 0 or 1
+// (as for a bone that won't fit).
+static int inactive_bones(oc_inact *s) {
+
+  oc_graph *g = s->g;
+  int mark = g->boneyard_next, j, i, n, b;
+  oc_bone *bone;
+
+  for (j = 0; j < s->k; ++j) {
+    n = s->vstart[j + 1] - s->vstart[j];
+    if (0 == (b = oc_new_bone(g, n + 1))) {
+      oc_release_bones(g, mark);
+      return 1;
+    }
+    bone = oc_graph_bone(g, b);
+    bone->a.unknowns = 1;
+    bone->b.size     = n + 1;
+    bone[1].a.node   = s->col_node[s->inactive[j]];
+    bone[1].b.link   = OC_NO_EDGE;
+    for (i = 0; i < n; ++i) {
+      bone[i + 2].a.node = s->vnodes[s->vstart[j] + i];
+      bone[i + 2].b.link = OC_NO_EDGE;
+    }
+    s->vbone[j] = b;
+
+    OC_STAT(g->stats.inact_bone_nodes += n);
+  }
+
+  return 0;
+}
+
+// Sort pivots by level (keeping them in order within each one), for
+// commit. Done before any bones are made so that commit doesn't need
+// to allocate anything before it starts changing the graph.
+static int order_pivots(oc_inact *s) {
+
+  int k = s->k, i, step;
+
+  if ((NULL == (s->start = calloc(k + 2, sizeof(int)))) ||
+      (NULL == (s->order = malloc((s->pivots + 1) * sizeof(int)))))
+    return -1;
+
+  for (i = 0; i < s->pivots; ++i)
+    ++(s->start[s->level[i] + 2]);
+  for (step = 0; step <= k; ++step)
+    s->start[step + 1] += s->start[step];
+  for (i = 0; i < s->pivots; ++i)
+    s->order[(s->start[s->level[i] + 1])++] = i;
+  // (start[level + 1] is now the end of that level's pivots)
+
+  return 0;
+}
+
+// solved node bookkeeping, as in oc_graph_resolve
+static int solved(oc_graph *g, int node,
+		  oc_uni_block **phead, oc_uni_block **ptail) {
+
+  if (-1 == oc_push_solved(g, node, phead, ptail))
+    return -1;
+  if (node < g->mblocks)
+    --(g->unsolved_count);
+  return oc_cascade(g, node);
+}
+
+// A pivot's row solves it, as with the propagation rule (or the aux
+// rule, if it's an aux node's own equation)
+static int solve_pivot(oc_inact *s, int i,
+		       oc_uni_block **phead, oc_uni_block **ptail) {
+
+  oc_graph *g = s->g;
+  int from = s->row_node[s->pivot_row[i]];
+  int to   = s->col_node[s->pivot_col[i]];
+  int idx;
+  oc_bone *bone;
+
+  if (from == to) {
+    oc_aux_rule(g, from);
+  } else {
+    bone = oc_graph_top(g, from);
+    idx  = oc_unknown_unsolved(bone, g);
+    assert(bone[idx].a.node == to);
+    oc_bubble_unsolved(bone, g, idx);
+    oc_delete_lower_end(g, bone[1].b.link, from, to, 1);
+    assert(!g->solution[to]);
+    g->solution[to] = g->top[from - g->mblocks];
+  }
+
+  return solved(g, to, phead, ptail);
+}
+
+// Step 3d: install all the solutions, step by step. This only fails
+// if memory runs out, by which time the graph has been changed.
+static int commit(oc_inact *s, oc_uni_block **phead, oc_uni_block **ptail) {
+
+  oc_graph *g = s->g;
+  int k = s->k, i, j, step, *start = s->start, *order = s->order;
+
+  for (i = step = 0; step <= k; ++step) {
+    if (step) {
+      j = step - 1;
+      assert(!g->solution[s->col_node[s->inactive[j]]]);
+      g->solution[s->col_node[s->inactive[j]]] = s->vbone[j];
+      if (-1 == solved(g, s->col_node[s->inactive[j]], phead, ptail))
+	break;
+    }
+    for (; i < start[step]; ++i)
+      if (-1 == solve_pivot(s, order[i], phead, ptail))
+	break;
+    if (i < start[step])
+      break;
+  }
+
+  if (step <= k)
+    return -1;
+
+  // Solving everything queues up nodes with nothing left to solve
+  assert(0 == g->unsolved_count);
+  g->done = 1;
+  oc_flush_pending(g);
+
+  return 0;
+}
+
+int oc_graph_inactivate(oc_graph *g,
+			oc_uni_block **phead, oc_uni_block **ptail) {
+
+  int checks = g->nodes - g->coblocks, short_by, j;
+  oc_inact s;
+
+  assert(g != NULL);
+
+  if (!g->max_inactive || g->done || !g->unsolved_count ||
+      (checks < g->inact_retry))
+    return 0;
+
+  OC_STAT(++(g->stats.inact_calls));
+
+  memset(&s, 0, sizeof(s));
+  s.g = g;
+
+  short_by = build_rows(&s);
+  if (0 == short_by)
+    short_by = peel(&s);
+  if (0 == short_by)
+    short_by = eliminate(&s);
+
+  if (0 == short_by) {
+    if ((NULL == (s.parity = calloc(g->nodes, 1)))           ||
+	(NULL == (s.list   = malloc(g->nodes * sizeof(int)))) ||
+	(NULL == (s.vbone  = malloc(s.k * sizeof(int) + 1)))  ||
+	(NULL == (s.vstart = calloc(s.k + 1, sizeof(int)))))
+      short_by = -1;
+    if (0 == short_by)
+      short_by = inactive_sums(&s);
+    for (j = 0; (0 == short_by) && (j < s.k); ++j)
+      short_by = inactive_sum(&s, j);
+    if (0 == short_by)
+      short_by = order_pivots(&s);
+    if (0 == short_by)
+      short_by = inactive_bones(&s);
+  }
+
+  if ((0 == short_by) && (-1 == commit(&s, phead, ptail)))
+    short_by = -1;
+
+  if (0 == short_by) {
+    OC_STAT(g->stats.inact_nodes += s.cols;
+	    if (s.k > g->stats.inact_max) g->stats.inact_max = s.k);
+  } else if (short_by > 0) {
+    // We'll need at least this many more check blocks before it's
+    // worth trying again
+    g->inact_retry = checks + short_by;
+  } else {
+    fprintf(stderr, "oc_graph_inactivate: out of memory\n");
+  }
+
+  free_inact(&s);
+
+  return (-1 == short_by) ? -1 : g->done;
+}
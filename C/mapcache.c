@@ -0,0 +1,221 @@
+// On-disk cache of codec tables (see mapcache.h)
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+#include "online-code.h"
+#include "mapcache.h"
+
+static char          *cache_dir  = NULL;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+// Codecs (and templates) may be made from several threads at once, so
+// the environment is only looked at once, before anything else
+// touches cache_dir
+static void cache_dir_from_env(void) {
+
+  const char *env = getenv("OC_MAP_CACHE_DIR");
+
+  if ((NULL != env) && *env)
+    cache_dir = strdup(env);
+}
+
+void oc_map_cache_set_dir(const char *dir) {
+
+  pthread_once(&cache_once, &cache_dir_from_env);
+
+  if (NULL != cache_dir) free(cache_dir);
+  cache_dir = (NULL == dir) ? NULL : strdup(dir);
+}
+
+const char *oc_map_cache_dir(void) {
+
+  pthread_once(&cache_once, &cache_dir_from_env);
+  return cache_dir;
+}
+
+#define ALIGN8(x) (((x) + 7) & ~((uint64_t) 7))
+
+// The file name has all of the key in it, so a lookup is just an open.
+// e is printed in hex so that it's exact.
+static int cache_path(char *buf, size_t size, const char *dir,
+		      const oc_codec *codec, const char *current, int subprt) {
+
+  char hex[2 * OC_RNG_BYTES + 1];
+  int  i, len;
+
+  for (i = 0; i < OC_RNG_BYTES; ++i)
+    sprintf(hex + 2 * i, "%02x", (unsigned char) current[i]);
+
+  len = snprintf(buf, size, "%s/oc-%d-%d-%d-%a-%d-%s-%d.map", dir,
+		 codec->mblocks, codec->ablocks, codec->q, codec->e, codec->F,
+		 hex, subprt);
+  return ((len < 0) || ((size_t) len >= size)) ? -1 : 0;
+}
+
+static void fill_header(oc_map_cache_header *h, const oc_codec *codec) {
+
+  memset(h, 0, sizeof(oc_map_cache_header));
+  memcpy(h->magic, OC_MAP_CACHE_MAGIC, sizeof(h->magic));
+  h->byte_order  = OC_MAP_CACHE_ORDER;
+  h->header_size = sizeof(oc_map_cache_header);
+
+  h->mblocks = codec->mblocks;
+  h->q       = codec->q;
+  h->F       = codec->F;
+  h->ablocks = codec->ablocks;
+  h->e       = codec->e;
+
+  h->p_offset   = ALIGN8((uint64_t) sizeof(oc_map_cache_header));
+  h->aux_offset = ALIGN8(h->p_offset + (uint64_t) codec->F * sizeof(double));
+  h->file_size  = h->aux_offset +
+    (uint64_t) codec->q * codec->mblocks * sizeof(int);
+}
+
+// Every aux mapping entry has to name an aux block. The encoder and
+// decoder index arrays with these, so a file that passes the header
+// checks but has been damaged since it was written can't be trusted.
+static int good_aux_map(const oc_map_cache_header *h) {
+
+  const int *aux = (const int *) ((const char *) h + h->aux_offset);
+  int        i, n = h->q * h->mblocks;
+
+  for (i = 0; i < n; ++i)
+    if ((aux[i] < h->mblocks) || (aux[i] >= h->mblocks + h->ablocks))
+      return 0;
+  return 1;
+}
+
+int oc_map_cache_load(oc_codec *codec, oc_rng_sha1 *rng) {
+
+  const char          *dir = oc_map_cache_dir();
+  char                 path[4096];
+  oc_map_cache_header  want, *h;
+  struct stat          st;
+  void                *base;
+  int                  fd;
+
+  assert(codec != NULL);
+  assert(rng   != NULL);
+
+  // the key doesn't cover precomputed hashes or the Perl-compatible
+  // stream, so don't try to be clever
+  if ((NULL == dir) || rng->ahead_left || rng->perl_compat ||
+      (NULL != codec->map_base))
+    return -1;
+  if (cache_path(path, sizeof(path), dir, codec, rng->current, rng->subprt))
+    return -1;
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return -1;
+  if ((fstat(fd, &st) < 0) || (st.st_size < (off_t) sizeof(oc_map_cache_header))) {
+    close(fd);
+    return -1;
+  }
+  base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (MAP_FAILED == base)
+    return -1;
+
+  // a file name match isn't enough; check everything
+  h = base;
+  fill_header(&want, codec);
+  if (memcmp(h->magic, want.magic, sizeof(want.magic)) ||
+      (h->byte_order  != want.byte_order)  ||
+      (h->header_size != want.header_size) ||
+      (h->mblocks != want.mblocks) || (h->q != want.q) ||
+      (h->F != want.F) || (h->ablocks != want.ablocks) || (h->e != want.e) ||
+      memcmp(h->rng_in, rng->current, OC_RNG_BYTES) ||
+      (h->subprt_in != rng->subprt) ||
+      (h->subprt_out >= OC_RNG_RANDS_PER_SUM) ||
+      (h->p_offset   != want.p_offset)   ||
+      (h->aux_offset != want.aux_offset) ||
+      (h->file_size  != want.file_size)  ||
+      (h->file_size  != (uint64_t) st.st_size) ||
+      !good_aux_map(h)) {
+    fprintf(stderr, "oc_map_cache_load: ignoring bad cache file %s\n", path);
+    munmap(base, st.st_size);
+    return -1;
+  }
+
+  // The probability table in the file is the same as the one that
+  // oc_codec_init would have made (so any guide table still matches
+  // it). oc_codec_init_lazy doesn't make one at all.
+  if (NULL != codec->p)         free(codec->p);
+  if (NULL != codec->auxiliary) free(codec->auxiliary);
+
+  codec->p         = (double *) ((char *) base + h->p_offset);
+  codec->auxiliary = (int *)    ((char *) base + h->aux_offset);
+  codec->map_base  = base;
+  codec->map_size  = st.st_size;
+
+  memcpy(rng->current, h->rng_out, OC_RNG_BYTES);
+  rng->subprt = h->subprt_out;
+
+  return 0;
+}
+
+void oc_map_cache_store(oc_codec *codec, const char *rng_in, int subprt_in,
+			oc_rng_sha1 *rng) {
+
+  const char          *dir = oc_map_cache_dir();
+  char                 path[4096], temp[4096 + 32];
+  oc_map_cache_header  h;
+  size_t               p_bytes, aux_bytes;
+  int                  fd, ok;
+
+  assert(codec != NULL);
+  assert(rng   != NULL);
+
+  if ((NULL == dir) || rng->perl_compat)
+    return;
+  if (cache_path(path, sizeof(path), dir, codec, rng_in, subprt_in))
+    return;
+
+  fill_header(&h, codec);
+  memcpy(h.rng_in,  rng_in,       OC_RNG_BYTES);
+  memcpy(h.rng_out, rng->current, OC_RNG_BYTES);
+  h.subprt_in  = subprt_in;
+  h.subprt_out = rng->subprt;
+
+  p_bytes   = (size_t) codec->F * sizeof(double);
+  aux_bytes = (size_t) codec->q * codec->mblocks * sizeof(int);
+
+  // write to a private name first so nobody maps a partial file
+  snprintf(temp, sizeof(temp), "%s.tmp.%ld", path, (long) getpid());
+  if ((fd = open(temp, O_WRONLY | O_CREAT | O_EXCL, 0644)) < 0)
+    return;
+
+  ok = (pwrite(fd, &h, sizeof(h), 0) == (ssize_t) sizeof(h)) &&
+    (pwrite(fd, codec->p, p_bytes, h.p_offset) == (ssize_t) p_bytes) &&
+    (pwrite(fd, codec->auxiliary, aux_bytes, h.aux_offset) ==
+     (ssize_t) aux_bytes);
+
+  if (close(fd) || !ok || rename(temp, path)) {
+    fprintf(stderr, "oc_map_cache_store: failed to write %s\n", path);
+    unlink(temp);
+  }
+}
+
+void oc_map_cache_release(oc_codec *codec) {
+
+  assert(codec != NULL);
+
+  if (NULL == codec->map_base)
+    return;
+
+  munmap(codec->map_base, codec->map_size);
+
+  codec->map_base  = NULL;
+  codec->map_size  = 0;
+  codec->p         = NULL;
+  codec->auxiliary = NULL;
+}
@@ -0,0 +1,78 @@
+// On-disk cache of codec tables (probability table and aux map)
+
+#ifndef OC_MAPCACHE_H
+#define OC_MAPCACHE_H
+
+#include <stdint.h>
+
+#include "online-code.h"
+#include "rng_sha1.h"
+
+// Building the auxiliary map takes q random numbers for each message
+// block, which adds up to a noticeable delay before the first check
+// block for big messages with small blocks. The map only depends on
+// the codec parameters and the state of the rng when it's made,
+// though, so if a cache directory is set, oc_auxiliary_map() looks
+// for a file made from the same (mblocks, q, e, F, rng state) and
+// maps it instead of making a new map. On a miss, it makes the map as
+// usual and then writes a new cache file for next time.
+//
+// Cache files are read-only once written (new ones are written to a
+// temporary name and renamed), so any number of processes can map
+// the same file at once and the pages are shared through the page
+// cache. The file holds the probability table too, so a codec that
+// was set up from the cache gets both tables from the mapping.
+//
+// The cache directory is taken from the OC_MAP_CACHE_DIR environment
+// variable unless oc_map_cache_set_dir() has been called. The
+// environment is read once, safely from any thread, but changing the
+// setting isn't locked: call oc_map_cache_set_dir() before creating
+// any codecs.
+
+void        oc_map_cache_set_dir(const char *dir);	// NULL => disable
+const char *oc_map_cache_dir(void);
+
+// File layout (native byte order, which byte_order checks): header,
+// then F doubles of probability table at p_offset, then q * mblocks
+// ints of aux map at aux_offset. Offsets are multiples of 8. A file
+// is only used if all of the header matches and every aux map entry
+// is an aux block number.
+
+#define OC_MAP_CACHE_MAGIC   "OCMAPv1"	// 8 bytes with the '\0'
+#define OC_MAP_CACHE_ORDER   0x01020304
+
+typedef struct {
+
+  char     magic[8];
+  uint32_t byte_order;
+  uint32_t header_size;
+
+  // key
+  int32_t  mblocks, q, F, ablocks;
+  double   e;
+  char     rng_in[OC_RNG_BYTES];	// rng->current before the map...
+  uint32_t subprt_in;
+
+  // ... and after it
+  char     rng_out[OC_RNG_BYTES];
+  uint32_t subprt_out;
+
+  uint64_t p_offset;
+  uint64_t aux_offset;
+  uint64_t file_size;
+
+} oc_map_cache_header;
+
+// Called by oc_auxiliary_map. Load returns 0 if the codec's tables were
+// set up from the cache (and rng moved on to where it would have been
+// after making the map) or -1 on a miss. Store writes a cache file for
+// a map just made from an rng whose state before was rng_in/subprt_in;
+// failure to write isn't an error as far as the caller's concerned.
+int  oc_map_cache_load (oc_codec *codec, oc_rng_sha1 *rng);
+void oc_map_cache_store(oc_codec *codec, const char *rng_in, int subprt_in,
+			oc_rng_sha1 *rng);
+
+// Undo a mapping made by load (called from oc_codec_free)
+void oc_map_cache_release(oc_codec *codec);
+
+#endif
@@ -17,9 +17,38 @@ const char *null_seed = "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0";
 oc_rng_sha1 rng;
 oc_decoder  d;
 
+// -S: print decoder statistics to stderr when done
+void print_stats(oc_decoder *d) {
+
+  oc_graph_stats s;
+
+  oc_decoder_get_stats(d, &s);
+
+  fprintf(stderr, "Check blocks: %d received, %d expected, %d to decode\n",
+	  s.check_blocks, s.check_blocks_expected, s.check_blocks_to_decode);
+  fprintf(stderr, "Pending queue: %lld pushes, high-water mark %d\n",
+	  s.push_pending_calls, s.pending_max_full);
+  fprintf(stderr, "Cascades: %lld, %lld edges (avg. %g, max. %d)\n",
+	  s.cascade_calls, s.cascade_edges,
+	  s.cascade_calls ? (double) s.cascade_edges / s.cascade_calls : 0.0,
+	  s.cascade_max);
+  fprintf(stderr, "Edges deleted: %lld\n", s.delete_n_calls);
+  fprintf(stderr, "Inactivation: %d attempts, %d nodes solved, "
+	  "max. %d inactive, %lld nodes in their solutions\n",
+	  s.inact_calls, s.inact_nodes, s.inact_max, s.inact_bone_nodes);
+  fprintf(stderr, "Transparent aux: %lld expanded, %lld messages cancelled\n",
+	  s.aux_expanded, s.aux_cancelled);
+  fprintf(stderr, "Nodes: %d/%d, bones: %lld/%lld, slabs: %lld/%lld\n",
+	  s.nodes, s.node_space, s.bones_used, s.bones_space,
+	  s.slabs_used, s.slabs_space);
+  fprintf(stderr, "Time (ms): map %.3f, graph %.3f, resolve %.3f, xor %.3f\n",
+	  s.ns_map / 1e6, s.ns_graph / 1e6, s.ns_resolve / 1e6, s.ns_xor / 1e6);
+}
+
 int main(int argc, char * const argv[]) {
 
-  int    opt, random_seed = 1, mblocks = 1, flags;
+  int    opt, random_seed = 1, mblocks = 1, flags, show_stats = 0;
+  int    max_inactive = 0, transparent = 0;
   char   seed[20];
   double e;
   int    q, f, ablocks, coblocks;
@@ -27,8 +56,17 @@ int main(int argc, char * const argv[]) {
   oc_uni_block *solved, *sp;
 
   // parse opts
-  while ((opt = getopt(argc, argv, "ds:")) != -1) {
+  while ((opt = getopt(argc, argv, "ds:SI:T")) != -1) {
     switch(opt) {
+    case 'S':
+      show_stats = 1;
+      break;
+    case 'I':
+      max_inactive = atoi(optarg);
+      break;
+    case 'T':
+      transparent = OC_TRANSPARENT_AUX;
+      break;
     case 'd':
       memcpy(seed, null_seed, 20);
       random_seed = 0;
@@ -42,7 +80,8 @@ int main(int argc, char * const argv[]) {
       random_seed = 0;
       break;
     default:
-      fprintf(stderr, "mindecoder [-d]|[-s seed] [mblocks]\n");
+      fprintf(stderr, "mindecoder [-S] [-I max_inactive] [-T] [-d]|[-s seed] "
+	      "[mblocks]\n");
       exit(1);
     }
   }
@@ -56,11 +95,17 @@ int main(int argc, char * const argv[]) {
 
   printf ("RNG seed: %s\n", oc_rng_as_hex(&rng));
 
-  flags = oc_decoder_init(&d, mblocks, &rng, OC_EXPAND_MSG, 2.0, 0ll);
+  // -T: transparent aux blocks
+  flags = oc_decoder_init(&d, mblocks, &rng, OC_EXPAND_MSG | transparent,
+			  2.0, 0ll);
 
   if (flags & OC_FATAL_ERROR)
     return fprintf(stderr, "OC decoder init returned fatal error\n");
 
+  // -I: fall back on inactivation decoding when peeling gets stuck
+  if (max_inactive)
+    oc_decoder_set_inactivation(&d, max_inactive);
+
   q = d.base.q;
   e = d.base.e;
   f = d.base.F;
@@ -111,4 +156,10 @@ int main(int argc, char * const argv[]) {
 	break;
     }
   }
+
+  if (show_stats)
+    print_stats(&d);
+
+  oc_decoder_free(&d);
+  return 0;
 }
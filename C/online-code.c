@@ -10,8 +10,126 @@
 #include "structs.h"
 #include "online-code.h"
 #include "floyd.h"
+#include "mapcache.h"
 
 
+// Guide table
+//
+// Bucket b covers random numbers in [b/F, (b+1)/F) and guide[b] is the
+// first i with p[i] >= b/F. Every entry before that is less than any r
+// in the bucket, so the linear search can safely start there. Both
+// sides of the comparison are worked out as x * F in floating point,
+// which keeps the shortcut exact even with rounding: if p[i] >= r then
+// p[i] * F >= r * F (rounding doesn't change the order).
+
+static double *init_guide(oc_codec *codec) {
+
+  int     f = codec->F, b, i = 0;
+  double *p = codec->p;
+  double  g = f;
+
+  if (NULL == (codec->guide = malloc(f * sizeof(int))))
+    return NULL;
+
+  for (b = 0; b < f; ++b) {
+    while (p[i] * g < b)	// terminates since p[f-1] is 1
+      ++i;
+    codec->guide[b] = i;
+  }
+  return p;
+}
+
+// Alias table (Vose's method)
+//
+// Each of the F columns holds probability 1/F and is split between
+// its own degree and (at most) one "alias" degree. Columns with less
+// than their share are topped up from ones with more.
+
+static int init_alias(oc_codec *codec) {
+
+  int     f = codec->F, i, s, l;
+  int    *small, *large, ns = 0, nl = 0;
+  double *scaled, *p = codec->p;
+
+  codec->alias_prob = malloc(f * sizeof(double));
+  codec->alias      = malloc(f * sizeof(int));
+  scaled            = malloc(f * sizeof(double));
+  small             = malloc(f * sizeof(int));
+  large             = malloc(f * sizeof(int));
+
+  if ((NULL == codec->alias_prob) || (NULL == codec->alias) ||
+      (NULL == scaled) || (NULL == small) || (NULL == large)) {
+    if (NULL != scaled) free(scaled);
+    if (NULL != small)  free(small);
+    if (NULL != large)  free(large);
+    if (NULL != codec->alias_prob) free(codec->alias_prob);
+    if (NULL != codec->alias)      free(codec->alias);
+    codec->alias_prob = NULL;	// so that a retry starts afresh
+    codec->alias      = NULL;
+    return -1;
+  }
+
+  // p holds cumulative probabilities
+  for (i = 0; i < f; ++i) {
+    scaled[i] = (p[i] - (i ? p[i - 1] : 0)) * f;
+    if (scaled[i] < 1.0)
+      small[ns++] = i;
+    else
+      large[nl++] = i;
+  }
+
+  while (ns && nl) {
+    s = small[--ns];
+    l = large[--nl];
+    codec->alias_prob[s] = scaled[s];
+    codec->alias[s]      = l;
+    scaled[l] -= 1.0 - scaled[s];
+    if (scaled[l] < 1.0)
+      small[ns++] = l;
+    else
+      large[nl++] = l;
+  }
+
+  // anything left over is full (give or take rounding)
+  while (nl) {
+    l = large[--nl];
+    codec->alias_prob[l] = 1.0;
+    codec->alias[l]      = l;
+  }
+  while (ns) {
+    s = small[--ns];
+    codec->alias_prob[s] = 1.0;
+    codec->alias[s]      = s;
+  }
+
+  free(scaled);
+  free(small);
+  free(large);
+
+  return 0;
+}
+
+int oc_codec_set_degree_method(oc_codec *codec, int method) {
+
+  assert(codec != NULL);
+
+  switch (method) {
+  case OC_DEGREE_ALIAS:
+    if ((NULL == codec->alias) && (-1 == init_alias(codec))) {
+      fprintf(stderr, "oc_codec_set_degree_method: failed to allocate memory\n");
+      return -1;
+    }
+    // fall through
+  case OC_DEGREE_GUIDE:
+  case OC_DEGREE_SCAN:
+    codec->degree_method = method;
+    return 0;
+  }
+
+  fprintf(stderr, "oc_codec_set_degree_method: unknown method %d\n", method);
+  return -1;
+}
+
 double *oc_codec_init_probdist(oc_codec *codec) {
 
   int    coblocks = codec->coblocks;
@@ -57,11 +175,11 @@ double *oc_codec_init_probdist(oc_codec *codec) {
   // hard-code simple cases where f = 1 or 2
   if (f == 1) {
     p[0] = 1;
-    return p;
+    return init_guide(codec);
   } else if (f == 2) {
     p[0] = p1;
     p[1] = 1;
-    return p;
+    return init_guide(codec);
   }
 
   // calculate sum(p_i) for 2 <= i < F.
@@ -75,7 +193,7 @@ double *oc_codec_init_probdist(oc_codec *codec) {
   }
   *(p) = 1.0;
 
-  return codec->p;
+  return init_guide(codec);
 
 }
 
@@ -95,17 +213,35 @@ double *oc_codec_init_probdist(oc_codec *codec) {
 // known at compile time.
 //
 // The encoder/decoder "subclasses" use the reverse mapping (of
-// auxiliary to message blocks) in different ways so it's not stored
-// here in the base class.
+// auxiliary to message blocks) in different ways, so it's only made
+// on demand (by oc_aux_reverse_map, below) rather than stored here
+// along with the forward map.
 
 int *oc_auxiliary_map(oc_codec *codec, oc_rng_sha1 *rng) {
 
   int  q       = codec->q;
   int  mblocks = codec->mblocks;
   int  ablocks = codec->ablocks;
-  int *p, i, j;
+  int *p, i, j, *map;
+  char rng_in[OC_RNG_BYTES];
+  int  subprt_in;
+
+  // Making a map takes q random numbers per message block, so use a
+  // saved one if we have it. The file has the probability table too,
+  // so a codec from oc_codec_init_lazy doesn't have to make it.
+  if (0 == oc_map_cache_load(codec, rng)) {
+    if ((NULL == codec->guide) && (NULL == init_guide(codec)))
+      return NULL;
+    return codec->auxiliary;
+  }
+
+  if ((NULL == codec->p) && (NULL == oc_codec_init_probdist(codec)))
+    return NULL;
+
+  memcpy(rng_in, rng->current, OC_RNG_BYTES);
+  subprt_in = rng->subprt;
 
-  int *map = calloc(q * mblocks, sizeof(int));
+  map = calloc(q * mblocks, sizeof(int));
 
   if (map == NULL) return NULL;
 
@@ -135,32 +271,110 @@ int *oc_auxiliary_map(oc_codec *codec, oc_rng_sha1 *rng) {
       // printf("msg block %d attaches to %d, %d, %d\n", i, a, b, c);
     }
   } else {
-    SET_INIT(codec->floyd_scratch, mblocks, ablocks, q);
     for (i=0; i < mblocks; ++i) {
-      p = oc_floyd(rng, mblocks, ablocks, q);
+      p = oc_floyd_r(&(codec->floyd), rng, mblocks, ablocks, q);
       for (j=0; j < q; ++j) {
 	*(map++) = p[j];
       }
-      free(p);
     }
   }
 
+  oc_map_cache_store(codec, rng_in, subprt_in, rng);
+
   return codec->auxiliary;
 
 }
 
 
+// Turn the aux map around. This is a counting sort of the map by aux
+// block, so each aux block's message blocks come out in order.
+static int *make_aux_reverse(const oc_codec *codec) {
+
+  int  q       = codec->q;
+  int  mblocks = codec->mblocks;
+  int  ablocks = codec->ablocks;
+  int *map     = codec->auxiliary;
+  int *rev, *next, i, a;
+
+  if (NULL == map) return NULL;
+
+  rev  = calloc(ablocks + 1 + mblocks * q, sizeof(int));
+  next = calloc(ablocks, sizeof(int));
+  if ((NULL == rev) || (NULL == next)) {
+    if (NULL != rev)  free(rev);
+    if (NULL != next) free(next);
+    return NULL;
+  }
+
+  for (i = 0; i < mblocks * q; ++i)
+    ++rev[map[i] - mblocks + 1];
+  rev[0] = ablocks + 1;
+  for (a = 0; a < ablocks; ++a) {
+    rev[a + 1] += rev[a];
+    next[a]     = rev[a];
+  }
+  for (i = 0; i < mblocks * q; ++i)
+    rev[next[map[i] - mblocks]++] = i / q;
+
+  free(next);
+  return rev;
+}
+
+const int *oc_aux_reverse_map(oc_codec *codec) {
+
+  oc_codec *owner;
+  int      *rev, *expected = NULL;
+
+  assert(codec != NULL);
+
+  if (NULL != codec->aux_reverse)
+    return codec->aux_reverse;
+
+  // Shared codecs make it for the template, where it's kept. Two
+  // threads could get here at once, so the first to store its copy
+  // wins and the other one throws its copy away.
+  owner = (NULL == codec->shared) ? codec : &(codec->shared->codec);
+  rev   = __atomic_load_n(&(owner->aux_reverse), __ATOMIC_ACQUIRE);
+  if (NULL == rev) {
+    if (NULL == (rev = make_aux_reverse(owner)))
+      return NULL;
+    if (!__atomic_compare_exchange_n(&(owner->aux_reverse), &expected, rev,
+				     0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      free(rev);
+      rev = expected;
+    }
+  }
+
+  return codec->aux_reverse = rev;
+}
+
 // use probability distribution table and rng to find degree of a
 // check block (a value between 1 and F)
 int oc_random_degree(oc_codec *codec, oc_rng_sha1 *rng) {
 
-  int     i = 0;
+  int     i = 0, f = codec->F;
   double  r = oc_rng_rand(rng, 1.0);
   double *p = codec->p;
-  // A linear scan is likely to be quick for most values of r.  Extra
-  // speedup might be achieved by partitioning and using binary search
-  // on the "flatter" part of the array but this is easier.
-  while (r > *(p++)) {	// terminates since r < p[last] (ie, 1)
+  double  u;
+
+  switch (codec->degree_method) {
+  case OC_DEGREE_ALIAS:
+    u = r * f;
+    i = u;
+    if (i >= f) i = f - 1;	// can't happen, but be safe
+    return ((u - i < codec->alias_prob[i]) ? i : codec->alias[i]) + 1;
+
+  case OC_DEGREE_GUIDE:
+    i = r * f;
+    if (i >= f) i = f - 1;
+    i = codec->guide[i];
+    break;
+  }
+
+  // Linear scan (from the guide entry if there is one). The guide
+  // table means this is quick for all values of r, not just the
+  // common low degrees.
+  while (r > p[i]) {	// terminates since r < p[last] (ie, 1)
     ++i;
   }
   return i + 1;
@@ -171,21 +385,25 @@ int oc_random_degree(oc_codec *codec, oc_rng_sha1 *rng) {
 
 int *oc_checkblock_map(oc_codec *codec, int degree, oc_rng_sha1 *rng) {
 
-  int  coblocks = codec->mblocks + codec->ablocks;
-  int *p, *q;
+  return oc_checkblock_map_r(codec, degree, rng,
+			     &(codec->floyd), codec->xor_scratch);
+}
+
+int *oc_checkblock_map_r(const oc_codec *codec, int degree, oc_rng_sha1 *rng,
+			 oc_floyd_ctx *ctx, int *dest) {
 
-  p = codec->xor_scratch;
+  int  coblocks = codec->mblocks + codec->ablocks;
+  int *q;
 
-  // select 'degree' composite blocks ('src' array is assumed to be
-  // initialised already)
+  // select 'degree' composite blocks
 
-  q = oc_floyd(rng, 0, coblocks, degree);
+  q = oc_floyd_r(ctx, rng, 0, coblocks, degree);
 
   // save degree and list of blocks in our array
-  *(p++) = degree;
-  memcpy(p, q, degree * sizeof(int));
+  dest[0] = degree;
+  memcpy(dest + 1, q, degree * sizeof(int));
 
-  return codec->xor_scratch;
+  return dest;
 
 }
 
@@ -215,11 +433,10 @@ int oc_count_aux(int mblocks, int q, double e) {
 
 // Use a binary search to find a new epsilon such that
 // oc_max_degree(epsilon) <= mblocks + ablocks (ie, n')
-double oc_recalculate_e(int mblocks, int q, double e) {
+// Find the smallest e (near enough) that gives F <= coblocks
+static double search_e(int coblocks, double e) {
 
   double l, r, m;		// left, right, middle
-  int    ablocks  = oc_count_aux(mblocks, q, e);
-  int    coblocks = mblocks + ablocks;
 
   // set up left and right of range to search
   l = -log(1/e - 1);
@@ -246,6 +463,10 @@ double oc_recalculate_e(int mblocks, int q, double e) {
 
 }
 
+double oc_recalculate_e(int mblocks, int q, double e) {
+  return search_e(mblocks + oc_count_aux(mblocks, q, e), e);
+}
+
 int oc_eval_f(double t) {
   return oc_max_degree(1/(1 + exp(-t)));
 }
@@ -273,12 +494,11 @@ int oc_eval_f(double t) {
 int oc_codec_init(oc_codec *codec, int mblocks, ...) {
 
   va_list ap;
-  int     flags = 0;
+  int     flags;
   int     q=OC_DEFAULT_Q, new_q;
   double  e=OC_DEFAULT_E, new_e;
   int     f=OC_DEFAULT_F, new_f; // f=0 => not supplied (calculated)
-
-  int     ablocks,coblocks;
+  int     ablocks=0, new_a;	 // ablocks=0 => calculated
 
   // extract variadic args
   va_start(ap, mblocks);
@@ -292,12 +512,37 @@ int oc_codec_init(oc_codec *codec, int mblocks, ...) {
     new_f = va_arg(ap, int);
     if (new_f == 0) break; else f=new_f;
 
+    new_a = va_arg(ap, int);
+    if (new_a == 0) break; else ablocks=new_a;
+
   } while(0);
   va_end(ap);
 
+  flags = oc_codec_init_lazy(codec, mblocks, q, e, f, ablocks);
+  if (flags & OC_FATAL_ERROR)
+    return flags;
+
+  // calculate the probability distribution (uses stashed values)
+  if (NULL == oc_codec_init_probdist(codec))
+    flags |= OC_FATAL_ERROR;
+
+  return codec->flags = flags;
+}
+
+int oc_codec_init_lazy(oc_codec *codec, int mblocks, int q, double e, int f,
+		       int ablocks) {
+
+  int     flags = 0;
+  int     new_f;
+  double  new_e;
+  int     given = ablocks;
+
+  if (0 == q) q = OC_DEFAULT_Q;
+  if (0 == e) e = OC_DEFAULT_E;
+
   // Sanity checking of parameters
   assert(codec != NULL);
-  if ((q <= 0) || (e <= 0) || (e >= 1) || (mblocks <= 0)) {
+  if ((q <= 0) || (e <= 0) || (e >= 1) || (mblocks <= 0) || (ablocks < 0)) {
     flags |= OC_FATAL_ERROR;
     return codec->flags = flags;
   }
@@ -308,16 +553,19 @@ int oc_codec_init(oc_codec *codec, int mblocks, ...) {
   codec->q       = q;
 
   // how many auxiliary blocks would this scheme need?
-  ablocks =  oc_count_aux(mblocks,q,e);
+  if (!given)
+    ablocks = oc_count_aux(mblocks,q,e);
 
   // does epsilon value need updating?
   new_f = oc_max_degree(e);
 
   if (new_f > mblocks + ablocks) {
     flags  |= OC_E_CHANGED;
-    new_e   = oc_recalculate_e(mblocks,q,e);
+    new_e   = given ? search_e(mblocks + ablocks, e)
+                    : oc_recalculate_e(mblocks,q,e);
     new_f   = oc_max_degree(new_e);
-    ablocks = oc_count_aux(mblocks,q,new_e);
+    if (!given)
+      ablocks = oc_count_aux(mblocks,q,new_e);
 
     e = new_e;
   }
@@ -331,7 +579,7 @@ int oc_codec_init(oc_codec *codec, int mblocks, ...) {
     flags |= OC_FATAL_ERROR;
   if (NULL == (codec->floyd_scratch = calloc(f + 1, sizeof(int))))
     flags |= OC_FATAL_ERROR;
-  SET_INIT(codec->floyd_scratch, mblocks, ablocks, q);
+  oc_floyd_init_ctx(&(codec->floyd), codec->floyd_scratch);
 
   // Fill in remaining fields
   codec->ablocks  = ablocks;
@@ -339,17 +587,129 @@ int oc_codec_init(oc_codec *codec, int mblocks, ...) {
   codec->e        = e;
   codec->F        = f;
   codec->flags    = flags;
-  
-  // calculate the probability distribution (uses stashed values)
-  if (NULL == oc_codec_init_probdist(codec))
-    flags |= OC_FATAL_ERROR;
 
-  // Auxiliary map is set up in encoder/decoder sub-class
+  // Probability table and auxiliary map are set up in encoder/decoder
+  // sub-class (by oc_auxiliary_map)
 
   return flags;
 
 }
 
+// Shared tables (see online-code.h)
+
+oc_codec_template *oc_codec_template_new(int mblocks, oc_rng_sha1 *rng, ...) {
+
+  va_list ap;
+  int     q=OC_DEFAULT_Q, new_q;
+  double  e=OC_DEFAULT_E, new_e;
+  int     f=OC_DEFAULT_F, new_f;
+  int     ablocks=0, new_a;
+  int     flags;
+  oc_codec_template *t;
+
+  // extract variadic args (duplicates code in oc_codec_init)
+  va_start(ap, rng);
+  do {
+    new_q = va_arg(ap, int);
+    if (new_q == 0) break; else q=new_q;
+
+    new_e = va_arg(ap, double);
+    if (new_e == 0) break; else e=new_e;
+
+    new_f = va_arg(ap, int);
+    if (new_f == 0) break; else f=new_f;
+
+    new_a = va_arg(ap, int);
+    if (new_a == 0) break; else ablocks=new_a;
+
+  } while(0);
+  va_end(ap);
+
+  assert(rng != NULL);
+
+  if (NULL == (t = calloc(1, sizeof(oc_codec_template)))) {
+    fprintf(stderr, "oc_codec_template_new: failed to allocate memory\n");
+    return NULL;
+  }
+
+  flags = oc_codec_init_lazy(&(t->codec), mblocks, q, e, f, ablocks);
+  if ((flags & OC_FATAL_ERROR) ||
+      (NULL == oc_auxiliary_map(&(t->codec), rng))) {
+    fprintf(stderr, "oc_codec_template_new: failed to make tables\n");
+    oc_codec_free(&(t->codec));
+    free(t);
+    return NULL;
+  }
+
+  // the template never makes check blocks itself
+  free(t->codec.xor_scratch);
+  free(t->codec.floyd_scratch);
+  oc_floyd_free_ctx(&(t->codec.floyd));
+  t->codec.xor_scratch   = NULL;
+  t->codec.floyd_scratch = NULL;
+
+  t->rng  = *rng;
+  t->refs = 1;
+
+  return t;
+}
+
+void oc_codec_template_ref(oc_codec_template *t) {
+  assert(t != NULL);
+  __atomic_add_fetch(&(t->refs), 1, __ATOMIC_RELAXED);
+}
+
+void oc_codec_template_unref(oc_codec_template *t) {
+
+  assert(t != NULL);
+
+  if (__atomic_sub_fetch(&(t->refs), 1, __ATOMIC_ACQ_REL))
+    return;
+
+  oc_codec_free(&(t->codec));
+  free(t);
+}
+
+int oc_codec_init_shared(oc_codec *codec, oc_codec_template *t) {
+
+  const oc_codec *tc;
+  int f;
+
+  assert(codec != NULL);
+  assert(t     != NULL);
+
+  tc = &(t->codec);
+  f  = tc->F;
+
+  memset(codec, 0, sizeof(oc_codec));
+  codec->q         = tc->q;
+  codec->e         = tc->e;
+  codec->F         = f;
+  codec->mblocks   = tc->mblocks;
+  codec->ablocks   = tc->ablocks;
+  codec->coblocks  = tc->coblocks;
+  codec->flags     = tc->flags;
+
+  // per-codec scratch space
+  codec->xor_scratch   = calloc(f + 1, sizeof(int));
+  codec->floyd_scratch = calloc(f + 1, sizeof(int));
+  oc_floyd_init_ctx(&(codec->floyd), codec->floyd_scratch);
+  if ((NULL == codec->xor_scratch) || (NULL == codec->floyd_scratch)) {
+    oc_codec_free(codec);
+    return codec->flags = OC_FATAL_ERROR;
+  }
+
+  // Read-only tables. The alias table isn't shared since it's only
+  // made when a codec asks for it (see oc_codec_set_degree_method).
+  codec->p         = tc->p;
+  codec->guide     = tc->guide;
+  codec->auxiliary = tc->auxiliary;
+  codec->shared    = t;
+  oc_codec_template_ref(t);
+
+  return codec->flags;
+}
+
 int oc_is_message(oc_codec *codec,int m) {
   return (m < codec->mblocks);
 }
@@ -375,6 +735,42 @@ void oc_print_xor_list(int *xp, char *terminal) {
   printf("%s", terminal);
 }
 
+void oc_codec_free(oc_codec *codec) {
+
+  assert(codec != NULL);
+
+  // tables belonging to a template are left alone
+  if (NULL != codec->shared) {
+    codec->p           = NULL;
+    codec->guide       = NULL;
+    codec->auxiliary   = NULL;
+    codec->aux_reverse = NULL;
+    oc_codec_template_unref(codec->shared);
+    codec->shared      = NULL;
+  }
+
+  oc_map_cache_release(codec);	// p and auxiliary may be mapped
+
+  if (NULL != codec->p)             free(codec->p);
+  if (NULL != codec->guide)         free(codec->guide);
+  if (NULL != codec->alias_prob)    free(codec->alias_prob);
+  if (NULL != codec->alias)         free(codec->alias);
+  if (NULL != codec->auxiliary)     free(codec->auxiliary);
+  if (NULL != codec->aux_reverse)   free(codec->aux_reverse);
+  if (NULL != codec->xor_scratch)   free(codec->xor_scratch);
+  if (NULL != codec->floyd_scratch) free(codec->floyd_scratch);
+  oc_floyd_free_ctx(&(codec->floyd));
+
+  codec->p             = NULL;
+  codec->guide         = NULL;
+  codec->alias_prob    = NULL;
+  codec->alias         = NULL;
+  codec->auxiliary     = NULL;
+  codec->aux_reverse   = NULL;
+  codec->xor_scratch   = NULL;
+  codec->floyd_scratch = NULL;
+}
+
 // calculate the length of a linked list
 int oc_len_linked_list (oc_uni_block *list) {
   int len = 0;
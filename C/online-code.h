@@ -6,8 +6,11 @@
 // #include "oc_encoder.h"
 // #include "oc_decoder.h"
 
+#include <stddef.h>
+
 #include "structs.h"
 #include "rng_sha1.h"
+#include "floyd.h"
 
 // structure holding details common to encoder and decoder
 
@@ -22,13 +25,25 @@ typedef struct {
 
   double *p;			// probablity distribution table
 
+  int     degree_method;	// OC_DEGREE_* (see oc_random_degree)
+  int    *guide;		// F entries: first p[i] >= bucket start
+  double *alias_prob;		// alias table (only built if selected)
+  int    *alias;
+
   int    flags;			// error flags; see discussion of
 				// oc_codec_init below
 
   int   *auxiliary;		// 2d array mapping message->auxiliary
+  int   *aux_reverse;		// auxiliary->message (oc_aux_reverse_map)
+
+  void  *map_base;		// if p and auxiliary were mapped from
+  size_t map_size;		// the cache (see mapcache.h)
 
   int   *xor_scratch;
   int   *floyd_scratch;
+  oc_floyd_ctx floyd;		// uses floyd_scratch
+
+  struct oc_codec_template *shared; // p, guide, auxiliary belong to this
 
 } oc_codec;
 
@@ -36,11 +51,27 @@ typedef struct {
 // values for q, e and F. The other parameters are derived from those
 // values. The full argument list looks like:
 //
-// oc_codec_init (oc_codec *codec, mblocks, q=3, e=0.01, F=0);
+// oc_codec_init (oc_codec *codec, mblocks, q=3, e=0.01, F=0, ablocks=0);
 // F=0 => calculate F based on other parameters
+// ablocks=0 => calculate ablocks with oc_count_aux
+//
+// Giving ablocks is for talking to other implementations that count
+// aux blocks differently (the Perl code rounds down where
+// oc_count_aux rounds up). It's used as is, even if e has to change.
 
 int oc_codec_init(oc_codec *codec, int mblocks, ...);
 
+// Same, but without the variadic arguments (0 => default for q, e,
+// F and ablocks) and without making the probability table.
+// oc_auxiliary_map makes it, or maps it from the map cache if there's
+// a cache hit, so the encoder and decoder use this to save making a
+// table that the cache would replace.
+int oc_codec_init_lazy(oc_codec *codec, int mblocks, int q, double e, int f,
+		       int ablocks);
+
+// free memory allocated by init, probdist and auxiliary map routines
+void oc_codec_free(oc_codec *codec);
+
 // init tries its best to combine the passed (or default) parameter
 // values, but some combinations don't make sense. If it detects such
 // a situation and has to change some parameters so that things do
@@ -53,6 +84,41 @@ int oc_codec_init(oc_codec *codec, int mblocks, ...);
 
 // (flags are returned, and also stored in the structure)
 
+// Shared codec tables
+//
+// The probability (and guide) table and the auxiliary map only depend
+// on the codec parameters and the rng used to make the map, and
+// nothing changes them once they're made. A template holds one copy
+// of them that any number of codecs (in encoders or decoders, in any
+// thread) can share; each codec then only has its own scratch space
+// and whatever per-session state its encoder/decoder adds (the graph,
+// for instance). Templates are reference counted: the creator holds
+// one reference and each codec made from it holds another, and the
+// tables go when the last one is dropped.
+//
+// A template's codec member is only used to hold the tables and
+// parameters; don't use it directly. rng is the state the rng passed
+// to oc_codec_template_new was in after the map was made.
+
+typedef struct oc_codec_template {
+  oc_codec    codec;
+  oc_rng_sha1 rng;
+  int         refs;		// updated atomically
+} oc_codec_template;
+
+// Same optional arguments as oc_codec_init (terminated by 0ll).
+// Returns NULL on error. rng is used to make the auxiliary map, as in
+// oc_encoder_init/oc_decoder_init.
+oc_codec_template *oc_codec_template_new(int mblocks, oc_rng_sha1 *rng, ...);
+
+void oc_codec_template_ref  (oc_codec_template *t);
+void oc_codec_template_unref(oc_codec_template *t);
+
+// Set up a codec to use a template's tables. Returns the flags that
+// oc_codec_init returned when the template was made, or OC_FATAL_ERROR
+// if the scratch space can't be allocated.
+int  oc_codec_init_shared(oc_codec *codec, oc_codec_template *t);
+
 // init doesn't allocate memory for the probablity distribution table
 // or populate it; those steps are done separately with the following
 // routine. This is decoupled from init to allow the caller to tweak
@@ -66,13 +132,47 @@ double *oc_codec_init_probdist(oc_codec *codec);
 // Create auxiliary map
 int *oc_auxiliary_map(oc_codec *codec, oc_rng_sha1 *rng);
 
+// Reverse of the auxiliary map, made from it on first use (returns
+// NULL if there's no map yet or malloc fails). It's one array: the
+// first ablocks + 1 entries are offsets into the same array, and the
+// message blocks for aux block a (numbered from 0, not mblocks) are
+// rev[i] for rev[a] <= i < rev[a + 1]. A codec made from a template
+// shares the template's copy.
+const int *oc_aux_reverse_map(oc_codec *codec);
+
 // use probability distribution table and rng to find degree of a
 // check block
 int oc_random_degree(oc_codec *codec, oc_rng_sha1 *rng);
 
+// There are three ways of turning the random number into a degree.
+// All of them use exactly one number from the rng.
+//
+// OC_DEGREE_GUIDE (the default) gives exactly the same degree as
+// OC_DEGREE_SCAN, the original linear search of p, but starts the
+// search from a guide table entry so it only looks at one or two
+// entries on average.
+//
+// OC_DEGREE_ALIAS uses a Walker/Vose alias table. It's a bit quicker
+// again and has the same probability distribution, but it maps random
+// numbers to degrees differently so the encoder and decoder both have
+// to use it (and it won't work with the Perl version).
+
+#define OC_DEGREE_GUIDE 0
+#define OC_DEGREE_SCAN  1
+#define OC_DEGREE_ALIAS 2
+
+// Returns 0 on success or -1 on error (unknown method or out of memory)
+int oc_codec_set_degree_method(oc_codec *codec, int method);
+
 // Create a check block map
 int *oc_checkblock_map(oc_codec *codec, int degree, oc_rng_sha1 *rng);
 
+// Reentrant version: uses the caller's Floyd context (with room for F
+// ints) and writes degree and block list to dest (F + 1 ints). The
+// codec itself isn't modified so several threads can share it.
+int *oc_checkblock_map_r(const oc_codec *codec, int degree, oc_rng_sha1 *rng,
+			 oc_floyd_ctx *ctx, int *dest);
+
 // The following routines are used by init to validate and "fix" the
 // parameter list. They can also be called directly.
 
@@ -109,6 +209,10 @@ int oc_eval_f(double t);
 // expansion.
 #define OC_XOR_CACHED_AUX 16
 
+// Decoder only: graph check blocks with "transparent" aux blocks (see
+// oc_graph_set_transparent_aux in graph.h)
+#define OC_TRANSPARENT_AUX 32
+
 
 // Defaults for q, e, F. Needed to keep consistency among online-code,
 // encoder and decoder va_args handling (code must be duplicated due
@@ -14,10 +14,22 @@
 #include "online-code.h"
 #include "encoder.h"
 #include "decoder.h"
-// #include "xor.h"
+#include "xor.h"
+#include "parallel.h"
+#include "diskio.h"
 
 #define OC_DEBUG 0
 
+// check blocks per call to the encoder pool
+#define OC_POOL_BATCH 256
+
+// output buffer (packets are written as they're made)
+#define OC_SINK_BUFFER (1 << 20)
+
+// check blocks per sweep of the file with -D (each sweep reads the
+// whole file once, so bigger batches mean less I/O per block)
+#define OC_DISK_BATCH 4096
+
 extern char *optarg;		// getopt-related
 extern int   optind;
 
@@ -41,8 +53,7 @@ char *e_message, *xmit;
 char *d_message = "";
 #endif
 
-// Auxiliary caches used by encoder and decoder, respectively
-char *e_aux_cache;
+// Auxiliary cache used by the decoder (encoder has its own)
 char *d_aux_cache;
 
 // Cache for received check blocks (with a huge fudge factor)
@@ -59,16 +70,10 @@ int eargs = 0;
 int dargs = 0; //OC_EXPAND_MSG;
 
 
-// simple XOR routine (for now)
-void xor(unsigned char *dst, unsigned char *src, int count) {
-  while (count--)
-    *(dst++) ^= *(src++);
-}
-
 void test_xor(void) {
   // basic test; should print cAMELcASE
   memcpy(xmit, "CamelCase", 9);
-  xor (xmit, "         ", 9);
+  oc_xor(xmit, "         ", 9);
   printf("%.9s\n", xmit);
 }
 
@@ -93,9 +98,35 @@ void print_sum(char *data, int size, char *before, char *after) {
   printf("%s", after);
 }
 
+// Packet sink: each packet is its seed followed by its contents.
+// Writes are buffered by stdio so small blocks don't mean small writes.
+FILE *sink = NULL;
+FILE *info;			// stdout unless packets are going there
+
+int sink_packets(const char *seeds, const char *blocks, int n,
+		 int block_size) {
+
+  int i;
+
+  if (NULL == sink)
+    return 0;
+  for (i = 0; i < n; ++i)
+    if ((1 != fwrite(seeds  + (size_t) i * OC_RNG_BYTES, OC_RNG_BYTES, 1,
+		     sink)) ||
+	(1 != fwrite(blocks + (size_t) i * block_size, block_size, 1, sink)))
+      return fprintf(stderr, "Problem writing packets: %s\n",
+		     strerror(errno)), -1;
+  return 0;
+}
+
 void usage() {
   printf("Packetise: convert a file to online code packets\n\n");
-  printf("packetise.pl [-d][-s seed] [-b block_size] [-p packets] infile\n\n");
+  printf("packetise.pl [-d][-s seed] [-b block_size] [-p packets] "
+	 "[-t threads] [-D] [-P] [-o outfile] infile\n\n");
+  printf("  -D  read the file from disk as needed instead of mapping it\n");
+  printf("  -P  fault the whole mapped file in before starting\n");
+  printf("  -o  write packets (seed then contents) to outfile "
+	 "(- for stdout)\n\n");
 }
 
 int main(int argc, char * const argv[]) {
@@ -106,18 +137,26 @@ int main(int argc, char * const argv[]) {
   int    block_size = 1024;
   int    q, f, ablocks, coblocks;
   int    done, i, j, check_count;
-  int    msg, aux, aux_block, *mp;
+  int    aux, *mp;
+  char   block_seed[OC_RNG_BYTES];
   int    remainder, padding;
-  off_t  filesize, padded, to_read;
+  off_t  filesize, padded;
   int   *exor_list, *dxor_list, count;
   int    packets=32768, rc;
+  int    threads = -1;		// -1 => don't use encoder pool
+  int    out_of_core = 0, populate = 0;
+  char  *outname = NULL;
+  oc_mapped_message mapped;
+  oc_disk_encoder disk;
+  int    batch;
+  char  *batch_seeds, *batch_blocks;
+  oc_encoder_pool pool;
   char  *filename;
-  FILE  *INFILE;
   
   oc_uni_block *solved, *sp;
 
   // parse opts
-  while ((opt = getopt(argc, argv, "ds:b:p:")) != -1) {
+  while ((opt = getopt(argc, argv, "ds:b:p:t:DPo:")) != -1) {
     switch(opt) {
     case 'd':
       memcpy(seed, null_seed, 20);
@@ -147,6 +186,22 @@ int main(int argc, char * const argv[]) {
 	exit(1);
       }
       break;
+    case 't':			// threads (besides this one)
+      threads = atoi(optarg);
+      if (threads < 0) {
+	fprintf(stderr, "Invalid number of threads %d\n", threads);
+	exit(1);
+      }
+      break;
+    case 'D':			// out-of-core encoding
+      out_of_core = 1;
+      break;
+    case 'P':			// prefault the mapping
+      populate = 1;
+      break;
+    case 'o':
+      outname = optarg;
+      break;
     default:
       usage();
       exit(1);
@@ -167,27 +222,27 @@ int main(int argc, char * const argv[]) {
   padded   = filesize;
   while (padded % block_size) { ++padded; }
 
-  INFILE = fopen(filename, "r");
-  if (INFILE == NULL) {
-    fprintf(stderr, "Problem opening file for read: %s\n", strerror(errno));
-    exit(1);
+  // Map the file (or, with -D, leave it where it is). Mapping means we
+  // don't have to read it all before the first packet, and the last
+  // block is padded out with zeros without copying anything.
+  xmit = malloc(block_size);
+  e_message = NULL;
+  if (!out_of_core) {
+    if (-1 == oc_message_map(&mapped, filename, block_size, populate))
+      exit(1);
+    e_message = mapped.data;
   }
 
-  // set up memory and slurp file
-  if (NULL == (e_message = malloc(padded))) {
-    fprintf(stderr, "Failed to malloc %d bytes for file\n", padded);
-    exit(1);
-  }
-  xmit = malloc(block_size);
-  to_read = filesize;
-  while (to_read > 0) {
-    rc = fread(e_message + filesize - to_read, to_read, 1, INFILE);
-    if (rc < 0) {
-      fprintf(stderr, "Problem reading file: %s\n", strerror(errno));
+  info = stdout;
+  if (NULL != outname) {
+    if (0 == strcmp(outname, "-")) {
+      sink = stdout;
+      info = stderr;
+    } else if (NULL == (sink = fopen(outname, "w"))) {
+      fprintf(stderr, "Problem opening %s: %s\n", outname, strerror(errno));
       exit(1);
     }
-    if (rc == 0) { break; };
-    to_read -= rc;
+    setvbuf(sink, NULL, _IOFBF, OC_SINK_BUFFER);
   }
 
   if (random_seed)
@@ -199,11 +254,11 @@ int main(int argc, char * const argv[]) {
   assert(0 == strcmp(oc_rng_as_hex(&erng), oc_rng_as_hex(&drng)));
 
   // Set up strings and such
-  printf ("SEED: %s\n", oc_rng_as_hex(&erng));
-  printf("Block size: %d\n", block_size);
+  fprintf(info, "SEED: %s\n", oc_rng_as_hex(&erng));
+  fprintf(info, "Block size: %d\n", block_size);
 
   mblocks = (padded) / block_size;
-  printf("Message blocks: %d\n", mblocks);
+  fprintf(info, "Message blocks: %d\n", mblocks);
   
   // Set up Encoder using default qef
   flags = oc_encoder_init(&enc, mblocks, &erng, eargs, 0ll);
@@ -216,36 +271,53 @@ int main(int argc, char * const argv[]) {
   e        = enc.base.e;
   f        = enc.base.F;
 
-  printf("Auxiliary blocks: %d\n", ablocks);
-  printf("Encoder parameters:\nq= %d, e= %.15g, f= %d\n", q, e, f);
-  printf("Expected number of check blocks: %d\n",
+  fprintf(info, "Auxiliary blocks: %d\n", ablocks);
+  fprintf(info, "Encoder parameters:\nq= %d, e= %.15g, f= %d\n", q, e, f);
+  fprintf(info, "Expected number of check blocks: %d\n",
 	 (int) (0.5 + (mblocks * (1 + e * q))));
-  printf("Failure probability: %e\n",pow(e/2,q + 1));
-
-  // allocate memory for auxiliary blocks
-  e_aux_cache = malloc(ablocks * block_size);
-  if (NULL == e_aux_cache)
-    return fprintf(stderr, "Failed to allocate encoder auxiliary cache\n");
-
-  memset(e_aux_cache, 0, ablocks * block_size);
-  mp = enc.base.auxiliary;
-  for (msg = 0; msg < mblocks; ++msg) {
-    for (aux = 0; aux < q; ++aux) {
-      aux_block = *(mp++) - mblocks;
-      assert(aux_block >= 0);
-      assert(aux_block < ablocks);
-      xor(e_aux_cache + block_size * aux_block,
-      	  e_message   + block_size * msg,
-      	  block_size);
+  fprintf(info, "Failure probability: %e\n",pow(e/2,q + 1));
+
+  // With -D, the disk encoder builds the aux blocks in one pass over
+  // the file and then makes check blocks a batch per sweep
+  if (out_of_core) {
+    if (-1 == oc_disk_encoder_init(&disk, &enc, filename, block_size, 0,
+				   (threads < 0) ? 0 : threads))
+      return fprintf(stderr, "Failed to set up disk encoder\n");
+
+    batch_seeds  = malloc(OC_DISK_BATCH * OC_RNG_BYTES);
+    batch_blocks = malloc((size_t) OC_DISK_BATCH * block_size);
+    if ((NULL == batch_seeds) || (NULL == batch_blocks))
+      return fprintf(stderr, "Failed to allocate batch buffers\n");
+
+    for (check_count = 0; check_count < packets; check_count += batch) {
+      batch = packets - check_count;
+      if (batch > OC_DISK_BATCH) batch = OC_DISK_BATCH;
+      if (-1 == oc_disk_encoder_emit(&disk, batch, batch_seeds, batch_blocks))
+	return fprintf(stderr, "Disk encoder failed to create check blocks\n");
+      if (-1 == sink_packets(batch_seeds, batch_blocks, batch, block_size))
+	exit(1);
     }
+    fprintf(info, "Disk reads: %lld (%lld bytes in %lld sweeps)\n",
+	   disk.file.reads, disk.file.bytes_read, disk.sweeps);
+    oc_disk_encoder_free(&disk);
+    threads = -1;		// skip the in-memory loops below
+    packets = 0;
   }
 
+  // hand the message to the encoder (this builds the aux blocks, with
+  // the pool's threads if there's going to be one)
+  else if (-1 == ((threads < 0) ?
+		  oc_encoder_init_data(&enc, e_message, block_size) :
+		  oc_encoder_init_data_parallel(&enc, e_message, block_size,
+						threads)))
+    return fprintf(stderr, "Failed to set up encoder data\n");
+
   // print out encoder's aux cache
   if (0) {
     printf ("ENCODER: Auxiliary block signatures:\n");
     for (aux = 0; aux < ablocks; ++aux) {
       printf("  signature %d :", aux + mblocks);
-      print_sum(e_aux_cache + block_size * aux, block_size," ", "\n");
+      print_sum(oc_arena_block(&enc.aux_cache, aux), block_size," ", "\n");
     }
   }
 
@@ -258,43 +330,47 @@ int main(int argc, char * const argv[]) {
     memset(chk_cache, 0, CHK_CACHE_BYTES);
     memset(d_aux_cache, 0, ablocks * block_size);
   }
+  // With -t, have a pool of threads make the check blocks in batches
+  if (threads >= 0) {
+    if (-1 == oc_encoder_pool_init(&pool, &enc, threads))
+      return fprintf(stderr, "Failed to set up encoder pool\n");
+
+    batch_seeds  = malloc(OC_POOL_BATCH * OC_RNG_BYTES);
+    batch_blocks = malloc(OC_POOL_BATCH * block_size);
+    if ((NULL == batch_seeds) || (NULL == batch_blocks))
+      return fprintf(stderr, "Failed to allocate batch buffers\n");
+
+    for (check_count = 0; check_count < packets; check_count += batch) {
+      batch = packets - check_count;
+      if (batch > OC_POOL_BATCH) batch = OC_POOL_BATCH;
+      if (-1 == oc_encoder_pool_emit(&pool, batch, batch_seeds, batch_blocks))
+	return fprintf(stderr, "Encoder pool failed to create check blocks\n");
+      if (-1 == sink_packets(batch_seeds, batch_blocks, batch, block_size))
+	exit(1);
+    }
+    oc_encoder_pool_free(&pool);
+    packets = 0;		// skip single-threaded loop below
+  }
+
   // main loop
   done = check_count = 0;
   while (packets--) {
 
-    // Encoder side: create a check block. The erng's current value is
-    // taken to be the "uuid/seed" for this checkblock. In practice,
-    // we'd create a random uuid/seed (or at least advance the rng)
-    // and save it for sending to the decoder along with the xored
-    // contents of the check block.
+    // Encoder side: create a check block. The encoder picks a new
+    // seed for each check block and writes it to block_seed, which
+    // would be sent to the decoder along with the xored contents.
 
-    //printf("\nENCODE Block #%d %s\n", check_count, oc_rng_as_hex(&erng));
-
-    if (NULL == (exor_list = oc_encoder_check_block(&enc)))
+    if (-1 == oc_encoder_emit_block(&enc, block_seed, xmit))
       return fprintf(stderr, "codec failed to create encoder check block\n");
 
-    //    printf("Encoder check block (degree %d): ",exor_list[0]);
-    //printf("Encoder check block: ");
-    //oc_print_xor_list(exor_list, "\n");
-
-    // XOR the contained message/auxiliary blocks
-    memset(xmit, 0, block_size);
-    mp    = exor_list;
-    count = *(mp++);
-    while (count--) {
-      i = *(mp++);
-      //printf("Encoder XORing block %d into check block %d\n", i, check_count);
-      assert (i < coblocks);
-      if (i < mblocks)
-       	xor(xmit, e_message   + i             * block_size, block_size);
-      else
-	xor(xmit, e_aux_cache + (i - mblocks) * block_size, block_size);
-    }
+    if (-1 == sink_packets(block_seed, xmit, 1, block_size))
+      exit(1);
 
+    exor_list = enc.base.xor_scratch;
     
     if (0) {
       // Check that xmit buffer is right (rint plain text/signature)
-      if ((1 == exor_list[0]) && (i < mblocks))
+      if ((1 == exor_list[0]) && (exor_list[1] < mblocks))
 	printf("SOLITARY ENCODED:\n");
       else
 	print_sum(xmit, block_size, "Encoder check block signature: ", "\n");
@@ -304,12 +380,10 @@ int main(int argc, char * const argv[]) {
     // At this point the encoder would send the saved seed plus the
     // contents of the xmit buffer
 
-    // Decoder side: Normally the first thing we'd do now is to seed
-    // our rng with the value given by the encoder, but we don't need
-    // to do that here because both rngs are synchronised right from
-    // the start.
+    // Decoder side: seed our rng with the value given by the encoder
 
     if (0) {
+      oc_rng_init_seed(&drng, block_seed);
       printf("\nDECODE Block #%d %s\n", check_count, oc_rng_as_hex(&drng));
 
       // Save contents of checkblock and add it to the graph
@@ -325,6 +399,11 @@ int main(int argc, char * const argv[]) {
 
   } // end while(packets)
 
-  printf("Decoded text: '%.*s'\n", LENGTH + padding, d_message);
+  if ((NULL != sink) && fclose(sink))
+    return fprintf(stderr, "Problem writing packets: %s\n", strerror(errno));
+  if (!out_of_core)
+    oc_message_unmap(&mapped);
+
+  fprintf(info, "Decoded text: '%.*s'\n", LENGTH + padding, d_message);
 
 }
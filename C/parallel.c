@@ -0,0 +1,859 @@
+// Parallel check block creation and decoding
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "online-code.h"
+#include "encoder.h"
+#include "decoder.h"
+#include "graph.h"
+#include "parallel.h"
+#include "xor.h"
+
+struct oc_pool_worker {
+  oc_encoder_pool   *pool;
+  oc_encoder_thread  state;
+};
+
+// Work through the current batch until there's nothing left. Each
+// thread claims OC_POOL_CHUNK blocks at a time, which is enough to
+// keep contention on pool->next low without leaving threads idle at
+// the end of a batch.
+static void run_batch(oc_encoder_pool *pool, oc_encoder_thread *t) {
+
+  oc_rng_sha1 rngs[OC_POOL_CHUNK];
+  char        ahead[OC_RNG_AHEAD_BYTES(OC_POOL_CHUNK, OC_RNG_LOOKAHEAD)];
+  const char *seeds[OC_POOL_CHUNK];
+  int i, j, count, n = pool->n;
+  int block_size = pool->enc->block_size;
+  int errors = 0;
+
+  // the rngs for a whole chunk are started together so that their
+  // first few hashes can be done side by side
+  while ((i = __atomic_fetch_add(&pool->next, OC_POOL_CHUNK,
+				 __ATOMIC_RELAXED)) < n) {
+    count = (n - i < OC_POOL_CHUNK) ? n - i : OC_POOL_CHUNK;
+    for (j = 0; j < count; ++j)
+      seeds[j] = pool->seeds + (size_t) (i + j) * OC_RNG_BYTES;
+    oc_rng_init_seeds(rngs, seeds, count, ahead, OC_RNG_LOOKAHEAD);
+    for (j = 0; j < count; ++j)
+      if (-1 == oc_encoder_emit_block_rng(pool->enc, t, rngs + j,
+					  pool->blocks +
+					  (size_t) (i + j) * block_size))
+	++errors;
+  }
+
+  if (errors)
+    __atomic_fetch_add(&pool->errors, errors, __ATOMIC_RELAXED);
+}
+
+static void *worker_main(void *arg) {
+
+  struct oc_pool_worker *w = arg;
+  oc_encoder_pool *pool    = w->pool;
+  unsigned int seen        = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  while (1) {
+    while ((pool->generation == seen) && !pool->shutdown)
+      pthread_cond_wait(&pool->start, &pool->lock);
+    if (pool->shutdown)
+      break;
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    run_batch(pool, &(w->state));
+
+    pthread_mutex_lock(&pool->lock);
+    if (0 == --(pool->busy))
+      pthread_cond_signal(&pool->finish);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+int oc_encoder_pool_init(oc_encoder_pool *pool, oc_encoder *enc,
+			 int threads) {
+
+  int i;
+
+  assert(NULL != pool);
+  assert(NULL != enc);
+
+  if (NULL == enc->message) {
+    fprintf(stderr, "oc_encoder_pool_init: encoder has no data plane\n");
+    return -1;
+  }
+
+  if (threads < 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    if (threads < 0) threads = 0;
+  }
+
+  memset(pool, 0, sizeof(oc_encoder_pool));
+  pool->enc = enc;
+
+  pthread_mutex_init(&pool->lock,   NULL);
+  pthread_cond_init (&pool->start,  NULL);
+  pthread_cond_init (&pool->finish, NULL);
+
+  pool->slots   = threads + 1;
+  pool->tids    = calloc(pool->slots, sizeof(pthread_t));
+  pool->workers = calloc(pool->slots, sizeof(struct oc_pool_worker));
+  if ((NULL == pool->tids) || (NULL == pool->workers)) {
+    fprintf(stderr, "oc_encoder_pool_init: failed to allocate memory\n");
+    oc_encoder_pool_free(pool);
+    return -1;
+  }
+
+  for (i = 0; i < pool->slots; ++i) {
+    pool->workers[i].pool = pool;
+    if (-1 == oc_encoder_thread_init(enc, &(pool->workers[i].state))) {
+      oc_encoder_pool_free(pool);
+      return -1;
+    }
+  }
+
+  // pool->threads only counts threads that actually started, so that
+  // oc_encoder_pool_free knows which ones to join
+  for (i = 0; i < threads; ++i) {
+    if (pthread_create(pool->tids + i, NULL, &worker_main,
+		       pool->workers + i)) {
+      fprintf(stderr, "oc_encoder_pool_init: failed to start thread\n");
+      oc_encoder_pool_free(pool);
+      return -1;
+    }
+    ++(pool->threads);
+  }
+
+  return 0;
+}
+
+int oc_encoder_pool_emit_seeded(oc_encoder_pool *pool, int n,
+				const char *seeds, char *blocks) {
+
+  assert(NULL != pool);
+
+  if (n <= 0)
+    return 0;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->n      = n;
+  pool->seeds  = seeds;
+  pool->blocks = blocks;
+  pool->next   = 0;
+  pool->errors = 0;
+  pool->busy   = pool->threads;
+  ++(pool->generation);
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  // caller's thread helps out too
+  run_batch(pool, &(pool->workers[pool->slots - 1].state));
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->busy)
+    pthread_cond_wait(&pool->finish, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+
+  return pool->errors ? -1 : 0;
+}
+
+int oc_encoder_pool_emit(oc_encoder_pool *pool, int n,
+			 char *seeds, char *blocks) {
+
+  int i;
+
+  assert(NULL != pool);
+
+  // the seed chain is inherently serial, but it's only one SHA1 per
+  // block (a single SHA-NI hash where available) so it's cheap
+  // compared with making the blocks
+  for (i = 0; i < n; ++i)
+    oc_encoder_next_seed(pool->enc, seeds + (size_t) i * OC_RNG_BYTES);
+
+  return oc_encoder_pool_emit_seeded(pool, n, seeds, blocks);
+}
+
+void oc_encoder_pool_free(oc_encoder_pool *pool) {
+
+  int i;
+
+  assert(NULL != pool);
+
+  if (pool->threads) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->threads; ++i)
+      pthread_join(pool->tids[i], NULL);
+  }
+
+  if (NULL != pool->workers) {
+    for (i = 0; i < pool->slots; ++i)
+      oc_encoder_thread_free(&(pool->workers[i].state));
+    free(pool->workers);
+  }
+  if (NULL != pool->tids)
+    free(pool->tids);
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy (&pool->start);
+  pthread_cond_destroy (&pool->finish);
+
+  pool->workers = NULL;
+  pool->tids    = NULL;
+  pool->threads = 0;
+  pool->slots   = 0;
+}
+
+
+// Parallel aux block building
+
+struct oc_aux_worker {
+  oc_aux_builder *b;
+  int             lo, hi;	// aux blocks this thread looks after
+};
+
+// Do the xors for the current run that land in w's aux blocks
+static void run_aux(struct oc_aux_worker *w) {
+
+  oc_aux_builder *b = w->b;
+  oc_codec *codec   = b->codec;
+  int mblocks = codec->mblocks, q = codec->q;
+  int lo = w->lo + mblocks, hi = w->hi + mblocks;
+  int *mp = codec->auxiliary + (size_t) b->first * q;
+  const char *bp = b->data;
+  int i, j;
+
+  if (lo == hi)
+    return;
+
+  for (i = 0; i < b->count; ++i, bp += b->block_size, mp += q)
+    for (j = 0; j < q; ++j)
+      if ((mp[j] >= lo) && (mp[j] < hi))
+	oc_xor(oc_arena_block(b->aux, mp[j] - mblocks), bp, b->block_size);
+}
+
+static void *aux_worker_main(void *arg) {
+
+  struct oc_aux_worker *w = arg;
+  oc_aux_builder *b       = w->b;
+  unsigned int seen       = 0;
+
+  pthread_mutex_lock(&b->lock);
+  while (1) {
+    while ((b->generation == seen) && !b->shutdown)
+      pthread_cond_wait(&b->start, &b->lock);
+    if (b->shutdown)
+      break;
+    seen = b->generation;
+    pthread_mutex_unlock(&b->lock);
+
+    run_aux(w);
+
+    pthread_mutex_lock(&b->lock);
+    if (0 == --(b->busy))
+      pthread_cond_signal(&b->finish);
+  }
+  pthread_mutex_unlock(&b->lock);
+
+  return NULL;
+}
+
+int oc_aux_builder_init(oc_aux_builder *b, oc_codec *codec, oc_arena *aux,
+			int block_size, int threads) {
+
+  int i, ablocks;
+
+  assert(NULL != b);
+  assert(NULL != codec);
+  assert(NULL != aux);
+
+  memset(b, 0, sizeof(oc_aux_builder));
+  b->codec      = codec;
+  b->aux        = aux;
+  b->block_size = block_size;
+  ablocks       = codec->ablocks;
+
+  if (NULL == codec->auxiliary) {
+    fprintf(stderr, "oc_aux_builder_init: no auxiliary mapping\n");
+    return -1;
+  }
+  if ((aux->blocks < ablocks) || (aux->block_size != block_size)) {
+    fprintf(stderr, "oc_aux_builder_init: aux blocks don't match codec\n");
+    return -1;
+  }
+
+  if (threads < 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    if (threads < 0) threads = 0;
+  }
+  if (threads > ablocks - 1)
+    threads = (ablocks > 0) ? ablocks - 1 : 0;
+
+  pthread_mutex_init(&b->lock,   NULL);
+  pthread_cond_init (&b->start,  NULL);
+  pthread_cond_init (&b->finish, NULL);
+
+  b->slots   = threads + 1;
+  b->tids    = calloc(b->slots, sizeof(pthread_t));
+  b->workers = calloc(b->slots, sizeof(struct oc_aux_worker));
+  if ((NULL == b->tids) || (NULL == b->workers)) {
+    fprintf(stderr, "oc_aux_builder_init: failed to allocate memory\n");
+    oc_aux_builder_free(b);
+    return -1;
+  }
+
+  // the map is random, so equal ranges of aux blocks get about the
+  // same number of xors
+  for (i = 0; i < b->slots; ++i) {
+    b->workers[i].b  = b;
+    b->workers[i].lo = (long long) ablocks * i / b->slots;
+    b->workers[i].hi = (long long) ablocks * (i + 1) / b->slots;
+  }
+
+  for (i = 0; i < threads; ++i) {
+    if (pthread_create(b->tids + i, NULL, &aux_worker_main,
+		       b->workers + i)) {
+      fprintf(stderr, "oc_aux_builder_init: failed to start thread\n");
+      oc_aux_builder_free(b);
+      return -1;
+    }
+    ++(b->threads);
+  }
+
+  return 0;
+}
+
+int oc_aux_builder_add(oc_aux_builder *b, const char *blocks,
+		       int first, int count) {
+
+  assert(NULL != b);
+
+  if (count <= 0)
+    return 0;
+  if ((NULL == blocks) || (first != b->added) ||
+      (count > b->codec->mblocks - first)) {
+    fprintf(stderr, "oc_aux_builder_add: expected blocks from %d\n",
+	    b->added);
+    return -1;
+  }
+
+  b->data  = blocks;
+  b->first = first;
+  b->count = count;
+
+  if (b->threads) {
+    pthread_mutex_lock(&b->lock);
+    b->busy = b->threads;
+    ++(b->generation);
+    pthread_cond_broadcast(&b->start);
+    pthread_mutex_unlock(&b->lock);
+  }
+
+  // caller's thread does the last range
+  run_aux(b->workers + b->slots - 1);
+
+  if (b->threads) {
+    pthread_mutex_lock(&b->lock);
+    while (b->busy)
+      pthread_cond_wait(&b->finish, &b->lock);
+    pthread_mutex_unlock(&b->lock);
+  }
+
+  b->data   = NULL;
+  b->added += count;
+
+  return 0;
+}
+
+int oc_aux_builder_done(oc_aux_builder *b) {
+
+  assert(NULL != b);
+
+  return b->added == b->codec->mblocks;
+}
+
+void oc_aux_builder_free(oc_aux_builder *b) {
+
+  int i;
+
+  assert(NULL != b);
+
+  if (b->threads) {
+    pthread_mutex_lock(&b->lock);
+    b->shutdown = 1;
+    pthread_cond_broadcast(&b->start);
+    pthread_mutex_unlock(&b->lock);
+
+    for (i = 0; i < b->threads; ++i)
+      pthread_join(b->tids[i], NULL);
+  }
+
+  if (NULL != b->workers) free(b->workers);
+  if (NULL != b->tids)    free(b->tids);
+
+  pthread_mutex_destroy(&b->lock);
+  pthread_cond_destroy (&b->start);
+  pthread_cond_destroy (&b->finish);
+
+  b->workers = NULL;
+  b->tids    = NULL;
+  b->threads = 0;
+  b->slots   = 0;
+}
+
+int oc_encoder_init_data_parallel(oc_encoder *enc, const char *message,
+				  int block_size, int threads) {
+
+  oc_codec       *codec;
+  oc_aux_builder  b;
+  int             rc;
+
+  if ((NULL == enc) || (NULL == message) || (block_size <= 0)) {
+    fprintf(stderr, "oc_encoder_init_data_parallel: invalid arguments\n");
+    return -1;
+  }
+
+  codec = &(enc->base);
+  if (NULL == codec->auxiliary) {
+    fprintf(stderr, "oc_encoder_init_data_parallel: no auxiliary mapping\n");
+    return -1;
+  }
+
+  oc_encoder_free_data(enc);	// in case we're called twice
+
+  enc->srcs = malloc((codec->F + 1) * sizeof(void *));
+  if ((-1 == oc_arena_init(&(enc->aux_cache), codec->ablocks, block_size,
+			   OC_ARENA_ZERO)) || (NULL == enc->srcs)) {
+    fprintf(stderr,
+	    "oc_encoder_init_data_parallel: failed to allocate memory\n");
+    oc_encoder_free_data(enc);
+    return -1;
+  }
+
+  if (-1 == oc_aux_builder_init(&b, codec, &(enc->aux_cache), block_size,
+				threads)) {
+    oc_encoder_free_data(enc);
+    return -1;
+  }
+  rc = oc_aux_builder_add(&b, message, 0, codec->mblocks);
+  oc_aux_builder_free(&b);
+  if (-1 == rc) {
+    oc_encoder_free_data(enc);
+    return -1;
+  }
+
+  enc->message    = message;
+  enc->block_size = block_size;
+
+  return 0;
+}
+
+
+// Pipelined decoder
+//
+// The queue is the usual bounded array of slots with a sequence
+// number in each. A slot at position pos is free for the producer
+// when seq == pos, full when seq == pos + 1 and, once a worker has
+// finished with it, free again for position pos + depth. Workers
+// claim slots by bumping head with a compare-and-swap and hang on to
+// them until they're done with the xor lists in them, so the producer
+// can safely reuse the lists' memory.
+
+static char *pipe_node_data(oc_decoder *dec, int node) {
+  if (node < dec->base.mblocks)
+    return dec->message + (size_t) node * dec->block_size;
+  return oc_arena_block(&(dec->aux_cache), node - dec->base.mblocks);
+}
+
+static char *pipe_check_data(oc_decoder_pipeline *pp, int check) {
+  return oc_arena_block(pp->chunks + (check >> OC_PIPE_CHUNK_BITS),
+			check & (OC_PIPE_CHUNK_BLOCKS - 1));
+}
+
+// Fill in one solved block. Check blocks never change, so they can be
+// xored in straight away; solved blocks have to wait until whoever's
+// working on them has finished.
+static void pipe_fill(oc_decoder_pipeline *pp, oc_pipe_slot *s) {
+
+  unsigned char *cached = pp->dec->cached;
+  int i;
+
+  memset(s->dest, 0, pp->block_size);
+  oc_xor_many(s->dest, s->srcs, s->nchk, pp->block_size);
+
+  for (i = 0; i < s->count - s->nchk; ++i)
+    while (!__atomic_load_n(cached + s->deps[i], __ATOMIC_ACQUIRE))
+      sched_yield();
+  oc_xor_many(s->dest, s->srcs + s->nchk, s->count - s->nchk,
+	      pp->block_size);
+
+  __atomic_store_n(cached + s->node, 1, __ATOMIC_RELEASE);
+}
+
+static int pipe_empty(oc_decoder_pipeline *pp) {
+  return __atomic_load_n(&pp->head,   __ATOMIC_SEQ_CST) ==
+         __atomic_load_n(&pp->queued, __ATOMIC_SEQ_CST);
+}
+
+static void *pipe_worker_main(void *arg) {
+
+  oc_decoder_pipeline *pp = arg;
+  oc_pipe_slot *s;
+  unsigned int pos;
+  int diff;
+
+  while (1) {
+    pos  = __atomic_load_n(&pp->head, __ATOMIC_RELAXED);
+    s    = pp->slots + (pos & pp->mask);
+    diff = (int) (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+
+    if (0 == diff) {
+      if (!__atomic_compare_exchange_n(&pp->head, &pos, pos + 1, 0,
+				       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	continue;
+      pipe_fill(pp, s);
+      __atomic_store_n(&s->seq, pos + pp->mask + 1, __ATOMIC_RELEASE);
+
+      __atomic_fetch_add(&pp->finished, 1, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&pp->waiting, __ATOMIC_SEQ_CST)) {
+	pthread_mutex_lock(&pp->lock);
+	pthread_cond_broadcast(&pp->idle);
+	pthread_mutex_unlock(&pp->lock);
+      }
+
+    } else if (diff < 0) {
+      // Nothing to do. The producer checks sleepers after making a
+      // slot full, so one of us is bound to see the other.
+      pthread_mutex_lock(&pp->lock);
+      __atomic_fetch_add(&pp->sleepers, 1, __ATOMIC_SEQ_CST);
+      while (pipe_empty(pp) && !pp->shutdown)
+	pthread_cond_wait(&pp->work, &pp->lock);
+      __atomic_fetch_sub(&pp->sleepers, 1, __ATOMIC_SEQ_CST);
+      if (pp->shutdown && pipe_empty(pp)) {
+	pthread_mutex_unlock(&pp->lock);
+	break;
+      }
+      pthread_mutex_unlock(&pp->lock);
+    }
+    // else another worker beat us to it
+  }
+
+  return NULL;
+}
+
+int oc_decoder_pipeline_init(oc_decoder_pipeline *pp, oc_decoder *dec,
+			     char *message, int block_size,
+			     int threads, int depth) {
+
+  unsigned int i, size;
+  int          t;
+
+  assert(NULL != pp);
+  assert(NULL != dec);
+
+  memset(pp, 0, sizeof(oc_decoder_pipeline));
+  pp->dec = dec;
+
+  if ((NULL != dec->cached) || (block_size <= 0) || (depth < 0)) {
+    fprintf(stderr, "oc_decoder_pipeline_init: invalid arguments\n");
+    pp->dec = NULL;
+    return -1;
+  }
+
+  if (threads < 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    if (threads < 0) threads = 0;
+  }
+  if (0 == depth)
+    depth = OC_PIPE_DEPTH;
+
+  // at least two slots, or "full" and "free for next time round" have
+  // the same sequence number
+  for (size = 2; size < (unsigned int) depth; size <<= 1)
+    ;
+
+  pthread_mutex_init(&pp->lock, NULL);
+  pthread_cond_init (&pp->work, NULL);
+  pthread_cond_init (&pp->idle, NULL);
+
+  // same data plane as oc_decoder_init_data, minus the check cache
+  pp->block_size   = block_size;
+  dec->block_size  = block_size;
+  if ((NULL == message) &&
+      (0 == oc_arena_init(&(dec->own_message), dec->base.mblocks, block_size,
+			  OC_ARENA_ZERO | OC_ARENA_PACKED)))
+    message = dec->own_message.base;
+  dec->message = message;
+  dec->cached  = calloc(dec->base.coblocks, sizeof(unsigned char));
+
+  pp->mask  = size - 1;
+  pp->slots = calloc(size, sizeof(oc_pipe_slot));
+  if ((NULL == dec->message) || (NULL == dec->cached) ||
+      (NULL == pp->slots) ||
+      (-1 == oc_arena_init(&(dec->aux_cache), dec->base.ablocks, block_size,
+			   OC_ARENA_ZERO)))
+    goto nomem;
+
+  for (i = 0; i < size; ++i) {
+    pp->slots[i].seq   = i;
+    pp->slots[i].space = dec->base.F + 1; // enough for any check block
+    pp->slots[i].srcs  = malloc(pp->slots[i].space * sizeof(void *));
+    pp->slots[i].deps  = malloc(pp->slots[i].space * sizeof(int));
+    if ((NULL == pp->slots[i].srcs) || (NULL == pp->slots[i].deps))
+      goto nomem;
+  }
+
+  if (threads && (NULL == (pp->tids = calloc(threads, sizeof(pthread_t)))))
+    goto nomem;
+  for (t = 0; t < threads; ++t) {
+    if (pthread_create(pp->tids + t, NULL, &pipe_worker_main, pp)) {
+      fprintf(stderr, "oc_decoder_pipeline_init: failed to start thread\n");
+      oc_decoder_pipeline_free(pp);
+      return -1;
+    }
+    ++(pp->threads);
+  }
+
+  return 0;
+
+ nomem:
+  fprintf(stderr, "oc_decoder_pipeline_init: failed to allocate memory\n");
+  oc_decoder_pipeline_free(pp);
+  return -1;
+}
+
+int oc_decoder_pipeline_accept(oc_decoder_pipeline *pp, oc_rng_sha1 *rng,
+			       const char *data) {
+
+  oc_arena *p;
+  int check;
+
+  assert(NULL != pp);
+  assert(NULL != data);
+
+  // store the contents first so that the node is never in the graph
+  // without them; if graphing fails, the next block takes the slot
+  check = pp->dec->graph.nodes - pp->dec->base.coblocks;
+
+  // new chunk (chunks themselves never move, only the table of them)
+  if ((check >> OC_PIPE_CHUNK_BITS) >= pp->chunks_used) {
+    if (pp->chunks_used == pp->chunks_space) {
+      p = realloc(pp->chunks, (pp->chunks_space + 16) * sizeof(oc_arena));
+      if (NULL == p)
+	goto nomem;
+      pp->chunks        = p;
+      pp->chunks_space += 16;
+    }
+    if (-1 == oc_arena_init(pp->chunks + pp->chunks_used,
+			    OC_PIPE_CHUNK_BLOCKS, pp->block_size, 0))
+      goto nomem;
+    ++(pp->chunks_used);
+  }
+
+  memcpy(pipe_check_data(pp, check), data, pp->block_size);
+
+  if (-1 == oc_decoder_graph_check_block(pp->dec, rng))
+    return -1;
+
+  return 0;
+
+ nomem:
+  fprintf(stderr, "oc_decoder_pipeline_accept: failed to allocate memory\n");
+  return -1;
+}
+
+// Put a newly-solved block on the queue (or fill it in now if there
+// are no workers)
+static int pipe_queue(oc_decoder_pipeline *pp, int node) {
+
+  oc_decoder   *dec = pp->dec;
+  oc_pipe_slot *s;
+  oc_bone      *b;
+  const void  **srcs;
+  int          *deps;
+  int coblocks = dec->base.coblocks, i, size, other;
+  unsigned int pos = pp->tail;
+
+  if (NULL == (b = oc_graph_solution(&(dec->graph), node))) {
+    fprintf(stderr, "oc_decoder_pipeline_resolve: node %d not solved\n", node);
+    return -1;
+  }
+  size = b->b.size - 1;
+
+  // wait for the slot to be free
+  s = pp->slots + (pos & pp->mask);
+  while (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != pos)
+    sched_yield();
+
+  if (size > s->space) {
+    srcs = realloc(s->srcs, size * sizeof(void *));
+    deps = realloc(s->deps, size * sizeof(int));
+    if (NULL != srcs) s->srcs = srcs;
+    if (NULL != deps) s->deps = deps;
+    if ((NULL == srcs) || (NULL == deps)) {
+      fprintf(stderr, "oc_decoder_pipeline_resolve: failed to grow list\n");
+      return -1;
+    }
+    s->space = size;
+  }
+
+  // check blocks first, then the solved blocks they need
+  s->node  = node;
+  s->dest  = pipe_node_data(dec, node);
+  s->nchk  = 0;
+  for (i = 2; i <= b->b.size; ++i)
+    if (b[i].a.node >= coblocks)
+      s->srcs[s->nchk++] = pipe_check_data(pp, b[i].a.node - coblocks);
+  s->count = s->nchk;
+  for (i = 2; i <= b->b.size; ++i)
+    if ((other = b[i].a.node) < coblocks) {
+      s->deps[s->count - s->nchk] = other;
+      s->srcs[s->count++]         = pipe_node_data(dec, other);
+    }
+
+  if (0 == pp->threads) {
+    pipe_fill(pp, s);
+    return 0;
+  }
+
+  __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+  pp->tail = pos + 1;
+  __atomic_fetch_add(&pp->queued, 1, __ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&pp->sleepers, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&pp->lock);
+    pthread_cond_broadcast(&pp->work);
+    pthread_mutex_unlock(&pp->lock);
+  }
+
+  return 0;
+}
+
+int oc_decoder_pipeline_resolve(oc_decoder_pipeline *pp,
+				oc_uni_block **solved) {
+
+  oc_uni_block *p;
+  int done;
+
+  assert(NULL != pp);
+  assert(NULL != solved);
+
+  if (NULL != pp->dec->solved_fn) {
+    fprintf(stderr, "oc_decoder_pipeline_resolve: solved callbacks "
+	    "not supported\n");
+    return -1;
+  }
+
+  done = oc_graph_resolve(&(pp->dec->graph), solved);
+  if (-1 != done)
+    for (p = *solved; p != NULL; p = p->a.next)
+      if (-1 == pipe_queue(pp, p->b.value))
+	return -1;
+
+  return done;
+}
+
+int oc_decoder_pipeline_accept_blocks(oc_decoder_pipeline *pp,
+				      const char *seeds[],
+				      const char *data[], int n,
+				      oc_uni_block **solved) {
+
+  oc_rng_sha1 rngs[OC_RNG_BATCH];
+  char ahead[OC_RNG_AHEAD_BYTES(OC_RNG_BATCH, OC_RNG_LOOKAHEAD)];
+  oc_graph *graph;
+  int i, j, count, mode, done;
+
+  assert(NULL != pp);
+  assert(NULL != solved);
+
+  *solved = NULL;
+  for (i = 0; i < n; i += OC_RNG_BATCH) {
+    count = (n - i < OC_RNG_BATCH) ? n - i : OC_RNG_BATCH;
+    oc_rng_init_seeds(rngs, seeds + i, count, ahead, OC_RNG_LOOKAHEAD);
+    for (j = 0; j < count; ++j)
+      if (-1 == oc_decoder_pipeline_accept(pp, rngs + j, data[i + j]))
+	return -1;
+  }
+
+  graph = &(pp->dec->graph);
+  mode  = graph->resolve_mode;
+  oc_graph_set_mode(graph, OC_RESOLVE_FIXPOINT);
+  done = oc_decoder_pipeline_resolve(pp, solved);
+  oc_graph_set_mode(graph, mode);
+
+  return done;
+}
+
+void oc_decoder_pipeline_wait(oc_decoder_pipeline *pp) {
+
+  assert(NULL != pp);
+
+  if (0 == pp->threads)
+    return;
+
+  pthread_mutex_lock(&pp->lock);
+  __atomic_store_n(&pp->waiting, 1, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&pp->finished, __ATOMIC_SEQ_CST) !=
+	 __atomic_load_n(&pp->queued,   __ATOMIC_SEQ_CST))
+    pthread_cond_wait(&pp->idle, &pp->lock);
+  __atomic_store_n(&pp->waiting, 0, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&pp->lock);
+}
+
+void oc_decoder_pipeline_free(oc_decoder_pipeline *pp) {
+
+  unsigned int i;
+  int          j;
+
+  assert(NULL != pp);
+
+  // workers finish whatever's queued before they see shutdown
+  if (pp->threads) {
+    pthread_mutex_lock(&pp->lock);
+    pp->shutdown = 1;
+    pthread_cond_broadcast(&pp->work);
+    pthread_mutex_unlock(&pp->lock);
+
+    for (j = 0; j < pp->threads; ++j)
+      pthread_join(pp->tids[j], NULL);
+  }
+  if (NULL != pp->tids)
+    free(pp->tids);
+
+  if (NULL != pp->slots) {
+    for (i = 0; i <= pp->mask; ++i) {
+      if (NULL != pp->slots[i].srcs) free(pp->slots[i].srcs);
+      if (NULL != pp->slots[i].deps) free(pp->slots[i].deps);
+    }
+    free(pp->slots);
+  }
+  if (NULL != pp->chunks) {
+    for (j = 0; j < pp->chunks_used; ++j)
+      oc_arena_free(pp->chunks + j);
+    free(pp->chunks);
+  }
+
+  pthread_mutex_destroy(&pp->lock);
+  pthread_cond_destroy (&pp->work);
+  pthread_cond_destroy (&pp->idle);
+
+  if (NULL != pp->dec)
+    oc_decoder_free_data(pp->dec);
+
+  pp->tids    = NULL;
+  pp->slots   = NULL;
+  pp->chunks  = NULL;
+  pp->dec     = NULL;
+  pp->threads = 0;
+}
@@ -0,0 +1,242 @@
+// Parallel check block creation and decoding
+
+#ifndef OC_PARALLEL_H
+#define OC_PARALLEL_H
+
+#include <pthread.h>
+
+#include "online-code.h"
+#include "encoder.h"
+#include "decoder.h"
+
+// An encoder pool is a set of worker threads that share a single
+// encoder (with its data plane already set up). Blocks are created in
+// batches: the caller's thread hands out a seed for each block in the
+// batch from the encoder's seed chain and then all threads (including
+// the caller's) take chunks of the batch until it's done. Since the
+// seeds come from the same chain as oc_encoder_emit_block uses, the
+// output is identical to calling that n times.
+
+struct oc_pool_worker;
+
+typedef struct {
+
+  oc_encoder            *enc;
+  int                    threads;	// worker threads (not counting caller)
+  pthread_t             *tids;
+  struct oc_pool_worker *workers;	// threads + 1 (last is caller's)
+  int                    slots;		// size of tids/workers arrays
+
+  pthread_mutex_t        lock;
+  pthread_cond_t         start;		// new batch available (or shutdown)
+  pthread_cond_t         finish;	// all workers done with batch
+  unsigned int           generation;	// batch number
+  int                    busy;		// workers still on this batch
+  int                    shutdown;
+
+  // current batch
+  int                    n;
+  const char            *seeds;		// n * OC_RNG_BYTES
+  char                  *blocks;	// n * block_size
+  int                    next;		// next block to hand out (atomic)
+  int                    errors;
+
+} oc_encoder_pool;
+
+// blocks taken by a thread at a time
+#define OC_POOL_CHUNK 16
+
+// threads is the number of extra threads to start. If it's negative,
+// start one per online CPU, less one for the caller. Returns 0 on
+// success.
+int  oc_encoder_pool_init(oc_encoder_pool *pool, oc_encoder *enc,
+			  int threads);
+
+// Create n check blocks, writing their seeds and contents
+int  oc_encoder_pool_emit(oc_encoder_pool *pool, int n,
+			  char *seeds, char *blocks);
+
+// As above, but with seeds supplied by the caller
+int  oc_encoder_pool_emit_seeded(oc_encoder_pool *pool, int n,
+				 const char *seeds, char *blocks);
+
+void oc_encoder_pool_free(oc_encoder_pool *pool);
+
+
+// Parallel aux block building
+//
+// oc_encoder_init_data builds the aux cache by walking the auxiliary
+// map in message order and xoring each message block into its q aux
+// blocks. For a big message that's a long serial loop. An aux builder
+// splits the aux blocks into one contiguous range per thread. Each
+// thread walks the map the same way, but only does the xors for aux
+// blocks in its own range, so no two threads ever write to the same
+// block and nothing needs locking. The map is only q ints per message
+// block, so walking all of it costs each thread little next to the
+// xoring; the message blocks themselves are only read by the threads
+// that have a use for them.
+//
+// The message doesn't have to be there all at once: it's added in
+// runs of consecutive blocks, in order (say, as it's read from a
+// file), and only the run being added has to be in memory. The aux
+// cache comes out the same as oc_encoder_init_data would make it, no
+// matter how the message is split up or how many threads there are.
+
+struct oc_aux_worker;
+
+typedef struct {
+
+  oc_codec             *codec;
+  oc_arena             *aux;		// ablocks blocks, cleared
+  int                   block_size;
+  int                   added;		// message blocks added so far
+
+  int                   threads;	// worker threads (not counting caller)
+  pthread_t            *tids;
+  struct oc_aux_worker *workers;	// threads + 1 (last is caller's)
+  int                   slots;		// size of tids/workers arrays
+
+  pthread_mutex_t       lock;
+  pthread_cond_t        start;		// new run available (or shutdown)
+  pthread_cond_t        finish;		// all workers done with run
+  unsigned int          generation;	// run number
+  int                   busy;		// workers still on this run
+  int                   shutdown;
+
+  // current run
+  const char           *data;		// count * block_size
+  int                   first, count;
+
+} oc_aux_builder;
+
+// Set up a builder for codec's aux blocks, to be built in aux (which
+// must have ablocks blocks of block_size, all cleared). threads is as
+// for oc_encoder_pool_init, but there's never more than one thread
+// per aux block. Returns 0 on success.
+int  oc_aux_builder_init(oc_aux_builder *b, oc_codec *codec, oc_arena *aux,
+			 int block_size, int threads);
+
+// Xor message blocks first ... first + count - 1 (count * block_size
+// bytes at blocks) into the aux blocks. Runs have to be added in order
+// with no gaps, starting from block 0. Returns 0 on success.
+int  oc_aux_builder_add(oc_aux_builder *b, const char *blocks,
+			int first, int count);
+
+// Returns 1 once all the message has been added (so the aux blocks
+// are finished), otherwise 0
+int  oc_aux_builder_done(oc_aux_builder *b);
+
+// Stops the workers and frees the builder (but not the aux blocks)
+void oc_aux_builder_free(oc_aux_builder *b);
+
+// Same as oc_encoder_init_data, but building the aux cache with an aux
+// builder and the given number of extra threads
+int  oc_encoder_init_data_parallel(oc_encoder *enc, const char *message,
+				   int block_size, int threads);
+
+
+// Pipelined decoder
+//
+// In the plain decoder, oc_resolve peels the graph and then xors the
+// contents of everything it solved, all on the caller's thread, so
+// the graph sits idle while the xoring is done. A decoder pipeline
+// splits the two: the caller's thread graphs check blocks and runs
+// the resolver, and for each solved block it puts the list of blocks
+// to be xored on a bounded queue that a pool of worker threads takes
+// them from. The caller can keep on accepting check blocks while the
+// workers catch up.
+//
+// A solved block usually depends on message/aux blocks that were
+// solved before it. They'll have been queued first, but could still
+// be in progress on another thread, so a worker xors in the check
+// blocks first and then waits for each dependency to be marked done
+// before xoring it in. Nothing waits on anything queued after it, so
+// this can't deadlock.
+//
+// Check block contents are copied into storage that never moves
+// (chunks of OC_PIPE_CHUNK_BLOCKS), since workers can be reading them
+// while new ones come in. Queue entries carry pointers rather than
+// node numbers, so workers never look at the graph.
+
+#define OC_PIPE_DEPTH       1024	// default queue length (power of 2, >= 2)
+#define OC_PIPE_CHUNK_BITS  10		// check blocks per chunk (as log2)
+#define OC_PIPE_CHUNK_BLOCKS (1 << OC_PIPE_CHUNK_BITS)
+
+// One solved block. nchk check blocks come first in srcs, followed by
+// the message/aux blocks in deps.
+typedef struct {
+
+  unsigned int  seq;		// queue sequence number (see parallel.c)
+  char         *dest;
+  int           node;
+  int           nchk, count;
+  const void  **srcs;
+  int          *deps;
+  int           space;		// size of srcs and deps
+
+} oc_pipe_slot;
+
+typedef struct {
+
+  oc_decoder      *dec;
+  int              block_size;
+
+  // check block storage (only touched by the caller's thread)
+  oc_arena        *chunks;		// OC_PIPE_CHUNK_BLOCKS blocks each
+  int              chunks_used, chunks_space;
+
+  // bounded queue: caller's thread is the only producer
+  oc_pipe_slot    *slots;
+  unsigned int     mask;		// depth - 1
+  unsigned int     tail;		// next to fill (producer only)
+  unsigned int     head;		// next to take (atomic)
+
+  unsigned int     queued;	// blocks put on the queue (atomic)
+  unsigned int     finished;	// and xored (atomic)
+
+  int              threads;
+  pthread_t       *tids;
+
+  // for when workers or the producer have nothing to do
+  pthread_mutex_t  lock;
+  pthread_cond_t   work;		// queue no longer empty (or shutdown)
+  pthread_cond_t   idle;		// all queued blocks finished
+  int              sleepers;	// workers waiting on work (atomic)
+  int              waiting;	// producer waiting on idle (atomic)
+  int              shutdown;
+
+} oc_decoder_pipeline;
+
+// Set up a pipeline (and the data plane) for a decoder made with
+// oc_decoder_init (or _init_shared) whose data plane hasn't been set
+// up. message is as for oc_decoder_init_data. threads is the number
+// of worker threads (negative means one per CPU less one for the
+// caller; 0 means do the xoring on the caller's thread, as the plain
+// decoder does) and depth is the queue length (0 means
+// OC_PIPE_DEPTH). Returns 0 on success.
+int  oc_decoder_pipeline_init(oc_decoder_pipeline *pp, oc_decoder *dec,
+			      char *message, int block_size,
+			      int threads, int depth);
+
+// Equivalents of oc_accept_check_block_data, oc_resolve and
+// oc_accept_check_blocks_data. Solved blocks are queued by resolve,
+// so their contents aren't necessarily there when it returns; call
+// oc_decoder_pipeline_wait before looking at them (oc_decoder_block
+// is only safe then too).
+int  oc_decoder_pipeline_accept(oc_decoder_pipeline *pp, oc_rng_sha1 *rng,
+				const char *data);
+int  oc_decoder_pipeline_resolve(oc_decoder_pipeline *pp,
+				 oc_uni_block **solved_list);
+int  oc_decoder_pipeline_accept_blocks(oc_decoder_pipeline *pp,
+				       const char *seeds[],
+				       const char *data[], int n,
+				       oc_uni_block **solved_list);
+
+// Wait until everything queued so far has been filled in
+void oc_decoder_pipeline_wait(oc_decoder_pipeline *pp);
+
+// Stops the workers and frees the pipeline and the decoder's data
+// plane (but not the decoder itself)
+void oc_decoder_pipeline_free(oc_decoder_pipeline *pp);
+
+#endif
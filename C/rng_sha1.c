@@ -10,6 +10,7 @@
 #include <fcntl.h>
 
 #include "rng_sha1.h"
+#include "sha1.h"
 
 // The endianness of the machine will have a bearing on conversion of
 // the SHA1 output into one or more 32-bit numbers. GCC provides
@@ -51,8 +52,11 @@ void oc_rng_init(oc_rng_sha1 *rng) {
   memset(rng->seed,    0, OC_RNG_BYTES);
   memset(rng->current, 0, OC_RNG_BYTES);
 
-  rng->reserved = 0;
-  rng->subprt   = 0;
+  rng->reserved    = 0;
+  rng->subprt      = 0;
+  rng->perl_compat = 0;
+  rng->ahead       = NULL;
+  rng->ahead_left  = 0;
 
 }
 
@@ -68,8 +72,11 @@ void oc_rng_init_seed(oc_rng_sha1 *rng, const char *seed) {
   memcpy(rng->seed,    seed, OC_RNG_BYTES);
   memcpy(rng->current, seed, OC_RNG_BYTES);
 
-  rng->reserved = 0;
-  rng->subprt   = 0;
+  rng->reserved    = 0;
+  rng->subprt      = 0;
+  rng->perl_compat = 0;
+  rng->ahead       = NULL;
+  rng->ahead_left  = 0;
 
 }
 
@@ -89,8 +96,11 @@ void oc_rng_init_random(oc_rng_sha1 *rng) {
 
   memcpy(rng->current, rng->seed, OC_RNG_BYTES);
 
-  rng->reserved = 0;
-  rng->subprt   = 0;
+  rng->reserved    = 0;
+  rng->subprt      = 0;
+  rng->perl_compat = 0;
+  rng->ahead       = NULL;
+  rng->ahead_left  = 0;
 
 }
 
@@ -99,14 +109,65 @@ void oc_rng_advance(oc_rng_sha1 *rng) {
 
   assert((void*) rng != 0);
 
-  if (++(rng->subprt) >= OC_RNG_RANDS_PER_SUM) {
-    // use rng->current as both input and output (works fine according
-    // to run of compat program)
-    SHA1(rng->current,OC_RNG_BYTES,rng->current);
+  if (++(rng->subprt) >= (rng->perl_compat ? 1 : OC_RNG_RANDS_PER_SUM)) {
+    if (rng->ahead_left) {
+      memcpy(rng->current, rng->ahead, OC_RNG_BYTES);
+      rng->ahead += OC_RNG_BYTES;
+      --(rng->ahead_left);
+    } else {
+      // use rng->current as both input and output (works fine
+      // according to run of compat program)
+      oc_sha1_20(rng->current, rng->current);
+    }
     rng->subprt = 0;
   }
 }
 
+void oc_rng_set_perl_compat(oc_rng_sha1 *rng, int on) {
+
+  assert((void*) rng != 0);
+
+  // with subprt at 0, the next draw hashes in either mode
+  rng->perl_compat = on ? 1 : 0;
+  rng->subprt      = 0;
+}
+
+// Hash the current state and use the result as a new seed. This
+// gives a cheap, deterministic chain of seeds (one per check block,
+// say) where each new seed depends on all the numbers drawn from the
+// previous one. Anyone holding the new seed alone can reproduce the
+// stream that follows it with oc_rng_init_seed(), so it can be sent
+// along with the check block instead of keeping two rngs in lockstep.
+
+void oc_rng_reseed(oc_rng_sha1 *rng) {
+
+  assert((void*) rng != 0);
+
+  oc_sha1_20(rng->current, rng->seed);
+  memcpy(rng->current, rng->seed, OC_RNG_BYTES);
+
+  rng->subprt     = 0;
+  rng->ahead      = NULL;
+  rng->ahead_left = 0;
+}
+
+void oc_rng_init_seeds(oc_rng_sha1 *rngs, const char *const *seeds, int n,
+		       char *ahead, int depth) {
+
+  int i;
+
+  assert((n == 0) || ((rngs != NULL) && (seeds != NULL)));
+  assert((depth == 0) || (ahead != NULL));
+
+  oc_sha1_chains((const void *const *) seeds, ahead, n, depth);
+
+  for (i = 0; i < n; ++i) {
+    oc_rng_init_seed(rngs + i, seeds[i]);
+    rngs[i].ahead      = ahead + OC_RNG_AHEAD_BYTES(i, depth);
+    rngs[i].ahead_left = depth;
+  }
+}
+
 // Generate a random seed/uuid by reading from /dev/urandom.  This
 // only works on Unix-like systems that have this device file.  The
 // routine reads OC_RNG_BYTES bytes from the file and writes them to
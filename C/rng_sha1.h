@@ -4,7 +4,6 @@
 #define OC_RNG_SHA1_H
 
 #include <stdint.h>
-#include <openssl/sha.h>
 
 #define OC_RNG_BITS 160
 #define OC_RNG_BYTES 20
@@ -21,9 +20,18 @@ typedef struct {
   // New version only does SHA after using up all 5 32-bit "random" bits.
   unsigned short subprt;	/* 0..4, then do another SHA1 */
 
+  // Perl-compatible stream: hash before every draw and use word 0,
+  // like Net::OnlineCode::RNG (see oc_rng_set_perl_compat)
+  unsigned short perl_compat;
+
   int reserved; // possible internal use
-} oc_rng_sha1;
 
+  // Precomputed hashes (see oc_rng_init_seeds). While there are some
+  // left, advancing takes the next one instead of hashing.
+  const char *ahead;
+  int         ahead_left;
+
+} oc_rng_sha1;
 
 
 void oc_rng_init(oc_rng_sha1 *rng);
@@ -36,6 +44,40 @@ double oc_rng_rand(oc_rng_sha1 *rng, double max);
 
 void oc_rng_advance(oc_rng_sha1 *rng);
 
+// The Perl RNG hashes once per number drawn and takes the first
+// (little-endian) word of each hash, so it gives a different stream
+// from the same seed. Turning this on makes this rng draw the same
+// numbers as the Perl one, which is what the Perl bindings use to
+// stay compatible with the pure-Perl encoder and decoder. All the
+// state is then in current, so the Perl side can carry on from
+// wherever the C side left off (and vice versa). The init functions
+// turn it off again.
+void oc_rng_set_perl_compat(oc_rng_sha1 *rng, int on);
+
+// Start a fresh, self-contained stream derived from the current state
+void oc_rng_reseed(oc_rng_sha1 *rng);
+
+// Batch initialisation
+//
+// Starting a separate rng for each of a batch of check block seeds
+// (as the pool and batched decoder do) means hashing a lot of short,
+// independent streams. This initialises n rngs at once, one per seed,
+// and precomputes the first depth hashes of every stream together
+// with oc_sha1_chains() so that the multi-buffer kernels can work on
+// them side by side. ahead must have room for n * depth *
+// OC_RNG_BYTES bytes (see OC_RNG_AHEAD_BYTES) and must stay around for
+// as long as the rngs are in use. Once a stream uses up its
+// precomputed hashes it carries on hashing one at a time as usual, so
+// the numbers drawn are exactly the same as with oc_rng_init_seed.
+
+#define OC_RNG_LOOKAHEAD 4	// covers 20 draws, enough for most blocks
+#define OC_RNG_BATCH     8	// streams per batch (one per AVX2 lane)
+
+#define OC_RNG_AHEAD_BYTES(n,depth) ((size_t) (n) * (depth) * OC_RNG_BYTES)
+
+void oc_rng_init_seeds(oc_rng_sha1 *rngs, const char *const *seeds, int n,
+		       char *ahead, int depth);
+
 const char *oc_rng_as_hex(oc_rng_sha1 *rng);
 
 #endif
@@ -0,0 +1,1791 @@
+// Self-tests for the parts of the library that the Perl comparison
+// programs (compat, codec, mindecoder) don't exercise
+//
+// selftest [test ...]
+//
+// With no arguments, runs every test. Failed checks are reported on
+// stderr and the exit status is the number of tests that failed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "xor.h"
+#include "online-code.h"
+#include "encoder.h"
+#include "decoder.h"
+#include "arena.h"
+#include "floyd.h"
+#include "mapcache.h"
+#include "diskio.h"
+#include "parallel.h"
+#include "transport.h"
+#include "snapshot.h"
+#include "carousel.h"
+
+const char *test_seed = "selftest seed 012345";	// 20 chars
+
+static int failed;		// checks failed in current test
+
+static void check(int ok, const char *test, const char *what, int line) {
+  if (ok) return;
+  fprintf(stderr, "%s: line %d: check failed: %s\n", test, line, what);
+  ++failed;
+}
+#define CHECK(TEST, COND) check((COND), TEST, #COND, __LINE__)
+
+// Round trips
+//
+// Most tests encode a message into a set of check blocks and decode it
+// again in some way, then compare with the original.
+
+typedef struct {
+  int   n, block_size;
+  char *seeds;			// n * OC_RNG_BYTES
+  char *data;			// n * block_size
+} block_set;
+
+static char *make_message(int mblocks, int block_size) {
+
+  char *msg = malloc((size_t) mblocks * block_size);
+  int   i;
+
+  if (NULL != msg)
+    for (srand(1), i = 0; i < mblocks * block_size; ++i)
+      msg[i] = rand();
+  return msg;
+}
+
+static int emit_blocks(oc_encoder *enc, block_set *b, int n) {
+
+  int i, bs = enc->block_size;
+
+  b->n          = n;
+  b->block_size = bs;
+  b->seeds      = malloc((size_t) n * OC_RNG_BYTES);
+  b->data       = malloc((size_t) n * bs);
+  if ((NULL == b->seeds) || (NULL == b->data))
+    return -1;
+
+  for (i = 0; i < n; ++i)
+    if (-1 == oc_encoder_emit_block(enc, b->seeds + i * OC_RNG_BYTES,
+				    b->data + i * bs))
+      return -1;
+  return 0;
+}
+
+static void free_blocks(block_set *b) {
+  free(b->seeds);
+  free(b->data);
+  b->seeds = b->data = NULL;
+}
+
+static void free_list(oc_uni_block *l) {
+
+  oc_uni_block *next;
+
+  for (; NULL != l; l = next) {
+    next = l->a.next;
+    free(l);
+  }
+}
+
+// Feed check blocks first ... last - 1 to a decoder (with its data
+// plane set up), stopping when it's done. Returns the index of the
+// next block to feed (so, blocks used if first was 0), or -1.
+static int feed_range(oc_decoder *dec, const block_set *b,
+		      int first, int last) {
+
+  oc_rng_sha1   rng;
+  oc_uni_block *solved;
+  int           i, done = 0;
+
+  for (i = first; (i < last) && !done; ++i) {
+    oc_rng_init_seed(&rng, b->seeds + i * OC_RNG_BYTES);
+    if (-1 == oc_accept_check_block_data(dec, &rng,
+					 b->data + i * b->block_size))
+      return -1;
+    do {
+      if (-1 == (done = oc_resolve(dec, &solved)))
+	return -1;
+      if (NULL == solved)
+	break;
+      free_list(solved);
+    } while (!done);
+  }
+  return i;
+}
+
+// Feed check blocks until the decoder is done. Returns the number of
+// blocks used or -1.
+static int feed_blocks(oc_decoder *dec, const block_set *b) {
+
+  int used = feed_range(dec, b, 0, b->n);
+
+  return ((-1 != used) && dec->graph.done) ? used : -1;
+}
+
+static int same_rng(const oc_rng_sha1 *a, const oc_rng_sha1 *b) {
+  return !memcmp(a->current, b->current, OC_RNG_BYTES) &&
+    (a->subprt == b->subprt);
+}
+
+// Floyd's algorithm
+//
+// Every set method has to make exactly the same picks from the same
+// rng, for all sorts of n and k (including k == n and ranges big
+// enough that the auto method switches to a bitmap or hash), and the
+// picks have to be distinct and in range. Contexts are reused from
+// one call to the next, so the indexes get grown as well.
+
+static int test_floyd(void) {
+
+  const char   *t = "floyd";
+  const int     start = 7;
+  const int     sizes[][2] = {
+    { 1, 1 }, { 2, 1 }, { 2, 2 }, { 5, 3 }, { 5, 5 }, { 16, 16 },
+    { 40, 17 }, { 100, 20 }, { 100, 99 }, { 1000, 15 }, { 1000, 60 },
+    { 5000, 40 }, { 5000, 500 }, { 100000, 30 }, { 100000, 1000 }
+  };
+  const int     methods[] = {
+    SET_AUTO, SET_UNORDERED_LIST, SET_BITMAP, SET_HASH
+  };
+  oc_floyd_ctx  ctx[4];
+  oc_rng_sha1   rng[4];
+  int          *buf[4], *ref, *out;
+  char         *seen;
+  int           s, m, i, n, k;
+
+  for (m = 0; m < 4; ++m) {
+    if (NULL == (buf[m] = malloc(1000 * sizeof(int))))
+      return -1;
+    oc_floyd_init_ctx(ctx + m, buf[m]);
+    CHECK(t, 0 == oc_floyd_set_method(ctx + m, methods[m]));
+    oc_rng_init_seed(rng + m, test_seed);
+  }
+  if (NULL == (seen = malloc(100000)))
+    return -1;
+
+  for (s = 0; s < (int) (sizeof(sizes) / sizeof(sizes[0])); ++s) {
+    n = sizes[s][0];
+    k = sizes[s][1];
+
+    ref = oc_floyd_r(ctx, rng, start, n, k);
+    memset(seen, 0, n);
+    for (i = 0; i < k; ++i) {
+      CHECK(t, (ref[i] >= start) && (ref[i] < start + n));
+      if ((ref[i] >= start) && (ref[i] < start + n)) {
+	CHECK(t, !seen[ref[i] - start]);
+	seen[ref[i] - start] = 1;
+      }
+    }
+
+    for (m = 1; m < 4; ++m) {
+      out = oc_floyd_r(ctx + m, rng + m, start, n, k);
+      CHECK(t, !memcmp(ref, out, k * sizeof(int)));
+      CHECK(t, same_rng(rng, rng + m));
+    }
+  }
+
+  for (m = 0; m < 4; ++m) {
+    oc_floyd_free_ctx(ctx + m);
+    free(buf[m]);
+  }
+  CHECK(t, -1 == oc_floyd_set_method(ctx, 99));
+  free(seen);
+
+  return 0;
+}
+
+// Degree lookup
+//
+// The guide table only changes where the search of the probability
+// table starts, so for the same random numbers it has to give the
+// same degrees as the plain linear scan, for big and small F alike.
+
+static int test_degree(void) {
+
+  const char  *t = "degree";
+  const int    sizes[] = { 100, 2000, 100000 };
+  oc_rng_sha1  grng, srng;
+  oc_encoder   guide, scan;
+  int          s, i, d, differ;
+
+  for (s = 0; s < (int) (sizeof(sizes) / sizeof(sizes[0])); ++s) {
+    oc_rng_init_seed(&grng, test_seed);
+    oc_rng_init_seed(&srng, test_seed);
+    if ((oc_encoder_init(&guide, sizes[s], &grng, 0, 0ll) & OC_FATAL_ERROR) ||
+	(oc_encoder_init(&scan,  sizes[s], &srng, 0, 0ll) & OC_FATAL_ERROR))
+      return -1;
+    CHECK(t, OC_DEGREE_GUIDE == guide.base.degree_method);
+    CHECK(t, 0 == oc_codec_set_degree_method(&scan.base, OC_DEGREE_SCAN));
+
+    for (i = differ = 0; i < 200000; ++i) {
+      d = oc_random_degree(&guide.base, &grng);
+      CHECK(t, (d >= 1) && (d <= guide.base.F));
+      differ += (d != oc_random_degree(&scan.base, &srng));
+    }
+    CHECK(t, 0 == differ);
+    CHECK(t, same_rng(&grng, &srng));
+
+    oc_encoder_free(&guide);
+    oc_encoder_free(&scan);
+  }
+  return 0;
+}
+
+// Arenas
+//
+// Growing an arena (from empty, within the heap and past the point
+// where it's mapped instead) has to keep the blocks that were there,
+// clear the new ones if asked to, and lay every block out as arena.h
+// says: on a cache line, inside one line if it's small, or packed.
+
+static int test_arena(void) {
+
+  const char *t = "arena";
+  const int   sizes[] = { 1, 5, 16, 33, 64, 100, 1027 };
+  const int   grow[]  = { 3, 10, 2, 300, 5000 };
+  const int   flags[] = {
+    0, OC_ARENA_ZERO, OC_ARENA_PACKED, OC_ARENA_ZERO | OC_ARENA_PACKED
+  };
+  oc_arena    a;
+  uintptr_t   addr;
+  char       *b;
+  int         s, f, g, i, j, bs, filled, bad;
+
+  for (s = 0; s < (int) (sizeof(sizes) / sizeof(sizes[0])); ++s)
+    for (f = 0; f < (int) (sizeof(flags) / sizeof(flags[0])); ++f) {
+      bs = sizes[s];
+      CHECK(t, 0 == oc_arena_init(&a, 0, bs, flags[f]));
+      CHECK(t, (NULL == a.base) && (0 == a.blocks));
+
+      if (flags[f] & OC_ARENA_PACKED)
+	CHECK(t, a.stride == (size_t) bs);
+      else if (bs < OC_ARENA_ALIGN)
+	CHECK(t, (a.stride >= (size_t) bs) && !(a.stride & (a.stride - 1)));
+      else
+	CHECK(t, (a.stride >= (size_t) bs) && !(a.stride % OC_ARENA_ALIGN));
+
+      for (g = filled = 0; g < (int) (sizeof(grow) / sizeof(grow[0])); ++g) {
+	CHECK(t, 0 == oc_arena_grow(&a, grow[g]));
+	if (grow[g] < filled) {		// shrinking does nothing
+	  CHECK(t, a.blocks == filled);
+	  continue;
+	}
+	CHECK(t, a.blocks == grow[g]);
+	CHECK(t, !((uintptr_t) a.base % OC_ARENA_ALIGN));
+
+	for (i = bad = 0; i < a.blocks; ++i) {
+	  b    = oc_arena_block(&a, i);
+	  addr = (uintptr_t) b;
+	  if (!(flags[f] & OC_ARENA_PACKED))
+	    bad += (bs < OC_ARENA_ALIGN) ?
+	      (addr % OC_ARENA_ALIGN + bs > OC_ARENA_ALIGN) :
+	      (0 != addr % OC_ARENA_ALIGN);
+	  for (j = 0; j < bs; ++j)
+	    if (i < filled)
+	      bad += (b[j] != (char) (i * 7 + j));
+	    else if (flags[f] & OC_ARENA_ZERO)
+	      bad += (0 != b[j]);
+	}
+	CHECK(t, 0 == bad);
+
+	for (i = filled; i < a.blocks; ++i)
+	  for (b = oc_arena_block(&a, i), j = 0; j < bs; ++j)
+	    b[j] = i * 7 + j;
+	filled = a.blocks;
+      }
+      oc_arena_free(&a);
+    }
+
+  return 0;
+}
+
+// Map cache
+//
+// An encoder made with the cache on has to end up with exactly the
+// same tables and rng state as one made without it, whether it's a
+// miss (the file is written), a hit (the file is mapped) or the file
+// is corrupt or truncated (it's ignored and replaced).
+
+static int same_tables(const oc_codec *a, const oc_codec *b) {
+  return (a->F == b->F) && (a->ablocks == b->ablocks) &&
+    !memcmp(a->p, b->p, a->F * sizeof(double)) &&
+    !memcmp(a->guide, b->guide, a->F * sizeof(int)) &&
+    !memcmp(a->auxiliary, b->auxiliary, a->q * a->mblocks * sizeof(int));
+}
+
+// name of the (only) cache file in dir, or -1 if there isn't just one
+static int cache_file(const char *dir, char *path, size_t size) {
+
+  DIR           *d;
+  struct dirent *de;
+  int            count = 0;
+
+  if (NULL == (d = opendir(dir)))
+    return -1;
+  while (NULL != (de = readdir(d)))
+    if ('.' != de->d_name[0]) {
+      snprintf(path, size, "%s/%s", dir, de->d_name);
+      ++count;
+    }
+  closedir(d);
+
+  return (1 == count) ? 0 : -1;
+}
+
+// remove a scratch directory and everything in it
+static void remove_dir(const char *dir) {
+
+  DIR           *d;
+  struct dirent *de;
+  char           path[4096];
+
+  if (NULL != (d = opendir(dir))) {
+    while (NULL != (de = readdir(d)))
+      if ('.' != de->d_name[0]) {
+	snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+	unlink(path);
+      }
+    closedir(d);
+  }
+  rmdir(dir);
+}
+
+static int test_mapcache(void) {
+
+  const char         *t = "mapcache";
+  const int           mblocks = 2000;
+  char                dir[] = "/tmp/oc-selftest-XXXXXX";
+  char                path[4096];
+  oc_rng_sha1         ref_rng, rng;
+  oc_encoder          ref, enc;
+  oc_map_cache_header h;
+  int                 fd, bad = mblocks - 1;
+
+  oc_rng_init_seed(&ref_rng, test_seed);
+  oc_map_cache_set_dir(NULL);
+  if (oc_encoder_init(&ref, mblocks, &ref_rng, 0, 0ll) & OC_FATAL_ERROR)
+    return -1;
+
+  if (NULL == mkdtemp(dir))
+    return -1;
+  oc_map_cache_set_dir(dir);
+
+  // miss: tables made as usual and a cache file written
+  oc_rng_init_seed(&rng, test_seed);
+  CHECK(t, !(oc_encoder_init(&enc, mblocks, &rng, 0, 0ll) & OC_FATAL_ERROR));
+  CHECK(t, NULL == enc.base.map_base);
+  CHECK(t, same_tables(&ref.base, &enc.base));
+  CHECK(t, same_rng(&ref_rng, &rng));
+  oc_encoder_free(&enc);
+  CHECK(t, 0 == cache_file(dir, path, sizeof(path)));
+
+  // hit: tables come from the file
+  oc_rng_init_seed(&rng, test_seed);
+  CHECK(t, !(oc_encoder_init(&enc, mblocks, &rng, 0, 0ll) & OC_FATAL_ERROR));
+  CHECK(t, NULL != enc.base.map_base);
+  CHECK(t, same_tables(&ref.base, &enc.base));
+  CHECK(t, same_rng(&ref_rng, &rng));
+  oc_encoder_free(&enc);
+
+  // corrupt header: ignored, then replaced by a good file
+  if ((fd = open(path, O_WRONLY)) >= 0) {
+    CHECK(t, 1 == pwrite(fd, "X", 1, 0));
+    close(fd);
+  }
+  oc_rng_init_seed(&rng, test_seed);
+  CHECK(t, !(oc_encoder_init(&enc, mblocks, &rng, 0, 0ll) & OC_FATAL_ERROR));
+  CHECK(t, NULL == enc.base.map_base);
+  CHECK(t, same_tables(&ref.base, &enc.base));
+  CHECK(t, same_rng(&ref_rng, &rng));
+  oc_encoder_free(&enc);
+
+  oc_rng_init_seed(&rng, test_seed);
+  CHECK(t, !(oc_encoder_init(&enc, mblocks, &rng, 0, 0ll) & OC_FATAL_ERROR));
+  CHECK(t, NULL != enc.base.map_base);
+  oc_encoder_free(&enc);
+
+  // aux map entry that isn't an aux block: ignored and replaced
+  if ((fd = open(path, O_RDWR)) >= 0) {
+    CHECK(t, sizeof(h) == pread(fd, &h, sizeof(h), 0));
+    CHECK(t, sizeof(int) == pwrite(fd, &bad, sizeof(int),
+				   h.aux_offset + 7 * sizeof(int)));
+    close(fd);
+  }
+  oc_rng_init_seed(&rng, test_seed);
+  CHECK(t, !(oc_encoder_init(&enc, mblocks, &rng, 0, 0ll) & OC_FATAL_ERROR));
+  CHECK(t, NULL == enc.base.map_base);
+  CHECK(t, same_tables(&ref.base, &enc.base));
+  CHECK(t, same_rng(&ref_rng, &rng));
+  oc_encoder_free(&enc);
+
+  oc_rng_init_seed(&rng, test_seed);
+  CHECK(t, !(oc_encoder_init(&enc, mblocks, &rng, 0, 0ll) & OC_FATAL_ERROR));
+  CHECK(t, NULL != enc.base.map_base);
+  oc_encoder_free(&enc);
+
+  // truncated (stale) file: also ignored
+  CHECK(t, 0 == truncate(path, 64));
+  oc_rng_init_seed(&rng, test_seed);
+  CHECK(t, !(oc_encoder_init(&enc, mblocks, &rng, 0, 0ll) & OC_FATAL_ERROR));
+  CHECK(t, NULL == enc.base.map_base);
+  CHECK(t, same_tables(&ref.base, &enc.base));
+  CHECK(t, same_rng(&ref_rng, &rng));
+  oc_encoder_free(&enc);
+
+  // a different seed is a different file
+  oc_rng_init_seed(&rng, "another seed 0123456");
+  CHECK(t, !(oc_encoder_init(&enc, mblocks, &rng, 0, 0ll) & OC_FATAL_ERROR));
+  CHECK(t, NULL == enc.base.map_base);
+  CHECK(t, -1 == cache_file(dir, path, sizeof(path)));
+  oc_encoder_free(&enc);
+
+  oc_encoder_free(&ref);
+  oc_map_cache_set_dir(NULL);
+
+  remove_dir(dir);
+
+  return 0;
+}
+
+// Codec templates
+//
+// One template shared by an encoder and several decoders, released in
+// an order that isn't the order they were made in. Each codec holds a
+// reference, so the template outlives its creator's reference. The
+// shared encoder has to give exactly the same blocks as a private one.
+
+static int test_template(void) {
+
+  const char        *t = "template";
+  const int          mblocks = 500, bs = 16, ndec = 3;
+  oc_codec_template *tmpl;
+  oc_rng_sha1        trng, erng, rrng, drng[3];
+  oc_encoder         enc, ref;
+  oc_decoder         dec[3];
+  block_set          blocks, ref_blocks;
+  char              *msg, *out[3];
+  int                i, order[3] = { 1, 0, 2 };
+
+  if (NULL == (msg = make_message(mblocks, bs)))
+    return -1;
+
+  oc_rng_init_seed(&trng, test_seed);
+  if (NULL == (tmpl = oc_codec_template_new(mblocks, &trng, 0ll)))
+    return -1;
+
+  oc_rng_init_seed(&rrng, test_seed);
+  if ((oc_encoder_init(&ref, mblocks, &rrng, 0, 0ll) & OC_FATAL_ERROR) ||
+      (-1 == oc_encoder_init_data(&ref, msg, bs)) ||
+      (-1 == emit_blocks(&ref, &ref_blocks, 2 * mblocks)))
+    return -1;
+  oc_encoder_free(&ref);
+
+  CHECK(t, !(oc_encoder_init_shared(&enc, tmpl, &erng, 0) & OC_FATAL_ERROR));
+  for (i = 0; i < ndec; ++i) {
+    CHECK(t, !(oc_decoder_init_shared(dec + i, tmpl, drng + i, 0, 0.0)
+	       & OC_FATAL_ERROR));
+    out[i] = calloc(mblocks, bs);
+    CHECK(t, 0 == oc_decoder_init_data(dec + i, out[i], bs));
+  }
+  CHECK(t, 1 + 1 + ndec == tmpl->refs);
+
+  // the creator's reference can go first
+  oc_codec_template_unref(tmpl);
+  CHECK(t, 1 + ndec == tmpl->refs);
+
+  CHECK(t, 0 == oc_encoder_init_data(&enc, msg, bs));
+  CHECK(t, 0 == emit_blocks(&enc, &blocks, 2 * mblocks));
+  CHECK(t, !memcmp(blocks.seeds, ref_blocks.seeds, 2 * mblocks * OC_RNG_BYTES));
+  CHECK(t, !memcmp(blocks.data, ref_blocks.data, 2 * mblocks * bs));
+  oc_encoder_free(&enc);
+  CHECK(t, ndec == tmpl->refs);
+
+  // decode with each and release them out of order
+  for (i = 0; i < ndec; ++i) {
+    CHECK(t, feed_blocks(dec + order[i], &blocks) > 0);
+    CHECK(t, !memcmp(msg, out[order[i]], (size_t) mblocks * bs));
+    if (i + 1 < ndec) {
+      oc_decoder_free(dec + order[i]);
+      CHECK(t, ndec - 1 - i == tmpl->refs);
+    }
+  }
+  oc_decoder_free(dec + order[ndec - 1]);  // frees the template
+
+  for (i = 0; i < ndec; ++i)
+    free(out[i]);
+  free_blocks(&blocks);
+  free_blocks(&ref_blocks);
+  free(msg);
+
+  return 0;
+}
+
+// Expansion
+//
+// Expanding a solved message block all the way down has to give a set
+// of check blocks that xor to its contents, and all four ways of
+// getting the expansion have to agree on what's in it. The unsorted
+// ones reuse the decoder's own list rather than allocating. Full
+// expansions get very long as messages get bigger, so this one's
+// small.
+
+typedef struct {
+  int *nodes;
+  int  count;
+} node_list;
+
+static void collect(void *arg, int node) {
+  node_list *l = arg;
+  l->nodes[l->count++] = node;
+}
+
+static int compare_ints(const void *a, const void *b) {
+  return *(const int *) a - *(const int *) b;
+}
+
+static int test_expansion(void) {
+
+  const char  *t = "expansion";
+  const int    mblocks = 200, bs = 16;
+  oc_rng_sha1  erng, drng;
+  oc_encoder   enc;
+  oc_decoder   dec;
+  block_set    blocks;
+  node_list    each;
+  char        *msg, *out, sum[16];
+  int         *sorted, *list, *into, i, j, n, bad = 0;
+
+  msg = make_message(mblocks, bs);
+  out = malloc((size_t) mblocks * bs);
+  if ((NULL == msg) || (NULL == out))
+    return -1;
+
+  oc_rng_init_seed(&erng, test_seed);
+  if ((oc_encoder_init(&enc, mblocks, &erng, 0, 0ll) & OC_FATAL_ERROR) ||
+      (-1 == oc_encoder_init_data(&enc, msg, bs)) ||
+      (-1 == emit_blocks(&enc, &blocks, 2 * mblocks)))
+    return -1;
+  oc_encoder_free(&enc);
+
+  oc_rng_init_seed(&drng, test_seed);
+  if ((oc_decoder_init(&dec, mblocks, &drng, OC_EXPAND_MSG | OC_EXPAND_AUX,
+		       0ll) & OC_FATAL_ERROR) ||
+      (-1 == oc_decoder_init_data(&dec, out, bs)))
+    return -1;
+  n = feed_blocks(&dec, &blocks);
+  CHECK(t, n > 0);
+
+  into       = malloc(n * sizeof(int));
+  each.nodes = malloc(n * sizeof(int));
+  if ((NULL == into) || (NULL == each.nodes))
+    return -1;
+
+  for (i = 0; i < mblocks; ++i) {
+    if (NULL == (sorted = oc_expansion(&dec, i)))
+      return -1;
+
+    // sorted, distinct check blocks that add up to the message block
+    memset(sum, 0, bs);
+    for (j = 1; j <= sorted[0]; ++j) {
+      bad += (sorted[j] < dec.base.coblocks) ||
+	(sorted[j] >= dec.base.coblocks + n) ||
+	((j > 1) && (sorted[j] <= sorted[j - 1]));
+      if ((sorted[j] >= dec.base.coblocks) &&
+	  (sorted[j] < dec.base.coblocks + n))
+	oc_xor(sum, oc_decoder_block(&dec, sorted[j]), bs);
+    }
+    bad += !!memcmp(sum, msg + (size_t) i * bs, bs);
+
+    // the same nodes whichever way they're asked for
+    list = oc_expansion_list(&dec, i);
+    bad += (list != dec.xlist) || (list[0] != sorted[0]);
+    qsort(list + 1, list[0], sizeof(int), &compare_ints);
+    bad += !!memcmp(list + 1, sorted + 1, sorted[0] * sizeof(int));
+
+    bad += (sorted[0] != oc_expansion_into(&dec, i, into, n));
+    qsort(into, sorted[0], sizeof(int), &compare_ints);
+    bad += !!memcmp(into, sorted + 1, sorted[0] * sizeof(int));
+
+    each.count = 0;
+    bad += (sorted[0] != oc_expansion_foreach(&dec, i, &collect, &each));
+    qsort(each.nodes, each.count, sizeof(int), &compare_ints);
+    bad += (each.count != sorted[0]) ||
+      memcmp(each.nodes, sorted + 1, sorted[0] * sizeof(int));
+
+    free(sorted);
+  }
+  CHECK(t, 0 == bad);
+
+  // too little space: just the count
+  n = oc_expansion_list(&dec, 0)[0];
+  into[0] = -1;
+  CHECK(t, n == oc_expansion_into(&dec, 0, into, n - 1));
+  CHECK(t, -1 == into[0]);
+
+  oc_decoder_free(&dec);
+  free_blocks(&blocks);
+  free(into);
+  free(each.nodes);
+  free(msg);
+  free(out);
+
+  return 0;
+}
+
+// Edge handles
+//
+// Bone elements are two ints, and each unknown element's handle has to
+// lead back to the node whose bone it's in: through the aux map for an
+// aux node's message edges, or to a slab slot for a check node's. Each
+// lower node's slab chain has to list its check nodes in the order
+// they were graphed. There are enough edges here for the slabs to run
+// into a second chunk. Afterwards the graph still has to decode.
+
+static int test_edges(void) {
+
+  const char     *t = "edges";
+  const int       mblocks = 5000, nchecks = 6000;
+  oc_rng_sha1     erng, drng, rng;
+  oc_encoder      enc;
+  oc_decoder      dec;
+  oc_graph       *g;
+  oc_graph_stats  stats;
+  oc_uni_block   *solved;
+  oc_bone        *b;
+  block_set       blocks;
+  char           *msg;
+  int            *uses, *seen, i, h, node, lower, slab, done, bad = 0;
+
+  msg = make_message(mblocks, 1);
+  oc_rng_init_seed(&erng, test_seed);
+  if ((NULL == msg) ||
+      (oc_encoder_init(&enc, mblocks, &erng, 0, 0ll) & OC_FATAL_ERROR) ||
+      (-1 == oc_encoder_init_data(&enc, msg, 1)) ||
+      (-1 == emit_blocks(&enc, &blocks, nchecks)))
+    return -1;
+  oc_encoder_free(&enc);
+
+  // graph all the check blocks before resolving anything
+  oc_rng_init_seed(&drng, test_seed);
+  if (oc_decoder_init(&dec, mblocks, &drng, 0, 0ll) & OC_FATAL_ERROR)
+    return -1;
+  for (i = 0; i < nchecks; ++i) {
+    oc_rng_init_seed(&rng, blocks.seeds + i * OC_RNG_BYTES);
+    CHECK(t, 0 == oc_accept_check_block(&dec, &rng));
+  }
+
+  g    = &(dec.graph);
+  uses = calloc(g->coblocks, sizeof(int));
+  seen = calloc(g->coblocks, sizeof(int));
+  if ((NULL == uses) || (NULL == seen))
+    return -1;
+
+  CHECK(t, 8 == sizeof(oc_bone));
+  for (node = mblocks; node < g->nodes; ++node) {
+    b = oc_graph_top(g, node);
+    for (i = 1; i <= b->a.unknowns; ++i) {
+      lower = b[i].a.node;
+      h     = b[i].b.link;
+      if (node < g->coblocks) {	// aux: message edges are in the aux map
+	if (lower != node)	// (the aux node itself has no edge)
+	  bad += (h < 0) || (h >= g->static_edges) ||
+	    (g->aux_map[h] != node) || (h / g->q != lower);
+      }
+      else {
+	bad += (h < g->static_edges) ||
+	  (OC_SLOT(g, h - g->static_edges) != node) || (lower >= node);
+	++(uses[lower]);
+      }
+    }
+  }
+
+  // each lower node's chain holds its check nodes in graphing order
+  // (nothing's been deleted yet, so the only tombstones are unused
+  // slots)
+  for (lower = 0; lower < g->coblocks; ++lower) {
+    for (slab = g->up_head[lower], node = -1; slab;
+	 slab = OC_SLOT(g, slab))
+      for (i = 1; i <= OC_SLAB_EDGES; ++i) {
+	h = OC_SLOT(g, slab + i);
+	if (h < 0)
+	  continue;
+	bad += (h <= node) || (h < g->coblocks);
+	node = h;
+	++(seen[lower]);
+      }
+    bad += (seen[lower] != uses[lower]);
+  }
+  CHECK(t, 0 == bad);
+
+  oc_decoder_get_stats(&dec, &stats);
+  CHECK(t, stats.slabs_used > OC_SLAB_CHUNK_INTS / OC_SLAB_INTS);
+
+  do {
+    done = oc_resolve(&dec, &solved);
+    free_list(solved);
+  } while ((0 == done) && (NULL != solved));
+  CHECK(t, 1 == done);
+
+  oc_decoder_free(&dec);
+  free_blocks(&blocks);
+  free(uses);
+  free(seen);
+  free(msg);
+
+  return 0;
+}
+
+// Transparent aux blocks
+//
+// The reverse aux map has to list exactly the message blocks that the
+// aux map sends to each aux block, in order. With transparent aux blocks on, no
+// check node's bone may mention an unsolved aux node, and the message
+// still has to come back right.
+
+static int test_transparent(void) {
+
+  const char     *t = "transparent";
+  const int       mblocks = 1000, bs = 16;
+  oc_rng_sha1     erng, drng, rng;
+  oc_encoder      enc;
+  oc_decoder      dec;
+  oc_graph_stats  stats;
+  oc_bone        *b;
+  block_set       blocks;
+  const int      *rev, *aux;
+  char           *msg, *out;
+  int             i, j, a, node, found, used, bad = 0;
+
+  msg = make_message(mblocks, bs);
+  out = calloc(mblocks, bs);
+  if ((NULL == msg) || (NULL == out))
+    return -1;
+
+  oc_rng_init_seed(&erng, test_seed);
+  if ((oc_encoder_init(&enc, mblocks, &erng, 0, 0ll) & OC_FATAL_ERROR) ||
+      (-1 == oc_encoder_init_data(&enc, msg, bs)) ||
+      (-1 == emit_blocks(&enc, &blocks, 3 * mblocks)))
+    return -1;
+
+  // every message -> aux edge appears once in the reverse map
+  if (NULL == (rev = oc_aux_reverse_map(&enc.base)))
+    return -1;
+  aux = enc.base.auxiliary;
+  CHECK(t, enc.base.ablocks + 1 == rev[0]);
+  CHECK(t, rev[enc.base.ablocks] - rev[0] == mblocks * enc.base.q);
+  for (a = 0; a < enc.base.ablocks; ++a)
+    for (node = rev[a] + 1; node < rev[a + 1]; ++node)
+      bad += (rev[node] <= rev[node - 1]);	// in order
+  for (i = 0; i < mblocks; ++i)
+    for (j = 0; j < enc.base.q; ++j) {
+      a = aux[i * enc.base.q + j] - mblocks;
+      for (found = 0, node = rev[a]; node < rev[a + 1]; ++node)
+	found += (rev[node] == i);
+      bad += (1 != found);
+    }
+  CHECK(t, 0 == bad);
+  oc_encoder_free(&enc);
+
+  oc_rng_init_seed(&drng, test_seed);
+  if ((oc_decoder_init(&dec, mblocks, &drng, OC_TRANSPARENT_AUX, 0ll)
+       & OC_FATAL_ERROR) ||
+      (-1 == oc_decoder_init_data(&dec, out, bs)))
+    return -1;
+
+  // before anything is solved, check nodes only link to message nodes
+  for (i = 0; i < mblocks / 2; ++i) {
+    oc_rng_init_seed(&rng, blocks.seeds + i * OC_RNG_BYTES);
+    CHECK(t, 0 == oc_accept_check_block_data(&dec, &rng,
+					     blocks.data + i * bs));
+  }
+  for (node = dec.base.coblocks; node < dec.graph.nodes; ++node) {
+    b = oc_graph_top(&(dec.graph), node);
+    for (i = 1; i <= b->a.unknowns; ++i)
+      bad += (b[i].a.node >= mblocks);
+  }
+  CHECK(t, 0 == bad);
+
+  used = feed_range(&dec, &blocks, mblocks / 2, blocks.n);
+  CHECK(t, dec.graph.done);
+  CHECK(t, !memcmp(msg, out, (size_t) mblocks * bs));
+
+  oc_decoder_get_stats(&dec, &stats);
+#if OC_GRAPH_STATS
+  CHECK(t, stats.aux_expanded > 0);
+#endif
+  CHECK(t, used > 0);
+
+  oc_decoder_free(&dec);
+  free_blocks(&blocks);
+  free(msg);
+  free(out);
+
+  return 0;
+}
+
+// Graph growth
+//
+// A decoder made with a tiny fudge factor starts with room for one
+// check node, so the graph (and the check block cache and the seeds)
+// have to grow over and over, with the pending queue wrapping around
+// as they do. It has to decode just as one with plenty of room does.
+
+static int test_growth(void) {
+
+  const char     *t = "growth";
+  const int       mblocks = 1000, bs = 16;
+  oc_rng_sha1     erng, drng, rng;
+  oc_encoder      enc;
+  oc_decoder      dec;
+  oc_graph_stats  stats;
+  block_set       blocks;
+  char           *msg, *out;
+  int             roomy, used, i, bad;
+
+  msg = make_message(mblocks, bs);
+  out = calloc(mblocks, bs);
+  if ((NULL == msg) || (NULL == out))
+    return -1;
+
+  oc_rng_init_seed(&erng, test_seed);
+  if ((oc_encoder_init(&enc, mblocks, &erng, 0, 0ll) & OC_FATAL_ERROR) ||
+      (-1 == oc_encoder_init_data(&enc, msg, bs)) ||
+      (-1 == emit_blocks(&enc, &blocks, 2 * mblocks)))
+    return -1;
+  oc_encoder_free(&enc);
+
+  oc_rng_init_seed(&drng, test_seed);
+  if ((oc_decoder_init(&dec, mblocks, &drng, 0, 2.0, 0ll) & OC_FATAL_ERROR) ||
+      (-1 == oc_decoder_init_data(&dec, out, bs)))
+    return -1;
+  roomy = feed_blocks(&dec, &blocks);
+  CHECK(t, roomy > 0);
+  oc_decoder_get_stats(&dec, &stats);
+  CHECK(t, stats.node_space > dec.base.coblocks + roomy);
+  oc_decoder_free(&dec);
+
+  memset(out, 0, (size_t) mblocks * bs);
+  oc_rng_init_seed(&drng, test_seed);
+  CHECK(t, !(oc_decoder_init(&dec, mblocks, &drng, 0, 0.0001, 0ll)
+	     & OC_FATAL_ERROR));
+  CHECK(t, dec.graph.node_space == dec.base.coblocks + 1);
+  CHECK(t, 0 == oc_decoder_init_data(&dec, out, bs));
+  CHECK(t, 0 == oc_decoder_keep_seeds(&dec));
+
+  // a block that's turned away mustn't leave a node behind
+  oc_rng_init_seed(&rng, blocks.seeds);
+  CHECK(t, -1 == oc_accept_check_block(&dec, &rng));
+  CHECK(t, dec.graph.nodes == dec.base.coblocks);
+
+  used = feed_blocks(&dec, &blocks);
+  CHECK(t, used == roomy);
+  CHECK(t, !memcmp(msg, out, (size_t) mblocks * bs));
+
+  oc_decoder_get_stats(&dec, &stats);
+  CHECK(t, stats.nodes == dec.base.coblocks + used);
+  CHECK(t, stats.node_space >= stats.nodes);
+  CHECK(t, dec.chk_cache.blocks >= used);
+  for (i = bad = 0; i < used; ++i)
+    bad += !!memcmp(oc_decoder_check_seed(&dec, dec.base.coblocks + i),
+		    blocks.seeds + i * OC_RNG_BYTES, OC_RNG_BYTES);
+  CHECK(t, 0 == bad);
+  oc_decoder_free(&dec);
+
+  free_blocks(&blocks);
+  free(msg);
+  free(out);
+
+  return 0;
+}
+
+// Graph statistics
+//
+// Each graph keeps its own statistics, so working one decoder mustn't
+// change another's. The counts have to agree with what happened: how
+// many check blocks were graphed and needed, how full the node table,
+// boneyard and slabs are, and (if they're built in) that the phases
+// were timed.
+
+static int test_stats(void) {
+
+  const char     *t = "stats";
+  const int       mblocks = 1000, bs = 16;
+  oc_rng_sha1     erng, drng;
+  oc_encoder      enc;
+  oc_decoder      dec, other;
+  oc_graph_stats  stats, before;
+  block_set       blocks;
+  char           *msg, *out, *other_out;
+  int             used;
+
+  msg       = make_message(mblocks, bs);
+  out       = malloc((size_t) mblocks * bs);
+  other_out = malloc((size_t) mblocks * bs);
+  if ((NULL == msg) || (NULL == out) || (NULL == other_out))
+    return -1;
+
+  oc_rng_init_seed(&erng, test_seed);
+  if ((oc_encoder_init(&enc, mblocks, &erng, 0, 0ll) & OC_FATAL_ERROR) ||
+      (-1 == oc_encoder_init_data(&enc, msg, bs)) ||
+      (-1 == emit_blocks(&enc, &blocks, 2 * mblocks)))
+    return -1;
+  oc_encoder_free(&enc);
+
+  oc_rng_init_seed(&drng, test_seed);
+  if ((oc_decoder_init(&dec, mblocks, &drng, 0, 0ll) & OC_FATAL_ERROR) ||
+      (-1 == oc_decoder_init_data(&dec, out, bs)))
+    return -1;
+  oc_rng_init_seed(&drng, test_seed);
+  if ((oc_decoder_init(&other, mblocks, &drng, 0, 0ll) & OC_FATAL_ERROR) ||
+      (-1 == oc_decoder_init_data(&other, other_out, bs)))
+    return -1;
+
+  oc_decoder_get_stats(&dec, &stats);
+  CHECK(t, (0 == stats.check_blocks) && (0 == stats.check_blocks_to_decode));
+  CHECK(t, stats.nodes == dec.base.coblocks);
+
+  used = feed_blocks(&dec, &blocks);
+  CHECK(t, used > 0);
+  oc_decoder_get_stats(&dec, &before);
+
+  CHECK(t, -1 != feed_range(&other, &blocks, 0, used / 2));
+  oc_decoder_get_stats(&dec, &stats);
+  CHECK(t, !memcmp(&before, &stats, sizeof(stats)));
+
+  CHECK(t, stats.nodes == dec.base.coblocks + used);
+  CHECK(t, stats.node_space >= stats.nodes);
+  CHECK(t, (stats.bones_used > 0) && (stats.bones_used <= stats.bones_space));
+  CHECK(t, (stats.slabs_used > 0) && (stats.slabs_used <= stats.slabs_space));
+
+#if OC_GRAPH_STATS
+  CHECK(t, used == stats.check_blocks);
+  CHECK(t, used == stats.check_blocks_to_decode);
+  CHECK(t, abs(stats.check_blocks_expected - (int)
+	       ((1 + dec.base.q * dec.base.e) * mblocks)) <= 1);
+  CHECK(t, stats.push_pending_calls >= used);
+  CHECK(t, stats.pending_max_full <= dec.graph.pending_size);
+  CHECK(t, stats.cascade_calls >= mblocks);
+  CHECK(t, stats.cascade_edges >= stats.cascade_max);
+  CHECK(t, 0 == stats.inact_calls);
+  CHECK(t, (stats.ns_map > 0) && (stats.ns_graph > 0) &&
+	(stats.ns_resolve > 0) && (stats.ns_xor > 0));
+
+  oc_decoder_get_stats(&other, &stats);
+  CHECK(t, used / 2 == stats.check_blocks);
+  CHECK(t, 0 == stats.check_blocks_to_decode);
+#endif
+
+  oc_decoder_free(&dec);
+  oc_decoder_free(&other);
+  free_blocks(&blocks);
+  free(msg);
+  free(out);
+  free(other_out);
+
+  return 0;
+}
+
+// Inactivation decoding
+//
+// With inactivation on, the decoder has to give back the same message
+// as with peeling alone, and never need more check blocks. A big
+// enough limit should solve the tail end by elimination and need
+// fewer; a tiny one mostly fails and has to leave the graph as it was
+// for peeling to carry on with.
+
+static int test_inactivate(void) {
+
+  const char     *t = "inactivate";
+  const int       mblocks = 500, bs = 16;
+  const int       limits[] = { 1, 8, 300 };
+  oc_rng_sha1     erng, drng;
+  oc_encoder      enc;
+  oc_decoder      dec;
+  oc_graph_stats  stats;
+  block_set       blocks;
+  char           *msg, *out;
+  int             peeled, used, r;
+
+  msg = make_message(mblocks, bs);
+  out = malloc((size_t) mblocks * bs);
+  if ((NULL == msg) || (NULL == out))
+    return -1;
+
+  oc_rng_init_seed(&erng, test_seed);
+  if ((oc_encoder_init(&enc, mblocks, &erng, 0, 0ll) & OC_FATAL_ERROR) ||
+      (-1 == oc_encoder_init_data(&enc, msg, bs)) ||
+      (-1 == emit_blocks(&enc, &blocks, 3 * mblocks)))
+    return -1;
+  oc_encoder_free(&enc);
+
+  oc_rng_init_seed(&drng, test_seed);
+  if ((oc_decoder_init(&dec, mblocks, &drng, 0, 0ll) & OC_FATAL_ERROR) ||
+      (-1 == oc_decoder_init_data(&dec, out, bs)))
+    return -1;
+  peeled = feed_blocks(&dec, &blocks);
+  CHECK(t, peeled > 0);
+  CHECK(t, !memcmp(msg, out, (size_t) mblocks * bs));
+  oc_decoder_free(&dec);
+
+  for (r = 0; r < (int) (sizeof(limits) / sizeof(limits[0])); ++r) {
+    memset(out, 0, (size_t) mblocks * bs);
+    oc_rng_init_seed(&drng, test_seed);
+    CHECK(t, !(oc_decoder_init(&dec, mblocks, &drng, 0, 0ll)
+	       & OC_FATAL_ERROR));
+    CHECK(t, 0 == oc_decoder_init_data(&dec, out, bs));
+    oc_decoder_set_inactivation(&dec, limits[r]);
+    used = feed_blocks(&dec, &blocks);
+    CHECK(t, (used > 0) && (used <= peeled));
+    CHECK(t, !memcmp(msg, out, (size_t) mblocks * bs));
+
+    oc_decoder_get_stats(&dec, &stats);
+    CHECK(t, stats.inact_max <= limits[r]);
+#if OC_GRAPH_STATS
+    if (limits[r] >= 300)
+      CHECK(t, (used < peeled) && (stats.inact_nodes > 0));
+#endif
+    oc_decoder_free(&dec);
+  }
+
+  free_blocks(&blocks);
+  free(msg);
+  free(out);
+
+  return 0;
+}
+
+// Disk encoder and decoder
+//
+// The message is a file that isn't a whole number of blocks long, so
+// the last block is padded (virtually) by the disk encoder. Its check
+// blocks have to be the same as an in-memory encoder's with the
+// padded message, and the disk decoder, logging check blocks to a
+// file through small buffers, has to recover the padded message.
+
+static int write_file(const char *path, const char *data, size_t length) {
+
+  int fd, ok;
+
+  if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    return -1;
+  ok = (write(fd, data, length) == (ssize_t) length);
+  return (close(fd) || !ok) ? -1 : 0;
+}
+
+static int test_disk(void) {
+
+  const char      *t = "disk";
+  const int        mblocks = 1000, bs = 64, nchecks = 2 * mblocks;
+  const int        batch = 150;
+  const size_t     length = (size_t) mblocks * bs - 5;
+  char             dir[] = "/tmp/oc-selftest-XXXXXX";
+  char             msg_path[4096], log_path[4096];
+  char            *msg, *seeds, *data, *out;
+  const char      *sp[150], *dp[150];
+  oc_rng_sha1      erng, rrng, drng;
+  oc_encoder       enc, ref;
+  oc_decoder       dec;
+  oc_disk_encoder  de;
+  oc_disk_decoder  dd;
+  oc_uni_block    *solved;
+  block_set        ref_blocks;
+  int              i, j, n, done = 0;
+
+  if (NULL == (msg = make_message(mblocks, bs)))
+    return -1;
+  memset(msg + length, 0, (size_t) mblocks * bs - length);	// padding
+
+  if (NULL == mkdtemp(dir))
+    return -1;
+  snprintf(msg_path, sizeof(msg_path), "%s/message", dir);
+  snprintf(log_path, sizeof(log_path), "%s/checks", dir);
+  if (-1 == write_file(msg_path, msg, length))
+    return remove_dir(dir), -1;
+
+  oc_rng_init_seed(&rrng, test_seed);
+  if ((oc_encoder_init(&ref, mblocks, &rrng, 0, 0ll) & OC_FATAL_ERROR) ||
+      (-1 == oc_encoder_init_data(&ref, msg, bs)) ||
+      (-1 == emit_blocks(&ref, &ref_blocks, nchecks)))
+    return remove_dir(dir), -1;
+  oc_encoder_free(&ref);
+
+  // encode from the file, in batches, with a buffer of a few blocks
+  seeds = malloc((size_t) nchecks * OC_RNG_BYTES);
+  data  = malloc((size_t) nchecks * bs);
+  out   = calloc(mblocks, bs);
+  if ((NULL == seeds) || (NULL == data) || (NULL == out))
+    return remove_dir(dir), -1;
+
+  oc_rng_init_seed(&erng, test_seed);
+  CHECK(t, !(oc_encoder_init(&enc, mblocks, &erng, 0, 0ll) & OC_FATAL_ERROR));
+  CHECK(t, 0 == oc_disk_encoder_init(&de, &enc, msg_path, bs, 16 * bs, 0));
+  for (i = 0; i < nchecks; i += n) {
+    n = (nchecks - i < batch) ? nchecks - i : batch;
+    CHECK(t, 0 == oc_disk_encoder_emit(&de, n, seeds + i * OC_RNG_BYTES,
+				       data + i * bs));
+  }
+  CHECK(t, !memcmp(seeds, ref_blocks.seeds, (size_t) nchecks * OC_RNG_BYTES));
+  CHECK(t, !memcmp(data, ref_blocks.data, (size_t) nchecks * bs));
+  oc_disk_encoder_free(&de);
+  oc_encoder_free(&enc);
+
+  // decode through the check block log
+  oc_rng_init_seed(&drng, test_seed);
+  CHECK(t, !(oc_decoder_init(&dec, mblocks, &drng, 0, 0ll) & OC_FATAL_ERROR));
+  CHECK(t, 0 == oc_disk_decoder_init(&dd, &dec, log_path, out, bs, 16 * bs));
+  for (i = 0; (i < nchecks) && !done; i += n) {
+    n = (nchecks - i < batch) ? nchecks - i : batch;
+    for (j = 0; j < n; ++j) {
+      sp[j] = seeds + (i + j) * OC_RNG_BYTES;
+      dp[j] = data  + (i + j) * bs;
+    }
+    done = oc_disk_decoder_accept_blocks(&dd, sp, dp, n, &solved);
+    CHECK(t, -1 != done);
+    free_list(solved);
+  }
+  CHECK(t, 1 == done);
+  CHECK(t, !memcmp(msg, out, (size_t) mblocks * bs));
+  oc_disk_decoder_free(&dd);
+  oc_decoder_free(&dec);
+
+  free(seeds);
+  free(data);
+  free(out);
+  free(msg);
+  free_blocks(&ref_blocks);
+  remove_dir(dir);
+
+  return 0;
+}
+
+// Decoder pipeline
+//
+// Decoding through a pipeline, with the xoring done on the caller's
+// thread or by worker threads (with a short queue, so the producer
+// has to wait for it), has to give the same message as the serial
+// decoder from the same check blocks, and take as many of them.
+
+// batch = 0 feeds one block at a time, resolving after each
+static int pipe_feed(oc_decoder_pipeline *pp, const block_set *b, int batch) {
+
+  oc_rng_sha1   rng;
+  oc_uni_block *solved;
+  const char   *sp[64], *dp[64];
+  int           i, j, n, done = 0;
+
+  for (i = 0; (i < b->n) && !done; i += n) {
+    if (0 == batch) {
+      n = 1;
+      oc_rng_init_seed(&rng, b->seeds + i * OC_RNG_BYTES);
+      if (-1 == oc_decoder_pipeline_accept(pp, &rng,
+					   b->data + i * b->block_size))
+	return -1;
+      do {
+	if (-1 == (done = oc_decoder_pipeline_resolve(pp, &solved)))
+	  return -1;
+	if (NULL == solved)
+	  break;
+	free_list(solved);
+      } while (!done);
+    } else {
+      n = (b->n - i < batch) ? b->n - i : batch;
+      for (j = 0; j < n; ++j) {
+	sp[j] = b->seeds + (i + j) * OC_RNG_BYTES;
+	dp[j] = b->data  + (i + j) * b->block_size;
+      }
+      done = oc_decoder_pipeline_accept_blocks(pp, sp, dp, n, &solved);
+      free_list(solved);
+      if (-1 == done)
+	return -1;
+    }
+  }
+  oc_decoder_pipeline_wait(pp);
+  return done ? i : -1;
+}
+
+static int test_pipeline(void) {
+
+  const char         *t = "pipeline";
+  const int           mblocks = 1000, bs = 32;
+  const struct { int threads, depth, batch; } runs[] = {
+    { 0, 0, 0 }, { 0, 0, 64 }, { 3, 4, 0 }, { 3, 0, 64 }, { -1, 0, 64 }
+  };
+  oc_rng_sha1         erng, drng;
+  oc_encoder          enc;
+  oc_decoder          dec;
+  oc_decoder_pipeline pp;
+  block_set           blocks;
+  char               *msg, *serial, *out;
+  int                 used, r, i;
+
+  msg    = make_message(mblocks, bs);
+  serial = calloc(mblocks, bs);
+  out    = malloc((size_t) mblocks * bs);
+  if ((NULL == msg) || (NULL == serial) || (NULL == out))
+    return -1;
+
+  oc_rng_init_seed(&erng, test_seed);
+  if ((oc_encoder_init(&enc, mblocks, &erng, 0, 0ll) & OC_FATAL_ERROR) ||
+      (-1 == oc_encoder_init_data(&enc, msg, bs)) ||
+      (-1 == emit_blocks(&enc, &blocks, 2 * mblocks)))
+    return -1;
+  oc_encoder_free(&enc);
+
+  oc_rng_init_seed(&drng, test_seed);
+  if ((oc_decoder_init(&dec, mblocks, &drng, 0, 0ll) & OC_FATAL_ERROR) ||
+      (-1 == oc_decoder_init_data(&dec, serial, bs)))
+    return -1;
+  used = feed_blocks(&dec, &blocks);
+  CHECK(t, used > 0);
+  CHECK(t, !memcmp(msg, serial, (size_t) mblocks * bs));
+  oc_decoder_free(&dec);
+
+  for (r = 0; r < (int) (sizeof(runs) / sizeof(runs[0])); ++r) {
+    memset(out, 0, (size_t) mblocks * bs);
+    oc_rng_init_seed(&drng, test_seed);
+    CHECK(t, !(oc_decoder_init(&dec, mblocks, &drng, 0, 0ll)
+	       & OC_FATAL_ERROR));
+    CHECK(t, 0 == oc_decoder_pipeline_init(&pp, &dec, out, bs,
+					   runs[r].threads, runs[r].depth));
+    i = pipe_feed(&pp, &blocks, runs[r].batch);
+    if (0 == runs[r].batch)
+      CHECK(t, used == i);
+    else			// whole batches
+      CHECK(t, (used + runs[r].batch - 1) / runs[r].batch * runs[r].batch
+	    == i);
+    CHECK(t, !memcmp(serial, out, (size_t) mblocks * bs));
+    oc_decoder_pipeline_free(&pp);
+    oc_decoder_free(&dec);
+  }
+
+  free_blocks(&blocks);
+  free(msg);
+  free(serial);
+  free(out);
+
+  return 0;
+}
+
+// Streaming delivery
+//
+// Plain write-behind, mapped output and mapped output with release,
+// the last through a pipeline with worker threads. Whatever's below
+// the cursor has to be the message already, the cursor has to reach
+// the end, and the file has to end up holding exactly the message.
+
+static int test_delivery(void) {
+
+  const char         *t = "delivery";
+  const int           mblocks = 1000, bs = 32;
+  const off_t         length = (off_t) mblocks * bs - 5;
+  const int           runs[] = {
+    0, OC_DELIVERY_MAPPED, OC_DELIVERY_MAPPED | OC_DELIVERY_RELEASE
+  };
+  char                dir[] = "/tmp/oc-selftest-XXXXXX";
+  char                path[4096];
+  char               *msg, *plain, *out, *file;
+  oc_rng_sha1         erng, drng, rng;
+  oc_encoder          enc;
+  oc_decoder          dec;
+  oc_decoder_pipeline pp;
+  oc_delivery         d;
+  oc_uni_block       *solved;
+  block_set           blocks;
+  int                 r, i, fd, last, done;
+
+  msg   = make_message(mblocks, bs);
+  plain = malloc((size_t) mblocks * bs);
+  file  = malloc((size_t) mblocks * bs);
+  if ((NULL == msg) || (NULL == plain) || (NULL == file))
+    return -1;
+  memset(msg + length, 0, (size_t) mblocks * bs - length);	// padding
+
+  oc_rng_init_seed(&erng, test_seed);
+  if ((oc_encoder_init(&enc, mblocks, &erng, 0, 0ll) & OC_FATAL_ERROR) ||
+      (-1 == oc_encoder_init_data(&enc, msg, bs)) ||
+      (-1 == emit_blocks(&enc, &blocks, 2 * mblocks)))
+    return -1;
+  oc_encoder_free(&enc);
+
+  if (NULL == mkdtemp(dir))
+    return -1;
+  snprintf(path, sizeof(path), "%s/message", dir);
+
+  for (r = 0; r < (int) (sizeof(runs) / sizeof(runs[0])); ++r) {
+    if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0)
+      return remove_dir(dir), -1;
+
+    oc_rng_init_seed(&drng, test_seed);
+    CHECK(t, !(oc_decoder_init(&dec, mblocks, &drng, 0, 0ll)
+	       & OC_FATAL_ERROR));
+    CHECK(t, 0 == oc_delivery_init(&d, &dec, fd, length, bs, runs[r]));
+    out = (runs[r] & OC_DELIVERY_MAPPED) ? d.message : plain;
+    if (runs[r] & OC_DELIVERY_RELEASE)
+      CHECK(t, 0 == oc_decoder_pipeline_init(&pp, &dec, out, bs, 2, 4));
+    else
+      CHECK(t, 0 == oc_decoder_init_data(&dec, out, bs));
+
+    for (i = done = 0; (i < blocks.n) && !done; ++i) {
+      oc_rng_init_seed(&rng, blocks.seeds + i * OC_RNG_BYTES);
+      if (runs[r] & OC_DELIVERY_RELEASE)
+	CHECK(t, 0 == oc_decoder_pipeline_accept(&pp, &rng,
+						 blocks.data + i * bs));
+      else
+	CHECK(t, 0 == oc_accept_check_block_data(&dec, &rng,
+						 blocks.data + i * bs));
+      do {
+	if (runs[r] & OC_DELIVERY_RELEASE)
+	  done = oc_decoder_pipeline_resolve(&pp, &solved);
+	else
+	  done = oc_resolve(&dec, &solved);
+	CHECK(t, -1 != done);
+	free_list(solved);
+      } while ((1 != done) && (NULL != solved));
+
+      last = d.next;
+      CHECK(t, -1 != oc_delivery_advance(&d));
+      CHECK(t, d.next >= last);
+      CHECK(t, !memcmp(msg + (size_t) last * bs, out + (size_t) last * bs,
+		       (size_t) (d.next - last) * bs));
+    }
+    CHECK(t, 1 == done);
+
+    if (runs[r] & OC_DELIVERY_RELEASE) {
+      oc_decoder_pipeline_wait(&pp);
+      CHECK(t, -1 != oc_delivery_advance(&d));
+      oc_decoder_pipeline_free(&pp);
+    }
+    CHECK(t, mblocks == d.next);
+    CHECK(t, 0 == oc_delivery_flush(&d));
+    oc_decoder_free(&dec);
+    oc_delivery_free(&d);
+
+    CHECK(t, length == lseek(fd, 0, SEEK_END));
+    CHECK(t, length == pread(fd, file, (size_t) mblocks * bs, 0));
+    CHECK(t, !memcmp(msg, file, length));
+    close(fd);
+  }
+
+  free_blocks(&blocks);
+  free(msg);
+  free(plain);
+  free(file);
+  remove_dir(dir);
+
+  return 0;
+}
+
+// Aux builder
+//
+// However many threads build the aux blocks, and however the message
+// is split into runs, the aux blocks have to come out byte for byte
+// the same as the serial encoder's aux cache.
+
+static int same_aux(const oc_arena *a, const oc_arena *b, int ablocks) {
+
+  int i;
+
+  for (i = 0; i < ablocks; ++i)
+    if (memcmp(oc_arena_block(a, i), oc_arena_block(b, i), a->block_size))
+      return 0;
+  return 1;
+}
+
+static int test_auxbuild(void) {
+
+  const char     *t = "auxbuild";
+  const int       mblocks = 2000, bs = 40;
+  const struct { int threads, run; } runs[] = {
+    { 0, 2000 }, { 0, 97 }, { 3, 2000 }, { 3, 97 }, { 3, 1 }, { -1, 500 }
+  };
+  oc_rng_sha1     rng;
+  oc_encoder      serial, enc;
+  oc_aux_builder  b;
+  oc_arena        aux;
+  char           *msg;
+  int             r, i, n, ablocks;
+
+  if (NULL == (msg = make_message(mblocks, bs)))
+    return -1;
+
+  oc_rng_init_seed(&rng, test_seed);
+  if ((oc_encoder_init(&serial, mblocks, &rng, 0, 0ll) & OC_FATAL_ERROR) ||
+      (-1 == oc_encoder_init_data(&serial, msg, bs)))
+    return -1;
+  ablocks = serial.base.ablocks;
+
+  for (r = 0; r < (int) (sizeof(runs) / sizeof(runs[0])); ++r) {
+    if (-1 == oc_arena_init(&aux, ablocks, bs, OC_ARENA_ZERO))
+      return -1;
+    CHECK(t, 0 == oc_aux_builder_init(&b, &serial.base, &aux, bs,
+				      runs[r].threads));
+    for (i = 0; i < mblocks; i += n) {
+      n = (mblocks - i < runs[r].run) ? mblocks - i : runs[r].run;
+      CHECK(t, !oc_aux_builder_done(&b));
+      CHECK(t, 0 == oc_aux_builder_add(&b, msg + (size_t) i * bs, i, n));
+    }
+    CHECK(t, oc_aux_builder_done(&b));
+    CHECK(t, same_aux(&serial.aux_cache, &aux, ablocks));
+    oc_aux_builder_free(&b);
+    oc_arena_free(&aux);
+  }
+
+  // and the encoder's own parallel set-up
+  for (r = 0; r < 2; ++r) {
+    oc_rng_init_seed(&rng, test_seed);
+    CHECK(t, !(oc_encoder_init(&enc, mblocks, &rng, 0, 0ll)
+	       & OC_FATAL_ERROR));
+    CHECK(t, 0 == oc_encoder_init_data_parallel(&enc, msg, bs, r ? 3 : 0));
+    CHECK(t, same_aux(&serial.aux_cache, &enc.aux_cache, ablocks));
+    oc_encoder_free(&enc);
+  }
+
+  oc_encoder_free(&serial);
+  free(msg);
+
+  return 0;
+}
+
+// Snapshots
+//
+// Decode partway with a couple of checkpoints (and a few blocks after
+// the last one, which are lost), then resume into a fresh decoder and
+// carry on from the last checkpoint. That has to decode the message
+// with the same check blocks as a decoder that was never stopped. A
+// decoder made from a different seed mustn't resume from it.
+
+static int test_snapshot(void) {
+
+  const char      *t = "snapshot";
+  const int        mblocks = 1000, bs = 24;
+  char             dir[] = "/tmp/oc-selftest-XXXXXX";
+  char             path[4096];
+  char            *msg, *out;
+  oc_rng_sha1      rng;
+  oc_encoder       enc;
+  oc_decoder       dec;
+  oc_snapshot      snap;
+  block_set        blocks;
+  int              used, first, second, i;
+
+  msg = make_message(mblocks, bs);
+  out = malloc((size_t) mblocks * bs);
+  if ((NULL == msg) || (NULL == out) || (NULL == mkdtemp(dir)))
+    return -1;
+  snprintf(path, sizeof(path), "%s/snap", dir);
+
+  oc_rng_init_seed(&rng, test_seed);
+  if ((oc_encoder_init(&enc, mblocks, &rng, 0, 0ll) & OC_FATAL_ERROR) ||
+      (-1 == oc_encoder_init_data(&enc, msg, bs)) ||
+      (-1 == emit_blocks(&enc, &blocks, 2 * mblocks)))
+    return remove_dir(dir), -1;
+  oc_encoder_free(&enc);
+
+  // never stopped
+  memset(out, 0, (size_t) mblocks * bs);
+  oc_rng_init_seed(&rng, test_seed);
+  if ((oc_decoder_init(&dec, mblocks, &rng, 0, 0ll) & OC_FATAL_ERROR) ||
+      (-1 == oc_decoder_init_data(&dec, out, bs)))
+    return remove_dir(dir), -1;
+  used = feed_blocks(&dec, &blocks);
+  CHECK(t, used > 0);
+  oc_decoder_free(&dec);
+  first  = used / 3;
+  second = 2 * used / 3;
+
+  // stopped after the second checkpoint
+  memset(out, 0, (size_t) mblocks * bs);
+  oc_rng_init_seed(&rng, test_seed);
+  CHECK(t, !(oc_decoder_init(&dec, mblocks, &rng, 0, 0ll) & OC_FATAL_ERROR));
+  CHECK(t, 0 == oc_decoder_init_data(&dec, out, bs));
+  CHECK(t, 0 == oc_snapshot_open(&snap, &dec, path, 0));
+  CHECK(t, first == feed_range(&dec, &blocks, 0, first));
+  CHECK(t, 0 == oc_snapshot_checkpoint(&snap));
+  CHECK(t, second == feed_range(&dec, &blocks, first, second));
+  CHECK(t, 0 == oc_snapshot_checkpoint(&snap));
+  CHECK(t, second + 10 == feed_range(&dec, &blocks, second, second + 10));
+  CHECK(t, !dec.graph.done);
+  oc_snapshot_close(&snap);
+  oc_decoder_free(&dec);
+
+  // not the same decoder
+  oc_rng_init_seed(&rng, "another seed 0123456");
+  CHECK(t, !(oc_decoder_init(&dec, mblocks, &rng, 0, 0ll) & OC_FATAL_ERROR));
+  CHECK(t, 0 == oc_decoder_init_data(&dec, out, bs));
+  CHECK(t, -1 == oc_snapshot_open(&snap, &dec, path, OC_SNAPSHOT_RESUME));
+  oc_decoder_free(&dec);
+
+  // resumed
+  memset(out, 0, (size_t) mblocks * bs);
+  oc_rng_init_seed(&rng, test_seed);
+  CHECK(t, !(oc_decoder_init(&dec, mblocks, &rng, 0, 0ll) & OC_FATAL_ERROR));
+  CHECK(t, 0 == oc_decoder_init_data(&dec, out, bs));
+  CHECK(t, 0 == oc_snapshot_open(&snap, &dec, path, OC_SNAPSHOT_RESUME));
+  CHECK(t, second == dec.graph.nodes - dec.base.coblocks);
+  i = feed_range(&dec, &blocks, second, blocks.n);
+  CHECK(t, dec.graph.done);
+  CHECK(t, used == i);
+  CHECK(t, !memcmp(msg, out, (size_t) mblocks * bs));
+  oc_snapshot_close(&snap);
+  oc_decoder_free(&dec);
+
+  CHECK(t, 0 == oc_snapshot_remove(path));
+
+  free_blocks(&blocks);
+  free(msg);
+  free(out);
+  remove_dir(dir);
+
+  return 0;
+}
+
+// Carousel
+//
+// A carousel has to give the same seeds and check blocks as
+// oc_encoder_emit_block from the same seed. With a period, it has to
+// go round again after period blocks, with or without the payload
+// cache. Small schedules make the sender wait on the schedule thread
+// and wrap the ring several times.
+
+static int test_carousel(void) {
+
+  const char      *t = "carousel";
+  const int        mblocks = 1000, bs = 32, nchecks = 2100, period = 700;
+  const struct { int batch, period, cache_degree, cache_blocks; } runs[] = {
+    { 0,   0,      0, 0   },
+    { 100, 0,      0, 0   },
+    { 128, period, 0, 0   },
+    { 128, period, 3, 100 },		// cache fills up
+    { 0,   period, 8, period }
+  };
+  oc_rng_sha1      rng;
+  oc_encoder       enc;
+  oc_carousel      c;
+  block_set        ref;
+  char            *msg, seed[OC_RNG_BYTES], *block;
+  int              r, i, j, same;
+
+  msg   = make_message(mblocks, bs);
+  block = malloc(bs);
+  if ((NULL == msg) || (NULL == block))
+    return -1;
+
+  oc_rng_init_seed(&rng, test_seed);
+  if ((oc_encoder_init(&enc, mblocks, &rng, 0, 0ll) & OC_FATAL_ERROR) ||
+      (-1 == oc_encoder_init_data(&enc, msg, bs)) ||
+      (-1 == emit_blocks(&enc, &ref, nchecks)))
+    return -1;
+  oc_encoder_free(&enc);
+
+  for (r = 0; r < (int) (sizeof(runs) / sizeof(runs[0])); ++r) {
+    oc_rng_init_seed(&rng, test_seed);
+    CHECK(t, !(oc_encoder_init(&enc, mblocks, &rng, 0, 0ll)
+	       & OC_FATAL_ERROR));
+    CHECK(t, 0 == oc_encoder_init_data(&enc, msg, bs));
+    CHECK(t, 0 == oc_carousel_init(&c, &enc, runs[r].batch, runs[r].period,
+				   runs[r].cache_degree,
+				   runs[r].cache_blocks));
+    for (same = 1, i = 0; i < nchecks; ++i) {
+      j = runs[r].period ? i % runs[r].period : i;
+      if ((oc_carousel_emit(&c, seed, block) <= 0) ||
+	  memcmp(seed, ref.seeds + j * OC_RNG_BYTES, OC_RNG_BYTES) ||
+	  memcmp(block, ref.data + j * bs, bs))
+	same = 0;
+    }
+    CHECK(t, same);
+    CHECK(t, nchecks == c.emitted);
+    if (runs[r].cache_degree)
+      CHECK(t, c.cache_hits > 0);
+    else
+      CHECK(t, 0 == c.cache_hits);
+    oc_carousel_free(&c);
+    oc_encoder_free(&enc);
+  }
+
+  free_blocks(&ref);
+  free(block);
+  free(msg);
+
+  return 0;
+}
+
+// UDP transport
+//
+// Loopback: the receiver binds to a port of the kernel's choosing on
+// 127.0.0.1. Packets sent from the caller's arrays have to arrive
+// unchanged, packets made by the encoder have to decode, a channel
+// has to stop at its limit and packets of the wrong size have to be
+// dropped. Each batch is taken as soon as it's sent so that the
+// socket buffer never overflows.
+
+static int udp_port(oc_udp_receiver *r) {
+
+  struct sockaddr_in sa;
+  socklen_t          len = sizeof(sa);
+
+  if (getsockname(r->fd, (struct sockaddr *) &sa, &len))
+    return -1;
+  return ntohs(sa.sin_port);
+}
+
+static int test_udp(void) {
+
+  const char      *t = "udp";
+  const int        mblocks = 500, bs = 48;
+  oc_rng_sha1      erng, drng;
+  oc_encoder       enc;
+  oc_decoder       dec;
+  oc_udp_receiver  r;
+  oc_udp_channel   ch;
+  oc_uni_block    *solved;
+  block_set        blocks;
+  char            *msg, *out, junk[8] = "junk";
+  int              port, i, got, n, done;
+
+  msg = make_message(mblocks, bs);
+  out = calloc(mblocks, bs);
+  if ((NULL == msg) || (NULL == out))
+    return -1;
+
+  oc_rng_init_seed(&erng, test_seed);
+  if ((oc_encoder_init(&enc, mblocks, &erng, 0, 0ll) & OC_FATAL_ERROR) ||
+      (-1 == oc_encoder_init_data(&enc, msg, bs)) ||
+      (-1 == emit_blocks(&enc, &blocks, 2 * OC_UDP_BATCH + 10)))
+    return -1;
+
+  if (-1 == oc_udp_receiver_open(&r, "127.0.0.1", 0, bs, 0))
+    return -1;
+  if ((-1 == (port = udp_port(&r))) ||
+      (-1 == oc_udp_channel_open(&ch, "127.0.0.1", port, 0, 0, 0, bs)))
+    return oc_udp_receiver_close(&r), -1;
+
+  // caller's arrays, gathered
+  for (i = 0; i < blocks.n; i += n) {
+    n = (blocks.n - i < OC_UDP_BATCH) ? blocks.n - i : OC_UDP_BATCH;
+    CHECK(t, n == oc_udp_channel_send(&ch, blocks.seeds + i * OC_RNG_BYTES,
+				      blocks.data + i * bs, n));
+    for (got = 0; got < n; got += r.count) {
+      if (oc_udp_receive(&r, 1000) <= 0)
+	break;
+      CHECK(t, !memcmp(r.seeds[0], blocks.seeds + (i + got) * OC_RNG_BYTES,
+		       OC_RNG_BYTES));
+      CHECK(t, !memcmp(r.data[r.count - 1],
+		       blocks.data + (i + got + r.count - 1) * bs, bs));
+    }
+    CHECK(t, got == n);
+  }
+
+  // wrong size
+  CHECK(t, 4 == send(ch.fd, junk, 4, 0));
+  CHECK(t, 0 == oc_udp_receive(&r, 1000));
+  CHECK(t, 1 == r.dropped);
+
+  // straight from the encoder into a decoder
+  oc_rng_init_seed(&drng, test_seed);
+  CHECK(t, !(oc_decoder_init(&dec, mblocks, &drng, 0, 0ll) & OC_FATAL_ERROR));
+  CHECK(t, 0 == oc_decoder_init_data(&dec, out, bs));
+  for (done = i = 0; !done && (i < 4 * mblocks); i += OC_UDP_BATCH) {
+    CHECK(t, OC_UDP_BATCH == oc_udp_channel_send_encoder(&ch, &enc,
+							 OC_UDP_BATCH));
+    for (got = 0; !done && (got < OC_UDP_BATCH); got += r.count) {
+      done = oc_udp_receiver_feed(&r, &dec, 1000, &solved);
+      free_list(solved);
+      if (-1 == done)
+	break;
+      if (0 == r.count)
+	break;
+    }
+  }
+  CHECK(t, 1 == done);
+  CHECK(t, !memcmp(msg, out, (size_t) mblocks * bs));
+  oc_decoder_free(&dec);
+  oc_udp_channel_close(&ch);
+
+  // limit
+  CHECK(t, 0 == oc_udp_channel_open(&ch, "127.0.0.1", port, 0, 0, 100, bs));
+  CHECK(t, 100 == oc_udp_channel_send_encoder(&ch, &enc, 2 * OC_UDP_BATCH));
+  CHECK(t, -1 == oc_udp_channel_wait_ns(&ch));
+  CHECK(t, 0 == oc_udp_channel_send_encoder(&ch, &enc, 1));
+  oc_udp_channel_close(&ch);
+
+  oc_udp_receiver_close(&r);
+  oc_encoder_free(&enc);
+  free_blocks(&blocks);
+  free(msg);
+  free(out);
+
+  return 0;
+}
+
+typedef struct {
+  const char *name;
+  int       (*run)(void);	// -1 if the test couldn't be set up
+} selftest;
+
+static const selftest tests[] = {
+  { "floyd",       &test_floyd       },
+  { "degree",      &test_degree      },
+  { "arena",       &test_arena       },
+  { "mapcache",    &test_mapcache    },
+  { "template",    &test_template    },
+  { "expansion",   &test_expansion   },
+  { "edges",       &test_edges       },
+  { "transparent", &test_transparent },
+  { "growth",      &test_growth      },
+  { "stats",       &test_stats       },
+  { "inactivate",  &test_inactivate  },
+  { "disk",        &test_disk        },
+  { "pipeline",    &test_pipeline    },
+  { "delivery",    &test_delivery    },
+  { "auxbuild",    &test_auxbuild    },
+  { "snapshot",    &test_snapshot    },
+  { "carousel",    &test_carousel    },
+  { "udp",         &test_udp         },
+  { NULL,          NULL              }
+};
+
+static int run(const selftest *test) {
+
+  int rc;
+
+  failed = 0;
+  rc = test->run();
+  if (-1 == rc)
+    fprintf(stderr, "%s: couldn't set up test\n", test->name);
+
+  printf("%-12s %s\n", test->name, (rc || failed) ? "FAIL" : "ok");
+  return (rc || failed) ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+
+  const selftest *test;
+  int             i, bad = 0;
+
+  if (argc < 2) {
+    for (test = tests; NULL != test->name; ++test)
+      bad += run(test);
+    return bad;
+  }
+
+  for (i = 1; i < argc; ++i) {
+    for (test = tests; NULL != test->name; ++test)
+      if (0 == strcmp(argv[i], test->name))
+	break;
+    if (NULL == test->name) {
+      fprintf(stderr, "selftest: no test called '%s'\n", argv[i]);
+      return 1;
+    }
+    bad += run(test);
+  }
+  return bad;
+}
@@ -0,0 +1,435 @@
+// SHA1 for 20-byte messages, with runtime-selected kernels
+//
+// A 20-byte message always pads out to exactly one block:
+//
+//   W[0..4]  message (big-endian words)
+//   W[5]     0x80000000 (the terminating 1 bit)
+//   W[6..14] 0
+//   W[15]    160 (message length in bits)
+//
+// so each hash is a single run of the compression function with the
+// standard IV, and the digest words (before they're written out as
+// big-endian bytes) are exactly the message words of the next hash in
+// the chain. The kernels below keep chains in that word form for as
+// long as they can and only convert to bytes on the way out.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sha1.h"
+
+static const uint32_t sha1_iv[5] = {
+  0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0
+};
+
+#define SHA1_K0 0x5A827999
+#define SHA1_K1 0x6ED9EBA1
+#define SHA1_K2 0x8F1BBCDC
+#define SHA1_K3 0xCA62C1D6
+
+#define SHA1_PAD 0x80000000
+#define SHA1_LEN (OC_SHA1_BYTES * 8)
+
+static inline uint32_t get_be32(const unsigned char *p) {
+  return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+         ((uint32_t) p[2] << 8)  |  (uint32_t) p[3];
+}
+
+static inline void put_be32(unsigned char *p, uint32_t v) {
+  p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+// Portable version
+
+#define ROL(x,n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+// W is kept in a 16-word ring: W[t-3], W[t-8], W[t-14] and W[t-16]
+// are at offsets 13, 8, 2 and 0 from t (mod 16)
+#define SCALAR_ROUND(F,K) {						\
+    if (i >= 16)							\
+      w[i & 15] = ROL(w[(i + 13) & 15] ^ w[(i + 8) & 15] ^		\
+		      w[(i + 2) & 15]  ^ w[i & 15], 1);			\
+    t = ROL(a, 5) + (F) + e + (K) + w[i & 15];				\
+    e = d; d = c; c = ROL(b, 30); b = a; a = t;				\
+  }
+
+// h holds the five message words on entry and the digest on exit
+static void scalar_compress(uint32_t *h) {
+
+  uint32_t w[16], a, b, c, d, e, t;
+  int i;
+
+  memcpy(w, h, 5 * sizeof(uint32_t));
+  w[5] = SHA1_PAD;
+  memset(w + 6, 0, 9 * sizeof(uint32_t));
+  w[15] = SHA1_LEN;
+
+  a = sha1_iv[0]; b = sha1_iv[1]; c = sha1_iv[2];
+  d = sha1_iv[3]; e = sha1_iv[4];
+
+  for (i =  0; i < 20; ++i) SCALAR_ROUND((b & c) | (~b & d),          SHA1_K0);
+  for (     ; i < 40; ++i) SCALAR_ROUND(b ^ c ^ d,                    SHA1_K1);
+  for (     ; i < 60; ++i) SCALAR_ROUND((b & c) | (d & (b | c)),      SHA1_K2);
+  for (     ; i < 80; ++i) SCALAR_ROUND(b ^ c ^ d,                    SHA1_K3);
+
+  h[0] = sha1_iv[0] + a; h[1] = sha1_iv[1] + b; h[2] = sha1_iv[2] + c;
+  h[3] = sha1_iv[3] + d; h[4] = sha1_iv[4] + e;
+}
+
+static void scalar_one(const unsigned char *in, unsigned char *out) {
+
+  uint32_t h[5];
+  int k;
+
+  for (k = 0; k < 5; ++k) h[k] = get_be32(in + 4 * k);
+  scalar_compress(h);
+  for (k = 0; k < 5; ++k) put_be32(out + 4 * k, h[k]);
+}
+
+static void scalar_chains(const unsigned char *const *in, unsigned char *out,
+			  int n, int depth) {
+
+  uint32_t h[5];
+  int s, j, k;
+
+  for (s = 0; s < n; ++s) {
+    for (k = 0; k < 5; ++k) h[k] = get_be32(in[s] + 4 * k);
+    for (j = 0; j < depth; ++j, out += OC_SHA1_BYTES) {
+      scalar_compress(h);
+      for (k = 0; k < 5; ++k) put_be32(out + 4 * k, h[k]);
+    }
+  }
+}
+
+static int always_supported(void) { return 1; }
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OC_SHA1_X86 1
+
+#include <immintrin.h>
+#include <cpuid.h>
+
+// AVX2 multi-buffer version
+//
+// There's no way to speed up a single SHA1 with plain vector
+// instructions since every round depends on the one before. Instead
+// this hashes eight independent streams at once, one per 32-bit lane.
+// It only pays off for oc_sha1_chains(); single hashes use the
+// portable code.
+
+#define AVX2_LANES 8
+
+#define VROL(x,n) _mm256_or_si256(_mm256_slli_epi32(x, n),		\
+				  _mm256_srli_epi32(x, 32 - (n)))
+
+#define AVX2_ROUND(F,K) {						\
+    if (i >= 16)							\
+      w[i & 15] = VROL(_mm256_xor_si256(				\
+			 _mm256_xor_si256(w[(i + 13) & 15], w[(i + 8) & 15]), \
+			 _mm256_xor_si256(w[(i + 2) & 15],  w[i & 15])), 1); \
+    t = _mm256_add_epi32(_mm256_add_epi32(VROL(a, 5), (F)),		\
+			 _mm256_add_epi32(_mm256_add_epi32(e, (K)),	\
+					  w[i & 15]));			\
+    e = d; d = c; c = VROL(b, 30); b = a; a = t;			\
+  }
+
+#define AVX2_CH  _mm256_or_si256(_mm256_and_si256(b, c),		\
+				 _mm256_andnot_si256(b, d))
+#define AVX2_PAR _mm256_xor_si256(_mm256_xor_si256(b, c), d)
+#define AVX2_MAJ _mm256_or_si256(_mm256_and_si256(b, c),		\
+				 _mm256_and_si256(d, _mm256_or_si256(b, c)))
+
+__attribute__((target("avx2")))
+static inline void avx2_compress(__m256i *h) {
+
+  __m256i w[16], a, b, c, d, e, t, k;
+  int i;
+
+  for (i = 0; i < 5; ++i) w[i] = h[i];
+  w[5] = _mm256_set1_epi32(SHA1_PAD);
+  for (i = 6; i < 15; ++i) w[i] = _mm256_setzero_si256();
+  w[15] = _mm256_set1_epi32(SHA1_LEN);
+
+  a = _mm256_set1_epi32(sha1_iv[0]); b = _mm256_set1_epi32(sha1_iv[1]);
+  c = _mm256_set1_epi32(sha1_iv[2]); d = _mm256_set1_epi32(sha1_iv[3]);
+  e = _mm256_set1_epi32(sha1_iv[4]);
+
+  k = _mm256_set1_epi32(SHA1_K0);
+  for (i =  0; i < 20; ++i) AVX2_ROUND(AVX2_CH,  k);
+  k = _mm256_set1_epi32(SHA1_K1);
+  for (     ; i < 40; ++i) AVX2_ROUND(AVX2_PAR, k);
+  k = _mm256_set1_epi32(SHA1_K2);
+  for (     ; i < 60; ++i) AVX2_ROUND(AVX2_MAJ, k);
+  k = _mm256_set1_epi32(SHA1_K3);
+  for (     ; i < 80; ++i) AVX2_ROUND(AVX2_PAR, k);
+
+  h[0] = _mm256_add_epi32(a, _mm256_set1_epi32(sha1_iv[0]));
+  h[1] = _mm256_add_epi32(b, _mm256_set1_epi32(sha1_iv[1]));
+  h[2] = _mm256_add_epi32(c, _mm256_set1_epi32(sha1_iv[2]));
+  h[3] = _mm256_add_epi32(d, _mm256_set1_epi32(sha1_iv[3]));
+  h[4] = _mm256_add_epi32(e, _mm256_set1_epi32(sha1_iv[4]));
+}
+
+__attribute__((target("avx2")))
+static void avx2_chains(const unsigned char *const *in, unsigned char *out,
+			int n, int depth) {
+
+  uint32_t words[5][AVX2_LANES] __attribute__((aligned(32)));
+  __m256i  h[5];
+  int      g, lanes, l, s, j, k;
+
+  for (g = 0; g < n; g += AVX2_LANES) {
+
+    // a short last group just repeats its last stream in the spare
+    // lanes and throws the results away
+    lanes = n - g;
+    if (lanes > AVX2_LANES) lanes = AVX2_LANES;
+
+    for (l = 0; l < AVX2_LANES; ++l) {
+      s = g + ((l < lanes) ? l : lanes - 1);
+      for (k = 0; k < 5; ++k)
+	words[k][l] = get_be32(in[s] + 4 * k);
+    }
+    for (k = 0; k < 5; ++k)
+      h[k] = _mm256_load_si256((__m256i *) words[k]);
+
+    for (j = 0; j < depth; ++j) {
+      avx2_compress(h);
+      for (k = 0; k < 5; ++k)
+	_mm256_store_si256((__m256i *) words[k], h[k]);
+      for (l = 0; l < lanes; ++l) {
+	s = g + l;
+	for (k = 0; k < 5; ++k)
+	  put_be32(out + ((size_t) s * depth + j) * OC_SHA1_BYTES + 4 * k,
+		   words[k][l]);
+      }
+    }
+  }
+}
+
+// SHA extensions (SHA-NI) version
+//
+// The CPU does four rounds per sha1rnds4, which makes this the fastest
+// way to do a single hash. ABCD holds digest words 0..3 in lanes 3..0
+// (ie, reversed) and E holds word 4 in lane 3 with zeros below, which
+// is also exactly the layout that the first two message vectors need,
+// so a chain never has to leave the registers.
+//
+// Each message vector for rounds 16 on is built from the previous four
+// in the usual way:
+//
+//   W[i] = msg2(msg1(W[i-4], W[i-3]) ^ W[i-2], W[i-1])
+
+#define SHANI_MSG(m0,m1,m2,m3)						\
+  m0 = _mm_sha1msg2_epu32(_mm_xor_si128(_mm_sha1msg1_epu32(m0, m1), m2), m3)
+
+// alternate between E0 and E1 as the "next E" register
+#define SHANI_EVEN(m,f) {						\
+    e0 = _mm_sha1nexte_epu32(e0, m); e1 = abcd;				\
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, f);				\
+  }
+#define SHANI_ODD(m,f) {						\
+    e1 = _mm_sha1nexte_epu32(e1, m); e0 = abcd;				\
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, f);				\
+  }
+
+#define SHANI_MASK _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL)
+
+__attribute__((target("sha,sse4.1")))
+static inline void shani_compress(__m128i *h_abcd, __m128i *h_e) {
+
+  const __m128i iv_abcd = _mm_set_epi32(sha1_iv[0], sha1_iv[1],
+					sha1_iv[2], sha1_iv[3]);
+  const __m128i iv_e    = _mm_set_epi32(sha1_iv[4], 0, 0, 0);
+  __m128i abcd, e0, e1, m0, m1, m2, m3;
+
+  m0 = *h_abcd;
+  m1 = _mm_or_si128(*h_e, _mm_set_epi32(0, SHA1_PAD, 0, 0));
+  m2 = _mm_setzero_si128();
+  m3 = _mm_set_epi32(0, 0, 0, SHA1_LEN);
+
+  abcd = iv_abcd;
+  e0   = _mm_add_epi32(iv_e, m0);
+  e1   = abcd;
+  abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);	// rounds 0-3
+
+  SHANI_ODD (m1, 0);
+  SHANI_EVEN(m2, 0);
+  SHANI_ODD (m3, 0);
+  SHANI_MSG(m0, m1, m2, m3); SHANI_EVEN(m0, 0);	// rounds 16-19
+  SHANI_MSG(m1, m2, m3, m0); SHANI_ODD (m1, 1);
+  SHANI_MSG(m2, m3, m0, m1); SHANI_EVEN(m2, 1);
+  SHANI_MSG(m3, m0, m1, m2); SHANI_ODD (m3, 1);
+  SHANI_MSG(m0, m1, m2, m3); SHANI_EVEN(m0, 1);
+  SHANI_MSG(m1, m2, m3, m0); SHANI_ODD (m1, 1);	// rounds 36-39
+  SHANI_MSG(m2, m3, m0, m1); SHANI_EVEN(m2, 2);
+  SHANI_MSG(m3, m0, m1, m2); SHANI_ODD (m3, 2);
+  SHANI_MSG(m0, m1, m2, m3); SHANI_EVEN(m0, 2);
+  SHANI_MSG(m1, m2, m3, m0); SHANI_ODD (m1, 2);
+  SHANI_MSG(m2, m3, m0, m1); SHANI_EVEN(m2, 2);	// rounds 56-59
+  SHANI_MSG(m3, m0, m1, m2); SHANI_ODD (m3, 3);
+  SHANI_MSG(m0, m1, m2, m3); SHANI_EVEN(m0, 3);
+  SHANI_MSG(m1, m2, m3, m0); SHANI_ODD (m1, 3);
+  SHANI_MSG(m2, m3, m0, m1); SHANI_EVEN(m2, 3);
+  SHANI_MSG(m3, m0, m1, m2); SHANI_ODD (m3, 3);	// rounds 76-79
+
+  *h_e    = _mm_sha1nexte_epu32(e0, iv_e);
+  *h_abcd = _mm_add_epi32(abcd, iv_abcd);
+}
+
+__attribute__((target("sha,sse4.1")))
+static inline void shani_load(const unsigned char *in,
+			      __m128i *abcd, __m128i *e) {
+  *abcd = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) in), SHANI_MASK);
+  *e    = _mm_set_epi32(get_be32(in + 16), 0, 0, 0);
+}
+
+__attribute__((target("sha,sse4.1")))
+static inline void shani_store(unsigned char *out, __m128i abcd, __m128i e) {
+  _mm_storeu_si128((__m128i *) out, _mm_shuffle_epi8(abcd, SHANI_MASK));
+  put_be32(out + 16, _mm_extract_epi32(e, 3));
+}
+
+__attribute__((target("sha,sse4.1")))
+static void shani_one(const unsigned char *in, unsigned char *out) {
+
+  __m128i abcd, e;
+
+  shani_load(in, &abcd, &e);
+  shani_compress(&abcd, &e);
+  shani_store(out, abcd, e);
+}
+
+// Going across the streams in the inner loop means that consecutive
+// hashes don't depend on each other, so the CPU can overlap them. The
+// previous hash in each chain is picked back up from out.
+__attribute__((target("sha,sse4.1")))
+static void shani_chains(const unsigned char *const *in, unsigned char *out,
+			 int n, int depth) {
+
+  const unsigned char *src;
+  unsigned char       *dst;
+  __m128i abcd, e;
+  int s, j;
+
+  for (j = 0; j < depth; ++j) {
+    for (s = 0; s < n; ++s) {
+      dst = out + ((size_t) s * depth + j) * OC_SHA1_BYTES;
+      src = j ? dst - OC_SHA1_BYTES : in[s];
+      shani_load(src, &abcd, &e);
+      shani_compress(&abcd, &e);
+      shani_store(dst, abcd, e);
+    }
+  }
+}
+
+static int avx2_supported(void) {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+static int shani_supported(void) {
+
+  unsigned int eax, ebx, ecx, edx;
+
+  __builtin_cpu_init();
+  if (!__builtin_cpu_supports("sse4.1"))
+    return 0;
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+    return 0;
+  return (ebx & bit_SHA) != 0;
+}
+
+// SHA-NI is quickest for a single hash, but on current CPUs the
+// eight-lane AVX2 code gets through independent chains faster
+static int shani_avx2_supported(void) {
+  return shani_supported() && avx2_supported();
+}
+
+#endif // x86
+
+const oc_sha1_kernel oc_sha1_kernels[] = {
+  { "scalar", scalar_one, scalar_chains, always_supported },
+#ifdef OC_SHA1_X86
+  { "avx2",   scalar_one, avx2_chains,   avx2_supported   },
+  { "shani",  shani_one,  shani_chains,  shani_supported  },
+  { "shani+avx2", shani_one, avx2_chains, shani_avx2_supported },
+#endif
+  { NULL, NULL, NULL, NULL },
+};
+
+// Dispatch (same scheme as oc_xor)
+
+static void resolve_one(const unsigned char *in, unsigned char *out);
+static void resolve_chains(const unsigned char *const *in, unsigned char *out,
+			   int n, int depth);
+
+static oc_sha1_fn        sha1_one    = resolve_one;
+static oc_sha1_chain_fn  sha1_chains = resolve_chains;
+static const char       *sha1_name   = "unresolved";
+
+static void resolve_one(const unsigned char *in, unsigned char *out) {
+  oc_sha1_init();
+  sha1_one(in, out);
+}
+
+static void resolve_chains(const unsigned char *const *in, unsigned char *out,
+			   int n, int depth) {
+  oc_sha1_init();
+  sha1_chains(in, out, n, depth);
+}
+
+int oc_sha1_select(const char *name) {
+
+  const oc_sha1_kernel *k;
+
+  for (k = oc_sha1_kernels; k->name != NULL; ++k) {
+    if (strcmp(k->name, name) == 0) {
+      if (!k->supported())
+	return -1;
+      sha1_name   = k->name;
+      sha1_one    = k->one;
+      sha1_chains = k->chains;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+#if defined(__GNUC__)
+__attribute__((constructor))
+#endif
+void oc_sha1_init(void) {
+
+  const oc_sha1_kernel *k, *best = oc_sha1_kernels;
+  const char *override = getenv("OC_SHA1_KERNEL");
+
+  if ((override != NULL) && (0 == oc_sha1_select(override)))
+    return;
+
+  for (k = oc_sha1_kernels; k->name != NULL; ++k)
+    if (k->supported())
+      best = k;
+
+  sha1_name   = best->name;
+  sha1_one    = best->one;
+  sha1_chains = best->chains;
+}
+
+const char *oc_sha1_kernel_name(void) {
+  if (sha1_one == resolve_one)
+    oc_sha1_init();
+  return sha1_name;
+}
+
+void oc_sha1_20(const void *in, void *out) {
+  sha1_one((const unsigned char *) in, (unsigned char *) out);
+}
+
+void oc_sha1_chains(const void *const *in, void *out, int n, int depth) {
+  if ((n <= 0) || (depth <= 0))
+    return;
+  sha1_chains((const unsigned char *const *) in, (unsigned char *) out,
+	      n, depth);
+}
@@ -0,0 +1,46 @@
+// SHA1 kernels for the RNG
+
+#ifndef OC_SHA1_H
+#define OC_SHA1_H
+
+// The RNG only ever hashes its own 20-byte state, so all it needs is
+// SHA1 of a single 20-byte message. That fits in one padded 64-byte
+// block with a fixed length field, so these routines skip all of the
+// general-purpose buffering in OpenSSL and go straight to the
+// compression function. Output is byte-for-byte the same as SHA1().
+//
+// As with the XOR routines, there's a table of kernels and the best
+// one the CPU supports is selected at runtime. Setting the
+// OC_SHA1_KERNEL environment variable to a kernel name overrides the
+// choice.
+
+#define OC_SHA1_BYTES 20
+
+// out = SHA1(in), where both are OC_SHA1_BYTES long (and may overlap)
+typedef void (*oc_sha1_fn)(const unsigned char *in, unsigned char *out);
+
+// Hash chains: for each of the n inputs, write depth successive
+// hashes, ie, SHA1(in[s]), SHA1(SHA1(in[s])), ... to out, with stream
+// s's hashes starting at out + s * depth * OC_SHA1_BYTES. The streams
+// are independent so they can be hashed side by side.
+typedef void (*oc_sha1_chain_fn)(const unsigned char *const *in,
+				 unsigned char *out, int n, int depth);
+
+typedef struct {
+  const char      *name;
+  oc_sha1_fn       one;
+  oc_sha1_chain_fn chains;
+  int            (*supported)(void);
+} oc_sha1_kernel;
+
+// In order of increasing speed; terminated by an entry with NULL name
+extern const oc_sha1_kernel oc_sha1_kernels[];
+
+void oc_sha1_20(const void *in, void *out);
+void oc_sha1_chains(const void *const *in, void *out, int n, int depth);
+
+void oc_sha1_init(void);
+int  oc_sha1_select(const char *name);
+const char *oc_sha1_kernel_name(void);
+
+#endif
@@ -0,0 +1,775 @@
+// Decoder checkpoints (see snapshot.h)
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "online-code.h"
+#include "decoder.h"
+#include "graph.h"
+#include "snapshot.h"
+
+#define ALIGN8(x) (((x) + 7) & ~((uint64_t) 7))
+
+// FNV-1a over the aux map, so that resuming with the wrong rng (which
+// gives a different map) is caught rather than making a mess
+static uint64_t map_hash(const oc_codec *codec) {
+
+  const unsigned char *p = (const unsigned char *) codec->auxiliary;
+  size_t   n = (size_t) codec->mblocks * codec->q * sizeof(int);
+  uint64_t h = 0xcbf29ce484222325ull;
+
+  while (n--)
+    h = (h ^ *(p++)) * 0x100000001b3ull;
+  return h;
+}
+
+static void make_key(oc_snapshot_key *key, oc_decoder *dec,
+		     const char *magic) {
+
+  memset(key, 0, sizeof(oc_snapshot_key));
+  strcpy(key->magic, magic);
+  key->byte_order  = OC_SNAPSHOT_ORDER;
+  key->header_size = sizeof(oc_snapshot_key);
+  key->mblocks     = dec->base.mblocks;
+  key->ablocks     = dec->base.ablocks;
+  key->coblocks    = dec->base.coblocks;
+  key->q           = dec->base.q;
+  key->F           = dec->base.F;
+  key->transparent = !!(dec->flags & OC_TRANSPARENT_AUX);
+  key->block_size  = (NULL == dec->cached) ? 0 : dec->block_size;
+  key->e           = dec->base.e;
+  key->map_hash    = map_hash(&(dec->base));
+}
+
+static char *graph_path(const char *path, const char *suffix) {
+
+  char *p = malloc(strlen(path) + strlen(OC_SNAPSHOT_GRAPH_SUFFIX) +
+		   strlen(suffix) + 1);
+
+  if (NULL != p)
+    sprintf(p, "%s%s%s", path, OC_SNAPSHOT_GRAPH_SUFFIX, suffix);
+  return p;
+}
+
+static char *node_data(oc_decoder *dec, int node) {
+  if (node < dec->base.mblocks)
+    return dec->message + (size_t) node * dec->block_size;
+  return oc_arena_block(&(dec->aux_cache), node - dec->base.mblocks);
+}
+
+
+// Writing goes through one buffer so that small pieces (record
+// headers, a few seeds) don't each cost a syscall. It's flushed before
+// switching between the log and the graph.
+
+static int write_out(int fd, const char *p, size_t bytes) {
+
+  ssize_t n;
+
+  while (bytes) {
+    if ((n = write(fd, p, bytes)) < 0) {
+      if (EINTR == errno) continue;
+      fprintf(stderr, "oc_snapshot: write: %s\n", strerror(errno));
+      return -1;
+    }
+    p += n; bytes -= n;
+  }
+  return 0;
+}
+
+static int flush(oc_snapshot *s, int fd) {
+
+  int rc = write_out(fd, s->buf, s->buf_used);
+
+  s->buf_used = 0;
+  return rc;
+}
+
+static int out(oc_snapshot *s, int fd, const void *p, size_t bytes) {
+
+  if (s->buf_used + bytes > OC_SNAPSHOT_BUFFER) {
+    if (-1 == flush(s, fd))
+      return -1;
+    if (bytes >= OC_SNAPSHOT_BUFFER)
+      return write_out(fd, p, bytes);
+  }
+  memcpy(s->buf + s->buf_used, p, bytes);
+  s->buf_used += bytes;
+  return 0;
+}
+
+// pad what's been written (bytes of it) to a multiple of 8
+static int pad(oc_snapshot *s, int fd, uint64_t bytes) {
+
+  static const char zeroes[8];
+
+  return out(s, fd, zeroes, ALIGN8(bytes) - bytes);
+}
+
+// array plus padding
+static int out_array(oc_snapshot *s, int fd, const void *p, size_t bytes) {
+  return ((-1 == out(s, fd, p, bytes)) || (-1 == pad(s, fd, bytes))) ? -1 : 0;
+}
+
+// The log's size is kept up to date as it's written, and every record
+// starts on a multiple of 8 bytes, so the padding after each part of
+// a record can be worked out from the size alone.
+
+static int log_out(oc_snapshot *s, const void *p, size_t bytes) {
+
+  if (-1 == out(s, s->fd, p, bytes))
+    return -1;
+  s->log_size += bytes;
+  return 0;
+}
+
+static int log_pad(oc_snapshot *s) {
+
+  uint64_t bytes = s->log_size;
+
+  if (-1 == pad(s, s->fd, bytes))
+    return -1;
+  s->log_size = ALIGN8(bytes);
+  return 0;
+}
+
+static int log_record(oc_snapshot *s, int type, int first, int count) {
+
+  oc_snapshot_record r;
+
+  memset(&r, 0, sizeof(r));
+  r.type  = type;
+  r.first = first;
+  r.count = count;
+  return log_out(s, &r, sizeof(r));
+}
+
+// Check blocks and newly solved blocks (everything that's new in the
+// log at this checkpoint). Solved blocks written here are marked 2 in
+// saved until the log has been synced.
+static int save_blocks(oc_snapshot *s) {
+
+  oc_decoder *dec    = s->dec;
+  int         bs     = dec->block_size;
+  int         checks = dec->graph.nodes - dec->base.coblocks;
+  int         i, count;
+
+  if ((NULL != dec->seeds) && (checks > s->seeds_saved)) {
+    count = checks - s->seeds_saved;
+    if ((-1 == log_record(s, OC_SNAP_SEEDS, s->seeds_saved, count)) ||
+	(-1 == log_out(s, dec->seeds + (size_t) s->seeds_saved * OC_RNG_BYTES,
+		       (size_t) count * OC_RNG_BYTES)) ||
+	(-1 == log_pad(s)))
+      return -1;
+    s->seeds_saved = checks;
+  }
+
+  if (NULL == dec->cached)
+    return 0;
+
+  // check blocks aren't contiguous in memory (the arena pads them) so
+  // they go through the buffer one at a time
+  if (checks > s->checks_saved) {
+    count = checks - s->checks_saved;
+    if (-1 == log_record(s, OC_SNAP_CHECKS, s->checks_saved, count))
+      return -1;
+    for (i = s->checks_saved; i < checks; ++i)
+      if (-1 == log_out(s, oc_arena_block(&(dec->chk_cache), i), bs))
+	return -1;
+    if (-1 == log_pad(s))
+      return -1;
+    s->checks_saved = checks;
+  }
+
+  // solved message and aux blocks: node numbers, then contents
+  for (count = i = 0; i < dec->base.coblocks; ++i)
+    if (dec->cached[i] && !s->saved[i])
+      ++count;
+  if (0 == count)
+    return 0;
+
+  if (-1 == log_record(s, OC_SNAP_SOLVED, 0, count))
+    return -1;
+  for (i = 0; i < dec->base.coblocks; ++i)
+    if (dec->cached[i] && !s->saved[i] && (-1 == log_out(s, &i, sizeof(int))))
+      return -1;
+  if (-1 == log_pad(s))
+    return -1;
+  for (i = 0; i < dec->base.coblocks; ++i)
+    if (dec->cached[i] && !s->saved[i]) {
+      if (-1 == log_out(s, node_data(dec, i), bs))
+	return -1;
+      s->saved[i] = 2;
+    }
+  return log_pad(s);
+}
+
+// Write the graph (header, then arrays in the order restore_graph
+// reads them) to fd
+static int save_graph(oc_snapshot *s, int fd) {
+
+  oc_snapshot_graph_header h;
+  oc_graph *g       = &(s->dec->graph);
+  int       mblocks = g->mblocks;
+  int       used    = g->nodes - mblocks;
+  int       chunk, n, i, first;
+
+  memset(&h, 0, sizeof(h));
+  make_key(&(h.key), s->dec, OC_SNAPSHOT_GRAPH_MAGIC);
+  h.key.header_size = sizeof(h);
+  h.log_size        = s->log_size;
+  h.nodes           = g->nodes;
+  h.node_space      = g->node_space;
+  h.bone_bits       = g->bone_bits;
+  h.boneyard_next   = g->boneyard_next;
+  h.slab_next       = g->slab_next;
+  h.pending_count   = g->pending_count;
+  h.inact_retry     = g->inact_retry;
+  h.unsolved_count  = g->unsolved_count;
+  h.done            = g->done;
+  h.stats           = g->stats;
+
+  h.file_size = ALIGN8(sizeof(h)) +
+    2 * ALIGN8((uint64_t) used * sizeof(int)) + ALIGN8(used) +
+    ALIGN8((uint64_t) g->pending_count * sizeof(int)) +
+    3 * ALIGN8((uint64_t) g->coblocks * sizeof(int)) +
+    ALIGN8((g->static_edges + 7) / 8) +
+    ALIGN8((uint64_t) g->boneyard_next * sizeof(oc_bone)) +
+    ALIGN8((uint64_t) g->slab_next * sizeof(int));
+
+  if ((-1 == out_array(s, fd, &h, sizeof(h))) ||
+      (-1 == out_array(s, fd, g->v_count, (size_t) used * sizeof(int))) ||
+      (-1 == out_array(s, fd, g->top,     (size_t) used * sizeof(int))) ||
+      (-1 == out_array(s, fd, g->queued,  used)))
+    return -1;
+
+  // pending queue from its head, unwrapping the ring
+  first = g->pending_size - g->pending_head;
+  if (first > g->pending_count)
+    first = g->pending_count;
+  if ((-1 == out(s, fd, g->pending + g->pending_head, first * sizeof(int))) ||
+      (-1 == out(s, fd, g->pending, (g->pending_count - first) * sizeof(int))) ||
+      (-1 == pad(s, fd, (uint64_t) g->pending_count * sizeof(int))))
+    return -1;
+
+  if ((-1 == out_array(s, fd, g->solution, g->coblocks * sizeof(int))) ||
+      (-1 == out_array(s, fd, g->up_head,  g->coblocks * sizeof(int))) ||
+      (-1 == out_array(s, fd, g->up_tail,  g->coblocks * sizeof(int))) ||
+      (-1 == out_array(s, fd, g->aux_dead, (g->static_edges + 7) / 8)))
+    return -1;
+
+  // boneyard and slabs, a chunk at a time (the unused tails of bone
+  // chunks go too, so that indices stay the same)
+  chunk = 1 << g->bone_bits;
+  for (i = 0; i < g->boneyard_next; i += chunk) {
+    n = (g->boneyard_next - i < chunk) ? g->boneyard_next - i : chunk;
+    if (-1 == out(s, fd, g->bone_chunks[i >> g->bone_bits],
+		  n * sizeof(oc_bone)))
+      return -1;
+  }
+  if (-1 == pad(s, fd, (uint64_t) g->boneyard_next * sizeof(oc_bone)))
+    return -1;
+
+  for (i = 0; i < g->slab_next; i += OC_SLAB_CHUNK_INTS) {
+    n = (g->slab_next - i < OC_SLAB_CHUNK_INTS) ?
+      g->slab_next - i : OC_SLAB_CHUNK_INTS;
+    if (-1 == out(s, fd, g->slab_chunks[i >> OC_SLAB_CHUNK_BITS],
+		  n * sizeof(int)))
+      return -1;
+  }
+  if ((-1 == pad(s, fd, (uint64_t) g->slab_next * sizeof(int))) ||
+      (-1 == flush(s, fd)))
+    return -1;
+
+  s->graph_bytes += h.file_size;
+  return 0;
+}
+
+int oc_snapshot_checkpoint(oc_snapshot *s) {
+
+  uint64_t start;
+  char *tmp, *final;
+  int   seeds, checks, i, ok;
+  int   fd, rc = -1;
+
+  assert(NULL != s);
+  assert(NULL != s->dec);
+
+  start  = s->log_size;
+  seeds  = s->seeds_saved;
+  checks = s->checks_saved;
+
+  ok = (0 == save_blocks(s)) && (0 == flush(s, s->fd)) &&
+    (0 == fdatasync(s->fd));
+
+  for (i = 0; i < s->dec->base.coblocks; ++i)
+    if (2 == s->saved[i])
+      s->saved[i] = ok;
+
+  // if any of it didn't make it, forget all of it, so that it's all
+  // written again next time
+  if (!ok) {
+    fprintf(stderr, "oc_snapshot_checkpoint: failed to write log\n");
+    s->buf_used     = 0;
+    s->log_size     = start;
+    s->seeds_saved  = seeds;
+    s->checks_saved = checks;
+    if ((-1 == ftruncate(s->fd, start)) ||
+	((off_t) -1 == lseek(s->fd, start, SEEK_SET)))
+      fprintf(stderr, "oc_snapshot_checkpoint: %s: %s\n", s->path,
+	      strerror(errno));
+    return -1;
+  }
+  s->log_bytes += s->log_size - start;
+
+  tmp   = graph_path(s->path, ".tmp");
+  final = graph_path(s->path, "");
+  if ((NULL == tmp) || (NULL == final))
+    goto done;
+
+  if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
+    fprintf(stderr, "oc_snapshot_checkpoint: %s: %s\n", tmp, strerror(errno));
+    goto done;
+  }
+  if ((-1 == save_graph(s, fd)) || (-1 == fdatasync(fd))) {
+    fprintf(stderr, "oc_snapshot_checkpoint: failed to write graph\n");
+    close(fd);
+    unlink(tmp);
+    goto done;
+  }
+  close(fd);
+
+  if (-1 == rename(tmp, final)) {
+    fprintf(stderr, "oc_snapshot_checkpoint: rename: %s\n", strerror(errno));
+    unlink(tmp);
+    goto done;
+  }
+
+  ++(s->checkpoints);
+  rc = 0;
+
+ done:
+  s->buf_used = 0;		// in case of a half-written graph
+  if (NULL != tmp)   free(tmp);
+  if (NULL != final) free(final);
+  return rc;
+}
+
+
+// Resuming
+
+static int same_key(const oc_snapshot_key *a, const oc_snapshot_key *b) {
+
+  return (a->byte_order  == b->byte_order) &&
+    (a->mblocks  == b->mblocks)  && (a->ablocks     == b->ablocks) &&
+    (a->coblocks == b->coblocks) && (a->q           == b->q) &&
+    (a->F        == b->F)        && (a->transparent == b->transparent) &&
+    (a->block_size == b->block_size) && (a->e == b->e) &&
+    (a->map_hash == b->map_hash);
+}
+
+// Map a whole file read-only. Returns NULL (with errno set) if that
+// can't be done.
+static const char *map_file(const char *path, size_t *size) {
+
+  struct stat st;
+  void *p;
+  int   fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return NULL;
+  if ((-1 == fstat(fd, &st)) || (0 == st.st_size)) {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (MAP_FAILED == p)
+    return NULL;
+
+  *size = st.st_size;
+  return p;
+}
+
+// Grow a node-indexed array (indexed by node - mblocks) to space
+// entries and fill it from src (used entries, the rest zero)
+static int load_nodes(void **array, int space, const char *src, int used,
+		      size_t size) {
+
+  void *p = realloc(*array, (size_t) space * size);
+
+  if (NULL == p)
+    return -1;
+  *array = p;
+  memcpy(p, src, (size_t) used * size);
+  memset((char *) p + (size_t) used * size, 0, (size_t) (space - used) * size);
+  return 0;
+}
+
+// Make sure a chunk table has exactly n chunks of bytes each
+static int load_chunks(void ***table, int *used, int *space, int n,
+		       size_t bytes) {
+
+  void **t;
+
+  if (n > *space) {
+    if (NULL == (t = realloc(*table, n * sizeof(void *))))
+      return -1;
+    *table = t;
+    *space = n;
+  }
+  while (*used > n)
+    free((*table)[--(*used)]);
+  while (*used < n) {
+    if (posix_memalign((*table) + *used, 64, bytes))
+      return -1;
+    ++(*used);
+  }
+  return 0;
+}
+
+// Load the saved graph into dec's graph, which has been set up from
+// the same codec but has no check blocks yet
+static int restore_graph(oc_decoder *dec, const oc_snapshot_graph_header *h,
+			 const char *p, size_t size) {
+
+  oc_graph *g       = &(dec->graph);
+  int       mblocks = g->mblocks;
+  int       used    = h->nodes - mblocks;
+  int       space   = h->node_space - mblocks;
+  int       chunk   = 1 << g->bone_bits;
+  int       i, n;
+
+  if ((h->nodes < g->coblocks) || (h->node_space < h->nodes) ||
+      (h->bone_bits != g->bone_bits) || (h->boneyard_next < 1) ||
+      (h->slab_next < OC_SLAB_INTS) || (h->slab_next % OC_SLAB_INTS) ||
+      (h->pending_count < 0) || (h->pending_count > used) ||
+      (h->file_size != size))
+    return -1;
+
+  p += ALIGN8(sizeof(oc_snapshot_graph_header));
+
+#define OC_LOAD(MEMBER, TYPE) \
+  if (-1 == load_nodes((void **) &(g->MEMBER), space, p, used, sizeof(TYPE))) \
+    return -1; \
+  p += ALIGN8((uint64_t) used * sizeof(TYPE));
+
+  OC_LOAD(v_count, int);
+  OC_LOAD(top,     int);
+  OC_LOAD(queued,  unsigned char);
+
+#undef OC_LOAD
+
+  if (-1 == load_nodes((void **) &(g->pending), space, p, h->pending_count,
+		       sizeof(int)))
+    return -1;
+  p += ALIGN8((uint64_t) h->pending_count * sizeof(int));
+
+  memcpy(g->solution, p, g->coblocks * sizeof(int));
+  p += ALIGN8((uint64_t) g->coblocks * sizeof(int));
+  memcpy(g->up_head,  p, g->coblocks * sizeof(int));
+  p += ALIGN8((uint64_t) g->coblocks * sizeof(int));
+  memcpy(g->up_tail,  p, g->coblocks * sizeof(int));
+  p += ALIGN8((uint64_t) g->coblocks * sizeof(int));
+  memcpy(g->aux_dead, p, (g->static_edges + 7) / 8);
+  p += ALIGN8((g->static_edges + 7) / 8);
+
+  // a chunk is only allocated once something is put in it, which is
+  // what oc_new_bone and new_slab expect of the chunk counts
+  if ((-1 == load_chunks((void ***) &(g->bone_chunks), &(g->bone_chunks_used),
+			 &(g->bone_chunks_space),
+			 ((h->boneyard_next - 1) >> g->bone_bits) + 1,
+			 chunk * sizeof(oc_bone))) ||
+      (-1 == load_chunks((void ***) &(g->slab_chunks), &(g->slab_chunks_used),
+			 &(g->slab_chunks_space),
+			 ((h->slab_next - 1) >> OC_SLAB_CHUNK_BITS) + 1,
+			 OC_SLAB_CHUNK_INTS * sizeof(int))))
+    return -1;
+
+  for (i = 0; i < h->boneyard_next; i += chunk) {
+    n = (h->boneyard_next - i < chunk) ? h->boneyard_next - i : chunk;
+    memcpy(g->bone_chunks[i >> g->bone_bits], p, n * sizeof(oc_bone));
+    p += n * sizeof(oc_bone);
+  }
+
+  for (i = 0; i < h->slab_next; i += OC_SLAB_CHUNK_INTS) {
+    n = (h->slab_next - i < OC_SLAB_CHUNK_INTS) ?
+      h->slab_next - i : OC_SLAB_CHUNK_INTS;
+    memcpy(g->slab_chunks[i >> OC_SLAB_CHUNK_BITS], p, n * sizeof(int));
+    p += n * sizeof(int);
+  }
+
+  g->nodes          = h->nodes;
+  g->node_space     = h->node_space;
+  g->boneyard_next  = h->boneyard_next;
+  g->slab_next      = h->slab_next;
+  g->pending_size   = space;
+  g->pending_head   = 0;
+  g->pending_count  = h->pending_count;
+  g->inact_retry    = h->inact_retry;
+  g->unsolved_count = h->unsolved_count;
+  g->done           = h->done;
+  g->stats          = h->stats;
+
+  return 0;
+}
+
+// Apply the log's records to dec's seeds and data plane
+static int restore_log(oc_snapshot *s, const char *p, uint64_t size) {
+
+  oc_decoder *dec    = s->dec;
+  int         bs     = dec->block_size;
+  int         checks = dec->graph.nodes - dec->base.coblocks;
+  const oc_snapshot_record *r;
+  const int  *nodes;
+  uint64_t    at, bytes;
+  int         i;
+
+  for (at = sizeof(oc_snapshot_key); at < size; at += bytes) {
+
+    if (at + sizeof(oc_snapshot_record) > size)
+      return -1;
+    r   = (const oc_snapshot_record *) (p + at);
+    at += sizeof(oc_snapshot_record);
+    if (r->count < 0)
+      return -1;
+
+    switch (r->type) {
+
+    case OC_SNAP_SEEDS:
+      bytes = ALIGN8((uint64_t) r->count * OC_RNG_BYTES);
+      if ((r->first != s->seeds_saved) || (r->first + r->count > checks) ||
+	  (at + bytes > size))
+	return -1;
+      memcpy(dec->seeds + (size_t) r->first * OC_RNG_BYTES, p + at,
+	     (size_t) r->count * OC_RNG_BYTES);
+      s->seeds_saved += r->count;
+      break;
+
+    case OC_SNAP_CHECKS:
+      bytes = ALIGN8((uint64_t) r->count * bs);
+      if ((NULL == dec->cached) || (r->first != s->checks_saved) ||
+	  (r->first + r->count > checks) || (at + bytes > size))
+	return -1;
+      for (i = 0; i < r->count; ++i)
+	memcpy(oc_arena_block(&(dec->chk_cache), r->first + i),
+	       p + at + (size_t) i * bs, bs);
+      s->checks_saved += r->count;
+      break;
+
+    case OC_SNAP_SOLVED:
+      bytes = ALIGN8((uint64_t) r->count * sizeof(int)) +
+	ALIGN8((uint64_t) r->count * bs);
+      if ((NULL == dec->cached) || (at + bytes > size))
+	return -1;
+      nodes = (const int *) (p + at);
+      for (i = 0; i < r->count; ++i) {
+	if ((nodes[i] < 0) || (nodes[i] >= dec->base.coblocks))
+	  return -1;
+	memcpy(node_data(dec, nodes[i]),
+	       p + at + ALIGN8((uint64_t) r->count * sizeof(int)) +
+	       (size_t) i * bs, bs);
+	dec->cached[nodes[i]] = s->saved[nodes[i]] = 1;
+      }
+      break;
+
+    default:
+      return -1;
+    }
+  }
+
+  // the log has to cover every check block in the graph
+  if ((s->seeds_saved != checks) ||
+      ((NULL != dec->cached) && (s->checks_saved != checks)))
+    return -1;
+
+  return 0;
+}
+
+static int resume(oc_snapshot *s) {
+
+  oc_decoder *dec = s->dec;
+  const oc_snapshot_graph_header *h;
+  oc_snapshot_key key;
+  const char *gp = NULL, *lp = NULL;
+  size_t gsize = 0, lsize = 0;
+  char  *path;
+  char  *seeds;
+  int    space, rc = -1;
+
+  if (NULL == (path = graph_path(s->path, "")))
+    return -1;
+  gp = map_file(path, &gsize);
+  free(path);
+  if (NULL == gp)
+    return (ENOENT == errno) ? 1 : -1;	// 1 => nothing to resume
+
+  make_key(&key, dec, OC_SNAPSHOT_GRAPH_MAGIC);
+  h = (const oc_snapshot_graph_header *) gp;
+  if ((gsize < sizeof(*h)) || strcmp(h->key.magic, key.magic) ||
+      (h->key.header_size != sizeof(*h)) || !same_key(&key, &(h->key))) {
+    fprintf(stderr, "oc_snapshot_open: %s%s doesn't match the decoder\n",
+	    s->path, OC_SNAPSHOT_GRAPH_SUFFIX);
+    goto done;
+  }
+
+  make_key(&key, dec, OC_SNAPSHOT_LOG_MAGIC);
+  if ((NULL == (lp = map_file(s->path, &lsize))) ||
+      (lsize < h->log_size) || (h->log_size < sizeof(key)) ||
+      strcmp(((const oc_snapshot_key *) lp)->magic, key.magic) ||
+      !same_key(&key, (const oc_snapshot_key *) lp)) {
+    fprintf(stderr, "oc_snapshot_open: %s is missing, short or doesn't "
+	    "match the decoder\n", s->path);
+    goto done;
+  }
+
+  if (-1 == restore_graph(dec, h, gp, gsize)) {
+    fprintf(stderr, "oc_snapshot_open: bad graph file (or out of memory)\n");
+    goto done;
+  }
+
+  // room for as many check blocks as the graph now has
+  space = dec->graph.node_space - dec->base.coblocks;
+  if (space > dec->seeds_space) {
+    if (NULL == (seeds = realloc(dec->seeds, (size_t) space * OC_RNG_BYTES)))
+      goto done;
+    dec->seeds       = seeds;
+    dec->seeds_space = space;
+  }
+  if ((NULL != dec->cached) && (-1 == oc_arena_grow(&(dec->chk_cache), space)))
+    goto done;
+
+  if (-1 == restore_log(s, lp, h->log_size)) {
+    fprintf(stderr, "oc_snapshot_open: bad log file\n");
+    goto done;
+  }
+
+  // drop anything from a checkpoint that didn't finish
+  s->log_size = h->log_size;
+  if ((-1 == ftruncate(s->fd, s->log_size)) ||
+      ((off_t) -1 == lseek(s->fd, s->log_size, SEEK_SET))) {
+    fprintf(stderr, "oc_snapshot_open: %s: %s\n", s->path, strerror(errno));
+    goto done;
+  }
+  rc = 0;
+
+ done:
+  if (NULL != gp) munmap((void *) gp, gsize);
+  if (NULL != lp) munmap((void *) lp, lsize);
+  return rc;
+}
+
+// Start a new log with just the header
+static int start_log(oc_snapshot *s) {
+
+  oc_snapshot_key key;
+  char *path;
+
+  if (NULL != (path = graph_path(s->path, ""))) {
+    unlink(path);
+    free(path);
+  }
+
+  make_key(&key, s->dec, OC_SNAPSHOT_LOG_MAGIC);
+  if ((-1 == ftruncate(s->fd, 0)) ||
+      ((off_t) -1 == lseek(s->fd, 0, SEEK_SET)) ||
+      (-1 == write_out(s->fd, (const char *) &key, sizeof(key))))
+    return -1;
+
+  s->log_size = sizeof(key);
+  return 0;
+}
+
+int oc_snapshot_open(oc_snapshot *s, oc_decoder *dec, const char *path,
+		     int flags) {
+
+  int rc = 1;
+
+  assert(NULL != s);
+  assert(NULL != dec);
+  assert(NULL != path);
+
+  memset(s, 0, sizeof(oc_snapshot));
+  s->fd  = -1;
+  s->dec = dec;
+
+  if ((NULL != dec->cached) && (NULL == dec->chk_cache.base)) {
+    fprintf(stderr, "oc_snapshot_open: check blocks aren't in memory\n");
+    return -1;
+  }
+  if (dec->graph.nodes != dec->base.coblocks) {
+    fprintf(stderr, "oc_snapshot_open: decoder already has check blocks\n");
+    return -1;
+  }
+
+  s->path  = strdup(path);
+  s->buf   = malloc(OC_SNAPSHOT_BUFFER);
+  s->saved = calloc(dec->base.coblocks, sizeof(unsigned char));
+  if ((NULL == s->path) || (NULL == s->buf) || (NULL == s->saved) ||
+      (-1 == oc_decoder_keep_seeds(dec))) {
+    fprintf(stderr, "oc_snapshot_open: failed to allocate memory\n");
+    oc_snapshot_close(s);
+    return -1;
+  }
+
+  if ((s->fd = open(path, O_RDWR | O_CREAT, 0600)) < 0) {
+    fprintf(stderr, "oc_snapshot_open: %s: %s\n", path, strerror(errno));
+    oc_snapshot_close(s);
+    return -1;
+  }
+
+  if ((flags & OC_SNAPSHOT_RESUME) && (-1 == (rc = resume(s)))) {
+    oc_snapshot_close(s);
+    return -1;
+  }
+  if ((1 == rc) && (-1 == start_log(s))) {
+    fprintf(stderr, "oc_snapshot_open: %s: %s\n", path, strerror(errno));
+    oc_snapshot_close(s);
+    return -1;
+  }
+
+  return 0;
+}
+
+void oc_snapshot_close(oc_snapshot *s) {
+
+  assert(NULL != s);
+
+  if (s->fd >= 0)        close(s->fd);
+  if (NULL != s->path)   free(s->path);
+  if (NULL != s->buf)    free(s->buf);
+  if (NULL != s->saved)  free(s->saved);
+
+  s->fd    = -1;
+  s->path  = NULL;
+  s->buf   = NULL;
+  s->saved = NULL;
+  s->dec   = NULL;
+}
+
+int oc_snapshot_remove(const char *path) {
+
+  char *graph;
+  int   rc = 0;
+
+  assert(NULL != path);
+
+  if ((-1 == unlink(path)) && (ENOENT != errno))
+    rc = -1;
+  if (NULL == (graph = graph_path(path, "")))
+    return -1;
+  if ((-1 == unlink(graph)) && (ENOENT != errno))
+    rc = -1;
+  free(graph);
+
+  return rc;
+}
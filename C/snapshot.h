@@ -0,0 +1,163 @@
+// Decoder checkpoints (snapshot and resume)
+
+#ifndef OC_SNAPSHOT_H
+#define OC_SNAPSHOT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "online-code.h"
+#include "decoder.h"
+
+// A receiver that restarts halfway through a long transfer would
+// otherwise have to start again with no check blocks. A snapshot
+// saves everything the decoder has built up so far, so that a new
+// decoder (set up the same way as the old one) can carry on where it
+// left off, and restarting only costs as much as reading the snapshot
+// back in.
+//
+// A snapshot is two files:
+//
+// * a log (at the path given), which only ever grows. Each checkpoint
+//   appends the seeds and contents of the check blocks that arrived
+//   since the last one, plus the contents of the message and aux
+//   blocks solved since then. None of these ever change once they're
+//   written, so they're never written twice.
+//
+// * the graph (path + OC_SNAPSHOT_GRAPH_SUFFIX), which is rewritten
+//   in full at every checkpoint since bones and edges change in place
+//   as nodes are solved. It's written to a temporary name and renamed
+//   over the old one, so there's always a complete graph on disk. It
+//   holds the length of the log it goes with, and anything in the log
+//   past that (from a checkpoint that didn't finish) is thrown away
+//   on resume.
+//
+// Everything in the graph file is an index: bones by their boneyard
+// index, edges by their handles, slab slots by number (see structs.h),
+// so nothing has to be fixed up when it's loaded. The only pointers
+// in the graph are to the chunks the boneyard and slabs are carved
+// from, and the chunks are saved (and loaded) end to end.
+//
+// The graph is much smaller than the blocks (about 200 bytes per check
+// block, against block_size for its contents), so rewriting it
+// costs little next to the first write of the log. Resuming maps both
+// files and copies them straight into the decoder's arrays.
+//
+// The decoder being resumed must have been made with the same
+// mblocks, rng, q, e, F and OC_TRANSPARENT_AUX flag as the one that
+// was saved (the aux map is checked against a hash of the saved one),
+// and must have the same data plane: either none, or one set up with
+// oc_decoder_init_data() with the same block size. Its resolver mode,
+// inactivation limit and solved callback aren't saved, so set them up
+// as before. Nodes solved before the snapshot aren't returned by
+// oc_resolve again; look at the decoder's cached[] array (or the
+// graph's solution[]) to see which they are.
+//
+// Check block contents have to be in memory, so decoders whose data
+// planes keep them elsewhere (oc_disk_decoder, oc_decoder_pipeline)
+// can't be saved. Only call oc_snapshot_checkpoint() between calls to
+// the decoder.
+
+#define OC_SNAPSHOT_GRAPH_SUFFIX ".graph"
+#define OC_SNAPSHOT_BUFFER       (1 << 20)	// write buffer size
+
+#define OC_SNAPSHOT_LOG_MAGIC    "OCSLOGv1"	// 8 bytes with the '\0'
+#define OC_SNAPSHOT_GRAPH_MAGIC  "OCSGRv1"
+#define OC_SNAPSHOT_ORDER        0x01020304
+
+// oc_snapshot_open flags
+#define OC_SNAPSHOT_RESUME 1	// load existing snapshot, if any
+
+// What both files start with: the decoder's parameters
+typedef struct {
+
+  char     magic[8];
+  uint32_t byte_order;
+  uint32_t header_size;
+
+  int32_t  mblocks, ablocks, coblocks, q, F;
+  int32_t  transparent;		// OC_TRANSPARENT_AUX set?
+  int32_t  block_size;		// 0 => no data plane
+  int32_t  reserved;
+  double   e;
+  uint64_t map_hash;		// FNV-1a of the aux map
+
+} oc_snapshot_key;
+
+// Log records: header then data, padded to a multiple of 8 bytes
+#define OC_SNAP_SEEDS  1	// seeds of check blocks first...
+#define OC_SNAP_CHECKS 2	// contents of check blocks first...
+#define OC_SNAP_SOLVED 3	// count node numbers, then their contents
+
+typedef struct {
+  uint32_t type;
+  int32_t  first;		// check block index (node - coblocks)
+  int32_t  count;
+  uint32_t reserved;
+} oc_snapshot_record;
+
+// The graph file header. Arrays follow in a fixed order (see
+// snapshot.c), each starting on a multiple of 8 bytes.
+typedef struct {
+
+  oc_snapshot_key key;
+  uint64_t log_size;		// log bytes that go with this graph
+  uint64_t file_size;
+
+  int32_t  nodes, node_space;
+  int32_t  bone_bits, boneyard_next;
+  int32_t  slab_next;
+  int32_t  pending_count;	// pending queue (saved from its head)
+  int32_t  inact_retry;
+  uint32_t unsolved_count;
+  int32_t  done;
+  int32_t  reserved;
+
+  oc_graph_stats stats;
+
+} oc_snapshot_graph_header;
+
+typedef struct {
+
+  oc_decoder *dec;
+  int         fd;		// log
+  char       *path;		// of the log
+  uint64_t    log_size;		// bytes in the log so far
+
+  // how much of the decoder is already in the log
+  int            seeds_saved;	// check blocks (from the first)
+  int            checks_saved;
+  unsigned char *saved;		// per msg/aux node: contents saved?
+
+  char       *buf;		// OC_SNAPSHOT_BUFFER
+  size_t      buf_used;
+
+  long long   checkpoints;
+  long long   log_bytes;	// written to the log
+  long long   graph_bytes;	// written to graph files
+
+} oc_snapshot;
+
+// Open (or create) the snapshot at path for dec. With
+// OC_SNAPSHOT_RESUME, if there's a snapshot there already it's loaded
+// into dec (see above for what dec has to be like); otherwise, or
+// without it, any old snapshot is discarded and a new one started.
+// Turns on oc_decoder_keep_seeds(). Returns 0 on success, -1 on error
+// (including a snapshot that doesn't match dec). If a resume fails
+// partway, dec may be half loaded, so free it rather than carry on.
+int  oc_snapshot_open(oc_snapshot *s, oc_decoder *dec, const char *path,
+		      int flags);
+
+// Save everything since the last checkpoint. The log is synced
+// before the new graph replaces the old one, and the graph before
+// this returns, so once it does, a resume gets at least this
+// checkpoint. Returns 0 on success.
+int  oc_snapshot_checkpoint(oc_snapshot *s);
+
+// Close the files (without a checkpoint). The snapshot stays on disk.
+void oc_snapshot_close(oc_snapshot *s);
+
+// Delete a snapshot's files (say, once the message is decoded)
+int  oc_snapshot_remove(const char *path);
+
+#endif
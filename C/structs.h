@@ -38,9 +38,9 @@
 // Although the number of check blocks sent or received is potentially
 // unbounded, the Online Code algorithm does place probablistic limits
 // on how many check blocks need to be received and stored. For this
-// reason, rather than using dynamic allocation, blocks are stored in
-// fixed-sized arrays that are a fixed multiple ("fudge factor") of
-// the expected size.
+// reason, per-block arrays start out at a multiple ("fudge factor")
+// of the expected size. They grow if a lossy channel makes us go past
+// that, but it's a rare event so the arrays are simply realloc'd.
 
 // Online Code --- Graph Edges
 //
@@ -98,15 +98,38 @@ typedef struct {
 
 
 
-// n edges are stored in circular lists (one ring per message or
-// auxiliary block)
-struct oc_n_edge_ring_node;
-typedef struct oc_n_edge_ring_node oc_n_edge_ring;
-struct oc_n_edge_ring_node {
-  int upper;			// node at the other end
-  oc_n_edge_ring *left;
-  oc_n_edge_ring *right;
-};
+// n edges used to be stored in circular lists of malloc'd ring nodes
+// (one ring per message or auxiliary block), with bones pointing at
+// the ring nodes. At 24 bytes per ring node plus 16 per bone element
+// that made every edge cost 40 bytes, and the cascade spent most of
+// its time chasing pointers all over the heap. Now edges are named by
+// 32-bit "edge handles" and live in two places:
+//
+// * up edges from message blocks to aux blocks are never created or
+//   destroyed except by the propagation rule, and each message block
+//   has exactly q of them, so the aux map itself (mblocks x q, see
+//   below) is used as their adjacency array. Edge handle h < mblocks *
+//   q refers to aux_map[h], the up edge from message h / q. Deleted
+//   edges are marked in a bitmap since the aux map is read-only (it
+//   may be shared with other codecs or mapped from a cache file).
+//
+// * up edges to check blocks are appended to per-node chains of
+//   fixed-size slabs carved out of one big array of ints. Each slab
+//   has the index of the next slab in the chain (0 => none) followed
+//   by OC_SLAB_EDGES upper node numbers. Deleting an edge just puts a
+//   tombstone (-1) in its slot; unused slots at the end of the last
+//   slab in a chain are tombstones too. Handle h >= mblocks * q refers
+//   to slab slot h - mblocks * q.
+//
+// Both keep edges in the order they were created, so the cascade
+// visits nodes in the same order as it did with rings.
+
+#define OC_NO_EDGE     (-1)	// handle for known bone elements
+#define OC_SLAB_INTS   8	// 32 bytes: next + 7 edges
+#define OC_SLAB_EDGES  (OC_SLAB_INTS - 1)
+
+#define OC_SLAB_CHUNK_BITS 16	// 256Kb of slabs per chunk
+#define OC_SLAB_CHUNK_INTS (1 << OC_SLAB_CHUNK_BITS)
 
 
 // "Bones" are part edge, part xor list. The C struct needs extra
@@ -121,8 +144,8 @@ typedef struct {
     int node;			// the actual node numbers
   } a;
   union {
-    int             size;	// sum of knowns + unknowns
-    oc_n_edge_ring *link;	// lower end of edge
+    int size;			// sum of knowns + unknowns
+    int link;			// edge handle for lower end of edge
   } b;
 
 } oc_bone;
@@ -135,18 +158,79 @@ typedef struct {
 // elements suffices.
 //
 // Where the reverse mapping (that of auxliary blocks to message
-// blocks) is needed, it uses one linked list per auxliary block.
+// blocks) is needed, it's one flat array per codec (see
+// oc_aux_reverse_map in online-code.h) that every graph made from it
+// can share.
 //
 
 
 
+// Online Code --- Graph decoder
+//
+// Measurements relating to key bottlenecks in the graph decoder. Each
+// graph has its own set, which can be read at any time with
+// oc_graph_get_stats (see graph.h). Counters are only updated if the
+// library is built with OC_GRAPH_STATS (the default); otherwise only
+// the fields that oc_graph_get_stats fills in from the graph itself
+// are set.
+
+typedef struct {
+
+  // check blocks received so far versus what we expect to need
+  int check_blocks;
+  int check_blocks_expected;	// (1 + q * e) * mblocks
+  int check_blocks_to_decode;	// how many it actually took (0 => not yet)
+
+  // pending queue
+  long long push_pending_calls;
+  int pending_fill_level;
+  int pending_max_full;		// high-water mark
+
+  // cascades (one per solved message/aux block)
+  long long cascade_calls;
+  long long cascade_edges;	// total up edges followed
+  int cascade_max;		// longest single cascade
+
+  // up edges deleted by the propagation rule
+  long long delete_n_calls;
+
+  // inactivation decoding (see oc_graph_set_inactivation)
+  int inact_calls;		// attempts (including ones that failed)
+  int inact_nodes;		// nodes it solved
+  int inact_max;		// most nodes inactivated at once
+  long long inact_bone_nodes;	// total size of inactive nodes' solutions
+
+  // transparent aux blocks (see oc_graph_set_transparent_aux)
+  long long aux_expanded;	// aux nodes replaced by their messages
+  long long aux_cancelled;	// message nodes that cancelled out
+
+  // arena usage versus capacity (filled in by oc_graph_get_stats)
+  int nodes, node_space;
+  long long bones_used, bones_space;	// in oc_bone elements
+  long long slabs_used, slabs_space;	// in OC_SLAB_INTS-int slabs
+
+  // time spent in each phase, in nanoseconds. The map and xor phases
+  // are timed by the decoder (working out which blocks make up a check
+  // block, and filling in the contents of solved blocks). If a solved
+  // callback is set, xor time is also counted as resolve time.
+  long long ns_map;
+  long long ns_graph;
+  long long ns_resolve;
+  long long ns_xor;
+
+} oc_graph_stats;
+
+// Everything the graph decoder needs lives in this structure (there
+// are no static variables in graph.c) so that any number of graphs
+// can be decoded at the same time, including in different threads.
+
 typedef struct {
 
   int mblocks;
   int ablocks;
   int coblocks;
   int nodes;			// running count of all blocks
-  int node_space;		// nodes < node_space
+  int node_space;		// nodes < node_space (grows as needed)
 
   // Node Edges
   // 
@@ -168,25 +252,70 @@ typedef struct {
   //unsigned char    *solved;	// is node solved?
 
 
-  // They're replaced by structures using bones:
-  oc_bone          **top;	// upper side of link
-  oc_n_edge_ring    *bottom;	// lower side (rings)
-  oc_bone          **solution;	// bone morphs into an xor list 
+  // They're replaced by structures using bones. Bones are referred to
+  // by their index in the boneyard, with 0 meaning "no bone".
+  int               *top;	// upper side of link
+  int               *solution;	// bone morphs into an xor list 
 
   // These two stay the same in the new implementation
   int               *v_count;	// per-node count of unsolved v edges
 
-  // Avoid using malloc for bones
-  oc_bone           *boneyard;
-  int                boneyard_size;
+  // Avoid using malloc for bones. Bones are carved out of fixed-size
+  // chunks (1 << bone_bits bones each, which is enough for the biggest
+  // possible bone), so bone b lives at bone_chunks[b >> bone_bits] +
+  // (b & mask). More chunks are added as needed and existing ones never
+  // move.
+  oc_bone          **bone_chunks;
+  int                bone_chunks_used;
+  int                bone_chunks_space;
+  int                bone_bits;
   int                boneyard_next;
 
-  // Avoid using malloc for lower side of edges
-  oc_n_edge_ring    *ringfence;
-  int                ringfence_size;
-  int                ringfence_next;  
-
-  oc_uni_block *phead, *ptail;	// queue of pending nodes
+  // Lower side of edges (see the discussion of edge handles above).
+  // Slabs are chunked in the same way as bones, with slot i at
+  // slab_chunks[i >> OC_SLAB_CHUNK_BITS][i & mask].
+  const int         *aux_map;	// codec's map; message -> aux up edges
+  int                q;
+  int                static_edges;	// mblocks * q
+  unsigned char     *aux_dead;	// bitmap of deleted message -> aux edges
+  int               *up_head;	// first slab for each lower node
+  int               *up_tail;	// next free slot in last slab (0 => none)
+  int              **slab_chunks;
+  int                slab_chunks_used;
+  int                slab_chunks_space;
+  int                slab_next;
+
+  // Queue of pending (aux or check) nodes. It's a ring buffer with
+  // room for every aux and check node, and a node is never queued
+  // twice, so it can't overflow. Only nodes >= mblocks are queued, so
+  // both arrays below are indexed by node - mblocks.
+  int              *pending;	// ring of node numbers
+  unsigned char    *queued;	// is node already in the ring?
+  int               pending_size;
+  int               pending_head;	// next node to shift
+  int               pending_count;
+
+  // Resolver mode (OC_RESOLVE_STEP or OC_RESOLVE_FIXPOINT) and an
+  // optional callback for solved nodes (see graph.h)
+  int           resolve_mode;
+  void        (*solved_cb)(void *arg, int node);
+  void         *solved_arg;
+
+  // Inactivation decoding when peeling gets stuck (see graph.h and
+  // inactivate.c). After a failed attempt, there's no point trying
+  // again until inact_retry check blocks have arrived.
+  int           max_inactive;	// 0 => peeling only
+  int           inact_retry;
+
+  // Transparent aux blocks (see graph.h). aux_rev is the codec's
+  // reverse map; t_parity and t_list are scratch space for expanding a
+  // check block's list.
+  const int     *aux_rev;	// NULL => aux nodes are opaque
+  unsigned char *t_parity;	// per msg/aux node
+  int           *t_list;
+  int            t_space;
+
+  oc_graph_stats stats;
 
   unsigned int  unsolved_count;	// count unsolved message blocks
   unsigned char done;		// are all message nodes decoded?
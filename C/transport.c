@@ -0,0 +1,520 @@
+// UDP transport for check blocks (see transport.h)
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		// sendmmsg, recvmmsg
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "online-code.h"
+#include "encoder.h"
+#include "decoder.h"
+#include "carousel.h"
+#include "transport.h"
+
+static long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+static void sleep_ns(long long ns) {
+  struct timespec ts;
+  ts.tv_sec  = ns / 1000000000ll;
+  ts.tv_nsec = ns % 1000000000ll;
+  while (nanosleep(&ts, &ts) && (EINTR == errno))
+    ;
+}
+
+static int lookup(const char *host, int port, struct sockaddr_in *sa) {
+
+  struct addrinfo hints, *res;
+  int rc;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+
+  if ((rc = getaddrinfo(host, NULL, &hints, &res))) {
+    fprintf(stderr, "oc_udp: %s: %s\n", host, gai_strerror(rc));
+    return -1;
+  }
+  memcpy(sa, res->ai_addr, sizeof(struct sockaddr_in));
+  sa->sin_port = htons(port);
+  freeaddrinfo(res);
+
+  return 0;
+}
+
+
+// Sending
+
+int oc_udp_channel_open(oc_udp_channel *ch, const char *host, int port,
+			int ttl, double rate, long long limit,
+			int block_size) {
+
+  int size = OC_UDP_SOCKBUF, multicast;
+
+  assert(ch   != NULL);
+  assert(host != NULL);
+
+  memset(ch, 0, sizeof(oc_udp_channel));
+  ch->fd = -1;
+
+  if ((block_size <= 0) || (rate < 0) || (limit < 0)) {
+    fprintf(stderr, "oc_udp_channel_open: invalid arguments\n");
+    return -1;
+  }
+  if (-1 == lookup(host, port, &(ch->dest)))
+    return -1;
+
+  ch->block_size = block_size;
+  ch->rate       = rate;
+  ch->limit      = limit;
+  ch->tokens     = OC_UDP_BATCH;
+  ch->last_ns    = now_ns();
+
+  ch->msgs = calloc(OC_UDP_BATCH, sizeof(struct mmsghdr));
+  ch->iov  = calloc(2 * OC_UDP_BATCH, sizeof(struct iovec));
+  ch->bufs = malloc((size_t) OC_UDP_BATCH * OC_WIRE_BYTES(block_size));
+  if ((NULL == ch->msgs) || (NULL == ch->iov) || (NULL == ch->bufs)) {
+    fprintf(stderr, "oc_udp_channel_open: failed to allocate memory\n");
+    oc_udp_channel_close(ch);
+    return -1;
+  }
+
+  // Connecting means the route is looked up once, not per packet
+  multicast = IN_MULTICAST(ntohl(ch->dest.sin_addr.s_addr));
+  if (((ch->fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) ||
+      ((ttl > 0) &&
+       setsockopt(ch->fd, IPPROTO_IP, multicast ? IP_MULTICAST_TTL : IP_TTL,
+		  &ttl, sizeof(ttl))) ||
+      connect(ch->fd, (struct sockaddr *) &(ch->dest), sizeof(ch->dest))) {
+    fprintf(stderr, "oc_udp_channel_open: %s\n", strerror(errno));
+    oc_udp_channel_close(ch);
+    return -1;
+  }
+  setsockopt(ch->fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+  return 0;
+}
+
+void oc_udp_channel_close(oc_udp_channel *ch) {
+
+  assert(ch != NULL);
+
+  if (ch->fd >= 0)       close(ch->fd);
+  if (NULL != ch->msgs)  free(ch->msgs);
+  if (NULL != ch->iov)   free(ch->iov);
+  if (NULL != ch->bufs)  free(ch->bufs);
+
+  ch->fd   = -1;
+  ch->msgs = NULL;
+  ch->iov  = NULL;
+  ch->bufs = NULL;
+}
+
+static void refill(oc_udp_channel *ch) {
+
+  long long now = now_ns();
+
+  if (0 == ch->rate)
+    ch->tokens = OC_UDP_BATCH;
+  else {
+    ch->tokens += (now - ch->last_ns) * ch->rate / 1e9;
+    if (ch->tokens > OC_UDP_BATCH)
+      ch->tokens = OC_UDP_BATCH;
+  }
+  ch->last_ns = now;
+}
+
+long long oc_udp_channel_wait_ns(oc_udp_channel *ch) {
+
+  assert(ch != NULL);
+
+  if (ch->limit && (ch->sent >= ch->limit))
+    return -1;
+  refill(ch);
+  if (ch->tokens >= 1)
+    return 0;
+  return (long long) ((1 - ch->tokens) * 1e9 / ch->rate) + 1;
+}
+
+// Wait until at least one packet can go, then say how many of the
+// wanted ones can go now (0 => at the limit)
+static int take(oc_udp_channel *ch, int want) {
+
+  long long wait;
+  int n;
+
+  while ((wait = oc_udp_channel_wait_ns(ch)) > 0)
+    sleep_ns(wait);
+  if (wait < 0)
+    return 0;
+
+  n = (int) ch->tokens;
+  if (n > want) n = want;
+  if (ch->limit && (n > ch->limit - ch->sent))
+    n = ch->limit - ch->sent;
+
+  return n;
+}
+
+// How long to wait for room to send before trying again
+#define OC_UDP_RETRY_MS 1
+
+// Wait for room in the socket's send buffer after a send failed with
+// err. A full device queue (ENOBUFS) doesn't show up in poll, so if
+// poll says there's room anyway, back off for a moment rather than
+// spinning.
+static void wait_to_send(oc_udp_channel *ch, int err) {
+
+  struct pollfd pfd;
+
+  pfd.fd     = ch->fd;
+  pfd.events = POLLOUT;
+  if ((1 == poll(&pfd, 1, OC_UDP_RETRY_MS)) && (ENOBUFS == err))
+    sleep_ns(OC_UDP_RETRY_MS * 1000000ll);
+}
+
+// Send the first n messages in ch->msgs
+static int send_batch(oc_udp_channel *ch, int n) {
+
+  int done = 0, rc;
+
+  while (done < n) {
+    rc = sendmmsg(ch->fd, ch->msgs + done, n - done, 0);
+    ++(ch->send_calls);
+    if (rc < 0) {
+      // local queue full, or (unicast) an ICMP error from earlier
+      // that says nobody's listening yet: neither is fatal
+      if ((ENOBUFS == errno) || (EAGAIN == errno)) {
+	wait_to_send(ch, errno);
+	continue;
+      }
+      if ((EINTR == errno) || (ECONNREFUSED == errno))
+	continue;
+      fprintf(stderr, "oc_udp_channel_send: %s\n", strerror(errno));
+      return -1;
+    }
+    done += rc;
+  }
+  ch->sent   += n;
+  ch->tokens -= n;
+
+  return 0;
+}
+
+// Set up packet i of a batch (the which'th of the whole send) in
+// ch->msgs. Returns -1 on error.
+typedef int (*packet_fn)(oc_udp_channel *ch, void *arg, int which, int i);
+
+// Send n packets in paced batches, each packet set up by fill
+static int send_packets(oc_udp_channel *ch, int n, packet_fn fill, void *arg) {
+
+  int done, i, count;
+
+  for (done = 0; done < n; done += count) {
+    count = n - done;
+    if (count > OC_UDP_BATCH) count = OC_UDP_BATCH;
+    if (0 == (count = take(ch, count)))
+      break;
+
+    for (i = 0; i < count; ++i)
+      if (-1 == (*fill)(ch, arg, done + i, i))
+	return -1;
+    if (-1 == send_batch(ch, count))
+      return -1;
+  }
+
+  return done;
+}
+
+// Point packet i at the channel's own buffer for it and return that
+static char *own_packet(oc_udp_channel *ch, int i) {
+
+  int   wire = OC_WIRE_BYTES(ch->block_size);
+  char *p    = ch->bufs + (size_t) i * wire;
+
+  ch->iov[i].iov_base = p;
+  ch->iov[i].iov_len  = wire;
+  ch->msgs[i].msg_hdr.msg_iov    = ch->iov + i;
+  ch->msgs[i].msg_hdr.msg_iovlen = 1;
+
+  return p;
+}
+
+typedef struct {
+  const char *seeds;
+  const char *blocks;
+} gather_arg;
+
+static int gather_packet(oc_udp_channel *ch, void *arg, int which, int i) {
+
+  gather_arg   *g   = arg;
+  struct iovec *iov = ch->iov + 2 * i;
+
+  iov[0].iov_base = (void *) (g->seeds + (size_t) which * OC_RNG_BYTES);
+  iov[0].iov_len  = OC_RNG_BYTES;
+  iov[1].iov_base = (void *) (g->blocks + (size_t) which * ch->block_size);
+  iov[1].iov_len  = ch->block_size;
+  ch->msgs[i].msg_hdr.msg_iov    = iov;
+  ch->msgs[i].msg_hdr.msg_iovlen = 2;
+
+  return 0;
+}
+
+int oc_udp_channel_send(oc_udp_channel *ch, const char *seeds,
+			const char *blocks, int n) {
+
+  gather_arg g;
+
+  assert(ch != NULL);
+
+  g.seeds  = seeds;
+  g.blocks = blocks;
+  return send_packets(ch, n, &gather_packet, &g);
+}
+
+static int encoder_packet(oc_udp_channel *ch, void *arg, int which, int i) {
+
+  char *p = own_packet(ch, i);
+
+  (void) which;
+  return oc_encoder_emit_block(arg, p, p + OC_RNG_BYTES);
+}
+
+int oc_udp_channel_send_encoder(oc_udp_channel *ch, oc_encoder *enc, int n) {
+
+  assert(ch  != NULL);
+  assert(enc != NULL);
+
+  if (enc->block_size != ch->block_size) {
+    fprintf(stderr, "oc_udp_channel_send_encoder: block size mismatch\n");
+    return -1;
+  }
+  return send_packets(ch, n, &encoder_packet, enc);
+}
+
+static int carousel_packet(oc_udp_channel *ch, void *arg, int which, int i) {
+
+  char *p = own_packet(ch, i);
+
+  (void) which;
+  return oc_carousel_emit(arg, p, p + OC_RNG_BYTES);
+}
+
+int oc_udp_channel_send_carousel(oc_udp_channel *ch, oc_carousel *c, int n) {
+
+  assert(ch != NULL);
+  assert(c  != NULL);
+
+  if (c->block_size != ch->block_size) {
+    fprintf(stderr, "oc_udp_channel_send_carousel: block size mismatch\n");
+    return -1;
+  }
+  return send_packets(ch, n, &carousel_packet, c);
+}
+
+int oc_udp_channels_run(oc_udp_channel *chs, int count, oc_encoder *enc,
+			long long ns) {
+
+  long long start = now_ns(), wait, soonest, left;
+  int i, live;
+
+  assert(chs != NULL);
+
+  while (1) {
+    // send whatever's due and see how long until the next one is
+    live    = 0;
+    soonest = -1;
+    for (i = 0; i < count; ++i) {
+      if ((wait = oc_udp_channel_wait_ns(chs + i)) < 0)
+	continue;
+      ++live;
+      if ((0 == wait) &&
+	  (-1 == oc_udp_channel_send_encoder(chs + i, enc,
+					     (int) chs[i].tokens)))
+	return -1;
+      if ((wait > 0) && ((soonest < 0) || (wait < soonest)))
+	soonest = wait;
+    }
+    if (0 == live)
+      return 0;
+
+    if (ns) {
+      if ((left = ns - (now_ns() - start)) <= 0)
+	return 0;
+      if (soonest > left)
+	soonest = left;
+    }
+    if (soonest > 0)
+      sleep_ns(soonest);
+  }
+}
+
+
+// Receiving
+
+int oc_udp_receiver_open(oc_udp_receiver *r, const char *group, int port,
+			 int block_size, int batch) {
+
+  struct sockaddr_in sa;
+  struct ip_mreq     mreq;
+  int size = OC_UDP_SOCKBUF, on = 1, i, slot;
+
+  assert(r != NULL);
+
+  memset(r, 0, sizeof(oc_udp_receiver));
+  r->fd = -1;
+
+  if ((block_size <= 0) || (batch < 0)) {
+    fprintf(stderr, "oc_udp_receiver_open: invalid arguments\n");
+    return -1;
+  }
+  if (0 == batch)
+    batch = OC_UDP_BATCH;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family      = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_ANY);
+  sa.sin_port        = htons(port);
+  if ((NULL != group) && (-1 == lookup(group, port, &sa)))
+    return -1;
+
+  r->block_size = block_size;
+  r->batch      = batch;
+
+  // one spare byte per slot so that oversized packets can be spotted
+  slot     = OC_WIRE_BYTES(block_size) + 1;
+  r->msgs  = calloc(batch, sizeof(struct mmsghdr));
+  r->iov   = calloc(batch, sizeof(struct iovec));
+  r->bufs  = malloc((size_t) batch * slot);
+  r->seeds = calloc(batch, sizeof(char *));
+  r->data  = calloc(batch, sizeof(char *));
+  if ((NULL == r->msgs) || (NULL == r->iov) || (NULL == r->bufs) ||
+      (NULL == r->seeds) || (NULL == r->data)) {
+    fprintf(stderr, "oc_udp_receiver_open: failed to allocate memory\n");
+    oc_udp_receiver_close(r);
+    return -1;
+  }
+  for (i = 0; i < batch; ++i) {
+    r->iov[i].iov_base = r->bufs + (size_t) i * slot;
+    r->iov[i].iov_len  = slot;
+    r->msgs[i].msg_hdr.msg_iov    = r->iov + i;
+    r->msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  // several receivers on one host can share a multicast port
+  if ((r->fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+    goto fail;
+  setsockopt(r->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  setsockopt(r->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+  if (IN_MULTICAST(ntohl(sa.sin_addr.s_addr))) {
+    mreq.imr_multiaddr        = sa.sin_addr;
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    sa.sin_addr.s_addr        = htonl(INADDR_ANY);
+    if (bind(r->fd, (struct sockaddr *) &sa, sizeof(sa)) ||
+	setsockopt(r->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)))
+      goto fail;
+  } else if (bind(r->fd, (struct sockaddr *) &sa, sizeof(sa)))
+    goto fail;
+
+  return 0;
+
+ fail:
+  fprintf(stderr, "oc_udp_receiver_open: %s\n", strerror(errno));
+  oc_udp_receiver_close(r);
+  return -1;
+}
+
+void oc_udp_receiver_close(oc_udp_receiver *r) {
+
+  assert(r != NULL);
+
+  if (r->fd >= 0)       close(r->fd);
+  if (NULL != r->msgs)  free(r->msgs);
+  if (NULL != r->iov)   free(r->iov);
+  if (NULL != r->bufs)  free(r->bufs);
+  if (NULL != r->seeds) free(r->seeds);
+  if (NULL != r->data)  free(r->data);
+
+  r->fd    = -1;
+  r->msgs  = NULL;
+  r->iov   = NULL;
+  r->bufs  = NULL;
+  r->seeds = NULL;
+  r->data  = NULL;
+  r->count = 0;
+}
+
+int oc_udp_receive(oc_udp_receiver *r, int timeout_ms) {
+
+  struct pollfd pfd;
+  int rc, i, wire;
+
+  assert(r != NULL);
+
+  r->count = 0;
+  pfd.fd     = r->fd;
+  pfd.events = POLLIN;
+  while ((rc = poll(&pfd, 1, timeout_ms)) < 0)
+    if (EINTR != errno) {
+      fprintf(stderr, "oc_udp_receive: %s\n", strerror(errno));
+      return -1;
+    }
+  if (0 == rc)
+    return 0;
+
+  rc = recvmmsg(r->fd, r->msgs, r->batch, MSG_DONTWAIT, NULL);
+  ++(r->recv_calls);
+  if (rc < 0) {
+    if ((EAGAIN == errno) || (EWOULDBLOCK == errno) || (EINTR == errno))
+      return 0;
+    fprintf(stderr, "oc_udp_receive: %s\n", strerror(errno));
+    return -1;
+  }
+
+  wire = OC_WIRE_BYTES(r->block_size);
+  for (i = 0; i < rc; ++i) {
+    if (r->msgs[i].msg_len != (unsigned int) wire) {
+      ++(r->dropped);
+      continue;
+    }
+    r->seeds[r->count] = r->iov[i].iov_base;
+    r->data [r->count] = (char *) r->iov[i].iov_base + OC_RNG_BYTES;
+    ++(r->count);
+  }
+  r->received += r->count;
+
+  return r->count;
+}
+
+int oc_udp_receiver_feed(oc_udp_receiver *r, oc_decoder *dec,
+			 int timeout_ms, oc_uni_block **solved) {
+
+  int n;
+
+  assert(r      != NULL);
+  assert(dec    != NULL);
+  assert(solved != NULL);
+
+  *solved = NULL;
+  if ((n = oc_udp_receive(r, timeout_ms)) <= 0)
+    return n;
+
+  return oc_accept_check_blocks_data(dec, r->seeds, r->data, n, solved);
+}
@@ -0,0 +1,144 @@
+// UDP transport for check blocks
+
+#ifndef OC_TRANSPORT_H
+#define OC_TRANSPORT_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "online-code.h"
+#include "encoder.h"
+#include "decoder.h"
+#include "carousel.h"
+
+// Wire format
+//
+// A packet is one check block: its seed (OC_RNG_BYTES) followed by its
+// contents (block_size bytes), and nothing else. The seed is all the
+// receiver needs to work out which blocks were xored together, and
+// since both ends have to agree on the codec parameters and block
+// size anyway, there's no point sending them in every packet. Packets
+// of any other size are counted and dropped by the receiver.
+//
+// Batching
+//
+// At small block sizes, a syscall per packet is what limits the rate,
+// not the network. Both ends work on batches of up to OC_UDP_BATCH
+// packets with sendmmsg/recvmmsg, so it's one syscall per batch. The
+// sender gathers each packet from the seed and block arrays it's
+// given (two iovecs per packet) rather than copying them together.
+//
+// Channels and pacing
+//
+// This is for the "multi-speed" sender in the TODO file: each channel
+// is a destination (usually a multicast group) with its own rate, in
+// packets per second, and TTL. Pacing is a token bucket that holds at
+// most one batch, so a channel sends in bursts of no more than
+// OC_UDP_BATCH packets and never runs ahead of its rate. A channel can
+// also have a limit on the number of packets to send, for when it
+// should stop after sending enough to decode the message.
+
+#define OC_UDP_BATCH        64
+#define OC_UDP_SOCKBUF      (4 << 20)	// asked for; the kernel may cap it
+#define OC_WIRE_BYTES(bs)   (OC_RNG_BYTES + (bs))
+
+typedef struct {
+
+  int                 fd;
+  struct sockaddr_in  dest;
+  int                 block_size;
+
+  // rate == 0 means as fast as possible; limit == 0 means no limit
+  double              rate;
+  long long           limit;
+  double              tokens;
+  long long           last_ns;	// when tokens was last topped up
+
+  // per-batch message headers and own packet buffers (for
+  // oc_udp_channel_send_encoder)
+  struct mmsghdr     *msgs;
+  struct iovec       *iov;	// 2 per packet
+  char               *bufs;	// OC_UDP_BATCH * OC_WIRE_BYTES
+
+  long long           sent;	// packets
+  long long           send_calls;
+
+} oc_udp_channel;
+
+// host is a name or dotted quad (IPv4 only). If it's a multicast
+// group, ttl is used as the multicast TTL, otherwise as the unicast
+// one (ttl <= 0 leaves the system default). Returns 0 on success.
+int  oc_udp_channel_open(oc_udp_channel *ch, const char *host, int port,
+			 int ttl, double rate, long long limit,
+			 int block_size);
+void oc_udp_channel_close(oc_udp_channel *ch);
+
+// Send n check blocks (seeds is n * OC_RNG_BYTES, blocks is n *
+// block_size), waiting for the channel's rate if need be. Returns
+// the number sent, which can be less than n if the channel reaches
+// its limit, or -1 on error.
+int  oc_udp_channel_send(oc_udp_channel *ch, const char *seeds,
+			 const char *blocks, int n);
+
+// As above, but make the n blocks with oc_encoder_emit_block, writing
+// them straight into packet buffers
+int  oc_udp_channel_send_encoder(oc_udp_channel *ch, oc_encoder *enc, int n);
+
+// Same again, but with the blocks from a carousel (see carousel.h)
+int  oc_udp_channel_send_carousel(oc_udp_channel *ch, oc_carousel *c, int n);
+
+// Run a set of channels off one encoder, each at its own rate, until
+// every channel has reached its limit or until ns nanoseconds have
+// passed (0 => no time limit). Every check block is different. The
+// encoder needs its data plane. Returns 0 on success.
+int  oc_udp_channels_run(oc_udp_channel *chs, int count, oc_encoder *enc,
+			 long long ns);
+
+// How long until the channel can send another packet: 0 if it can
+// now, or -1 if it's reached its limit. For callers with their own
+// event loops.
+long long oc_udp_channel_wait_ns(oc_udp_channel *ch);
+
+
+typedef struct {
+
+  int                 fd;
+  int                 block_size;
+  int                 batch;
+
+  struct mmsghdr     *msgs;
+  struct iovec       *iov;
+  char               *bufs;	// batch * (OC_WIRE_BYTES + 1)
+
+  // filled in by oc_udp_receive: count packets, with their seeds and
+  // contents (pointers into bufs, valid until the next receive)
+  int                 count;
+  const char        **seeds;
+  const char        **data;
+
+  long long           received;
+  long long           dropped;	// wrong size
+  long long           recv_calls;
+
+} oc_udp_receiver;
+
+// Listen on port. If group is a multicast group, join it (on the
+// default interface); if it's NULL, listen on all addresses. batch =
+// 0 means OC_UDP_BATCH. Returns 0 on success.
+int  oc_udp_receiver_open(oc_udp_receiver *r, const char *group, int port,
+			  int block_size, int batch);
+void oc_udp_receiver_close(oc_udp_receiver *r);
+
+// Wait up to timeout_ms (< 0 => forever) for packets and take as many
+// as are waiting, up to a batch. Returns the number of good packets
+// (0 on timeout) or -1 on error.
+int  oc_udp_receive(oc_udp_receiver *r, int timeout_ms);
+
+// Receive a batch and give it to the decoder (which needs its data
+// plane) with oc_accept_check_blocks_data. Returns 1 if the message is
+// decoded, 0 if not (including timeouts) or -1 on error.
+int  oc_udp_receiver_feed(oc_udp_receiver *r, oc_decoder *dec,
+			  int timeout_ms, oc_uni_block **solved_list);
+
+#endif
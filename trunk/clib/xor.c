@@ -18,6 +18,10 @@
 // The native register size in bytes can be calculated by using sizeof
 // on the above type.
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "this_machine.h"
 #include "xor.h"
 
@@ -111,3 +115,460 @@ void aligned_word_xor(unsigned char *dest, unsigned char *src,
     *dest++ ^= *src++;
   }
 }
+
+// SIMD kernels
+//
+// Block sizes are usually large enough (1K and up) that the cost of
+// xoring them is dominated by memory bandwidth, so the kernels below
+// all follow the same simple pattern:
+//
+// 1. for large buffers, xor words until dest is aligned to the vector
+//    size (stores that straddle cache lines are the expensive ones)
+// 2. xor four vectors per iteration
+// 3. xor one vector per iteration
+// 4. xor whatever is left a word, then a byte, at a time
+//
+// Loads and stores are all of the unaligned variety since we can't
+// align src and dest at the same time, and on small buffers the
+// alignment step would cost more than it saves. On current CPUs an
+// unaligned access to an aligned address is just as fast as an
+// aligned one.
+//
+// Each kernel is compiled with a function-level target attribute so
+// that the rest of the file (and the library) can still be built for
+// the baseline architecture. Which one is actually used is decided at
+// runtime by oc_xor_init().
+
+#define OC_XOR_ALIGN_MIN 512	// don't bother aligning smaller buffers
+
+static inline void xor_word(unsigned char *dest, const unsigned char *src) {
+  uint64_t d, s;
+  memcpy(&d, dest, 8);		// compiles to plain (unaligned) loads
+  memcpy(&s, src,  8);
+  d ^= s;
+  memcpy(dest, &d, 8);
+}
+
+static inline void xor_head(unsigned char **dest, const unsigned char **src,
+			    unsigned long *bytes, uintptr_t mask) {
+  if (*bytes < OC_XOR_ALIGN_MIN)
+    return;
+  while (((uintptr_t) *dest) & 7) {
+    *(*dest)++ ^= *(*src)++;
+    --*bytes;
+  }
+  while (((uintptr_t) *dest) & mask) {
+    xor_word(*dest, *src);
+    *dest += 8; *src += 8; *bytes -= 8;
+  }
+}
+
+static inline void xor_tail(unsigned char *dest, const unsigned char *src,
+			    unsigned long bytes) {
+  while (bytes >= 8) {
+    xor_word(dest, src);
+    dest += 8; src += 8; bytes -= 8;
+  }
+  while (bytes--) {
+    *dest++ ^= *src++;
+  }
+}
+
+static void byte_kernel(unsigned char *dest, const unsigned char *src,
+			unsigned long bytes) {
+  bytewise_xor(dest, (unsigned char *) src, bytes);
+}
+
+static void word_kernel(unsigned char *dest, const unsigned char *src,
+			unsigned long bytes) {
+  aligned_word_xor(dest, (unsigned char *) src, bytes);
+}
+
+static void byte_kernel4(unsigned char *dest,
+			 const unsigned char *a, const unsigned char *b,
+			 const unsigned char *c, const unsigned char *d,
+			 unsigned long bytes) {
+  while (bytes--)
+    *dest++ ^= *a++ ^ *b++ ^ *c++ ^ *d++;
+}
+
+static void word_kernel4(unsigned char *dest,
+			 const unsigned char *a, const unsigned char *b,
+			 const unsigned char *c, const unsigned char *d,
+			 unsigned long bytes) {
+  aligned_word_xor(dest, (unsigned char *) a, bytes);
+  aligned_word_xor(dest, (unsigned char *) b, bytes);
+  aligned_word_xor(dest, (unsigned char *) c, bytes);
+  aligned_word_xor(dest, (unsigned char *) d, bytes);
+}
+
+// tail handling for the four-source kernels
+static inline void xor4_tail(unsigned char *dest,
+			     const unsigned char *a, const unsigned char *b,
+			     const unsigned char *c, const unsigned char *d,
+			     unsigned long bytes) {
+  while (bytes >= 8) {
+    xor_word(dest, a); xor_word(dest, b);
+    xor_word(dest, c); xor_word(dest, d);
+    dest += 8; a += 8; b += 8; c += 8; d += 8; bytes -= 8;
+  }
+  while (bytes--)
+    *dest++ ^= *a++ ^ *b++ ^ *c++ ^ *d++;
+}
+
+static int always_supported(void) { return 1; }
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OC_XOR_X86 1
+
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static void sse2_kernel(unsigned char *dest, const unsigned char *src,
+			unsigned long bytes) {
+
+  __m128i d0, d1, d2, d3;
+
+  xor_head(&dest, &src, &bytes, 15);
+
+  while (bytes >= 64) {
+    d0 = _mm_xor_si128(_mm_loadu_si128((__m128i *) dest),
+		       _mm_loadu_si128((const __m128i *) src));
+    d1 = _mm_xor_si128(_mm_loadu_si128((__m128i *) (dest + 16)),
+		       _mm_loadu_si128((const __m128i *) (src + 16)));
+    d2 = _mm_xor_si128(_mm_loadu_si128((__m128i *) (dest + 32)),
+		       _mm_loadu_si128((const __m128i *) (src + 32)));
+    d3 = _mm_xor_si128(_mm_loadu_si128((__m128i *) (dest + 48)),
+		       _mm_loadu_si128((const __m128i *) (src + 48)));
+    _mm_storeu_si128((__m128i *) dest,        d0);
+    _mm_storeu_si128((__m128i *) (dest + 16), d1);
+    _mm_storeu_si128((__m128i *) (dest + 32), d2);
+    _mm_storeu_si128((__m128i *) (dest + 48), d3);
+    dest += 64; src += 64; bytes -= 64;
+  }
+  while (bytes >= 16) {
+    d0 = _mm_xor_si128(_mm_loadu_si128((__m128i *) dest),
+		       _mm_loadu_si128((const __m128i *) src));
+    _mm_storeu_si128((__m128i *) dest, d0);
+    dest += 16; src += 16; bytes -= 16;
+  }
+  xor_tail(dest, src, bytes);
+}
+
+__attribute__((target("avx2")))
+static void avx2_kernel(unsigned char *dest, const unsigned char *src,
+			unsigned long bytes) {
+
+  __m256i d0, d1, d2, d3;
+
+  xor_head(&dest, &src, &bytes, 31);
+
+  while (bytes >= 128) {
+    d0 = _mm256_xor_si256(_mm256_loadu_si256((__m256i *) dest),
+			  _mm256_loadu_si256((const __m256i *) src));
+    d1 = _mm256_xor_si256(_mm256_loadu_si256((__m256i *) (dest + 32)),
+			  _mm256_loadu_si256((const __m256i *) (src + 32)));
+    d2 = _mm256_xor_si256(_mm256_loadu_si256((__m256i *) (dest + 64)),
+			  _mm256_loadu_si256((const __m256i *) (src + 64)));
+    d3 = _mm256_xor_si256(_mm256_loadu_si256((__m256i *) (dest + 96)),
+			  _mm256_loadu_si256((const __m256i *) (src + 96)));
+    _mm256_storeu_si256((__m256i *) dest,        d0);
+    _mm256_storeu_si256((__m256i *) (dest + 32), d1);
+    _mm256_storeu_si256((__m256i *) (dest + 64), d2);
+    _mm256_storeu_si256((__m256i *) (dest + 96), d3);
+    dest += 128; src += 128; bytes -= 128;
+  }
+  while (bytes >= 32) {
+    d0 = _mm256_xor_si256(_mm256_loadu_si256((__m256i *) dest),
+			  _mm256_loadu_si256((const __m256i *) src));
+    _mm256_storeu_si256((__m256i *) dest, d0);
+    dest += 32; src += 32; bytes -= 32;
+  }
+  xor_tail(dest, src, bytes);
+}
+
+__attribute__((target("avx512f")))
+static void avx512_kernel(unsigned char *dest, const unsigned char *src,
+			  unsigned long bytes) {
+
+  __m512i d0, d1, d2, d3;
+
+  xor_head(&dest, &src, &bytes, 63);
+
+  while (bytes >= 256) {
+    d0 = _mm512_xor_si512(_mm512_loadu_si512((void *) dest),
+			  _mm512_loadu_si512((const void *) src));
+    d1 = _mm512_xor_si512(_mm512_loadu_si512((void *) (dest + 64)),
+			  _mm512_loadu_si512((const void *) (src + 64)));
+    d2 = _mm512_xor_si512(_mm512_loadu_si512((void *) (dest + 128)),
+			  _mm512_loadu_si512((const void *) (src + 128)));
+    d3 = _mm512_xor_si512(_mm512_loadu_si512((void *) (dest + 192)),
+			  _mm512_loadu_si512((const void *) (src + 192)));
+    _mm512_storeu_si512((void *) dest,         d0);
+    _mm512_storeu_si512((void *) (dest + 64),  d1);
+    _mm512_storeu_si512((void *) (dest + 128), d2);
+    _mm512_storeu_si512((void *) (dest + 192), d3);
+    dest += 256; src += 256; bytes -= 256;
+  }
+  while (bytes >= 64) {
+    d0 = _mm512_xor_si512(_mm512_loadu_si512((void *) dest),
+			  _mm512_loadu_si512((const void *) src));
+    _mm512_storeu_si512((void *) dest, d0);
+    dest += 64; src += 64; bytes -= 64;
+  }
+  xor_tail(dest, src, bytes);
+}
+
+// The four-source kernels don't bother aligning dest: they're only
+// called on L1-resident stripes (see oc_xor_many) and four of the five
+// streams are going to be unaligned anyway.
+
+#define XOR4_BODY(TYPE, LOAD, STORE, XOR, V)				\
+  TYPE r0, r1;								\
+  while (bytes >= 2 * V) {						\
+    r0 = XOR(XOR(LOAD((TYPE *) dest), LOAD((const TYPE *) a)),		\
+	     XOR(LOAD((const TYPE *) b),					\
+		 XOR(LOAD((const TYPE *) c), LOAD((const TYPE *) d))));	\
+    r1 = XOR(XOR(LOAD((TYPE *) (dest + V)), LOAD((const TYPE *) (a + V))), \
+	     XOR(LOAD((const TYPE *) (b + V)),				\
+		 XOR(LOAD((const TYPE *) (c + V)),			\
+		     LOAD((const TYPE *) (d + V)))));			\
+    STORE((TYPE *) dest, r0);						\
+    STORE((TYPE *) (dest + V), r1);					\
+    dest += 2 * V; a += 2 * V; b += 2 * V; c += 2 * V; d += 2 * V;	\
+    bytes -= 2 * V;							\
+  }									\
+  xor4_tail(dest, a, b, c, d, bytes);
+
+__attribute__((target("sse2")))
+static void sse2_kernel4(unsigned char *dest,
+			 const unsigned char *a, const unsigned char *b,
+			 const unsigned char *c, const unsigned char *d,
+			 unsigned long bytes) {
+  XOR4_BODY(__m128i, _mm_loadu_si128, _mm_storeu_si128, _mm_xor_si128, 16)
+}
+
+__attribute__((target("avx2")))
+static void avx2_kernel4(unsigned char *dest,
+			 const unsigned char *a, const unsigned char *b,
+			 const unsigned char *c, const unsigned char *d,
+			 unsigned long bytes) {
+  XOR4_BODY(__m256i, _mm256_loadu_si256, _mm256_storeu_si256,
+	    _mm256_xor_si256, 32)
+}
+
+__attribute__((target("avx512f")))
+static void avx512_kernel4(unsigned char *dest,
+			   const unsigned char *a, const unsigned char *b,
+			   const unsigned char *c, const unsigned char *d,
+			   unsigned long bytes) {
+  XOR4_BODY(__m512i, _mm512_loadu_si512, _mm512_storeu_si512,
+	    _mm512_xor_si512, 64)
+}
+
+static int sse2_supported(void) {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse2");
+}
+
+static int avx2_supported(void) {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+static int avx512_supported(void) {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx512f");
+}
+
+#endif // x86
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#define OC_XOR_NEON 1
+
+#include <arm_neon.h>
+#ifdef __linux__
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+static void neon_kernel(unsigned char *dest, const unsigned char *src,
+			unsigned long bytes) {
+
+  uint8x16_t d0, d1, d2, d3;
+
+  xor_head(&dest, &src, &bytes, 15);
+
+  while (bytes >= 64) {
+    d0 = veorq_u8(vld1q_u8(dest),      vld1q_u8(src));
+    d1 = veorq_u8(vld1q_u8(dest + 16), vld1q_u8(src + 16));
+    d2 = veorq_u8(vld1q_u8(dest + 32), vld1q_u8(src + 32));
+    d3 = veorq_u8(vld1q_u8(dest + 48), vld1q_u8(src + 48));
+    vst1q_u8(dest,      d0);
+    vst1q_u8(dest + 16, d1);
+    vst1q_u8(dest + 32, d2);
+    vst1q_u8(dest + 48, d3);
+    dest += 64; src += 64; bytes -= 64;
+  }
+  while (bytes >= 16) {
+    vst1q_u8(dest, veorq_u8(vld1q_u8(dest), vld1q_u8(src)));
+    dest += 16; src += 16; bytes -= 16;
+  }
+  xor_tail(dest, src, bytes);
+}
+
+static void neon_kernel4(unsigned char *dest,
+			 const unsigned char *a, const unsigned char *b,
+			 const unsigned char *c, const unsigned char *d,
+			 unsigned long bytes) {
+
+  uint8x16_t r0, r1;
+
+  while (bytes >= 32) {
+    r0 = veorq_u8(veorq_u8(vld1q_u8(dest), vld1q_u8(a)),
+		  veorq_u8(vld1q_u8(b), veorq_u8(vld1q_u8(c), vld1q_u8(d))));
+    r1 = veorq_u8(veorq_u8(vld1q_u8(dest + 16), vld1q_u8(a + 16)),
+		  veorq_u8(vld1q_u8(b + 16),
+			   veorq_u8(vld1q_u8(c + 16), vld1q_u8(d + 16))));
+    vst1q_u8(dest,      r0);
+    vst1q_u8(dest + 16, r1);
+    dest += 32; a += 32; b += 32; c += 32; d += 32; bytes -= 32;
+  }
+  xor4_tail(dest, a, b, c, d, bytes);
+}
+
+static int neon_supported(void) {
+#if defined(__linux__) && defined(__aarch64__) && defined(HWCAP_ASIMD)
+  return (getauxval(AT_HWCAP) & HWCAP_ASIMD) != 0;
+#elif defined(__linux__) && defined(HWCAP_NEON)
+  return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#else
+  return 1;			// compiler was told we have NEON
+#endif
+}
+
+#endif // NEON
+
+const oc_xor_kernel oc_xor_kernels[] = {
+  { "bytewise", byte_kernel,   byte_kernel4,   always_supported },
+  { "word",     word_kernel,   word_kernel4,   always_supported },
+#ifdef OC_XOR_X86
+  { "sse2",     sse2_kernel,   sse2_kernel4,   sse2_supported   },
+  { "avx2",     avx2_kernel,   avx2_kernel4,   avx2_supported   },
+  { "avx512",   avx512_kernel, avx512_kernel4, avx512_supported },
+#endif
+#ifdef OC_XOR_NEON
+  { "neon",     neon_kernel,   neon_kernel4,   neon_supported   },
+#endif
+  { NULL, NULL, NULL, NULL },
+};
+
+// Dispatch
+//
+// The function pointer starts off pointing at a stub that does the
+// selection and then forwards the call, so oc_xor() works even if the
+// constructor below never runs. Selection is idempotent, so it
+// doesn't matter if two threads race to do it.
+
+static void resolve_kernel(unsigned char *dest, const unsigned char *src,
+			   unsigned long bytes);
+
+static void resolve_kernel4(unsigned char *dest,
+			    const unsigned char *a, const unsigned char *b,
+			    const unsigned char *c, const unsigned char *d,
+			    unsigned long bytes);
+
+static oc_xor_fn         xor_impl   = resolve_kernel;
+static oc_xor4_fn        xor4_impl  = resolve_kernel4;
+static const char       *xor_name   = "unresolved";
+
+static void resolve_kernel(unsigned char *dest, const unsigned char *src,
+			   unsigned long bytes) {
+  oc_xor_init();
+  xor_impl(dest, src, bytes);
+}
+
+static void resolve_kernel4(unsigned char *dest,
+			    const unsigned char *a, const unsigned char *b,
+			    const unsigned char *c, const unsigned char *d,
+			    unsigned long bytes) {
+  oc_xor_init();
+  xor4_impl(dest, a, b, c, d, bytes);
+}
+
+int oc_xor_select(const char *name) {
+
+  const oc_xor_kernel *k;
+
+  for (k = oc_xor_kernels; k->name != NULL; ++k) {
+    if (strcmp(k->name, name) == 0) {
+      if (!k->supported())
+	return -1;
+      xor_name  = k->name;
+      xor_impl  = k->xor;
+      xor4_impl = k->xor4;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+#if defined(__GNUC__)
+__attribute__((constructor))
+#endif
+void oc_xor_init(void) {
+
+  const oc_xor_kernel *k, *best = oc_xor_kernels;
+  const char *override = getenv("OC_XOR_KERNEL");
+
+  if ((override != NULL) && (0 == oc_xor_select(override)))
+    return;
+
+  // later entries in the table are faster
+  for (k = oc_xor_kernels; k->name != NULL; ++k)
+    if (k->supported())
+      best = k;
+
+  xor_name  = best->name;
+  xor_impl  = best->xor;
+  xor4_impl = best->xor4;
+}
+
+const char *oc_xor_kernel_name(void) {
+  if (xor_impl == resolve_kernel)
+    oc_xor_init();
+  return xor_name;
+}
+
+void oc_xor(void *dest, const void *src, unsigned long bytes) {
+  xor_impl((unsigned char *) dest, (const unsigned char *) src, bytes);
+}
+
+void oc_xor_many(void *dest, const void **srcs, int n, unsigned long bytes) {
+
+  unsigned char *dp = dest;
+  unsigned long  offset, len;
+  int            i;
+
+  // a single source doesn't need striping
+  if (n == 1) {
+    xor_impl(dp, srcs[0], bytes);
+    return;
+  }
+
+  for (offset = 0; offset < bytes; offset += OC_XOR_STRIPE) {
+    len = bytes - offset;
+    if (len > OC_XOR_STRIPE)
+      len = OC_XOR_STRIPE;
+
+    for (i = 0; i + 4 <= n; i += 4)
+      xor4_impl(dp + offset,
+		(const unsigned char *) srcs[i]     + offset,
+		(const unsigned char *) srcs[i + 1] + offset,
+		(const unsigned char *) srcs[i + 2] + offset,
+		(const unsigned char *) srcs[i + 3] + offset,
+		len);
+    for (; i < n; ++i)
+      xor_impl(dp + offset, (const unsigned char *) srcs[i] + offset, len);
+  }
+}
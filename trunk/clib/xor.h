@@ -1,6 +1,61 @@
 // function declarations
 
-void bytewise_xor (unsigned char *dest, unsigned char *src, 
+#ifndef OC_XOR_H
+#define OC_XOR_H
+
+void bytewise_xor (unsigned char *dest, unsigned char *src,
 		   unsigned long bytes);
-void aligned_word_xor(unsigned char *dest, unsigned char *src, 
+void aligned_word_xor(unsigned char *dest, unsigned char *src,
 		      unsigned long bytes);
+
+// Runtime-dispatched XOR
+//
+// oc_xor() is the single entry point that both the C library and the
+// Perl XS code should call. It forwards to whichever of the kernels
+// below is the best one that the CPU we're running on supports. The
+// choice is made once at startup (or on the first call if the
+// compiler doesn't support constructor functions).
+
+typedef void (*oc_xor_fn)(unsigned char *dest, const unsigned char *src,
+			  unsigned long bytes);
+
+typedef void (*oc_xor4_fn)(unsigned char *dest,
+			   const unsigned char *a, const unsigned char *b,
+			   const unsigned char *c, const unsigned char *d,
+			   unsigned long bytes);
+
+typedef struct {
+  const char *name;
+  oc_xor_fn   xor;		// dest ^= src
+  oc_xor4_fn  xor4;		// dest ^= a ^ b ^ c ^ d
+  int       (*supported)(void);	// non-zero if CPU can run this kernel
+} oc_xor_kernel;
+
+// Table of all kernels compiled in for this platform, roughly in
+// order of increasing speed. Terminated by an entry with a NULL name.
+extern const oc_xor_kernel oc_xor_kernels[];
+
+void oc_xor(void *dest, const void *src, unsigned long bytes);
+
+// Fused multi-source XOR: dest ^= srcs[0] ^ srcs[1] ^ ... ^ srcs[n-1]
+//
+// Xoring n sources in one at a time reads and writes dest n times.
+// This routine instead works through dest in stripes small enough to
+// stay in L1 cache and xors up to four sources into each stripe per
+// pass, so dest only makes one trip through the cache no matter how
+// many sources there are.
+void oc_xor_many(void *dest, const void **srcs, int n, unsigned long bytes);
+
+#define OC_XOR_STRIPE 4096	// bytes of dest per stripe
+
+// Select the best supported kernel. Setting the OC_XOR_KERNEL
+// environment variable to the name of a kernel overrides the choice.
+void oc_xor_init(void);
+
+// Force use of a particular kernel (mainly for testing/benchmarks).
+// Returns 0 on success, -1 if the name is unknown or unsupported.
+int oc_xor_select(const char *name);
+
+const char *oc_xor_kernel_name(void);
+
+#endif
@@ -513,10 +513,257 @@ void do_benchmarks(void) {
 }
 
 
+// Tests for the runtime-dispatched kernels behind oc_xor()
+//
+// The table-driven tests above always use the same offset into src
+// and dst, but the SIMD kernels can only align one of the two, so we
+// need to try all combinations of (mis)alignment. Each kernel is
+// checked against bytewise_xor, and we also check that it doesn't
+// write outside the range it was given.
+
+#define KERNEL_ALL_LEN  300	/* test every length up to this */
+#define KERNEL_MAX_LEN  1100	/* then some longer ones that get aligned */
+#define KERNEL_BUF      (64 + KERNEL_MAX_LEN + 64)
+
+unsigned char __attribute__((aligned(64))) k_src[KERNEL_BUF];
+unsigned char __attribute__((aligned(64))) k_dst[KERNEL_BUF];
+unsigned char __attribute__((aligned(64))) k_ref[KERNEL_BUF];
+unsigned char __attribute__((aligned(64))) k_srcs[4][KERNEL_BUF];
+
+int src_offsets[] = { 0, 1, 7, 15, 31, 33, 63, -1 };
+
+// returns 1 on success
+int test_kernel(const oc_xor_kernel *k) {
+
+  int i, len, doff, *sp, soff;
+
+  for (i = 0; i < KERNEL_BUF; ++i) {
+    k_src[i] = (i * 7 + 3) & 0xff;
+    k_srcs[0][i] = (i * 11 + 5) & 0xff;
+    k_srcs[1][i] = (i * 17 + 9) & 0xff;
+    k_srcs[2][i] = (i * 19 + 2) & 0xff;
+    k_srcs[3][i] = (i * 23 + 4) & 0xff;
+  }
+
+  for (len = 0; len <= KERNEL_MAX_LEN;
+       len += (len < KERNEL_ALL_LEN) ? 1 : 7) {
+    for (doff = 0; doff < 64; ++doff) {
+      for (sp = src_offsets; (soff = *sp) >= 0; ++sp) {
+
+	for (i = 0; i < KERNEL_BUF; ++i)
+	  k_dst[i] = k_ref[i] = (i * 13 + 1) & 0xff;
+
+	bytewise_xor(k_ref + doff, k_src + soff, len);
+	(k->xor)(k_dst + doff, k_src + soff, len);
+
+	if (memcmp(k_dst, k_ref, KERNEL_BUF)) {
+	  printf("  %s: failed with length %d, dest offset %d, src offset %d\n",
+		 k->name, len, doff, soff);
+	  return 0;
+	}
+
+	// four-source version (each source at a different offset)
+	for (i = 0; i < 4; ++i)
+	  bytewise_xor(k_ref + doff, k_srcs[i] + ((soff + i) & 63), len);
+	(k->xor4)(k_dst + doff, k_srcs[0] + (soff & 63),
+		  k_srcs[1] + ((soff + 1) & 63), k_srcs[2] + ((soff + 2) & 63),
+		  k_srcs[3] + ((soff + 3) & 63), len);
+
+	if (memcmp(k_dst, k_ref, KERNEL_BUF)) {
+	  printf("  %s: xor4 failed with length %d, dest offset %d, "
+		 "src offset %d\n", k->name, len, doff, soff);
+	  return 0;
+	}
+      }
+    }
+  }
+
+  return 1;
+}
+
+// Check oc_xor_many against one oc_xor per source, for various
+// numbers of sources and lengths either side of a stripe boundary.
+// Returns 1 on success.
+int test_xor_many(void) {
+
+  int lengths[] = { 0, 1, 63, OC_XOR_STRIPE - 1, OC_XOR_STRIPE,
+		    OC_XOR_STRIPE + 1, 3 * OC_XOR_STRIPE + 100, -1 };
+  int *lp, len, n, i, max_len = 3 * OC_XOR_STRIPE + 100;
+  unsigned char *dst_many, *dst_one, *srcs[11];
+  const void *src_list[11];
+  int ok = 1;
+
+  dst_many = malloc(max_len);
+  dst_one  = malloc(max_len);
+  assert(dst_many != NULL && dst_one != NULL);
+  for (n = 0; n < 11; ++n) {
+    srcs[n] = malloc(max_len + n);
+    assert(srcs[n] != NULL);
+    for (i = 0; i < max_len + n; ++i)
+      srcs[n][i] = rand();
+    src_list[n] = srcs[n] + n;	// vary alignment
+  }
+
+  for (n = 0; ok && n <= 11; ++n) {
+    for (lp = lengths; ok && (len = *lp) >= 0; ++lp) {
+      memset(dst_many, 0x33, max_len);
+      memset(dst_one,  0x33, max_len);
+      oc_xor_many(dst_many, src_list, n, len);
+      for (i = 0; i < n; ++i)
+	oc_xor(dst_one, src_list[i], len);
+      if (memcmp(dst_many, dst_one, max_len)) {
+	printf("  oc_xor_many failed with %d sources, length %d\n", n, len);
+	ok = 0;
+      }
+    }
+  }
+
+  for (n = 0; n < 11; ++n)
+    free(srcs[n]);
+  free(dst_many);
+  free(dst_one);
+  return ok;
+}
+
+// returns number of kernels that failed
+int kernel_harness(void) {
+
+  const oc_xor_kernel *k;
+  int failed = 0;
+
+  printf("\nTesting XOR kernels (oc_xor uses '%s')\n", oc_xor_kernel_name());
+  for (k = oc_xor_kernels; k->name != NULL; ++k) {
+    if (!k->supported()) {
+      printf("  %-10s not supported on this CPU\n", k->name);
+      continue;
+    }
+    if (test_kernel(k)) {
+      printf("  %-10s passed\n", k->name);
+    } else {
+      ++failed;
+    }
+  }
+
+  if (test_xor_many()) {
+    printf("  oc_xor_many passed\n");
+  } else {
+    ++failed;
+  }
+
+  return failed;
+}
+
+// Compare one oc_xor call per source with a single oc_xor_many call
+// for a high-degree check block (reported in GB/s of source data)
+void xor_many_benchmark(void) {
+
+  struct timespec start_time, end_time;
+  long long delta_ns;
+  unsigned long block = 65536, runs;
+  int n = 64, i;
+  unsigned char *dest, *pool;
+  const void *srcs[64];
+
+  dest = malloc(block);
+  pool = malloc(block * n);
+  assert(dest != NULL && pool != NULL);
+  memset(pool, 0x5a, block * n);
+  memset(dest, 0, block);
+  for (i = 0; i < n; ++i)
+    srcs[i] = pool + i * block;
+
+  printf("\n%d sources of %lu bytes each (GB/s of source data)\n", n, block);
+
+  runs = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  do {
+    for (i = 0; i < n; ++i)
+      oc_xor(dest, srcs[i], block);
+    ++runs;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    delta_ns  = end_time.tv_nsec - start_time.tv_nsec;
+    delta_ns += 1000000000ll * (end_time.tv_sec - start_time.tv_sec);
+  } while (delta_ns < 250000000ll);
+  printf("  oc_xor x %d   %10.2f\n", n, ((double) block * n * runs) / delta_ns);
+
+  runs = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  do {
+    oc_xor_many(dest, srcs, n, block);
+    ++runs;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    delta_ns  = end_time.tv_nsec - start_time.tv_nsec;
+    delta_ns += 1000000000ll * (end_time.tv_sec - start_time.tv_sec);
+  } while (delta_ns < 250000000ll);
+  printf("  oc_xor_many  %10.2f\n", ((double) block * n * runs) / delta_ns);
+
+  free(dest);
+  free(pool);
+}
+
+// Report throughput of each kernel in GB/s. The larger sizes don't
+// fit in the static arrays and are meant to show memory rather than
+// cache bandwidth.
+void kernel_benchmarks(void) {
+
+  struct timespec start_time, end_time;
+  long long delta_ns, ns_per_test = 250000000ll; // 0.25 seconds
+  unsigned long sizes[] = { 64, 1024, 4096, 32768, 1 << 20, 16 << 20, 0 };
+  unsigned long *sp, size, runs, j, batch;
+  const oc_xor_kernel *k;
+  unsigned char *big_src, *big_dst;
+
+  big_src = malloc(16 << 20);
+  big_dst = malloc(16 << 20);
+  assert(big_src != NULL && big_dst != NULL);
+  memset(big_src, 0x5a, 16 << 20);
+  memset(big_dst, 0xa5, 16 << 20);
+
+  printf("\nKernel throughput (GB/s, higher is better)\n");
+  printf("  %-10s", "bytes");
+  for (sp = sizes; *sp; ++sp)
+    printf("%10lu", *sp);
+  printf("\n");
+
+  for (k = oc_xor_kernels; k->name != NULL; ++k) {
+    if (!k->supported())
+      continue;
+    printf("  %-10s", k->name);
+    for (sp = sizes; (size = *sp); ++sp) {
+      batch = 1 + (1 << 20) / size;	// about 1MB between clock reads
+      runs  = 0;
+      clock_gettime(CLOCK_MONOTONIC, &start_time);
+      do {
+	for (j = 0; j < batch; ++j)
+	  (k->xor)(big_dst, big_src, size);
+	runs += batch;
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	delta_ns  = end_time.tv_nsec - start_time.tv_nsec;
+	delta_ns += 1000000000ll * (end_time.tv_sec - start_time.tv_sec);
+      } while (delta_ns < ns_per_test);
+      printf("%10.2f", ((double) size * runs) / delta_ns);
+    }
+    printf("\n");
+  }
+
+  free(big_src);
+  free(big_dst);
+}
+
 int main(int ac, char **av) {
+
+  int failed;
+
   printf("Passed %d of %d tests\n", test_harness(), sizeof(tests)/sizeof(test_entry_t));
 
+  failed = kernel_harness();
+  printf("%d kernel(s) failed\n", failed);
+
+  kernel_benchmarks();
+  xor_many_benchmark();
+
   do_benchmarks();
 
+  return failed ? 1 : 0;
 }
   
@@ -232,6 +232,36 @@ sub get_P {			# P == probability distribution
 
 # "Private" routines
 
+# Pick the engine. The C one is used if the XS module was built with
+# it, unless the caller asks for the pure-Perl one. Net::OnlineCode::C
+# objects take the same rng and give the same results as the Perl code.
+sub _engine {
+  my ($self, $engine) = @_;
+  my $class = ref($self);
+
+  $engine = Net::OnlineCode::c_engine() ? "c" : "perl"
+    unless defined $engine;
+  croak "$class: engine should be 'c' or 'perl'\n"
+    unless $engine eq "c" or $engine eq "perl";
+  croak "$class: C engine not built (see Build.PL)\n"
+    if $engine eq "c" and !Net::OnlineCode::c_engine();
+
+  return $engine;
+}
+
+# The C code is given the ablocks and e worked out in new() (it would
+# round the number of aux blocks up, not down), so F should agree too
+sub _check_c_params {
+  my ($self, $c) = @_;
+  my ($ablocks, $f) = $c->params;
+
+  croak ref($self) . ": C engine disagrees on parameters " .
+    "(ablocks $ablocks, F $f vs $self->{ablocks}, $self->{f}); " .
+    "use engine => 'perl'\n"
+    unless $ablocks == $self->{ablocks} and $f == $self->{f};
+}
+
+
 # calculate how many auxiliary blocks need to be generated for a given
 # code setup
 sub _count_auxiliary {
@@ -777,6 +807,18 @@ Apart from that, the original paper does not specify a PRNG algorithm.
 This module implements one using SHA-1, since it is portable across
 platforms and readily available.
 
+=head2 THE C ENGINE
+
+If Build.PL finds the C version of the code (the C/ directory next to
+this distribution, or wherever the ONLINECODE_C_DIR environment
+variable points), it's compiled into the XS module and
+Net::OnlineCode::c_engine() returns true. The Encoder and Decoder then
+use it by default for making check block and auxiliary mappings and
+for graph decoding; pass C<engine =E<gt> 'perl'> to their constructors
+to use the pure-Perl code instead. The two engines draw exactly the
+same random numbers from the same rng objects, so a Perl encoder can
+talk to a C decoder and vice versa.
+
 
 =head1 RELEASE NOTE FOR V0.03
 
@@ -16,6 +16,97 @@
 
 #include "xor.h"
 
+// Bindings for the C encoder and graph decoder (in the C/ directory
+// of the source tree). Build.PL compiles them in and defines
+// OC_HAVE_C_PORT if it can find them; otherwise only the xor routine
+// above is available and c_engine() returns false.
+//
+// Each Perl object is a blessed reference to one of the wrappers
+// below. The C side doesn't keep hold of the caller's rng: every call
+// that takes one copies the Perl RNG object's current value into a C
+// rng in Perl-compatible mode (see rng_sha1.h), draws from that and
+// copies the new value back, so the Perl RNG ends up in exactly the
+// state it would be in if the pure-Perl code had been called.
+
+#ifdef OC_HAVE_C_PORT
+
+#include "online-code.h"
+#include "encoder.h"
+#include "decoder.h"
+
+typedef struct {
+  oc_encoder   enc;
+  oc_rng_sha1  rng;
+} oc_perl_encoder;
+
+typedef struct {
+  oc_decoder   dec;
+  oc_rng_sha1  rng;
+} oc_perl_decoder;
+
+// Net::OnlineCode::RNG objects are [ CURRENT, SEED ]
+static void rng_from_perl(oc_rng_sha1 *rng, SV *rng_sv) {
+
+  SV    **current;
+  char   *p;
+  STRLEN  len;
+
+  if (!(SvROK(rng_sv) && SvTYPE(SvRV(rng_sv)) == SVt_PVAV))
+    croak("rng should be a Net::OnlineCode::RNG object\n");
+  current = av_fetch((AV *) SvRV(rng_sv), 0, 0);
+  if ((NULL == current) || !SvOK(*current))
+    croak("rng has not been seeded\n");
+  p = SvPV(*current, len);
+  if (len != OC_RNG_BYTES)
+    croak("rng value should be %d bytes long\n", OC_RNG_BYTES);
+
+  oc_rng_init_seed(rng, p);
+  oc_rng_set_perl_compat(rng, 1);
+}
+
+static void rng_to_perl(oc_rng_sha1 *rng, SV *rng_sv) {
+  av_store((AV *) SvRV(rng_sv), 0, newSVpvn(rng->current, OC_RNG_BYTES));
+}
+
+static void *handle(SV *self, const char *class) {
+  if (!sv_derived_from(self, class))
+    croak("object is not a %s\n", class);
+  return INT2PTR(void *, SvIV(SvRV(self)));
+}
+
+// Same layout as Net::OnlineCode's aux_mapping: message blocks first,
+// each with its q aux blocks, then aux blocks with their messages
+static SV *aux_mapping(oc_codec *codec) {
+
+  AV        *map, *list;
+  const int *rev;
+  int        mblocks = codec->mblocks;
+  int        q       = codec->q;
+  int        i, j;
+
+  if (NULL == (rev = oc_aux_reverse_map(codec)))
+    croak("failed to make reverse auxiliary mapping\n");
+
+  map = newAV();
+  av_extend(map, codec->coblocks - 1);
+  for (i = 0; i < mblocks; ++i) {
+    list = newAV();
+    for (j = 0; j < q; ++j)
+      av_push(list, newSViv(codec->auxiliary[i * q + j]));
+    av_push(map, newRV_noinc((SV *) list));
+  }
+  for (i = 0; i < codec->ablocks; ++i) {
+    list = newAV();
+    for (j = rev[i]; j < rev[i + 1]; ++j)
+      av_push(list, newSViv(rev[j]));
+    av_push(map, newRV_noinc((SV *) list));
+  }
+
+  return newRV_noinc((SV *) map);
+}
+
+#endif
+
 MODULE = Net::OnlineCode  PACKAGE = Net::OnlineCode
 
 PROTOTYPES: ENABLE
@@ -59,9 +150,10 @@ CODE:
 	exit(1);
       }
 
-      // call C library routine
+      // call C library routine (dispatches to best kernel for CPU)
       //bytewise_xor(dest_ptr, source_ptr, dest_size);
-      aligned_word_xor(dest_ptr, source_ptr, dest_size);
+      //aligned_word_xor(dest_ptr, source_ptr, dest_size);
+      oc_xor(dest_ptr, source_ptr, dest_size);
     }
   }
 
@@ -83,3 +175,265 @@ OUTPUT:
 #	char *dest
 #	char *src
 #	unsigned int bytes
+
+int
+c_engine ()
+CODE:
+#ifdef OC_HAVE_C_PORT
+  RETVAL = 1;
+#else
+  RETVAL = 0;
+#endif
+OUTPUT:
+  RETVAL
+
+#ifdef OC_HAVE_C_PORT
+
+MODULE = Net::OnlineCode  PACKAGE = Net::OnlineCode::C::Encoder
+
+PROTOTYPES: DISABLE
+
+# new(class, mblocks, rng, q, e, f, ablocks): wraps oc_encoder_init,
+# which builds the auxiliary mapping from rng (so rng is advanced).
+# ablocks is the Perl code's count, since oc_count_aux rounds it up
+# rather than down; f has to be given for ablocks to be.
+
+SV *
+new (class, mblocks, rng_sv, q, e, f, ablocks)
+	const char *class;
+	int         mblocks;
+	SV         *rng_sv;
+	int         q;
+	double      e;
+	int         f;
+	int         ablocks;
+CODE:
+
+  oc_perl_encoder *h;
+  int              flag;
+
+  Newxz(h, 1, oc_perl_encoder);
+  rng_from_perl(&h->rng, rng_sv);
+  flag = oc_encoder_init(&h->enc, mblocks, &h->rng, 0, q, e, f, ablocks,
+			 0ll);
+  if (flag & OC_FATAL_ERROR) {
+    Safefree(h);
+    croak("oc_encoder_init failed\n");
+  }
+  rng_to_perl(&h->rng, rng_sv);
+
+  RETVAL = newSV(0);
+  sv_setref_pv(RETVAL, class, (void *) h);
+OUTPUT:
+  RETVAL
+
+# (ablocks, F, e) after any change made to e by the C code
+
+void
+params (self)
+	SV *self;
+PPCODE:
+
+  oc_perl_encoder *h = handle(self, "Net::OnlineCode::C::Encoder");
+
+  EXTEND(SP, 3);
+  mPUSHi(h->enc.base.ablocks);
+  mPUSHi(h->enc.base.F);
+  mPUSHn(h->enc.base.e);
+
+SV *
+aux_mapping (self)
+	SV *self;
+CODE:
+  RETVAL = aux_mapping(&((oc_perl_encoder *)
+			 handle(self, "Net::OnlineCode::C::Encoder"))->enc.base);
+OUTPUT:
+  RETVAL
+
+# check_block(self, rng): wraps oc_encoder_check_block, returning an
+# array ref of composite block numbers
+
+SV *
+check_block (self, rng_sv)
+	SV *self;
+	SV *rng_sv;
+CODE:
+
+  oc_perl_encoder *h = handle(self, "Net::OnlineCode::C::Encoder");
+  AV              *list;
+  int             *p, i;
+
+  rng_from_perl(&h->rng, rng_sv);
+  if (NULL == (p = oc_encoder_check_block(&h->enc)))
+    croak("oc_encoder_check_block failed\n");
+  rng_to_perl(&h->rng, rng_sv);
+
+  // p is [count, block, block, ...] in the codec's scratch space
+  list = newAV();
+  av_extend(list, p[0] - 1);
+  for (i = 1; i <= p[0]; ++i)
+    av_push(list, newSViv(p[i]));
+  RETVAL = newRV_noinc((SV *) list);
+OUTPUT:
+  RETVAL
+
+void
+DESTROY (self)
+	SV *self;
+CODE:
+
+  oc_perl_encoder *h = handle(self, "Net::OnlineCode::C::Encoder");
+
+  oc_encoder_free(&h->enc);
+  Safefree(h);
+
+
+MODULE = Net::OnlineCode  PACKAGE = Net::OnlineCode::C::Decoder
+
+PROTOTYPES: DISABLE
+
+# new(class, mblocks, rng, flags, fudge, q, e, f, ablocks): wraps
+# oc_decoder_init. flags are OC_EXPAND_MSG (1) and OC_EXPAND_AUX (2);
+# fudge is the graph's sizing hint (see graph.h) and f and ablocks are
+# as for the encoder.
+
+SV *
+new (class, mblocks, rng_sv, flags, fudge, q, e, f, ablocks)
+	const char *class;
+	int         mblocks;
+	SV         *rng_sv;
+	int         flags;
+	double      fudge;
+	int         q;
+	double      e;
+	int         f;
+	int         ablocks;
+CODE:
+
+  oc_perl_decoder *h;
+  int              flag;
+
+  if (flags & ~(OC_EXPAND_MSG | OC_EXPAND_AUX))
+    croak("decoder flags should only have OC_EXPAND_MSG, OC_EXPAND_AUX\n");
+
+  Newxz(h, 1, oc_perl_decoder);
+  rng_from_perl(&h->rng, rng_sv);
+  flag = oc_decoder_init(&h->dec, mblocks, &h->rng, flags, fudge, q, e, f,
+			 ablocks, 0ll);
+  if (flag & OC_FATAL_ERROR) {
+    Safefree(h);
+    croak("oc_decoder_init failed\n");
+  }
+  rng_to_perl(&h->rng, rng_sv);
+
+  RETVAL = newSV(0);
+  sv_setref_pv(RETVAL, class, (void *) h);
+OUTPUT:
+  RETVAL
+
+void
+params (self)
+	SV *self;
+PPCODE:
+
+  oc_perl_decoder *h = handle(self, "Net::OnlineCode::C::Decoder");
+
+  EXTEND(SP, 3);
+  mPUSHi(h->dec.base.ablocks);
+  mPUSHi(h->dec.base.F);
+  mPUSHn(h->dec.base.e);
+
+SV *
+aux_mapping (self)
+	SV *self;
+CODE:
+  RETVAL = aux_mapping(&((oc_perl_decoder *)
+			 handle(self, "Net::OnlineCode::C::Decoder"))->dec.base);
+OUTPUT:
+  RETVAL
+
+# accept_check_block(self, rng): wraps oc_accept_check_block
+
+void
+accept_check_block (self, rng_sv)
+	SV *self;
+	SV *rng_sv;
+CODE:
+
+  oc_perl_decoder *h = handle(self, "Net::OnlineCode::C::Decoder");
+
+  rng_from_perl(&h->rng, rng_sv);
+  if (-1 == oc_accept_check_block(&h->dec, &h->rng))
+    croak("oc_accept_check_block failed\n");
+  rng_to_perl(&h->rng, rng_sv);
+
+# resolve(self): wraps oc_resolve, returning (done, bones...) like
+# Net::OnlineCode::GraphDecoder. Each bone is a Net::OnlineCode::Bones
+# object [ 1, solved node, nodes to xor... ] made from the node's
+# solution in the graph.
+
+void
+resolve (self)
+	SV *self;
+PPCODE:
+
+  oc_perl_decoder *h = handle(self, "Net::OnlineCode::C::Decoder");
+  HV              *stash = gv_stashpv("Net::OnlineCode::Bones", GV_ADD);
+  oc_uni_block    *solved, *next;
+  oc_bone         *bone;
+  AV              *av;
+  int              done, i;
+
+  if (-1 == (done = oc_resolve(&h->dec, &solved)))
+    croak("oc_resolve failed\n");
+
+  XPUSHs(sv_2mortal(newSViv(done)));
+  for (; NULL != solved; solved = next) {
+    next = solved->a.next;
+    bone = oc_graph_solution(&h->dec.graph, solved->b.value);
+    free(solved);
+    if (NULL == bone)
+      continue;			// can't happen
+
+    av = newAV();
+    av_extend(av, bone->b.size);
+    av_push(av, newSViv(1));
+    for (i = 1; i <= bone->b.size; ++i)
+      av_push(av, newSViv(bone[i].a.node));
+    XPUSHs(sv_2mortal(sv_bless(newRV_noinc((SV *) av), stash)));
+  }
+
+# expansion(self, node): wraps oc_expansion, returning the sorted
+# list of blocks that make up node (expanded as set by the flags)
+
+void
+expansion (self, node)
+	SV *self;
+	int node;
+PPCODE:
+
+  oc_perl_decoder *h = handle(self, "Net::OnlineCode::C::Decoder");
+  int             *list, i;
+
+  if ((node < 0) || (node >= h->dec.base.coblocks) ||
+      (0 == h->dec.graph.solution[node]))
+    croak("expansion: node %d is not a solved composite block\n", node);
+  if (NULL == (list = oc_expansion(&h->dec, node)))
+    croak("oc_expansion failed\n");
+
+  EXTEND(SP, list[0]);
+  for (i = 1; i <= list[0]; ++i)
+    mPUSHi(list[i]);
+  free(list);
+
+void
+DESTROY (self)
+	SV *self;
+CODE:
+
+  oc_perl_decoder *h = handle(self, "Net::OnlineCode::C::Decoder");
+
+  oc_decoder_free(&h->dec);
+  Safefree(h);
+
+#endif
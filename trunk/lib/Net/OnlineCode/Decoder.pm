@@ -30,6 +30,8 @@ sub new {
               expand_aux  => 0,    # override parent class's default
               expand_msg  => 1,    # expand_* options used by expansion()
               initial_rng => undef,
+              engine      => undef, # 'c' or 'perl' (default: c if built)
+              fudge       => 1.2,  # C graph sizing hint (see C/graph.h)
               # user-supplied arguments:
               @_
              );
@@ -46,6 +48,18 @@ sub new {
 
   # Our subclass includes extra data/options
   $self->{expand_msg}=$opts{expand_msg};
+  $self->{engine} = $self->_engine($opts{engine});
+
+  if ($self->{engine} eq "c") {
+    my $flags = ($self->{expand_msg} ? 1 : 0) | ($self->{expand_aux} ? 2 : 0);
+    $self->{cdec} = Net::OnlineCode::C::Decoder->new
+      ($self->{mblocks}, $opts{initial_rng}, $flags, $opts{fudge},
+       $self->{q}, $self->{e}, $self->{f}, $self->{ablocks});
+    $self->_check_c_params($self->{cdec});
+    $self->{aux_mapping} = $self->{cdec}->aux_mapping;
+    return $self;
+  }
+
   my $graph = Net::OnlineCode::GraphDecoder->new
     (
      $self->{mblocks},
@@ -63,6 +77,12 @@ sub accept_check_block {
   my $self = shift;
   my $rng  = shift;
 
+  if (exists $self->{cdec}) {
+    croak "rng is not an object reference\n" unless ref($rng);
+    $self->{cdec}->accept_check_block($rng);
+    return ($self->{chblocks})++;
+  }
+
   # print "Decoder: calling checkblock_mapping\n";
   my $composite_blocks = $self->checkblock_mapping($rng);
 
@@ -89,6 +109,7 @@ sub accept_check_block {
 sub resolve {
   my ($self,@args) = @_;
 
+  return $self->{cdec}->resolve if exists $self->{cdec};
   $self->{graph}->resolve(@args);
 }
 
@@ -101,6 +122,11 @@ sub expansion {
 
   my ($bone, $node);
 
+  if (exists $self->{cdec}) {
+    $node = ref($bone_or_node) ? $bone_or_node->[1] : $bone_or_node;
+    return $self->{cdec}->expansion($node);
+  }
+
   if (ref($bone_or_node)) {
     $bone = $bone_or_node;
     $node = $bone->[1];
@@ -215,6 +241,7 @@ sub xor_list {
   my $self = shift;
   my $i = shift;
 
+  return $self->expansion($i) if exists $self->{cdec};
   return ($self->{graph}->xor_list($i));
 
   # algorithm will no longer return just composite blocks
@@ -323,6 +350,33 @@ Net::OnlineCode documentation|Net::OnlineCode> for the technical
 background
 
 
+=head1 ENGINES
+
+The decoder can use either the pure-Perl graph decoder
+(L<Net::OnlineCode::GraphDecoder>) or the C one that the XS module is
+linked with when Build.PL finds the C code (C<Net::OnlineCode::c_engine>
+returns true if so). The C engine is the default when it's available.
+Both take the same rng objects, draw exactly the same random numbers
+and solve the same blocks, so the choice makes no difference to the
+encoder or to callers, except that the C one is a great deal faster.
+The C engine doesn't create a C<graph> member.
+
+Extra options to C<new>:
+
+=over
+
+=item engine => 'c' | 'perl'
+
+Select an engine explicitly. Asking for 'c' when it isn't built is an
+error.
+
+=item fudge => 1.2
+
+How many check blocks the C graph makes room for up front, as a
+multiple of the number of composite blocks. It's only a sizing hint.
+
+=back
+
 =head1 SEE ALSO
 
 See L<Net::OnlineCode> for background information on Online Codes.
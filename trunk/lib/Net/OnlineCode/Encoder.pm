@@ -24,6 +24,7 @@ sub new {
   my %opts = (
 	      # include any encoder-specific arguments here
 	      initial_rng      => undef,
+	      engine           => undef, # 'c' or 'perl' (as in Decoder)
 	      @_
 	     );
 
@@ -33,7 +34,17 @@ sub new {
 
   croak "Failed to create superclass\n" unless ref($self);
 
-  $self->auxiliary_mapping($opts{initial_rng});
+  $self->{engine} = $self->_engine($opts{engine});
+
+  if ($self->{engine} eq "c") {
+    $self->{cenc} = Net::OnlineCode::C::Encoder->new
+      ($self->{mblocks}, $opts{initial_rng}, $self->{q}, $self->{e},
+       $self->{f}, $self->{ablocks});
+    $self->_check_c_params($self->{cenc});
+    $self->{aux_mapping} = $self->{cenc}->aux_mapping;
+  } else {
+    $self->auxiliary_mapping($opts{initial_rng});
+  }
 
   # delete unwanted mblocks elements from aux_mapping
   #splice $self->{aux_mapping}, 0, $self->{mblocks};
@@ -53,7 +64,14 @@ sub create_check_block {
   # already tested by parent method:
   # croak "rng parameter must be an object ref" unless ref($rng);
 
-  my $xor_list  = $self->checkblock_mapping($rng);
+  my $xor_list;
+
+  if (exists $self->{cenc}) {
+    croak "rng is not an object reference\n" unless ref($rng);
+    $xor_list = $self->{cenc}->check_block($rng);
+  } else {
+    $xor_list = $self->checkblock_mapping($rng);
+  }
 
   # Optionally replace auxiliary indices with a list of message
   # indices.  Message blocks may appear multiple times in the
@@ -191,6 +209,10 @@ The procedure for sending a single check block is as follows:
 
 =back
 
+As with the decoder, the C engine is used if it was built (see
+L<Net::OnlineCode::Decoder/ENGINES>); pass C<engine =E<gt> 'perl'> to
+C<new> to use the pure-Perl code. The check blocks are the same
+either way.
 
 =head1 SEE ALSO
 
@@ -0,0 +1,130 @@
+# -*- Perl -*-
+
+use Test::More;
+
+use Net::OnlineCode ':xor';
+use Net::OnlineCode::Encoder;
+use Net::OnlineCode::Decoder;
+use Net::OnlineCode::RNG;
+
+plan skip_all => "C engine not built (see Build.PL)"
+  unless Net::OnlineCode::c_engine();
+plan tests => 13;
+
+# Round trips between the C and Perl engines. Both draw the same
+# random numbers from the same rngs, so whichever engine encodes and
+# whichever decodes, the message has to come back and the decoder has
+# to need the same number of check blocks.
+
+my $mblocks = 300;
+my $blksiz  = 8;
+my $seed    = "C engine test seed 0";	# 20 chars
+
+my $message = join "",
+  map { chr(($_ * 37 + 11) % 256) } 0 .. $mblocks * $blksiz - 1;
+
+# Encode with one engine and decode with the other. Returns the
+# decoded message, the number of check blocks it took and the
+# encoder's check block lists.
+sub round_trip {
+  my ($enc_engine, $dec_engine) = @_;
+
+  my $erng = Net::OnlineCode::RNG->new($seed);
+  my $drng = Net::OnlineCode::RNG->new($seed);
+
+  my $enc = Net::OnlineCode::Encoder
+    ->new(mblocks => $mblocks, initial_rng => $erng, e_warning => 0,
+	  engine => $enc_engine);
+  my $dec = Net::OnlineCode::Decoder
+    ->new(mblocks => $mblocks, initial_rng => $drng, e_warning => 0,
+	  expand_msg => 0, engine => $dec_engine);
+
+  my $ablocks  = $enc->get_ablocks;
+  my $coblocks = $enc->get_coblocks;
+
+  my @aux = (("\0" x $blksiz) x $ablocks);
+  for my $aux_block ($mblocks .. $coblocks - 1) {
+    for my $msg (@{$enc->{aux_mapping}->[$aux_block]}) {
+      xor_strings(\($aux[$aux_block - $mblocks]),
+		  substr($message, $blksiz * $msg, $blksiz));
+    }
+  }
+
+  my @mblocks = (("\0" x $blksiz) x $mblocks);
+  my @ablocks = (("\0" x $blksiz) x $ablocks);
+  my (@check_blocks, @lists);
+  my $done = 0;
+
+  until ($done or @check_blocks > 2 * $mblocks) {
+    my $block_id = $erng->seed($erng->as_string);
+    my $list     = $enc->create_check_block($erng);
+    my $contents = "\0" x $blksiz;
+
+    push @lists, [ sort { $a <=> $b } @$list ];	# order may differ
+    foreach (@$list) {
+      xor_strings(\$contents, ($_ < $mblocks) ?
+		  substr($message, $blksiz * $_, $blksiz) :
+		  $aux[$_ - $mblocks]);
+    }
+    push @check_blocks, $contents;
+
+    $drng->seed($block_id);
+    $dec->accept_check_block($drng);
+
+    while (1) {
+      my @decoded;
+      ($done, @decoded) = $dec->resolve;
+      last unless @decoded;
+
+      foreach my $bone (@decoded) {
+	my $node  = $bone->[1];
+	my $block = "\0" x $blksiz;
+	foreach my $i ($dec->expansion($bone)) {
+	  xor_strings(\$block, ($i < $mblocks) ? $mblocks[$i] :
+		      ($i >= $coblocks) ? $check_blocks[$i - $coblocks] :
+		      $ablocks[$i - $mblocks]);
+	}
+	if ($node < $mblocks) {
+	  $mblocks[$node] = $block;
+	} else {
+	  $ablocks[$node - $mblocks] = $block;
+	}
+      }
+      last if $done;
+    }
+  }
+
+  return (join("", @mblocks), scalar(@check_blocks), \@lists);
+}
+
+# Both engines have to agree on the codec parameters (the C engine is
+# given the Perl code's number of aux blocks)
+my %enc;
+for my $engine (qw(perl c)) {
+  $enc{$engine} = Net::OnlineCode::Encoder
+    ->new(mblocks => $mblocks, e_warning => 0, engine => $engine,
+	  initial_rng => Net::OnlineCode::RNG->new($seed));
+  ok(ref($enc{$engine}), "$engine encoder new returns object");
+}
+ok($enc{c}->get_ablocks == 23, "C engine: 23 aux blocks for 300 message blocks");
+ok($enc{c}->get_ablocks == $enc{perl}->get_ablocks, "engines agree on ablocks");
+ok($enc{c}->get_f == $enc{perl}->get_f, "engines agree on F");
+is_deeply([ map { [ sort { $a <=> $b } @$_ ] } @{$enc{c}->{aux_mapping}} ],
+	  [ map { [ sort { $a <=> $b } @$_ ] } @{$enc{perl}->{aux_mapping}} ],
+	  "engines make the same aux mapping");
+
+my %trip;
+for my $pair (qw(perl:perl c:c perl:c c:perl)) {
+  my ($enc_engine, $dec_engine) = split /:/, $pair;
+  $trip{$pair} = [ round_trip($enc_engine, $dec_engine) ];
+  ok($trip{$pair}->[0] eq $message,
+     "encode with $enc_engine, decode with $dec_engine");
+}
+
+is_deeply($trip{"c:c"}->[2], $trip{"perl:perl"}->[2],
+	  "engines make the same check blocks");
+ok($trip{"c:c"}->[1] == $trip{"perl:perl"}->[1],
+   "C decoder needs as many check blocks as Perl");
+ok(($trip{"perl:c"}->[1] == $trip{"c:c"}->[1]) &&
+   ($trip{"c:perl"}->[1] == $trip{"perl:perl"}->[1]),
+   "cross-engine decoders need as many check blocks");